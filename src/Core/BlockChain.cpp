@@ -9,6 +9,7 @@
 #include <boost/lexical_cast.hpp>
 #include <chrono>
 #include <iostream>
+#include <set>
 #include "Config.hpp"
 #include "CryptoNoteTools.hpp"
 #include "Currency.hpp"
@@ -16,7 +17,9 @@
 #include "TransactionExtra.hpp"
 #include "common/StringTools.hpp"
 #include "common/Varint.hpp"
+#include "common/string.hpp"
 #include "crypto/crypto.hpp"
+#include "platform/PathTools.hpp"
 #include "rpc_api.hpp"
 #include "seria/BinaryInputStream.hpp"
 #include "seria/BinaryOutputStream.hpp"
@@ -24,20 +27,123 @@
 using namespace cryonerocoin;
 using namespace platform;
 
-const std::string BlockChain::version_current = "5";
-static const std::string BLOCK_PREFIX = "b";
-static const std::string BLOCK_SUFFIX = "b";
-static const std::string HEADER_PREFIX = "b";
-static const std::string HEADER_SUFFIX = "h";
-static const std::string TRANSATION_PREFIX = "t";
-static const std::string TIP_CHAIN_PREFIX = "c";
-static const std::string TIMESTAMP_BLOCK_PREFIX = "T";
-static const std::string CHILDREN_PREFIX = "x-ch/";
-static const std::string CD_TIPS_PREFIX = "x-tips/";
+const std::string BlockChain::version_current = "7";
+// Before version 6 everything was in unnamed table, we need only main chain and its blocks for internal import
+static const std::string LEGACY_BLOCK_PREFIX = "b";
+static const std::string LEGACY_BLOCK_SUFFIX = "b";
+static const std::string LEGACY_TIP_CHAIN_PREFIX = "c";
+// In version 6 block bodies were in "blocks" table
+static const std::string LEGACY_BLOCKS_TABLE = "blocks";
+static const std::string BLOCK_SEGMENTS_END = "$block_segments_end";
+static const std::string FIRST_BLOCK_SEGMENT = "$first_block_segment";  // earlier ones are pruned
+static const std::string SEGMENT_MAX_HEIGHT_PREFIX = "$segment_max_height/";  // segment -> max height of blocks in it
+static const uint64_t BLOCK_SEGMENT_SIZE = 256 * 1024 * 1024;
 static const size_t HEADER_CACHE_MAX_SIZE = 100000;
 static const size_t COMMIT_EVERY_N_BLOCKS = 50000;
+static const size_t MIN_FILTER_CAPACITY = 1 << 20;
+static const Height UNDO_RECORDS_DEPTH = 1000;  // deeper reorganizations parse blocks to undo
+static const Height MIN_PRUNE_DEPTH = 10000;  // reorganizations read bodies of blocks they undo
 static const std::string delete_blockchain_message = "database corrupted, please delete ";
 
+struct BlockLocation {
+	uint32_t segment = 0;
+	uint64_t offset  = 0;
+	uint32_t size    = 0;
+};
+
+namespace seria {
+	void ser_members(BlockLocation &v, ISeria &s) {
+		seria_kv("segment", v.segment, s);
+		seria_kv("offset", v.offset, s);
+		seria_kv("size", v.size, s);
+	}
+	void ser_members(ChainHeader &v, ISeria &s) {
+		seria_kv("timestamp", v.timestamp, s);
+		seria_kv("block_size", v.block_size, s);
+		seria_kv("cumulative_difficulty", v.cumulative_difficulty, s);
+	}
+}
+
+static ChainHeader to_chain_header(const api::BlockHeader &header) {
+	ChainHeader result;
+	result.timestamp             = header.timestamp;
+	result.block_size            = header.block_size;
+	result.cumulative_difficulty = header.cumulative_difficulty;
+	return result;
+}
+
+// Tip chain value is bid followed by ChainHeader, databases written before have only bid
+static BinaryArray tip_chain_value(const Hash &bid, const ChainHeader &header) {
+	BinaryArray ba       = seria::to_binary(bid);
+	const BinaryArray hb = seria::to_binary(header);
+	common::append(ba, hb.begin(), hb.end());
+	return ba;
+}
+
+static bool tip_chain_value_has_header(size_t size) { return size > sizeof(Hash); }
+
+struct UndoRecordOp {
+	uint32_t table = 0;  // in UndoRecord::tables
+	std::string key;
+	bool existed = false;
+	std::string value;
+};
+
+// Written by redo_block, undo replays it without reading and parsing block. Table indexes depend on order
+// of open_table, so tables are stored by name
+struct UndoRecord {
+	std::vector<std::string> tables;
+	std::vector<UndoRecordOp> ops;
+	std::vector<Hash> transaction_hashes;  // of block except coinbase, reorganization returns them to pool
+};
+
+namespace seria {
+	void ser_members(UndoRecordOp &v, ISeria &s) {
+		seria_kv("table", v.table, s);
+		seria_kv("key", v.key, s);
+		seria_kv("existed", v.existed, s);
+		seria_kv("value", v.value, s);
+	}
+	void ser_members(UndoRecord &v, ISeria &s) {
+		seria_kv("tables", v.tables, s);
+		seria_kv("ops", v.ops, s);
+		seria_kv("transaction_hashes", v.transaction_hashes, s);
+	}
+}
+
+static BinaryArray undo_to_binary(
+    const DB &db, const std::vector<DB::UndoOp> &undo, const std::vector<Hash> &transaction_hashes) {
+	UndoRecord record;
+	record.transaction_hashes = transaction_hashes;
+	std::map<std::string, uint32_t> table_positions;
+	for (auto &&uop : undo) {
+		const std::string &name = db.get_table_name(uop.table);
+		auto pit = table_positions.insert(std::make_pair(name, static_cast<uint32_t>(record.tables.size()))).first;
+		if (pit->second == record.tables.size())
+			record.tables.push_back(name);
+		record.ops.push_back(UndoRecordOp{pit->second, uop.key, uop.existed, uop.value});
+	}
+	return seria::to_binary(record);
+}
+
+static std::vector<DB::UndoOp> undo_from_binary(
+    const DB &db, const BinaryArray &ba, std::vector<Hash> *transaction_hashes) {
+	UndoRecord record;
+	seria::from_binary(record, ba);
+	*transaction_hashes = std::move(record.transaction_hashes);
+	std::vector<DB::Table> tables;
+	for (auto &&name : record.tables)
+		tables.push_back(db.find_table(name));
+	std::vector<DB::UndoOp> undo(record.ops.size());
+	for (size_t i = 0; i != record.ops.size(); ++i) {
+		undo[i].table   = tables.at(record.ops[i].table);
+		undo[i].key     = std::move(record.ops[i].key);
+		undo[i].existed = record.ops[i].existed;
+		undo[i].value   = std::move(record.ops[i].value);
+	}
+	return undo;
+}
+
 bool Block::from_raw_block(const RawBlock &raw_block) 
 {
 	try 
@@ -108,7 +214,16 @@ PreparedBlock::PreparedBlock(RawBlock &&rba, crypto::CryptoNightContext *context
 
 BlockChain::BlockChain(logging::ILogger &log, const Config &config, const Currency &currency, bool read_only)
 	: m_genesis_bid(currency.genesis_block_hash)
+	, m_block_segments(config.get_data_folder() + "/block_segments", read_only, BLOCK_SEGMENT_SIZE)
 	, m_db(read_only, config.get_data_folder() + "/blockchain")
+	, m_block_locations_table(m_db.open_table("block_locations"))
+	, m_headers_table(m_db.open_table("headers"))
+	, m_transactions_table(m_db.open_table("transactions"))
+	, m_tip_chain_table(m_db.open_table("tip_chain", true))
+	, m_timestamps_table(m_db.open_table("timestamps"))
+	, m_children_table(m_db.open_table("children"))
+	, m_tips_table(m_db.open_table("tips"))
+	, m_undo_table(m_db.open_table("undo"))
 	, m_log(log, "BlockChainState")
 	, m_config(config)
 	, m_currency(currency)
@@ -121,27 +236,79 @@ BlockChain::BlockChain(logging::ILogger &log, const Config &config, const Curren
 			throw std::runtime_error("Blockchain database format unknown version, please delete " + m_db.get_path());
 		version = version_current;
 		m_db.put("$version", version, false);
+		m_db.commit_db_txn();
+	}
+	BlockLocation segments_end;
+	BinaryArray se;
+	if (m_db.get(BLOCK_SEGMENTS_END, se))
+		seria::from_binary(segments_end, se);
+	m_block_segments.open(SegmentedFile::Position{segments_end.segment, segments_end.offset});
+	if (version == "6" && !read_only) {
+		migrate_blocks_to_segments();
+		version = version_current;
 	}
 	if (version != version_current)
 		return;
-	Hash stored_genesis_bid;
-	if (read_chain(0, &stored_genesis_bid))
+	std::vector<Height> heights_without_header;
+	for (auto cur = m_db.begin(m_tip_chain_table, std::string()); !cur.end(); cur.next()) {
+		invariant(DB::from_integer_key(cur.get_suffix()) == m_chain_bids.size(), "tip chain table corrupted");
+		m_chain_bids.push_back(Hash{});
+		m_chain_headers.push_back(ChainHeader{});
+		const auto &value = cur.get_value();
+		invariant(value.size() >= sizeof(Hash), "tip chain table corrupted");
+		seria::from_binary(m_chain_bids.back(), value.data(), sizeof(Hash));
+		if (tip_chain_value_has_header(value.size()))
+			seria::from_binary(m_chain_headers.back(), value.data() + sizeof(Hash), value.size() - sizeof(Hash));
+		else
+			heights_without_header.push_back(static_cast<Height>(m_chain_bids.size() - 1));
+	}
+	if (!heights_without_header.empty())
+		m_log(logging::INFO) << "Adding headers to " << heights_without_header.size() << " tip chain records"
+		                     << std::endl;
+	for (auto height : heights_without_header) {  // once after upgrade
+		m_chain_headers.at(height) = to_chain_header(read_header(m_chain_bids.at(height), height));
+		if (!read_only)
+			m_db.put(m_tip_chain_table, DB::to_integer_key(height),
+			    tip_chain_value(m_chain_bids.at(height), m_chain_headers.at(height)), false);
+	}
+	if (!m_chain_bids.empty())
 	{
-		if (stored_genesis_bid != m_genesis_bid)
+		if (m_chain_bids.front() != m_genesis_bid)
 			throw std::runtime_error("Database starts with different genesis_block");
 		read_tip();
 	}
 	BinaryArray cha;
 	if (m_db.get("internal_import_chain", cha))
 		seria::from_binary(m_internal_import_chain, cha);
+	load_segment_max_heights(read_only);
+}
+
+BlockChain::~BlockChain() {
+	save_filter(m_transactions_filter, "transactions");
 }
 
 void BlockChain::db_commit() 
 {
-	m_log(logging::INFO) << "BlockChain::db_commit started... tip_height=" << m_tip_height << " header_cache.size=" << header_cache.size() << std::endl;
+	m_log(logging::INFO) << "BlockChain::db_commit started... tip_height=" << m_tip_height << " side_headers.size=" << m_side_headers.size() << std::endl;
+	rebuild_filters_if_needed();
+	m_block_segments.sync();  // DB must never reference block bodies not yet on disk
+	const uint32_t first_segment = prune_block_segments();
 	m_db.commit_db_txn();
-	header_cache.clear();
-	m_log(logging::INFO) << "BlockChain::db_commit finished..." << std::endl;
+	const auto stats = m_db.get_commit_stats();
+	if (first_segment != m_pruned_first_segment) {
+		m_pruned_first_segment        = first_segment;
+		m_pruned_first_segment_commit = stats.commits;
+		m_log(logging::INFO) << "BlockChain::db_commit pruned block segments before " << first_segment
+		                     << ", pruned_height=" << m_pruned_height << std::endl;
+	}
+	// Last commit can be lost on power failure (MDB_NOMETASYNC), then DB would reference removed files. So files
+	// are removed on later commit, after that commit is durable
+	if (m_pruned_first_segment != m_block_segments.get_first_segment() &&
+	    stats.durable_commits >= m_pruned_first_segment_commit)
+		m_block_segments.set_first_segment(m_pruned_first_segment);
+	m_filters_stamp = get_tip_stamp();
+	m_committed_tip_height = get_tip_height();
+	m_log(logging::INFO) << "BlockChain::db_commit finished... commit_ms=" << stats.last_commit_ms << std::endl;
 }
 
 BroadcastAction BlockChain::add_block(
@@ -170,12 +337,11 @@ BroadcastAction BlockChain::add_block(
 	try 
 	{
 		if (!have_block)
-			store_block(pb.bid, pb.block_data);  
+			store_block(pb.bid, pb.block_data, info->height);
 		store_header(pb.bid, *info);
 		if (pb.bid == m_genesis_bid) 
 		{
 			invariant(redo_block(pb.bid, pb.block_data, pb.raw_block, pb.block, *info, pb.base_transaction_hash),	"Failed to apply genesis block");
-			push_chain(*info);
 		}
 		else 
 		{
@@ -189,7 +355,6 @@ BroadcastAction BlockChain::add_block(
 			{
 				if (!redo_block(pb.bid, pb.block_data, pb.raw_block, pb.block, *info, pb.base_transaction_hash))
 					return BroadcastAction::BAN;
-				push_chain(*info);
 			}
 			else
 				reorganize_blocks(pb.bid, pb, *info);
@@ -231,23 +396,17 @@ bool BlockChain::reorganize_blocks(const Hash &switch_to_chain,	const PreparedBl
 		if (!has_block(chha))
 			return false;  
 	}
-	std::map<Hash, std::pair<Transaction, BinaryArray>> undone_transactions;
-	bool undone_blocks = false;
+	std::vector<std::pair<Hash, std::vector<Hash>>> undone;  // blocks with their transactions
 	while (get_tip_bid() != common)
 	{
-		RawBlock raw_block;
-		Block block;
-		invariant(read_block(get_tip_bid(), &raw_block) && block.from_raw_block(raw_block),	"Block to undo not found or failed to convert" + common::pod_to_hex(get_tip_bid()));
-		undone_blocks = true;
-		undo_block(get_tip_bid(), raw_block, block, m_tip_height);
-		for (size_t tx_index = 0; tx_index != block.transactions.size(); ++tx_index) 
-		{
-			Hash tid = block.header.transaction_hashes.at(tx_index);
-			undone_transactions.insert(std::make_pair(tid, std::make_pair(std::move(block.transactions.at(tx_index)),	std::move(raw_block.transactions.at(tx_index)))));
-		}
-		pop_chain(block.header.previous_block_hash);
+		const Hash previous_block_hash = get_tip().previous_block_hash;
+		std::vector<Hash> transaction_hashes;
+		invariant(undo_block(get_tip_bid(), m_tip_height, &transaction_hashes), "Block to undo not found or failed to convert" + common::pod_to_hex(get_tip_bid()));
+		undone.push_back(std::make_pair(get_tip_bid(), std::move(transaction_hashes)));
+		pop_chain(previous_block_hash);
 		tip_changed();
 	}
+	std::set<Hash> redone_transactions;
 	bool result = true;
 	while (!chain2.empty()) 
 	{
@@ -261,9 +420,7 @@ bool BlockChain::reorganize_blocks(const Hash &switch_to_chain,	const PreparedBl
 				result = false;
 				break;
 			}
-			push_chain(recent_info);
-			for (auto &&tid : recent_pb.block.header.transaction_hashes)
-				undone_transactions.erase(tid);
+			redone_transactions.insert(recent_pb.block.header.transaction_hashes.begin(), recent_pb.block.header.transaction_hashes.end());
 		}
 		else
 		{
@@ -282,12 +439,29 @@ bool BlockChain::reorganize_blocks(const Hash &switch_to_chain,	const PreparedBl
 				result = false;
 				break;
 			}
-			push_chain(info);
-			for (auto &&tid : block.header.transaction_hashes)
-				undone_transactions.erase(tid);
+			redone_transactions.insert(block.header.transaction_hashes.begin(), block.header.transaction_hashes.end());
+		}
+	}
+	// Usually new chain contains most undone transactions, only the rest are read from bodies of undone blocks
+	std::map<Hash, std::pair<Transaction, BinaryArray>> undone_transactions;
+	for (auto &&ub : undone)
+	{
+		RawBlock raw_block;
+		bool body_read = false;
+		for (size_t tx_index = 0; tx_index != ub.second.size(); ++tx_index)
+		{
+			const Hash &tid = ub.second.at(tx_index);
+			if (redone_transactions.count(tid) != 0)
+				continue;
+			if (!body_read)
+				invariant(read_block(ub.first, &raw_block), "Undone block not found " + common::pod_to_hex(ub.first));
+			body_read = true;
+			Transaction tx;
+			seria::from_binary(tx, raw_block.transactions.at(tx_index));
+			undone_transactions.insert(std::make_pair(tid, std::make_pair(std::move(tx), std::move(raw_block.transactions.at(tx_index)))));
 		}
 	}
-	on_reorganization(undone_transactions, undone_blocks);
+	on_reorganization(undone_transactions, !undone.empty());
 	return result;
 }
 
@@ -347,17 +521,12 @@ std::vector<Hash> BlockChain::get_sparse_chain() const
 	return tip_path;
 }
 
-std::vector<api::BlockHeader> BlockChain::get_sync_headers(const std::vector<Hash> &locator, size_t max_count) const 
+std::vector<ChainHeader> BlockChain::get_sync_headers(
+	const std::vector<Hash> &locator, Height *start_height, size_t max_count) const 
 {
-	std::vector<api::BlockHeader> result;
-	Height start_height = 0;
-	auto chain = get_sync_headers_chain(locator, &start_height, max_count);
-	result.reserve(chain.size());
-	for (auto &&c : chain) 
-	{
-		result.push_back(read_header(c));
-	}
-	return result;
+	auto chain = get_sync_headers_chain(locator, start_height, max_count);
+	auto start = m_chain_headers.begin() + *start_height;
+	return std::vector<ChainHeader>(start, start + chain.size());  // bids from read_chain
 }
 
 uint32_t BlockChain::find_blockchain_supplement(const std::vector<Hash> &remote_block_ids) const
@@ -376,14 +545,10 @@ uint32_t BlockChain::find_blockchain_supplement(const std::vector<Hash> &remote_
 
 Height BlockChain::get_timestamp_lower_bound_block_index(Timestamp ts) const 
 {
-	auto middle = common::write_varint_sqlite4(ts);
-	auto cur = m_db.begin(TIMESTAMP_BLOCK_PREFIX, middle);
+	auto cur = m_db.begin(m_timestamps_table, std::string(), to_be_key(ts, sizeof(Timestamp)));
 	if (cur.end())
 		return m_tip_height;
-	const char *be = cur.get_suffix().data();
-	const char *en = be + cur.get_suffix().size();
-	common::read_varint_sqlite4(be, en);  
-	return boost::lexical_cast<Height>(common::read_varint_sqlite4(be, en));
+	return static_cast<Height>(from_be_key(cur.get_suffix(), sizeof(Timestamp), sizeof(Height)));
 }
 
 std::vector<Hash> BlockChain::get_sync_headers_chain(const std::vector<Hash> &locator,	Height *start_height,	size_t max_count) const 
@@ -444,92 +609,347 @@ namespace seria {
 	}
 } 
 
-bool BlockChain::read_transaction(const Hash &tid, Transaction *tx, Height *block_height, Hash *block_hash, size_t *index_in_block, uint32_t *binary_size) const 
-{
+// DBReader is either DB (sees current txn) or DB::Snapshot (sees last commit)
+template<class DBReader>
+static bool read_chain_impl(const DBReader &db, const DB::Table &tip_chain_table, Height height, Hash *bid) {
+	DB::Value ba;
+	if (!db.get(tip_chain_table, DB::to_integer_key(height), ba))
+		return false;
+	invariant(ba.size() >= sizeof(Hash), "tip chain table corrupted");
+	seria::from_binary(*bid, ba.data(), sizeof(Hash));
+	return true;
+}
 
-	auto txkey = TRANSATION_PREFIX + DB::to_binary_key(tid.data, sizeof(tid.data));
-	BinaryArray ba;
-	if (!m_db.get(txkey, ba))
+template<class DBReader>
+static bool read_block_location(
+    const DBReader &db, const DB::Table &block_locations_table, const Hash &bid, BlockLocation *location) {
+	DB::Value ba;
+	const auto key = DBKey().append(bid.data, sizeof(bid.data));
+	if (!db.get(block_locations_table, key, ba))
+		return false;
+	seria::from_binary(*location, ba.data(), ba.size());
+	return true;
+}
+
+template<class DBReader>
+static bool read_block_impl(const DBReader &db, const DB::Table &block_locations_table,
+    const SegmentedFile &block_segments, const Hash &bid, BinaryArray *block_data, RawBlock *raw_block) {
+	BlockLocation location;
+	if (!read_block_location(db, block_locations_table, bid, &location) ||
+	    location.segment < block_segments.get_first_segment())
+		return false;
+	BinaryArray rb;
+	try {
+		block_segments.read(SegmentedFile::Position{location.segment, location.offset}, location.size, &rb);
+	} catch (const common::StreamError &) {
+		if (location.segment < block_segments.get_first_segment())
+			return false;  // snapshot older than prune commit, segment removed meanwhile
+		throw;
+	}
+	if (raw_block)
+		seria::from_binary(*raw_block, rb);
+	*block_data = std::move(rb);
+	return true;
+}
+
+template<class DBReader>
+static bool read_header_impl(const DBReader &db, const DB::Table &headers_table, const Hash &bid, api::BlockHeader *header) {
+	DB::Value rb;
+	const auto key = DBKey().append(bid.data, sizeof(bid.data));
+	if (!db.get(headers_table, key, rb))
+		return false;
+	seria::from_binary(*header, rb.data(), rb.size());
+	return true;
+}
+
+static bool read_transaction_impl(const DB &db, const DB::Table &transactions_table,
+    const DB::Table &tip_chain_table, const DB::Table &block_locations_table, const SegmentedFile &block_segments,
+    const Hash &tid, Transaction *tx, Height *block_height, Hash *block_hash, size_t *index_in_block,
+    uint32_t *binary_size) {
+	const auto txkey = DBKey().append(tid.data, sizeof(tid.data));
+	DB::Value ba;
+	if (!db.get(transactions_table, txkey, ba))
 		return false;
 	APITransactionPos tpos;
-	seria::from_binary(tpos, ba);
-	auto bid = read_chain(tpos.height);
-	DB::Value block_val;
-	auto key = BLOCK_PREFIX + DB::to_binary_key(bid.data, sizeof(bid.data)) + BLOCK_SUFFIX;
-	invariant(m_db.get(key, block_val), "block must be there if transaction is there");
-	invariant(tpos.offset + tpos.size <= block_val.size(), "Transaction offset corrupted");
+	seria::from_binary(tpos, ba.data(), ba.size());
+	Hash bid;
+	invariant(read_chain_impl(db, tip_chain_table, tpos.height, &bid), "transaction must be in main chain");
+	BlockLocation location;
+	invariant(read_block_location(db, block_locations_table, bid, &location),
+	    "block must be there if transaction is there");
+	if (location.segment < block_segments.get_first_segment())
+		return false;  // body pruned
+	invariant(tpos.offset + tpos.size <= location.size, "Transaction offset corrupted");
+	BinaryArray tx_data;  // only transaction bytes are read from segment
+	block_segments.read(
+	    SegmentedFile::Position{location.segment, location.offset + tpos.offset}, tpos.size, &tx_data);
 	*block_hash = bid;
 	*block_height = tpos.height;
 	*index_in_block = tpos.index;
 	*binary_size = tpos.size;
-	BinaryArray tbody(block_val.data() + tpos.offset, block_val.data() + tpos.offset + tpos.size);
-	seria::from_binary(*tx, tbody);  
+	seria::from_binary(*tx, tx_data);
 	return true;
 }
 
+bool BlockChain::read_transaction(const Hash &tid, Transaction *tx, Height *block_height, Hash *block_hash, size_t *index_in_block, uint32_t *binary_size) const 
+{
+	if (!m_transactions_filter.may_contain(tid.data, sizeof(tid.data)))
+		return false;
+	return read_transaction_impl(m_db, m_transactions_table, m_tip_chain_table, m_block_locations_table,
+	    m_block_segments, tid, tx, block_height, block_hash, index_in_block, binary_size);
+}
+
 bool BlockChain::redo_block(const Hash &bhash, const BinaryArray &block_data, const RawBlock &raw_block,const Block &block, const api::BlockHeader &info, const Hash &base_transaction_hash) 
 {
+	DB::WriteBatch batch(m_db);  // all state, index and tip chain writes of block go in one sorted pass
 	if (!redo_block(bhash, block, info))
 		return false;
-	auto tikey = TIMESTAMP_BLOCK_PREFIX + common::write_varint_sqlite4(info.timestamp) +	common::write_varint_sqlite4(info.height);
-	m_db.put(tikey, std::string(), true);
+	const auto tikey = DBKey().append_be(info.timestamp, sizeof(Timestamp)).append_be(info.height, sizeof(Height));
+	m_db.put(m_timestamps_table, tikey, std::string(), true);
 
 	APITransactionPos tpos;
 	tpos.height = info.height;
-	auto bkey = TRANSATION_PREFIX + DB::to_binary_key(base_transaction_hash.data, sizeof(base_transaction_hash.data));
+	auto bkey = DBKey().append(base_transaction_hash.data, sizeof(base_transaction_hash.data));
 	tpos.index = 0;
 	auto coinbase_ba = seria::to_binary(block.header.base_transaction);
 	auto ptr = common::slow_memmem(block_data.data() + tpos.offset + tpos.size, block_data.size() - tpos.offset - tpos.size, coinbase_ba.data(), coinbase_ba.size());
 	invariant(ptr, "binary coinbase tx not found in binary block");
 	tpos.offset = static_cast<uint32_t>(ptr - block_data.data());
 	tpos.size = static_cast<uint32_t>(coinbase_ba.size());
-	m_db.put(bkey, seria::to_binary(tpos), true);
+	m_db.put(m_transactions_table, bkey, seria::to_binary(tpos), true);
+	m_transactions_filter.insert(base_transaction_hash.data, sizeof(base_transaction_hash.data));
 	for (auto tx_index = 0; tx_index != block.transactions.size(); ++tx_index)
 	{
 		auto tid = block.header.transaction_hashes.at(tx_index);
 		tpos.index = static_cast<uint32_t>(tx_index + 1);
-		bkey = TRANSATION_PREFIX + DB::to_binary_key(tid.data, sizeof(tid.data));
+		bkey = DBKey().append(tid.data, sizeof(tid.data));
 		const auto &binary_tx = raw_block.transactions.at(tx_index);
 		ptr = common::slow_memmem(block_data.data() + tpos.offset + tpos.size,
 			block_data.size() - tpos.offset - tpos.size, binary_tx.data(), binary_tx.size());
 		invariant(ptr, "binary tx not found in binary block");
 		tpos.offset = static_cast<uint32_t>(ptr - block_data.data());
 		tpos.size = static_cast<uint32_t>(binary_tx.size());
-		m_db.put(bkey, seria::to_binary(tpos), true);
+		m_db.put(m_transactions_table, bkey, seria::to_binary(tpos), true);
+		m_transactions_filter.insert(tid.data, sizeof(tid.data));
 	}
+	std::vector<DB::UndoOp> undo;
+	batch.get_undo(&undo);
+	batch.apply();
+	const auto ukey = DBKey().append(bhash.data, sizeof(bhash.data));
+	m_db.put(m_undo_table, ukey, undo_to_binary(m_db, undo, block.header.transaction_hashes), false);
+	push_chain(info);  // pop_chain reverts it, so not in undo record
+	Hash old_bid;
+	if (info.height >= UNDO_RECORDS_DEPTH && read_chain(info.height - UNDO_RECORDS_DEPTH, &old_bid))
+		m_db.del(m_undo_table, DBKey().append(old_bid.data, sizeof(old_bid.data)), false);
 	return true;
 }
-void BlockChain::undo_block(const Hash &bhash, const RawBlock &, const Block &block, Height height)
+bool BlockChain::undo_block(const Hash &bhash, Height height, std::vector<Hash> *transaction_hashes)
 {
+	const auto ukey = DBKey().append(bhash.data, sizeof(bhash.data));
+	BinaryArray ba;
+	if (m_db.get(m_undo_table, ukey, ba)) {
+		m_log(logging::INFO) << "undo_block from undo record height=" << height << " bid=" << bhash << std::endl;
+		const auto undo = undo_from_binary(m_db, ba, transaction_hashes);
+#if cryonero_CHECK_UNDO_JOURNAL  // differential check, parse-based undo must end in state described by undo record
+		check_undo_journal(bhash, height, undo, *transaction_hashes);
+#else
+		apply_undo_journal(bhash, undo);
+#endif
+		return true;
+	}
+	RawBlock raw_block;
+	Block block;
+	if (!read_block(bhash, &raw_block) || !block.from_raw_block(raw_block))
+		return false;
+	undo_block_parsed(bhash, block, height);
+	*transaction_hashes = block.header.transaction_hashes;
+	return true;
+}
+
+void BlockChain::apply_undo_journal(const Hash &bhash, const std::vector<DB::UndoOp> &undo) {
+	for (auto &&uop : undo)
+		if (uop.existed)
+			m_db.put(uop.table, uop.key, uop.value, false);
+		else
+			m_db.del(uop.table, uop.key, true);
+	m_db.del(m_undo_table, DBKey().append(bhash.data, sizeof(bhash.data)), true);
+	undo_journal_applied(undo);
+}
+
+void BlockChain::check_undo_journal(const Hash &bhash, Height height, const std::vector<DB::UndoOp> &undo,
+    const std::vector<Hash> &transaction_hashes) {
+	RawBlock raw_block;
+	Block block;
+	invariant(read_block(bhash, &raw_block) && block.from_raw_block(raw_block),
+	    "Block to undo not found or failed to convert" + common::pod_to_hex(bhash));
+	invariant(transaction_hashes == block.header.transaction_hashes, "undo record has wrong transaction hashes");
+	std::set<std::pair<std::string, std::string>> journal_keys;  // table name, key
+	for (auto &&uop : undo)
+		journal_keys.insert(std::make_pair(m_db.get_table_name(uop.table), uop.key));
+	std::vector<std::pair<bool, std::string>> parsed_state(undo.size());  // existed, value of each undo record key
+	test_save_memory_indexes();
+	{
+		DB::WriteBatch batch(m_db);  // never applied, so DB stays as before undo
+		undo_block_parsed(bhash, block, height);
+		std::vector<DB::UndoOp> parsed_undo;
+		batch.get_undo(&parsed_undo);
+		for (auto &&uop : parsed_undo)
+			invariant(journal_keys.count(std::make_pair(m_db.get_table_name(uop.table), uop.key)) != 0,
+			    "parse-based undo wrote key missing from undo record, table=" + m_db.get_table_name(uop.table));
+		for (size_t i = 0; i != undo.size(); ++i)
+			parsed_state[i].first = m_db.get(undo[i].table, undo[i].key, parsed_state[i].second);
+	}
+	test_swap_memory_indexes();  // parse-based result is saved, indexes are as before undo again
+	apply_undo_journal(bhash, undo);
+	for (size_t i = 0; i != undo.size(); ++i) {
+		std::string value;
+		const bool existed = m_db.get(undo[i].table, undo[i].key, value);
+		invariant(existed == parsed_state[i].first && value == parsed_state[i].second,
+		    "undo record differs from parse-based undo, table=" + m_db.get_table_name(undo[i].table));
+	}
+	invariant(test_memory_indexes_equal_saved(), "in-memory indexes after undo record differ from parse-based undo");
+}
+
+void BlockChain::undo_block_parsed(const Hash &bhash, const Block &block, Height height) {
 	undo_block(bhash, block, height);
-	auto tikey = TIMESTAMP_BLOCK_PREFIX + common::write_varint_sqlite4(block.header.timestamp) +	common::write_varint_sqlite4(height);
-	m_db.del(tikey, true);
+	const auto tikey = DBKey().append_be(block.header.timestamp, sizeof(Timestamp)).append_be(height, sizeof(Height));
+	m_db.del(m_timestamps_table, tikey, true);
 
 	auto tid = get_transaction_hash(block.header.base_transaction);
-	auto bkey = TRANSATION_PREFIX + DB::to_binary_key(tid.data, sizeof(tid.data));
-	m_db.del(bkey, true);
+	auto bkey = DBKey().append(tid.data, sizeof(tid.data));
+	m_db.del(m_transactions_table, bkey, true);
 	for (auto tx_index = 0; tx_index != block.transactions.size(); ++tx_index) 
 	{
 		tid = block.header.transaction_hashes.at(tx_index);
-		bkey = TRANSATION_PREFIX + DB::to_binary_key(tid.data, sizeof(tid.data));
-		m_db.del(bkey, true);
+		bkey = DBKey().append(tid.data, sizeof(tid.data));
+		m_db.del(m_transactions_table, bkey, true);
+	}
+}
+
+void BlockChain::store_block(const Hash &bid, const BinaryArray &block_data, Height height) {
+	const auto pos = m_block_segments.append(block_data.data(), block_data.size());
+	auto mit = m_segment_max_heights.find(pos.segment);
+	if (mit == m_segment_max_heights.end() || mit->second < height) {
+		m_segment_max_heights[pos.segment] = height;
+		m_db.put(DBKey(SEGMENT_MAX_HEIGHT_PREFIX).append_be(pos.segment, 4), seria::to_binary(height), false);
 	}
+	BlockLocation location;
+	location.segment = pos.segment;
+	location.offset  = pos.offset;
+	location.size    = static_cast<uint32_t>(block_data.size());
+	const auto key = DBKey().append(bid.data, sizeof(bid.data));
+	m_db.put(m_block_locations_table, key, seria::to_binary(location), true);
+	BlockLocation segments_end;  // bytes past it after crash are not referenced and will be truncated
+	segments_end.segment = m_block_segments.get_end().segment;
+	segments_end.offset  = m_block_segments.get_end().offset;
+	m_db.put(BLOCK_SEGMENTS_END, seria::to_binary(segments_end), false);
 }
 
-void BlockChain::store_block(const Hash &bid, const BinaryArray &block_data) {
-	auto key = BLOCK_PREFIX + DB::to_binary_key(bid.data, sizeof(bid.data)) + BLOCK_SUFFIX;
-	m_db.put(key, block_data, true);
+SegmentedFile::Position BlockChain::read_committed_segments_end(const std::string &db_path) {
+	BlockLocation segments_end;
+	try {
+		DB db(true, db_path);
+		BinaryArray se;
+		if (db.get(BLOCK_SEGMENTS_END, se))
+			seria::from_binary(segments_end, se);
+	} catch (const std::exception &) {  // no DB yet
+	}
+	return SegmentedFile::Position{segments_end.segment, segments_end.offset};
+}
+
+void BlockChain::load_segment_max_heights(bool read_only) {
+	m_segment_max_heights.clear();
+	for (auto cur = m_db.begin(SEGMENT_MAX_HEIGHT_PREFIX); !cur.end(); cur.next()) {
+		Height height = 0;
+		seria::from_binary(height, cur.get_value_array());
+		m_segment_max_heights[static_cast<uint32_t>(from_be_key(cur.get_suffix(), 0, 4))] = height;
+	}
+	uint32_t first_segment = 0;
+	BinaryArray ba;
+	if (m_db.get(FIRST_BLOCK_SEGMENT, ba))
+		seria::from_binary(first_segment, ba);
+	m_pruned_height = 0;
+	for (auto &&sh : m_segment_max_heights)
+		if (sh.first < first_segment)
+			m_pruned_height = std::max(m_pruned_height, sh.second + 1);
+	m_block_segments.set_first_segment(first_segment);
+	m_pruned_first_segment = first_segment;
+	const auto &end   = m_block_segments.get_end();
+	bool all_known = true;
+	for (uint32_t segment = first_segment; segment != end.segment + (end.offset != 0 ? 1 : 0); ++segment)
+		all_known = all_known && m_segment_max_heights.count(segment) != 0;
+	if (read_only || m_config.prune_blocks_below_depth == 0 || all_known)
+		return;
+	// Segments written before heights were tracked, one pass over locations of all blocks
+	m_log(logging::INFO) << "Finding heights of blocks in block segments for pruning..." << std::endl;
+	for (auto cur = m_db.begin(m_block_locations_table, std::string()); !cur.end(); cur.next()) {
+		Hash bid;
+		DB::from_binary_key(cur.get_suffix(), 0, bid.data, sizeof(bid.data));
+		BlockLocation location;
+		seria::from_binary(location, cur.get_value_array());
+		api::BlockHeader header;
+		if (location.segment < first_segment || !read_header_impl(m_db, m_headers_table, bid, &header))
+			continue;
+		auto mit = m_segment_max_heights.find(location.segment);
+		if (mit == m_segment_max_heights.end() || mit->second < header.height)
+			m_segment_max_heights[location.segment] = header.height;
+	}
+	for (auto &&sh : m_segment_max_heights)
+		m_db.put(DBKey(SEGMENT_MAX_HEIGHT_PREFIX).append_be(sh.first, 4), seria::to_binary(sh.second), false);
+	m_db.commit_db_txn();
+}
+
+uint32_t BlockChain::prune_block_segments() {
+	uint32_t first_segment = m_pruned_first_segment;
+	const Height depth     = std::max(m_config.prune_blocks_below_depth, MIN_PRUNE_DEPTH);
+	if (m_config.prune_blocks_below_depth == 0 || !m_internal_import_chain.empty() || m_tip_height == Height(-1))
+		return first_segment;
+	for (; first_segment < m_block_segments.get_end().segment; ++first_segment) {  // never one being appended to
+		auto mit = m_segment_max_heights.find(first_segment);
+		if (mit == m_segment_max_heights.end() || mit->second + depth >= m_tip_height)
+			break;
+		m_pruned_height = std::max(m_pruned_height, mit->second + 1);
+	}
+	if (first_segment != m_pruned_first_segment)
+		m_db.put(FIRST_BLOCK_SEGMENT, seria::to_binary(first_segment), false);
+	return first_segment;
+}
+
+void BlockChain::migrate_blocks_to_segments() {
+	m_log(logging::INFO) << "Moving block bodies from database to segment files, can take several minutes..."
+	                     << std::endl;
+	const DB::Table legacy_blocks_table = m_db.open_table(LEGACY_BLOCKS_TABLE);
+	size_t moved = 0;
+	// Moved rows are erased and committed together with segments end, so rows left in legacy table are resume
+	// marker, interrupted migration continues from them on next start, $version changes only after the last one
+	while (true) {
+		size_t batch = 0;
+		for (auto cur = m_db.begin(legacy_blocks_table, std::string()); !cur.end() && batch != COMMIT_EVERY_N_BLOCKS;
+		     cur.erase(), ++batch) {
+			Hash bid;
+			DB::from_binary_key(cur.get_suffix(), 0, bid.data, sizeof(bid.data));
+			api::BlockHeader header;
+			store_block(bid, cur.get_value_array(), read_header_impl(m_db, m_headers_table, bid, &header) ? header.height : 0);
+		}
+		moved += batch;
+		if (batch != COMMIT_EVERY_N_BLOCKS)
+			break;
+		m_block_segments.sync();
+		m_db.commit_db_txn();
+		m_log(logging::INFO) << "Moved " << moved << " blocks" << std::endl;
+	}
+	m_db.put("$version", version_current, false);
+	m_block_segments.sync();
+	m_db.commit_db_txn();
+	m_log(logging::INFO) << "Moved " << moved << " blocks, database will shrink only after backup" << std::endl;
 }
 
 bool BlockChain::read_block(const Hash &bid, BinaryArray *block_data, RawBlock *raw_block) const {
-	BinaryArray rb;
-	auto key = BLOCK_PREFIX + DB::to_binary_key(bid.data, sizeof(bid.data)) + BLOCK_SUFFIX;
-	if (!m_db.get(key, rb))
-		return false;
-	if (raw_block)
-		seria::from_binary(*raw_block, rb);
-	*block_data = std::move(rb);
-	return true;
+	return read_block_impl(m_db, m_block_locations_table, m_block_segments, bid, block_data, raw_block);
+}
+
+bool BlockChain::read_block(const DB::Snapshot &snapshot, const Hash &bid, BinaryArray *block_data, RawBlock *raw_block) const {
+	return read_block_impl(snapshot, m_block_locations_table, m_block_segments, bid, block_data, raw_block);
 }
 
 bool BlockChain::read_block(const Hash &bid, RawBlock *raw_block) const {
@@ -539,16 +959,16 @@ bool BlockChain::read_block(const Hash &bid, RawBlock *raw_block) const {
 
 bool BlockChain::has_block(const Hash &bid) const {
 	platform::DB::Value ms;
-	auto key = BLOCK_PREFIX + DB::to_binary_key(bid.data, sizeof(bid.data)) + BLOCK_SUFFIX;
-	if (!m_db.get(key, ms))
+	const auto key = DBKey().append(bid.data, sizeof(bid.data));
+	if (!m_db.get(m_block_locations_table, key, ms))
 		return false;
 	return true;
 }
 
 void BlockChain::store_header(const Hash &bid, const api::BlockHeader &header) {
-	auto key = HEADER_PREFIX + DB::to_binary_key(bid.data, sizeof(bid.data)) + HEADER_SUFFIX;
+	const auto key = DBKey().append(bid.data, sizeof(bid.data));
 	auto ba = seria::to_binary(header);
-	m_db.put(key, ba, true);
+	m_db.put(m_headers_table, key, ba, true);
 }
 
 bool BlockChain::read_header(const Hash &bid, api::BlockHeader *header, Height hint) const {
@@ -560,25 +980,26 @@ bool BlockChain::read_header(const Hash &bid, api::BlockHeader *header, Height h
 			return true;
 		}
 	}
-	auto cit = header_cache.find(bid);
-	if (cit != header_cache.end()) {
+	auto cit = m_side_headers.find(bid);
+	if (cit != m_side_headers.end()) {
 		*header = cit->second;
 		return true;
 	}
-	if (header_cache.size() > largest_window() * 10) {
-		m_log(logging::INFO) << "BlockChain header cache reached max size and cleared" << std::endl;
-		header_cache.clear();  // very simple policy
+	if (m_side_headers.size() > largest_window() * 10) {
+		m_log(logging::INFO) << "BlockChain side headers reached max size and cleared" << std::endl;
+		m_side_headers.clear();  // very simple policy
 	}
-	BinaryArray rb;
-	auto key = HEADER_PREFIX + DB::to_binary_key(bid.data, sizeof(bid.data)) + HEADER_SUFFIX;
-	if (!m_db.get(key, rb))
-		return false;
 	auto bbid = bid; 
-	seria::from_binary(*header, rb);
-	header_cache.insert(std::make_pair(bbid, *header));
+	if (!read_header_impl(m_db, m_headers_table, bid, header))
+		return false;
+	m_side_headers.insert(std::make_pair(bbid, *header));
 	return true;
 }
 
+bool BlockChain::read_header(const DB::Snapshot &snapshot, const Hash &bid, api::BlockHeader *header) const {
+	return read_header_impl(snapshot, m_headers_table, bid, header);
+}
+
 api::BlockHeader BlockChain::read_header(const Hash &bid, Height hint) const {
 	api::BlockHeader result;
 	invariant(read_header(bid, &result, hint), "Expected header was not found" + common::pod_to_hex(bid));
@@ -590,29 +1011,101 @@ const api::BlockHeader &BlockChain::get_tip() const {
 	return m_header_tip_window.back();
 }
 
-std::vector<api::BlockHeader> BlockChain::get_tip_segment(
+std::vector<ChainHeader> BlockChain::get_tip_segment(
 	const api::BlockHeader &prev_info, Height window, bool add_genesis) const {
-	std::vector<api::BlockHeader> result;
+	std::vector<ChainHeader> result;
 	result.reserve(window);
 	if (prev_info.height == Height(-1))
 		return result;
-	auto pi = prev_info;
+	const Height first = prev_info.height + 1 - std::min<Height>(window, prev_info.height + (add_genesis ? 1 : 0));
+	if (prev_info.height < m_chain_bids.size() && m_chain_bids[prev_info.height] == prev_info.hash) {
+		auto start = m_chain_headers.begin() + first;
+		result.assign(start, start + (prev_info.height + 1 - first));  // main chain, slice of chain headers
+		return result;
+	}
+	auto pi = prev_info;  // side branch, walked until it joins main chain
 	while (result.size() < window && pi.height != 0) {
-		result.push_back(pi);
+		Hash bid;
+		if (read_chain(pi.height, &bid) && bid == pi.hash) {
+			const Height count = std::min<Height>(static_cast<Height>(window - result.size()),
+			    pi.height + (add_genesis ? 1 : 0));
+			for (Height i = 0; i != count; ++i)
+				result.push_back(m_chain_headers.at(pi.height - i));
+			std::reverse(result.begin(), result.end());
+			return result;
+		}
+		result.push_back(to_chain_header(pi));
 		pi = read_header(pi.previous_block_hash, pi.height - 1);
 	}
 	if (result.size() < window && add_genesis) {
 		invariant(pi.height == 0, "Invariant dead - window size not reached, but genesis not found in get_tip_segment");
-		result.push_back(pi);
+		result.push_back(to_chain_header(pi));
 	}
 	std::reverse(result.begin(), result.end());
 	return result;
 }
 
+std::string BlockChain::get_tip_stamp() const {
+	return common::pod_to_hex(m_tip_bid) + "/" + common::to_string(m_tip_height);
+}
+
+void BlockChain::load_filter(common::BloomFilter &filter, const std::string &name, const DB::Table &table) {
+	const std::string path = m_db.get_path() + "." + name + ".filter";
+	m_filters_stamp        = get_tip_stamp();
+	BinaryArray data;
+	if (platform::load_file(path, data)) {
+		platform::remove_file(path);  // if we crash, DB can be committed past saved filter
+		if (filter.from_binary(data, m_filters_stamp)) {
+			m_log(logging::INFO) << "Loaded " << name << " filter count=" << filter.get_count() << std::endl;
+			return;
+		}
+	}
+	rebuild_filter(filter, name, table);
+}
+
+void BlockChain::rebuild_filter(common::BloomFilter &filter, const std::string &name, const DB::Table &table) {
+	m_log(logging::INFO) << "Building " << name << " filter, can take several minutes..." << std::endl;
+	for (size_t capacity = MIN_FILTER_CAPACITY;; capacity *= 4) {
+		filter.reset(capacity);
+		auto cur = m_db.begin(table, std::string());
+		for (; !cur.end() && filter.get_count() * 2 < capacity; cur.next())
+			filter.insert(reinterpret_cast<const unsigned char *>(cur.get_suffix().data()), cur.get_suffix().size());
+		if (cur.end())
+			break;
+	}
+	m_log(logging::INFO) << "Built " << name << " filter count=" << filter.get_count()
+	                     << " capacity=" << filter.get_capacity() << std::endl;
+}
+
+void BlockChain::save_filter(const common::BloomFilter &filter, const std::string &name) const {
+	if (!filter.is_built())
+		return;
+	const std::string path = m_db.get_path() + "." + name + ".filter";
+	auto data              = filter.to_binary(m_filters_stamp);
+	if (!platform::atomic_save_file(path, data.data(), data.size(), path + ".tmp"))
+		m_log(logging::WARNING) << "Failed to save " << name << " filter to " << path << std::endl;
+}
+
+void BlockChain::check_filter(const common::BloomFilter &filter, const std::string &name, const DB::Table &table) const {
+	if (!filter.is_built())
+		return;
+	for (auto cur = m_db.begin(table, std::string()); !cur.end(); cur.next())
+		invariant(filter.may_contain(reinterpret_cast<const unsigned char *>(cur.get_suffix().data()),
+		              cur.get_suffix().size()),
+		    "key of table is absent in " + name + " filter");
+}
+
+void BlockChain::rebuild_filters_if_needed() {
+	if (m_transactions_filter.is_built() && m_transactions_filter.get_count() >= m_transactions_filter.get_capacity())
+		rebuild_filter(m_transactions_filter, "transactions", m_transactions_table);
+#if cryonero_CHECK_FILTERS  // differential check, filter must never say absent for key in table, slow
+	check_filter(m_transactions_filter, "transactions", m_transactions_table);
+#endif
+}
+
 void BlockChain::read_tip() {
-	auto cur2 = m_db.rbegin(TIP_CHAIN_PREFIX);
-	m_tip_height = cur2.end() ? -1 : boost::lexical_cast<Height>(common::read_varint_sqlite4(cur2.get_suffix()));
-	seria::from_binary(m_tip_bid, cur2.get_value_array());
+	m_tip_height = static_cast<Height>(m_chain_bids.size() - 1);
+	m_tip_bid    = m_chain_bids.back();
 	auto tip_header = read_header(m_tip_bid);
 	m_tip_cumulative_difficulty = tip_header.cumulative_difficulty;
 	m_header_tip_window.clear();
@@ -627,8 +1120,10 @@ Height BlockChain::largest_window() const {
 
 void BlockChain::push_chain(const api::BlockHeader &header) {
 	m_tip_height += 1;
-	auto ba = seria::to_binary(header.hash);
-	m_db.put(TIP_CHAIN_PREFIX + common::write_varint_sqlite4(m_tip_height), ba, true);
+	m_chain_headers.push_back(to_chain_header(header));
+	m_db.put(m_tip_chain_table, DB::to_integer_key(m_tip_height), tip_chain_value(header.hash, m_chain_headers.back()),
+	    true);
+	m_chain_bids.push_back(header.hash);
 	m_tip_bid = header.hash;
 	m_tip_cumulative_difficulty = header.cumulative_difficulty;
 	m_header_tip_window.push_back(header);
@@ -640,7 +1135,9 @@ void BlockChain::push_chain(const api::BlockHeader &header) {
 void BlockChain::pop_chain(const Hash &new_tip_bid) {
 	invariant(m_tip_height != 0 && !m_header_tip_window.empty(), "pop_chain tip_height == 0");
 	m_header_tip_window.pop_back();
-	m_db.del(TIP_CHAIN_PREFIX + common::write_varint_sqlite4(m_tip_height), true);
+	m_db.del(m_tip_chain_table, DB::to_integer_key(m_tip_height), true);
+	m_chain_bids.pop_back();
+	m_chain_headers.pop_back();
 	m_tip_height -= 1;
 	m_tip_bid = new_tip_bid;
 	invariant(read_chain(m_tip_height) == m_tip_bid,
@@ -653,13 +1150,16 @@ void BlockChain::pop_chain(const Hash &new_tip_bid) {
 }
 
 bool BlockChain::read_chain(uint32_t height, Hash *bid) const {
-	BinaryArray ba;
-	if (!m_db.get(TIP_CHAIN_PREFIX + common::write_varint_sqlite4(height), ba))
+	if (height >= m_chain_bids.size())
 		return false;
-	seria::from_binary(*bid, ba);
+	*bid = m_chain_bids[height];
 	return true;
 }
 
+bool BlockChain::read_chain(const DB::Snapshot &snapshot, Height height, Hash *bid) const {
+	return read_chain_impl(snapshot, m_tip_chain_table, height, bid);
+}
+
 bool BlockChain::in_chain(Height height, Hash bid) const {
 	Hash ha;
 	return read_chain(height, &ha) && ha == bid;
@@ -672,65 +1172,57 @@ Hash BlockChain::read_chain(uint32_t height) const {
 }
 
 void BlockChain::check_children_counter(Difficulty cd, const Hash &bid, int value) {
-	auto key = CHILDREN_PREFIX + DB::to_binary_key(bid.data, sizeof(bid.data));
-	auto cd_key = CD_TIPS_PREFIX + common::write_varint_sqlite4(cd) + DB::to_binary_key(bid.data, sizeof(bid.data));
+	const auto key = DBKey().append(bid.data, sizeof(bid.data));
+	const auto cd_key = DBKey().append_be(cd, sizeof(Difficulty)).append(bid.data, sizeof(bid.data));
 	int counter = 1;  // default is 1 when not stored in db
-	BinaryArray rb;
-	if (m_db.get(key, rb))
-		seria::from_binary(counter, rb);
+	DB::Value rb;
+	if (m_db.get(m_children_table, key, rb))
+		seria::from_binary(counter, rb.data(), rb.size());
 	invariant(counter == value, "check_children_counter index corrupted");
 
-	invariant(counter != 0 || m_db.get(cd_key, rb), "check_children_counter tip is not in index");
-	invariant(counter == 0 || !m_db.get(cd_key, rb), "check_children_counter non-tip is in index");
+	invariant(counter != 0 || m_db.get(m_tips_table, cd_key, rb), "check_children_counter tip is not in index");
+	invariant(counter == 0 || !m_db.get(m_tips_table, cd_key, rb), "check_children_counter non-tip is in index");
 }
 
 void BlockChain::modify_children_counter(Difficulty cd, const Hash &bid, int delta) {
-	auto key = CHILDREN_PREFIX + DB::to_binary_key(bid.data, sizeof(bid.data));
-	auto cd_key = CD_TIPS_PREFIX + common::write_varint_sqlite4(cd) + DB::to_binary_key(bid.data, sizeof(bid.data));
+	const auto key = DBKey().append(bid.data, sizeof(bid.data));
+	const auto cd_key = DBKey().append_be(cd, sizeof(Difficulty)).append(bid.data, sizeof(bid.data));
 	uint32_t counter = 1;  // default is 1 when not stored in db
-	BinaryArray rb;
-	if (m_db.get(key, rb))
-		seria::from_binary(counter, rb);
+	DB::Value rb;
+	if (m_db.get(m_children_table, key, rb))
+		seria::from_binary(counter, rb.data(), rb.size());
 	counter += delta;
 	if (counter == 1) {
-		m_db.del(key, false);
+		m_db.del(m_children_table, key, false);
 	}
 	else {
 		auto ba = seria::to_binary(counter);
-		m_db.put(key, ba, false);
+		m_db.put(m_children_table, key, ba, false);
 	}
 	if (counter == 0) {
-		m_db.put(cd_key, std::string(), false);
+		m_db.put(m_tips_table, cd_key, std::string(), false);
 	}
 	else {
-		m_db.del(cd_key, false);
+		m_db.del(m_tips_table, cd_key, false);
 	}
 }
 
 bool BlockChain::get_oldest_tip(Difficulty *cd, Hash *bid) const {
-	auto cur = m_db.begin(CD_TIPS_PREFIX);
+	auto cur = m_db.begin(m_tips_table, std::string());
 	if (cur.end())
 		return false;
-	const std::string &suf = cur.get_suffix();
-	const char *be = suf.data();
-	const char *en = be + suf.size();
-	*cd = common::read_varint_sqlite4(be, en);
-	invariant(en - be == sizeof(bid->data), "CD_TIPS_PREFIX corrupted");
-	DB::from_binary_key(cur.get_suffix(), cur.get_suffix().size() - sizeof(bid->data), bid->data, sizeof(bid->data));
+	invariant(cur.get_suffix().size() == sizeof(Difficulty) + sizeof(bid->data), "tips table corrupted");
+	*cd = from_be_key(cur.get_suffix(), 0, sizeof(Difficulty));
+	DB::from_binary_key(cur.get_suffix(), sizeof(Difficulty), bid->data, sizeof(bid->data));
 	return true;
 }
 
 void BlockChain::for_each_tip(std::function<bool(Difficulty cd, Hash bid)> fun) const {
-	for (auto cur = m_db.rbegin(CD_TIPS_PREFIX); !cur.end(); cur.next()) {
-		const std::string &suf = cur.get_suffix();
-		const char *be = suf.data();
-		const char *en = be + suf.size();
-		Difficulty cd;
-		cd = common::read_varint_sqlite4(be, en);
+	for (auto cur = m_db.rbegin(m_tips_table, std::string()); !cur.end(); cur.next()) {
 		Hash tip_bid;
-		invariant(en - be == sizeof(tip_bid.data), "CD_TIPS_PREFIX corrupted");
-		DB::from_binary_key(
-			cur.get_suffix(), cur.get_suffix().size() - sizeof(tip_bid.data), tip_bid.data, sizeof(tip_bid.data));
+		invariant(cur.get_suffix().size() == sizeof(Difficulty) + sizeof(tip_bid.data), "tips table corrupted");
+		Difficulty cd = from_be_key(cur.get_suffix(), 0, sizeof(Difficulty));
+		DB::from_binary_key(cur.get_suffix(), sizeof(Difficulty), tip_bid.data, sizeof(tip_bid.data));
 		if (!fun(cd, tip_bid))
 			break;
 	}
@@ -745,10 +1237,10 @@ bool BlockChain::prune_branch(Difficulty cd, Hash bid) {
 	auto pa = read_header(me.previous_block_hash);
 	modify_children_counter(cd, bid, 1);
 	modify_children_counter(pa.cumulative_difficulty, me.previous_block_hash, -1);
-	auto key = BLOCK_PREFIX + DB::to_binary_key(bid.data, sizeof(bid.data)) + BLOCK_SUFFIX;
-	m_db.del(key, true);
-	auto key2 = HEADER_PREFIX + DB::to_binary_key(bid.data, sizeof(bid.data)) + HEADER_SUFFIX;
-	m_db.del(key2, true);
+	const auto key = DBKey().append(bid.data, sizeof(bid.data));
+	m_db.del(m_block_locations_table, key, true);  // body stays in segment as garbage
+	m_db.del(m_headers_table, key, true);
+	m_side_headers.erase(bid);
 	return true;
 }
 
@@ -768,7 +1260,7 @@ void BlockChain::test_print_structure(Height n_confirmations) const {
 	if (get_oldest_tip(&ocd, &obid))
 		std::cout << "oldest tip cd=" << ocd << " bid=" << obid << std::endl;
 	std::cout << "---- BlockTree tips and forking nodes ----" << std::endl;
-	for (auto cur = m_db.begin(CHILDREN_PREFIX); !cur.end(); cur.next()) {
+	for (auto cur = m_db.begin(m_children_table, std::string()); !cur.end(); cur.next()) {
 		Hash bid;
 		DB::from_binary_key(cur.get_suffix(), 0, bid.data, sizeof(bid.data));
 		uint32_t counter = 1;
@@ -840,7 +1332,7 @@ void BlockChain::start_internal_import() {
 	m_log(logging::INFO) << "Blockchain database has old format, preparing for internal block import..." << std::endl;
 	if (m_internal_import_chain.empty()) {
 		const std::vector<std::string> former_prefixes{
-			TIP_CHAIN_PREFIX + "B/", TIP_CHAIN_PREFIX + "1/", TIP_CHAIN_PREFIX + "/", TIP_CHAIN_PREFIX };
+			LEGACY_TIP_CHAIN_PREFIX + "B/", LEGACY_TIP_CHAIN_PREFIX + "1/", LEGACY_TIP_CHAIN_PREFIX + "/", LEGACY_TIP_CHAIN_PREFIX };
 		for (auto && prefix : former_prefixes) {
 			std::vector<Hash> main_chain;
 			for (auto ha = 0;; ha += 1) {
@@ -856,7 +1348,9 @@ void BlockChain::start_internal_import() {
 		}
 	}
 	// we could wish to advance version on half-imported chain
-	std::set<Hash> main_chain_bids{ m_internal_import_chain.begin(), m_internal_import_chain.end() };
+	std::map<Hash, Height> main_chain_bids;
+	for (size_t ha = 0; ha != m_internal_import_chain.size(); ++ha)
+		main_chain_bids.emplace(m_internal_import_chain[ha], static_cast<Height>(ha));
 	m_log(logging::INFO) << "Found " << m_internal_import_chain.size() << " blocks from main chain" << std::endl;
 	size_t erased = 0, skipped = 0;
 	auto total_items = m_db.get_approximate_items_count();
@@ -864,22 +1358,29 @@ void BlockChain::start_internal_import() {
 		if ((erased + skipped) % 1000000 == 0)
 			m_log(logging::INFO) << "Processing " << (erased + skipped) / 1000000 << "/"
 			<< (total_items + 999999) / 1000000 << " million DB records" << std::endl;
-		if (cur.get_suffix().find(BLOCK_PREFIX) == 0 &&
-			cur.get_suffix().substr(cur.get_suffix().size() - BLOCK_SUFFIX.size()) == BLOCK_SUFFIX) {
+		if (cur.get_suffix().size() == LEGACY_BLOCK_PREFIX.size() + sizeof(Hash) + LEGACY_BLOCK_SUFFIX.size() &&
+			cur.get_suffix().find(LEGACY_BLOCK_PREFIX) == 0 &&
+			cur.get_suffix().substr(cur.get_suffix().size() - LEGACY_BLOCK_SUFFIX.size()) == LEGACY_BLOCK_SUFFIX) {
 			Hash bid;
-			DB::from_binary_key(cur.get_suffix(), BLOCK_PREFIX.size(), bid.data, sizeof(bid.data));
-			if (main_chain_bids.count(bid) != 0) {
-				cur.next();
+			DB::from_binary_key(cur.get_suffix(), LEGACY_BLOCK_PREFIX.size(), bid.data, sizeof(bid.data));
+			auto mit = main_chain_bids.find(bid);
+			if (mit != main_chain_bids.end()) {  // block in main chain, moving to segments
+				store_block(bid, cur.get_value_array(), mit->second);
 				skipped += 1;
-				continue;  // block in main chain
 			}
-			BinaryArray block_data;
-
 		}
 		cur.erase();
 		erased += 1;
 	}
 	m_db.put("internal_import_chain", seria::to_binary(m_internal_import_chain), true);  // we've just erased it :)
+	// store_block records sort before block records, so were erased after being written, without them segments
+	// would be truncated on next start
+	for (auto &&sh : m_segment_max_heights)
+		m_db.put(DBKey(SEGMENT_MAX_HEIGHT_PREFIX).append_be(sh.first, 4), seria::to_binary(sh.second), false);
+	BlockLocation segments_end;
+	segments_end.segment = m_block_segments.get_end().segment;
+	segments_end.offset  = m_block_segments.get_end().offset;
+	m_db.put(BLOCK_SEGMENTS_END, seria::to_binary(segments_end), false);
 	m_log(logging::INFO) << "Deleted " << erased << " records, skipped " << skipped << " records" << std::endl;
 }
 
@@ -915,32 +1416,33 @@ bool BlockChain::internal_import() {
 	return false;
 }
 
-void BlockChain::test_undo_everything(Height new_tip_height) {
+void BlockChain::undo_to_height(Height new_tip_height) {
 	while (get_tip_height() > new_tip_height) {
-		RawBlock raw_block;
-		Block block;
-		if (!read_block(get_tip_bid(), &raw_block) || !block.from_raw_block(raw_block))
-			break;
-		undo_block(get_tip_bid(), raw_block, block, m_tip_height);
+		const Hash previous_block_hash = get_tip().previous_block_hash;
+		std::vector<Hash> transaction_hashes;
+		if (!undo_block(get_tip_bid(), m_tip_height, &transaction_hashes))
+			throw std::runtime_error("Failed to undo block at height " + common::to_string(m_tip_height) +
+			                         ", block body not found or corrupted, bid=" + common::pod_to_hex(get_tip_bid()));
 		if (get_tip_bid() == m_genesis_bid)
 			break;
-		pop_chain(block.header.previous_block_hash);
+		pop_chain(previous_block_hash);
 		tip_changed();
 		if (get_tip_height() % COMMIT_EVERY_N_BLOCKS == 1)
 			db_commit();
 	}
+}
+
+void BlockChain::test_undo_everything(Height new_tip_height) {
+	undo_to_height(new_tip_height);
 	std::cout << "---- After undo everything ---- " << std::endl;
 
 	int counter = 0;
-	for (auto cur = m_db.begin(std::string()); !cur.end(); cur.next()) {
-		if (cur.get_suffix().find(BLOCK_PREFIX) == 0)
-			continue;
-		if (cur.get_suffix().find(HEADER_PREFIX) == 0)
-			continue;
-		if (cur.get_suffix().find("f") == 0)
-			continue;
-		std::cout << DB::clean_key(cur.get_suffix()) << std::endl;
-		if (counter++ > 1000)
-			break;
-	}
+	for (auto &&table : {DB::Table(), m_transactions_table, m_timestamps_table})
+		for (auto cur = m_db.begin(table, std::string()); !cur.end(); cur.next()) {
+			if (cur.get_suffix().find("f") == 0)
+				continue;
+			std::cout << DB::clean_key(cur.get_suffix()) << std::endl;
+			if (counter++ > 1000)
+				break;
+		}
 }
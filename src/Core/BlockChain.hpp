@@ -8,12 +8,15 @@
 
 #include <bitset>
 #include <deque>
+#include <map>
 #include <unordered_map>
 #include "CryptoNote.hpp"
+#include "common/BloomFilter.hpp"
 #include "logging/LoggerMessage.hpp"
 #include "Currency.hpp"
 #include "platform/DB.hpp"
 #include "platform/ExclusiveLock.hpp"
+#include "platform/SegmentedFile.hpp"
 #include "rpc_api.hpp"
 
 namespace crypto 
@@ -52,24 +55,32 @@ namespace cryonerocoin
 		PreparedBlock() = default;
 	};
 
+	// Fields of main chain block used by consensus windows, kept for every height, about 16 bytes per block
+	struct ChainHeader {
+		Timestamp timestamp              = 0;
+		uint32_t block_size              = 0;
+		Difficulty cumulative_difficulty = 0;
+	};
+
 	class BlockChain {
 	public:
 
 		using DB = platform::DB;
 
 		explicit BlockChain(logging::ILogger &, const Config &config, const Currency &, bool read_only);
-		virtual ~BlockChain() = default;
+		virtual ~BlockChain();
 
 		const Hash &get_genesis_bid() const { return m_genesis_bid; }
 		Hash get_tip_bid() const { return m_tip_bid; }
 		Height get_tip_height() const { return m_tip_height; }
+		Height get_pruned_height() const { return m_pruned_height; }  // bodies of blocks from it up are stored
 		const api::BlockHeader &get_tip() const;
 		template<typename T>
 		void get_tips(Height, Height, T &) const;
 		template<typename T>
 		void get_txs(const std::vector<Hash> &, T &) const;
 
-		std::vector<api::BlockHeader> get_tip_segment(
+		std::vector<ChainHeader> get_tip_segment(
 			const api::BlockHeader &prev_info, Height window, bool add_genesis) const;
 
 		bool read_chain(Height height, Hash *bid) const;
@@ -80,23 +91,46 @@ namespace cryonerocoin
 		bool read_header(const Hash &bid, api::BlockHeader *info, Height hint = 0) const;
 		bool read_transaction(const Hash &tid, Transaction *tx, Height *block_height, Hash *block_hash, size_t *index_in_block, uint32_t *binary_size) const;
 
+		// Snapshot and reads through it can be used on any thread, they see state as of last db_commit
+		Height get_committed_tip_height() const { return m_committed_tip_height; }
+		std::unique_ptr<DB::Snapshot> create_db_snapshot() const { return std::unique_ptr<DB::Snapshot>(new DB::Snapshot(m_db)); }
+		bool read_chain(const DB::Snapshot &snapshot, Height height, Hash *bid) const;
+		bool read_block(const DB::Snapshot &snapshot, const Hash &bid, BinaryArray *block_data, RawBlock *rb) const;
+		bool read_header(const DB::Snapshot &snapshot, const Hash &bid, api::BlockHeader *info) const;
+
 
 		BroadcastAction add_block(const PreparedBlock &pb, api::BlockHeader *info, const std::string &source_address);
 
 		std::vector<Hash> get_sparse_chain() const;
-		std::vector<api::BlockHeader> get_sync_headers(const std::vector<Hash> &sparse_chain, size_t max_count) const;
+		std::vector<ChainHeader> get_sync_headers(
+			const std::vector<Hash> &sparse_chain, Height *start_height, size_t max_count) const;
 		std::vector<Hash> get_sync_headers_chain(
 			const std::vector<Hash> &sparse_chain, Height *start_height, size_t max_count) const;
 
 		Height find_blockchain_supplement(const std::vector<Hash> &remote_block_ids) const;
 		Height get_timestamp_lower_bound_block_index(Timestamp) const;
 
+		void undo_to_height(Height new_tip_height);  // blocks above stay stored, redone with full checks on reorg
 		void test_undo_everything(Height new_tip_height);
 		void test_print_structure(Height n_confirmations) const;
 
 		void test_prune_oldest();
 
 		void db_commit();
+		DB::CommitStats get_db_commit_stats() const { return m_db.get_commit_stats(); }
+
+		// Checksummed copy of all tables and block bodies, to bootstrap other nodes. Tip must contain last checkpoint,
+		// and block bodies above it must not be pruned
+		void export_state(const std::string &folder) const;
+		// Fills empty DB of data folder before BlockChain is constructed, if manifest hash equals snapshot_id.
+		// Returns checkpoint height and bid snapshot was verified against, constructed BlockChain should
+		// undo_to_height it and then have checkpoint bid as tip, so that blocks past it are checked
+		static std::pair<Height, Hash> import_state(
+		    const std::string &folder, const Hash &snapshot_id, const Config &config, const Currency &currency);
+
+		// End of block segments referenced by DB at db_path, {0, 0} if there is no DB. Hot backup passes it to
+		// SegmentedFile::copy_folder
+		static platform::SegmentedFile::Position read_committed_segments_end(const std::string &db_path);
 
 		bool internal_import(); 
 		Height internal_import_known_height() const { return static_cast<Height>(m_internal_import_chain.size()); }
@@ -106,6 +140,7 @@ namespace cryonerocoin
 
 	protected:
 		Difficulty get_tip_cumulative_difficulty() const { return m_tip_cumulative_difficulty; }
+		const ChainHeader &get_chain_header(Height height) const { return m_chain_headers.at(height); }  // main chain
 		bool read_next_internal_block(Hash *bid) const;
 
 		std::vector<Hash> m_internal_import_chain;
@@ -118,8 +153,29 @@ namespace cryonerocoin
 		bool redo_block(const Hash &bhash, const BinaryArray &block_data, const RawBlock &raw_block, const Block &block, const api::BlockHeader &info, const Hash &base_transaction_hash);
 		void debug_check_transaction_invariants(const RawBlock &raw_block, const Block &block, const api::BlockHeader &info,
 			const Hash &base_transaction_hash) const;
-		void undo_block(const Hash &bhash, const RawBlock &raw_block, const Block &block, Height height);
+		// From undo record when block is recent, otherwise reads and parses block. False if body is not stored
+		bool undo_block(const Hash &bhash, Height height, std::vector<Hash> *transaction_hashes);
+		void undo_block_parsed(const Hash &bhash, const Block &block, Height height);  // when no undo record
+		void apply_undo_journal(const Hash &bhash, const std::vector<DB::UndoOp> &undo);
+		void check_undo_journal(const Hash &bhash, Height height, const std::vector<DB::UndoOp> &undo,
+		    const std::vector<Hash> &transaction_hashes);  // compares with parse-based undo, then applies
+		virtual void undo_journal_applied(const std::vector<DB::UndoOp> &) {}  // in-memory indexes follow DB
+		// check_undo_journal runs parse-based undo on saved copy of in-memory indexes
+		virtual void test_save_memory_indexes() {}
+		virtual void test_swap_memory_indexes() {}
+		virtual bool test_memory_indexes_equal_saved() const { return true; }
 		virtual void tip_changed() {} 
+
+		// Short-circuit lookups of absent keys. Built only in read-write mode, saved on exit with tip of last commit,
+		// file is used only if DB tip is the same, otherwise filter is rebuilt from table.
+		common::BloomFilter m_transactions_filter;
+		std::string m_filters_stamp;
+		Height m_committed_tip_height = 0;
+		void load_filter(common::BloomFilter &filter, const std::string &name, const DB::Table &table);
+		void rebuild_filter(common::BloomFilter &filter, const std::string &name, const DB::Table &table);
+		void save_filter(const common::BloomFilter &filter, const std::string &name) const;
+		void check_filter(const common::BloomFilter &filter, const std::string &name, const DB::Table &table) const;
+		virtual void rebuild_filters_if_needed();  // called before each commit
 		virtual void on_reorganization(
 			const std::map<Hash, std::pair<Transaction, BinaryArray>> &undone_transactions, bool undone_blocks) = 0;
 
@@ -127,7 +183,16 @@ namespace cryonerocoin
 		const std::string m_coin_folder;
 		Hash get_common_block(const Hash &bid1, const Hash &bid2, std::vector<Hash> *chain1, std::vector<Hash> *chain2) const; // both can be null
 
+		platform::SegmentedFile m_block_segments;  // block bodies, appended as they arrive
 		DB m_db;
+		const DB::Table m_block_locations_table;  // bid -> position of block body in m_block_segments
+		const DB::Table m_headers_table;       // bid -> api::BlockHeader
+		const DB::Table m_transactions_table;  // tid -> position in block
+		const DB::Table m_tip_chain_table;     // height -> bid of main chain
+		const DB::Table m_timestamps_table;    // timestamp, height -> nothing
+		const DB::Table m_children_table;      // bid -> children counter, when not 1
+		const DB::Table m_tips_table;          // cumulative difficulty, bid -> nothing
+		const DB::Table m_undo_table;          // bid -> previous values of keys written by redo_block, recent blocks
 		logging::LoggerRef m_log;
 		const Config &m_config;
 		const Currency &m_currency;
@@ -138,16 +203,26 @@ namespace cryonerocoin
 		Hash m_tip_bid;
 		Difficulty m_tip_cumulative_difficulty = 0;
 		Height m_tip_height = -1;
+		std::string get_tip_stamp() const;
 		void read_tip();
 		void push_chain(const api::BlockHeader &header);
 		void pop_chain(const Hash &new_tip_bid);
 		Hash read_chain(Height height) const;
 
-		mutable std::unordered_map<Hash, api::BlockHeader> header_cache;
-		std::deque<api::BlockHeader> m_header_tip_window;
+		std::vector<Hash> m_chain_bids;  // main chain by height, mirrors m_tip_chain_table
+		std::vector<ChainHeader> m_chain_headers;  // by height too, stored after bid in m_tip_chain_table
+		std::deque<api::BlockHeader> m_header_tip_window;  // main chain headers ending with tip
+		mutable std::unordered_map<Hash, api::BlockHeader> m_side_headers;  // other headers read, kept across commits
 		api::BlockHeader read_header(const Hash &bid, Height hint = 0) const;
 
-		void store_block(const Hash &bid, const BinaryArray &block_data);
+		void store_block(const Hash &bid, const BinaryArray &block_data, Height height);
+		std::map<uint32_t, Height> m_segment_max_heights;  // prune segment when its highest block is deep enough
+		Height m_pruned_height = 0;
+		uint32_t m_pruned_first_segment = 0;  // in DB, files before it are removed when commit is durable
+		uint64_t m_pruned_first_segment_commit = 0;
+		void load_segment_max_heights(bool read_only);
+		uint32_t prune_block_segments();  // returns new first segment, writes it to DB
+		void migrate_blocks_to_segments();
 
 		void store_header(const Hash &bid, const api::BlockHeader &header);
 
@@ -32,15 +32,7 @@ LegacyBlockChainReader::LegacyBlockChainReader(const std::string &index_file_nam
 	}
 }
 
-LegacyBlockChainReader::~LegacyBlockChainReader() {
-	{
-		std::unique_lock<std::mutex> lock(mu);
-		quit = true;
-		have_work.notify_all();
-	}
-	if (th.joinable())
-		th.join();
-}
+LegacyBlockChainReader::~LegacyBlockChainReader() { prepare_token.cancel(); }
 
 void LegacyBlockChainReader::load_offsets() {
 	if (m_count == 0 || !m_offsets.empty())
@@ -74,53 +66,36 @@ BinaryArray LegacyBlockChainReader::get_block_data_by_index(Height i) {
 const size_t MAX_PRELOAD_BLOCKS     = 100;
 const size_t MAX_PRELOAD_TOTAL_SIZE = 50 * 1024 * 1024;
 
-void LegacyBlockChainReader::thread_run() {
-	while (true) {
-		Height to_load = 0;
-		{
-			std::unique_lock<std::mutex> lock(mu);
-			if (quit)
-				return;
-			if (next_load_height == 0)
-				next_load_height = last_load_height;
-			if (next_load_height > last_load_height + MAX_PRELOAD_BLOCKS ||
-			    total_prepared_data_size > MAX_PRELOAD_TOTAL_SIZE) {
-				have_work.wait(lock);
-				continue;
-			}
-			to_load = next_load_height++;
-		}
-		BinaryArray rba = get_block_data_by_index(to_load);
-		PreparedBlock pb(std::move(rba), nullptr);
-		{
-			std::unique_lock<std::mutex> lock(mu);
-			total_prepared_data_size += pb.block_data.size();
-			prepared_blocks[to_load] = std::move(pb);
-			prepared_blocks_ready.notify_all();
-		}
-	}
-}
-
 static size_t max_ps = 0;
 PreparedBlock LegacyBlockChainReader::get_prepared_block_by_index(Height i) {
 	load_offsets();
-	{
-		std::unique_lock<std::mutex> lock(mu);
-		if (!th.joinable())
-			th           = std::thread(&LegacyBlockChainReader::thread_run, this);
-		last_load_height = i;
-		have_work.notify_all();
+	// File is read here in order, only preparation is done by executor
+	next_load_height = std::max(next_load_height, i);
+	std::vector<common::Executor::Task> tasks;
+	while (next_load_height == i ||  // throws if i is out of range
+	       (next_load_height <= i + MAX_PRELOAD_BLOCKS && next_load_height + 1 < m_offsets.size() &&
+	           total_prepared_data_size <= MAX_PRELOAD_TOTAL_SIZE)) {
+		BinaryArray rba = get_block_data_by_index(next_load_height);
+		total_prepared_data_size += rba.size();
+		tasks.push_back([pbs = prepared_blocks, height = next_load_height, rba = std::move(rba)]() mutable {
+			PreparedBlock pb(std::move(rba), nullptr);
+			std::unique_lock<std::mutex> lock(pbs->mu);
+			pbs->blocks[height] = std::move(pb);
+			pbs->ready.notify_all();
+		});
+		next_load_height += 1;
 	}
+	common::Executor::instance().submit_batch(common::Executor::SYNC, prepare_token, std::move(tasks));
+	std::unique_lock<std::mutex> lock(prepared_blocks->mu);
 	while (true) {
-		std::unique_lock<std::mutex> lock(mu);
-		auto pit = prepared_blocks.find(i);
-		if (pit == prepared_blocks.end()) {
-			prepared_blocks_ready.wait(lock);
+		auto pit = prepared_blocks->blocks.find(i);
+		if (pit == prepared_blocks->blocks.end()) {
+			prepared_blocks->ready.wait(lock);
 			continue;
 		}
 		PreparedBlock result = std::move(pit->second);
-		pit                  = prepared_blocks.erase(pit);
-		max_ps               = std::max(max_ps, total_prepared_data_size);
+		prepared_blocks->blocks.erase(pit);
+		max_ps = std::max(max_ps, total_prepared_data_size);
 		total_prepared_data_size -= result.block_data.size();
 		return result;
 	}
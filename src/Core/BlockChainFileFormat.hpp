@@ -8,11 +8,13 @@
 
 #include <condition_variable>
 #include <cstdint>
+#include <memory>
+#include <mutex>
 #include <string>
-#include <thread>
 #include <vector>
 #include "BlockChain.hpp"
 #include "CryptoNote.hpp"
+#include "common/Executor.hpp"
 #include "platform/Files.hpp"
 
 namespace cryonerocoin {
@@ -26,17 +28,15 @@ class LegacyBlockChainReader {
 	std::vector<uint64_t> m_offsets;  
 	void load_offsets();
 
-	std::thread th;
-	std::mutex mu;
-	std::condition_variable have_work;
-	std::condition_variable prepared_blocks_ready;
-	bool quit = false;
-
-	std::map<Height, PreparedBlock> prepared_blocks;
-	size_t total_prepared_data_size = 0;
-	Height last_load_height         = 0;
+	struct PreparedBlocks {  // shared with executor tasks, which can outlive reader
+		std::mutex mu;
+		std::condition_variable ready;
+		std::map<Height, PreparedBlock> blocks;
+	};
+	std::shared_ptr<PreparedBlocks> prepared_blocks = std::make_shared<PreparedBlocks>();
+	common::CancelToken prepare_token;
+	size_t total_prepared_data_size = 0;  // blocks read but not yet taken
 	Height next_load_height         = 0;
-	void thread_run();
 
 public:
 	explicit LegacyBlockChainReader(const std::string &index_file_name, const std::string &item_file_name);
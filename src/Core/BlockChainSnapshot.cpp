@@ -0,0 +1,294 @@
+// Copyright (c) 2019, The Cryonero developers.
+// Licensed under the GNU Lesser General Public License. See LICENSE for details.
+
+#include "BlockChain.hpp"
+
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include "Config.hpp"
+#include "Currency.hpp"
+#include "common/StringTools.hpp"
+#include "common/MemoryStreams.hpp"
+#include "common/string.hpp"
+#include "crypto/crypto.hpp"
+#include "platform/PathTools.hpp"
+#include "seria/BinaryInputStream.hpp"
+#include "seria/BinaryOutputStream.hpp"
+
+using namespace cryonerocoin;
+using namespace platform;
+
+// State snapshot is a folder with manifest.bin, state_NNNNNN.dat files with DB records and block_segments/ with
+// block bodies. Every file is hashed in CHUNK_SIZE pieces, manifest keeps the hashes, so corrupted transfer is
+// detected before anything is written. Hash of manifest is printed as snapshot id for comparing out of band.
+static const size_t CHUNK_SIZE = 64 * 1024 * 1024;
+static const std::string MANIFEST_NAME = "manifest.bin";
+static const std::string SNAPSHOT_SEGMENTS_FOLDER = "block_segments";
+#if platform_USE_SQLITE
+static const std::string DB_BACKEND = "sqlite";  // integer keys and tables differ, so no import across backends
+#else
+static const std::string DB_BACKEND = "lmdb";
+#endif
+
+struct StateSnapshotTable {
+	std::string name;  // empty for default table
+	bool integer_key = false;
+};
+
+struct StateSnapshotFile {
+	std::string name;  // relative to snapshot folder
+	uint64_t size = 0;
+	std::vector<Hash> chunk_hashes;
+};
+
+struct StateSnapshotManifest {
+	std::string version;
+	std::string db_backend;
+	Hash genesis_bid;
+	Height tip_height = 0;
+	Hash tip_bid;
+	Height checkpoint_height = 0;
+	Hash checkpoint_bid;
+	Height pruned_height = 0;  // importer undoes to checkpoint, so bodies of blocks above it must be in snapshot
+	std::vector<StateSnapshotTable> tables;
+	std::vector<StateSnapshotFile> state_files;    // records are table index, key, value, all length-prefixed
+	std::vector<StateSnapshotFile> segment_files;  // in order, last one is cut at committed end
+};
+
+// Tables of BlockChainState in order of open_table. Export checks them against get_tables(), import rejects
+// manifest with other tables, so untrusted manifest cannot redirect records into wrong tables
+static const std::vector<StateSnapshotTable> STATE_TABLES{{"", false}, {"block_locations", false},
+    {"headers", false}, {"transactions", false}, {"tip_chain", true}, {"timestamps", false}, {"children", false},
+    {"tips", false}, {"undo", false}, {"keyimages", false}, {"amount_outputs", false}, {"global_indices", false}};
+
+static bool same_tables(const std::vector<StateSnapshotTable> &a, const std::vector<StateSnapshotTable> &b) {
+	if (a.size() != b.size())
+		return false;
+	for (size_t i = 0; i != a.size(); ++i)
+		if (a[i].name != b[i].name || a[i].integer_key != b[i].integer_key)
+			return false;
+	return true;
+}
+
+namespace seria {
+	void ser_members(StateSnapshotTable &v, ISeria &s) {
+		seria_kv("name", v.name, s);
+		seria_kv("integer_key", v.integer_key, s);
+	}
+	void ser_members(StateSnapshotFile &v, ISeria &s) {
+		seria_kv("name", v.name, s);
+		seria_kv("size", v.size, s);
+		seria_kv("chunk_hashes", v.chunk_hashes, s);
+	}
+	void ser_members(StateSnapshotManifest &v, ISeria &s) {
+		seria_kv("version", v.version, s);
+		seria_kv("db_backend", v.db_backend, s);
+		seria_kv("genesis_bid", v.genesis_bid, s);
+		seria_kv("tip_height", v.tip_height, s);
+		seria_kv("tip_bid", v.tip_bid, s);
+		seria_kv("checkpoint_height", v.checkpoint_height, s);
+		seria_kv("checkpoint_bid", v.checkpoint_bid, s);
+		seria_kv("pruned_height", v.pruned_height, s);
+		seria_kv("tables", v.tables, s);
+		seria_kv("state_files", v.state_files, s);
+		seria_kv("segment_files", v.segment_files, s);
+	}
+}
+
+static void write_snapshot_record(
+    common::IOutputStream &out, size_t table, const std::string &key, const std::string &value) {
+	common::write_varint(out, static_cast<uint64_t>(table));
+	common::write_varint(out, static_cast<uint64_t>(key.size()));
+	common::write(out, key);
+	common::write_varint(out, static_cast<uint64_t>(value.size()));
+	common::write(out, value);
+}
+
+static std::string read_snapshot_string(common::MemoryInputStream &in) {
+	const uint64_t size = common::read_varint<uint64_t>(in);
+	if (size > in.size())
+		throw std::runtime_error("State snapshot record corrupted");
+	std::string result;
+	common::read(in, result, static_cast<size_t>(size));
+	return result;
+}
+
+static StateSnapshotFile save_state_file(const std::string &folder, size_t index, const BinaryArray &data) {
+	char name[32] = {};
+	sprintf(name, "state_%06u.dat", static_cast<unsigned>(index));
+	if (!save_file(folder + "/" + name, data.data(), data.size()))
+		throw std::runtime_error("Failed to write state snapshot file " + folder + "/" + name);
+	StateSnapshotFile result;
+	result.name = name;
+	result.size = data.size();
+	for (size_t pos = 0; pos < data.size(); pos += CHUNK_SIZE)
+		result.chunk_hashes.push_back(crypto::cn_fast_hash(data.data() + pos, std::min(CHUNK_SIZE, data.size() - pos)));
+	return result;
+}
+
+// Reads file chunk by chunk, checking sizes and hashes against manifest. fun gets each chunk, can be empty
+static void read_snapshot_file(const std::string &folder, const StateSnapshotFile &file,
+    std::function<void(const BinaryArray &)> fun) {
+	const std::string path = folder + "/" + file.name;
+	FileStream stream(path, FileStream::READ_EXISTING);
+	if (stream.seek(0, SEEK_END) != file.size ||
+	    file.chunk_hashes.size() != (file.size + CHUNK_SIZE - 1) / CHUNK_SIZE)
+		throw std::runtime_error("State snapshot file " + path + " has wrong size");
+	stream.seek(0, SEEK_SET);
+	BinaryArray chunk;
+	for (size_t i = 0; i != file.chunk_hashes.size(); ++i) {
+		chunk.resize(static_cast<size_t>(std::min<uint64_t>(CHUNK_SIZE, file.size - i * CHUNK_SIZE)));
+		stream.read(chunk.data(), chunk.size());
+		if (crypto::cn_fast_hash(chunk.data(), chunk.size()) != file.chunk_hashes[i])
+			throw std::runtime_error("State snapshot file " + path + " is corrupted at chunk " + common::to_string(i));
+		if (fun)
+			fun(chunk);
+	}
+}
+
+void BlockChain::export_state(const std::string &folder) const {
+	StateSnapshotManifest manifest;
+	manifest.version     = version_current;
+	manifest.db_backend  = DB_BACKEND;
+	manifest.genesis_bid = m_genesis_bid;
+	manifest.tip_height  = m_tip_height;
+	manifest.tip_bid     = m_tip_bid;
+	std::tie(manifest.checkpoint_height, manifest.checkpoint_bid) = m_currency.last_sw_checkpoint();
+	Hash bid;
+	if (manifest.checkpoint_height == 0)
+		throw std::runtime_error("No checkpoints in this currency, nothing to verify state snapshot against");
+	if (!read_chain(manifest.checkpoint_height, &bid) || bid != manifest.checkpoint_bid)
+		throw std::runtime_error("Blockchain does not contain last checkpoint at height " +
+		                         common::to_string(manifest.checkpoint_height) + " yet, sync further before exporting");
+	manifest.pruned_height = m_pruned_height;
+	if (manifest.pruned_height > manifest.checkpoint_height)
+		throw std::runtime_error("Block bodies below height " + common::to_string(manifest.pruned_height) +
+		                         " are pruned, importer needs them above last checkpoint at height " +
+		                         common::to_string(manifest.checkpoint_height) + ", export from unpruned node");
+	if (!create_folder_if_necessary(folder) || !create_folder_if_necessary(folder + "/" + SNAPSHOT_SEGMENTS_FOLDER))
+		throw std::runtime_error("Failed to create folder " + folder);
+
+	const auto tables = m_db.get_tables();
+	for (auto &&table : tables)
+		manifest.tables.push_back(StateSnapshotTable{m_db.get_table_name(table), m_db.is_integer_key(table)});
+	if (!same_tables(manifest.tables, STATE_TABLES))
+		throw std::runtime_error("Blockchain database tables differ from tables of state snapshot, cannot export");
+	BinaryArray chunk;
+	common::VectorOutputStream chunk_stream(chunk);
+	for (size_t ti = 0; ti != tables.size(); ++ti) {
+		for (auto cur = m_db.begin(tables[ti], std::string()); !cur.end(); cur.next()) {
+			write_snapshot_record(chunk_stream, ti, cur.get_suffix(), cur.get_value_string());
+			if (chunk.size() < CHUNK_SIZE)
+				continue;
+			manifest.state_files.push_back(save_state_file(folder, manifest.state_files.size(), chunk));
+			chunk.clear();
+			std::cout << "Exported " << manifest.state_files.size() << " state files..." << std::endl;
+		}
+	}
+	if (!chunk.empty())
+		manifest.state_files.push_back(save_state_file(folder, manifest.state_files.size(), chunk));
+	// DB read txn is consistent and segments are append-only, so bytes up to committed end are exactly what DB
+	// references, even if daemon keeps appending while we copy
+	const SegmentedFile::Position end = m_block_segments.get_end();
+	for (uint32_t segment = m_block_segments.get_first_segment(); segment <= end.segment; ++segment) {
+		const std::string path = m_block_segments.segment_path(segment);
+		const std::string name = SNAPSHOT_SEGMENTS_FOLDER + "/" + get_filename_without_folder(path);
+		FileStream src(path, FileStream::READ_EXISTING);
+		const uint64_t size = segment == end.segment ? end.offset : src.seek(0, SEEK_END);
+		FileStream dst(folder + "/" + name, FileStream::TRUNCATE_READ_WRITE);
+		StateSnapshotFile file;
+		file.name = name;
+		file.size = size;
+		for (uint64_t pos = 0; pos < size; pos += CHUNK_SIZE) {
+			chunk.resize(static_cast<size_t>(std::min<uint64_t>(CHUNK_SIZE, size - pos)));
+			src.read_at(pos, chunk.data(), chunk.size());
+			dst.write(chunk.data(), chunk.size());
+			file.chunk_hashes.push_back(crypto::cn_fast_hash(chunk.data(), chunk.size()));
+		}
+		dst.fsync();
+		manifest.segment_files.push_back(std::move(file));
+		std::cout << "Exported block segment " << segment << " of " << end.segment << std::endl;
+	}
+	const BinaryArray manifest_data = seria::to_binary(manifest);
+	if (!save_file(folder + "/" + MANIFEST_NAME, manifest_data.data(), manifest_data.size()))
+		throw std::runtime_error("Failed to write state snapshot file " + folder + "/" + MANIFEST_NAME);
+	std::cout << "Exported state at height " << manifest.tip_height << ", checkpoint height "
+	          << manifest.checkpoint_height << ", snapshot id "
+	          << crypto::cn_fast_hash(manifest_data.data(), manifest_data.size()) << std::endl;
+}
+
+std::pair<Height, Hash> BlockChain::import_state(
+    const std::string &folder, const Hash &snapshot_id, const Config &config, const Currency &currency) {
+	BinaryArray manifest_data;
+	if (!load_file(folder + "/" + MANIFEST_NAME, manifest_data))
+		throw std::runtime_error("Failed to read state snapshot manifest " + folder + "/" + MANIFEST_NAME);
+	// Chunk hashes only protect transfer, state tables are trusted, so manifest must be the one user expects
+	const Hash manifest_hash = crypto::cn_fast_hash(manifest_data.data(), manifest_data.size());
+	if (manifest_hash != snapshot_id)
+		throw std::runtime_error("State snapshot id " + common::pod_to_hex(manifest_hash) + " differs from expected " +
+		                         common::pod_to_hex(snapshot_id));
+	StateSnapshotManifest manifest;
+	seria::from_binary(manifest, manifest_data);
+	std::cout << "Importing state at height " << manifest.tip_height << ", snapshot id " << manifest_hash
+	          << std::endl;
+	bool is_sw_checkpoint = false;
+	if (manifest.version != version_current || manifest.db_backend != DB_BACKEND)
+		throw std::runtime_error("State snapshot has version " + manifest.version + " of " + manifest.db_backend +
+		                         " database, expected " + version_current + " of " + DB_BACKEND);
+	if (manifest.genesis_bid != currency.genesis_block_hash)
+		throw std::runtime_error("State snapshot is of different currency or network");
+	if (manifest.checkpoint_height == 0 || manifest.checkpoint_height > manifest.tip_height ||
+	    !currency.check_sw_checkpoint(manifest.checkpoint_height, manifest.checkpoint_bid, is_sw_checkpoint) ||
+	    !is_sw_checkpoint)
+		throw std::runtime_error("State snapshot is not at any known checkpoint");
+	if (manifest.pruned_height > manifest.checkpoint_height)
+		throw std::runtime_error("State snapshot has block bodies pruned up to height " +
+		                         common::to_string(manifest.pruned_height) + ", cannot undo to checkpoint at height " +
+		                         common::to_string(manifest.checkpoint_height));
+	if (!same_tables(manifest.tables, STATE_TABLES))
+		throw std::runtime_error("State snapshot has unexpected tables");
+	for (auto &&file : manifest.state_files)
+		read_snapshot_file(folder, file, nullptr);
+	for (auto &&file : manifest.segment_files)
+		read_snapshot_file(folder, file, nullptr);
+	std::cout << "Verified checksums of " << manifest.state_files.size() << " state files and "
+	          << manifest.segment_files.size() << " block segments" << std::endl;
+
+	DB db(false, config.get_data_folder() + "/blockchain");
+	if (!db.begin(std::string()).end())
+		throw std::runtime_error("Blockchain database " + db.get_path() + " is not empty, delete it before import");
+	std::vector<DB::Table> tables;
+	for (auto &&table : manifest.tables)
+		tables.push_back(table.name.empty() ? DB::Table() : db.open_table(table.name, table.integer_key));
+	const std::string segments_folder = config.get_data_folder() + "/block_segments";
+	if (!create_folder_if_necessary(segments_folder))
+		throw std::runtime_error("Failed to create folder " + segments_folder);
+	for (auto &&file : manifest.segment_files)
+		if (!copy_file(folder + "/" + file.name, segments_folder + "/" + get_filename_without_folder(file.name)))
+			throw std::runtime_error("Failed to copy " + folder + "/" + file.name);
+	// Default table has $version, so it is written in the last commit, DB of interrupted import is not valid
+	std::vector<std::pair<std::string, std::string>> default_records;
+	BinaryArray data;
+	for (auto &&file : manifest.state_files) {
+		data.clear();  // records span chunks, so whole file is read, it is only slightly larger than CHUNK_SIZE
+		read_snapshot_file(folder, file, [&](const BinaryArray &chunk) { common::append(data, chunk.begin(), chunk.end()); });
+		common::MemoryInputStream in(data.data(), data.size());
+		while (!in.empty()) {
+			const uint64_t ti = common::read_varint<uint64_t>(in);
+			if (ti >= tables.size())
+				throw std::runtime_error("State snapshot record corrupted in " + file.name);
+			const std::string key   = read_snapshot_string(in);
+			const std::string value = read_snapshot_string(in);
+			if (manifest.tables[ti].name.empty())
+				default_records.emplace_back(key, value);
+			else
+				db.put(tables[ti], key, value, true);
+		}
+		db.commit_db_txn();
+	}
+	for (auto &&kv : default_records)
+		db.put(kv.first, kv.second, true);
+	db.commit_db_txn();
+	return std::make_pair(manifest.checkpoint_height, manifest.checkpoint_bid);
+}
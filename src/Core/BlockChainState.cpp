@@ -19,11 +19,6 @@
 #include "seria/BinaryInputStream.hpp"
 #include "seria/BinaryOutputStream.hpp"
 
-static const std::string KEYIMAGE_PREFIX = "i";
-static const std::string AMOUNT_OUTPUT_PREFIX = "a";
-static const std::string BLOCK_GLOBAL_INDICES_PREFIX = "b";
-static const std::string BLOCK_GLOBAL_INDICES_SUFFIX = "g";
-
 static const std::string UNLOCK_BLOCK_PREFIX = "u";
 static const std::string UNLOCK_TIME_PREFIX = "U";
 
@@ -188,14 +183,19 @@ static std::string validate_semantic(bool generating, const Transaction &tx, uin
 }
 
 BlockChainState::BlockChainState(logging::ILogger &log, const Config &config, const Currency &currency, bool read_only)
-	: BlockChain(log, config, currency, read_only), log_redo_block_timestamp(std::chrono::steady_clock::now()) {
+	: BlockChain(log, config, currency, read_only)
+	, m_keyimages_table(m_db.open_table("keyimages"))
+	, m_amount_outputs_table(m_db.open_table("amount_outputs"))
+	, m_global_indices_table(m_db.open_table("global_indices"))
+	, m_index_outputs_in_memory(config.index_outputs_in_memory)
+	, log_redo_block_timestamp(std::chrono::steady_clock::now()) {
 
 
 
 
 	std::string version;
 	m_db.get("$version", version);
-	if (version == "B" || version == "1" || version == "2" || version == "3" || version == "4") {
+	if (version == "B" || version == "1" || version == "2" || version == "3" || version == "4" || version == "5") {
 		start_internal_import();
 		version = version_current;
 		m_db.put("$version", version, false);
@@ -204,6 +204,12 @@ BlockChainState::BlockChainState(logging::ILogger &log, const Config &config, co
 	if (version != version_current)
 		throw std::runtime_error("Blockchain database format unknown (version=" + version + "), please delete " +
 			config.get_data_folder() + "/blockchain");
+	if (!read_only) {
+		load_filter(m_transactions_filter, "transactions", m_transactions_table);
+		load_filter(m_keyimages_filter, "keyimages", m_keyimages_table);
+	}
+	if (m_index_outputs_in_memory)
+		build_outputs_index();
 	if (get_tip_height() == (Height)-1) {
 		Block genesis_block;
 		genesis_block.header = currency.genesis_block_template;
@@ -214,11 +220,47 @@ BlockChainState::BlockChainState(logging::ILogger &log, const Config &config, co
 		invariant(add_block(pb, &info, std::string()) != BroadcastAction::BAN, "Genesis block failed to add");
 	}
 	BlockChainState::tip_changed();
+	if (!read_only)
+		m_db.commit_db_txn();  // tables opened by txn are visible to snapshots only after it commits
+	m_committed_tip_height = get_tip_height();
 	m_log(logging::INFO) << "BlockChainState::BlockChainState height=" << get_tip_height()
 		<< " cumulative_difficulty=" << get_tip_cumulative_difficulty() << " bid=" << get_tip_bid()
 		<< std::endl;
 }
 
+BlockChainState::~BlockChainState() { save_filter(m_keyimages_filter, "keyimages"); }
+
+void BlockChainState::build_outputs_index() {
+	m_log(logging::INFO) << "Building in-memory outputs index, can take several minutes..." << std::endl;
+	m_outputs_index.clear();
+	size_t total_count = 0;
+	for (DB::Cursor cur = m_db.begin(m_amount_outputs_table, std::string()); !cur.end(); cur.next()) {
+		invariant(cur.get_suffix().size() == sizeof(Amount) + sizeof(uint32_t), "amount outputs table corrupted");
+		Amount amount = from_be_key(cur.get_suffix(), 0, sizeof(Amount));
+		auto global_index = from_be_key(cur.get_suffix(), sizeof(Amount), sizeof(uint32_t));
+		UnlockTimePublickKeyHeightSpent unp;
+		seria::from_binary(unp, cur.get_value_array());
+		auto &columns = m_outputs_index[amount];
+		invariant(global_index == columns.heights.size(), "amount outputs table has gaps");
+		columns.public_keys.push_back(unp.public_key);
+		columns.unlock_times.push_back(unp.unlock_time);
+		columns.heights.push_back(unp.height);
+		columns.spent.push_back(unp.spent);
+		total_count += 1;
+	}
+	m_log(logging::INFO) << "Built in-memory outputs index, amounts=" << m_outputs_index.size()
+	                     << " outputs=" << total_count << std::endl;
+}
+
+void BlockChainState::rebuild_filters_if_needed() {
+	BlockChain::rebuild_filters_if_needed();
+	if (m_keyimages_filter.is_built() && m_keyimages_filter.get_count() >= m_keyimages_filter.get_capacity())
+		rebuild_filter(m_keyimages_filter, "keyimages", m_keyimages_table);
+#if cryonero_CHECK_FILTERS
+	check_filter(m_keyimages_filter, "keyimages", m_keyimages_table);
+#endif
+}
+
 std::string BlockChainState::check_standalone_consensus(
 	const PreparedBlock &pb, api::BlockHeader *info, const api::BlockHeader &prev_info, bool check_pow) const {
 	const auto &block = pb.block;
@@ -355,8 +397,9 @@ std::string BlockChainState::check_standalone_consensus(
 	else {
 		if (!check_pow)
 			return std::string();
-		Hash long_hash = pb.long_block_hash != Hash{} ? pb.long_block_hash
-			: get_block_long_hash(block.header, m_hash_crypto_context);
+		Hash long_hash = pb.long_block_hash;
+		if (long_hash == Hash{})  // mined blocks and blocks prepared without PoW
+			long_hash = get_block_long_hash(block.header, *crypto::CryptoNightContextPool::instance().acquire(1));
 		if (!m_currency.check_proof_of_work(long_hash, block.header, info->difficulty))
 			return "PROOF_OF_WORK_TOO_WEAK";
 	}
@@ -386,8 +429,63 @@ void BlockChainState::calculate_consensus_values(const api::BlockHeader &prev_in
 	}
 }
 
+template<class T>
+void BlockChainState::move_window(ConsensusWindow<T> *window, Height first, T ChainHeader::*field) const {
+	const Height end = get_tip_height() + 1;
+	while (!window->blocks.empty()) {  // after undo or reorg
+		const Height last = window->first + static_cast<Height>(window->blocks.size()) - 1;
+		Hash bid;
+		if (last < end && read_chain(last, &bid) && bid == window->blocks.back().first)
+			break;  // then all blocks before are in main chain too
+		window->values.erase(window->blocks.back().second);
+		window->blocks.pop_back();
+	}
+	for (; !window->blocks.empty() && window->first < first; window->first += 1) {
+		window->values.erase(window->blocks.front().second);
+		window->blocks.pop_front();
+	}
+	if (window->blocks.empty())
+		window->first = first;
+	Hash bid;
+	for (; window->first > first; window->first -= 1) {
+		const Height height = window->first - 1;
+		invariant(read_chain(height, &bid), "main chain header not found");
+		window->blocks.emplace_front(bid, get_chain_header(height).*field);
+		window->values.insert(get_chain_header(height).*field);
+	}
+	while (window->first + window->blocks.size() < end) {
+		const Height height = window->first + static_cast<Height>(window->blocks.size());
+		invariant(read_chain(height, &bid), "main chain header not found");
+		window->blocks.emplace_back(bid, get_chain_header(height).*field);
+		window->values.insert(get_chain_header(height).*field);
+	}
+}
+
+// Same windows as calculate_consensus_values(get_tip(), ...), which is too slow to call for every block
 void BlockChainState::tip_changed() {
-	calculate_consensus_values(get_tip(), &m_next_median_size, &m_next_median_timestamp);
+	const Height end           = get_tip_height() + 1;
+	const Height sizes_count   = std::min(m_currency.reward_blocks_window, end);
+	const Height ts_window     = m_currency.get_timestamp_check_window(end);
+	const Height ts_count      = std::min(ts_window, end - 1);
+	move_window(&m_sizes_window, end - sizes_count, &ChainHeader::block_size);
+	move_window(&m_timestamps_window, end - ts_count, &ChainHeader::timestamp);
+	m_next_median_size      = m_sizes_window.values.median();
+	m_next_median_timestamp = ts_count >= ts_window ? m_timestamps_window.values.median() : 0;
+#if cryonero_CHECK_CONSENSUS_WINDOWS  // differential check, very slow
+	uint32_t median_size       = 0;
+	Timestamp median_timestamp = 0;
+	calculate_consensus_values(get_tip(), &median_size, &median_timestamp);
+	invariant(median_size == m_next_median_size && median_timestamp == m_next_median_timestamp,
+	    "incremental consensus windows differ from calculate_consensus_values");
+	for (Height height = end - sizes_count; height != end; ++height) {  // compact chain headers against stored ones
+		Hash bid;
+		api::BlockHeader header;
+		invariant(read_chain(height, &bid) && read_header(bid, &header) && header.timestamp == get_chain_header(height).timestamp &&
+		              header.block_size == get_chain_header(height).block_size &&
+		              header.cumulative_difficulty == get_chain_header(height).cumulative_difficulty,
+		    "chain header differs from stored header");
+	}
+#endif
 }
 
 bool BlockChainState::create_mining_block_template(BlockTemplate *b, const AccountPublicAddress &adr,
@@ -396,26 +494,6 @@ bool BlockChainState::create_mining_block_template(BlockTemplate *b, const Accou
 	*height = get_tip_height() + 1;
 	*b = BlockTemplate{};
 	b->major_version = m_currency.get_block_major_version_for_height(*height);
-	{
-		std::vector<Timestamp> timestamps;
-		std::vector<Difficulty> difficulties;
-		Height blocks_count = std::min(get_tip_height(), m_currency.get_difficulty_blocks_count(get_tip_height() + 1));
-		timestamps.reserve(blocks_count);
-		difficulties.reserve(blocks_count);
-		auto timestamps_window = get_tip_segment(get_tip(), blocks_count, false);
-		for (auto it = timestamps_window.begin(); it != timestamps_window.end(); ++it) {
-			timestamps.push_back(it->timestamp);
-			difficulties.push_back(it->cumulative_difficulty);
-		}
-		*difficulty = m_currency.next_difficulty(*height, timestamps, difficulties);
-	}
-	if (*difficulty == 0) {
-		m_log(logging::ERROR) << "difficulty overhead in create_mining_block_template." << std::endl;
-		return false;
-	}
-
-
-
 	if (b->major_version == 1) {
 		b->minor_version = m_currency.upgrade_height_v2 == Height(-1) ? 1 : 0;
 	}
@@ -440,7 +518,8 @@ bool BlockChainState::create_mining_block_template(BlockTemplate *b, const Accou
 	}
 
 	b->previous_block_hash = get_tip_bid();
-	b->timestamp = std::max(platform::now_unix_timestamp(), m_next_median_timestamp);
+	// Pool admitted transactions unlocked at tip timestamp, block is validated at its own, so never go below tip
+	b->timestamp = std::max(std::max(platform::now_unix_timestamp(), m_next_median_timestamp), get_tip().timestamp);
 
 	auto next_block_granted_full_reward_zone =
 		m_currency.block_granted_full_reward_zone_by_block_version(b->major_version);
@@ -451,42 +530,32 @@ bool BlockChainState::create_mining_block_template(BlockTemplate *b, const Accou
 	auto max_cumulative_size = m_currency.max_block_cumulative_size(*height);
 	max_total_size = std::min(max_total_size, max_cumulative_size) - m_currency.miner_tx_blob_reserved_size;
 
-	std::vector<Hash> pool_hashes;
-	for (auto &&msf : m_memory_state_fee_tx)
-		for (auto &&ha : msf.second)
-			pool_hashes.push_back(ha);
-	size_t txs_size = 0;
-	Amount fee = 0;
-	DeltaState memory_state(*height, b->timestamp, this);  // will be get_tip().timestamp_unlock after fork
-
-
-	for (; !pool_hashes.empty(); pool_hashes.pop_back()) {
-		auto tit = m_memory_state_tx.find(pool_hashes.back());
-		if (tit == m_memory_state_tx.end()) {
-			m_log(logging::ERROR) << "Transaction " << pool_hashes.back() << " is in pool index, but not in pool";
-			assert(false);
-			continue;
-		}
-		const size_t block_size_limit = max_total_size;
-		const size_t tx_size = tit->second.binary_tx.size();
-		if (txs_size + tx_size > block_size_limit)
-			continue;
-		Amount single_fee = tit->second.fee;
-		BlockGlobalIndices global_indices;
-		Height conflict_height = 0;
-		const std::string result =
-			redo_transaction_get_error(false, tit->second.tx, &memory_state, &global_indices, &conflict_height, true);
-		if (!result.empty()) {
-			m_log(logging::ERROR) << "Transaction " << tit->first
-				<< " is in pool, but could not be redone result=" << result << std::endl;
-			continue;
+	update_mining_template(max_total_size);
+	*difficulty = m_mining_template.difficulty;
+	if (*difficulty == 0) {
+		m_log(logging::ERROR) << "difficulty overhead in create_mining_block_template." << std::endl;
+		return false;
+	}
+	b->transaction_hashes = m_mining_template.transaction_hashes;
+	const size_t txs_size = m_mining_template.txs_size;
+	const Amount fee      = m_mining_template.fee;
+#if cryonero_CHECK_MINING_TEMPLATE  // differential check against redo of selection made from scratch, slow
+	{
+		DeltaState memory_state(*height, b->timestamp, this);  // same height and timestamp redo_block will use
+		for (auto &&tid : b->transaction_hashes) {
+			BlockGlobalIndices global_indices;
+			Height conflict_height = 0;
+			invariant(redo_transaction_get_error(false, m_memory_state_tx.at(tid).tx, &memory_state, &global_indices,
+			              &conflict_height, true).empty(), "mining template transaction could not be redone");
 		}
-		txs_size += tx_size;
-		fee += single_fee;
-		b->transaction_hashes.emplace_back(tit->first);
-		m_mining_transactions.insert(std::make_pair(tit->first, std::make_pair(tit->second.binary_tx, *height)));
-		m_log(logging::TRACE) << "Transaction " << tit->first << " included to block template";
+		const auto cached        = m_mining_template;
+		m_mining_template.valid = false;
+		update_mining_template(max_total_size);
+		invariant(cached.transaction_set == m_mining_template.transaction_set && cached.txs_size == txs_size &&
+		              m_mining_template.txs_size == txs_size && m_mining_template.fee == fee,
+		    "incremental mining template differs from selection from scratch");
 	}
+#endif
 
 
 	bool r = m_currency.construct_miner_tx(b->major_version, *height, effective_size_median, already_generated_coins,
@@ -591,6 +660,90 @@ BroadcastAction BlockChainState::add_mined_block(
 	return add_block(pb, info, "json_rpc");
 }
 
+// Block removes its transactions one by one, erasing each from vector would be quadratic
+static void compact_mining_template_hashes(std::vector<Hash> *hashes, const std::unordered_set<Hash> &set) {
+	if (hashes->size() == set.size())
+		return;
+	hashes->erase(std::remove_if(hashes->begin(), hashes->end(), [&](const Hash &tid) { return set.count(tid) == 0; }),
+	    hashes->end());
+}
+
+void BlockChainState::update_mining_template(size_t max_total_size) const {
+	auto &mt = m_mining_template;
+	if (mt.tip_bid != get_tip_bid() || mt.difficulty == 0) {
+		std::vector<Timestamp> timestamps;
+		std::vector<Difficulty> difficulties;
+		Height blocks_count = std::min(get_tip_height(), m_currency.get_difficulty_blocks_count(get_tip_height() + 1));
+		timestamps.reserve(blocks_count);
+		difficulties.reserve(blocks_count);
+		auto timestamps_window = get_tip_segment(get_tip(), blocks_count, false);
+		for (auto it = timestamps_window.begin(); it != timestamps_window.end(); ++it) {
+			timestamps.push_back(it->timestamp);
+			difficulties.push_back(it->cumulative_difficulty);
+		}
+		mt.difficulty = m_currency.next_difficulty(get_tip_height() + 1, timestamps, difficulties);
+		mt.tip_bid    = get_tip_bid();
+	}
+	if (mt.valid && mt.max_total_size != max_total_size)  // median moved
+		mt.valid = mt.complete && mt.txs_size <= max_total_size;
+	mt.max_total_size = max_total_size;
+	if (mt.valid) {
+		compact_mining_template_hashes(&mt.transaction_hashes, mt.transaction_set);
+		return;
+	}
+	std::unordered_set<Hash> previous_set;
+	std::swap(previous_set, mt.transaction_set);
+	mt.transaction_hashes.clear();
+	mt.txs_size = 0;
+	mt.fee      = 0;
+	mt.complete = true;
+	for (auto fit = m_memory_state_fee_tx.rbegin(); fit != m_memory_state_fee_tx.rend(); ++fit)
+		for (auto hit = fit->second.rbegin(); hit != fit->second.rend(); ++hit) {
+			const PoolTransaction &ptx = m_memory_state_tx.at(*hit);
+			if (mt.txs_size + ptx.binary_tx.size() > max_total_size) {
+				mt.complete = false;
+				continue;
+			}
+			mt.transaction_hashes.push_back(*hit);
+			mt.transaction_set.insert(*hit);
+			mt.txs_size += ptx.binary_tx.size();
+			mt.fee += ptx.fee;
+		}
+	mt.valid = true;
+	// miners can still submit blocks with transactions displaced from previous template, even after they leave pool
+	for (auto &&tid : previous_set)
+		if (mt.transaction_set.count(tid) == 0 && m_mining_transactions.count(tid) == 0)
+			m_mining_transactions.insert(
+			    std::make_pair(tid, std::make_pair(m_memory_state_tx.at(tid).binary_tx, get_tip_height() + 1)));
+}
+
+void BlockChainState::mining_template_add(const Hash &tid, const PoolTransaction &ptx) {
+	auto &mt = m_mining_template;
+	if (!mt.valid)
+		return;
+	if (!mt.complete || mt.txs_size + ptx.binary_tx.size() > mt.max_total_size) {
+		mt.valid = false;  // could displace cheaper transactions
+		return;
+	}
+	compact_mining_template_hashes(&mt.transaction_hashes, mt.transaction_set);  // tid can be there as removed
+	mt.transaction_hashes.push_back(tid);
+	mt.transaction_set.insert(tid);
+	mt.txs_size += ptx.binary_tx.size();
+	mt.fee += ptx.fee;
+}
+
+void BlockChainState::mining_template_remove(const Hash &tid, const PoolTransaction &ptx) {
+	auto &mt = m_mining_template;
+	if (mt.transaction_set.erase(tid) == 0)
+		return;  // greedy selection does not depend on transactions which did not fit
+	// miners can still submit blocks with it
+	m_mining_transactions.insert(std::make_pair(tid, std::make_pair(ptx.binary_tx, get_tip_height() + 1)));
+	mt.txs_size -= ptx.binary_tx.size();
+	mt.fee -= ptx.fee;
+	if (!mt.complete)
+		mt.valid = false;  // skipped transaction can fit now
+}
+
 void BlockChainState::clear_mining_transactions() const {
 	for (auto tit = m_mining_transactions.begin(); tit != m_mining_transactions.end();)
 		if (get_tip_height() > tit->second.second + 3)  // Remember txs for 3 blocks
@@ -613,7 +766,18 @@ Amount BlockChainState::minimum_pool_fee_per_byte(Hash *minimal_tid) const {
 void BlockChainState::on_reorganization(
 	const std::map<Hash, std::pair<Transaction, BinaryArray>> &undone_transactions, bool undone_blocks) {
 	Height conflict_height = 0;
+	std::vector<const Transaction *> batch;
+	for (auto &&ud : undone_transactions)
+		batch.push_back(&ud.second.first);
+	for (auto &&msf : m_memory_state_tx)
+		if (undone_blocks)
+			batch.push_back(&msf.second.tx);
+	if (!batch.empty())
+		ring_checker.check_batch(this, batch);
 	if (undone_blocks) {
+		for (auto &&msf : m_memory_state_tx)
+			mining_template_remove(msf.first, msf.second);
+		m_mining_template.valid = false;
 		PoolTransMap old_memory_state_tx;
 		std::swap(old_memory_state_tx, m_memory_state_tx);
 		m_memory_state_ki_tx.clear();
@@ -631,6 +795,11 @@ void BlockChainState::on_reorganization(
 	m_tx_pool_version = 2;  // add_transaction will erroneously increase
 }
 
+void BlockChainState::check_transactions_batch(const std::vector<const Transaction *> &transactions) const {
+	if (transactions.size() > 1)  // single transaction is faster to check inline
+		ring_checker.check_batch(this, transactions);
+}
+
 AddTransactionResult BlockChainState::add_transaction(const Hash &tid, const Transaction &tx,
 	const BinaryArray &binary_tx, Timestamp now, Height *conflict_height, const std::string &source_address) {
 
@@ -638,21 +807,26 @@ AddTransactionResult BlockChainState::add_transaction(const Hash &tid, const Tra
 		tid, tx, binary_tx, get_tip_height() + 1, get_tip().timestamp, conflict_height, true, source_address);
 }
 
-AddTransactionResult BlockChainState::add_transaction(const Hash &tid, const Transaction &tx,
-	const BinaryArray &binary_tx, Height unlock_height, Timestamp unlock_timestamp, Height *conflict_height,
-	bool check_sigs, const std::string &source_address) {
+bool BlockChainState::precheck_transaction(const Hash &tid, const Transaction &tx, size_t binary_size,
+	Height *conflict_height, AddTransactionResult *result) const {
+	return precheck_transaction(tid, tx, binary_size, conflict_height, true, result);
+}
+
+bool BlockChainState::precheck_transaction(const Hash &tid, const Transaction &tx, size_t binary_size,
+	Height *conflict_height, bool check_sigs, AddTransactionResult *result) const {
 	if (m_memory_state_tx.count(tid) != 0) {
-		return AddTransactionResult::ALREADY_IN_POOL;
+		*result = AddTransactionResult::ALREADY_IN_POOL;
+		return false;
 	}
-	const size_t my_size = binary_tx.size();
 	const Amount my_fee = cryonerocoin::get_tx_fee(tx);
-	const Amount my_fee_per_byte = my_fee / my_size;
+	const Amount my_fee_per_byte = my_fee / binary_size;
 	Hash minimal_tid;
 	Amount minimal_fee = minimum_pool_fee_per_byte(&minimal_tid);
-	if (m_memory_state_total_size >= MAX_POOL_SIZE && my_fee_per_byte < minimal_fee)
-		return AddTransactionResult::INCREASE_FEE;
-	if (m_memory_state_total_size >= MAX_POOL_SIZE && my_fee_per_byte == minimal_fee && tid < minimal_tid)
-		return AddTransactionResult::INCREASE_FEE;
+	if (m_memory_state_total_size >= MAX_POOL_SIZE && (my_fee_per_byte < minimal_fee ||
+		(my_fee_per_byte == minimal_fee && tid < minimal_tid))) {
+		*result = AddTransactionResult::INCREASE_FEE;
+		return false;
+	}
 	for (const auto &input : tx.inputs) {
 		if (input.type() == typeid(KeyInput)) {
 			const KeyInput &in = boost::get<KeyInput>(input);
@@ -661,10 +835,10 @@ AddTransactionResult BlockChainState::add_transaction(const Hash &tid, const Tra
 				continue;
 			const PoolTransaction &other_tx = m_memory_state_tx.at(tit->second);
 			const Amount other_fee_per_byte = other_tx.fee_per_byte();
-			if (my_fee_per_byte < other_fee_per_byte)
-				return AddTransactionResult::INCREASE_FEE;
-			if (my_fee_per_byte == other_fee_per_byte && tid < tit->second)
-				return AddTransactionResult::INCREASE_FEE;
+			if (my_fee_per_byte < other_fee_per_byte || (my_fee_per_byte == other_fee_per_byte && tid < tit->second)) {
+				*result = AddTransactionResult::INCREASE_FEE;
+				return false;
+			}
 			break;  // Can displace another transaction from the pool, Will have to make heavy-lifting for this tx
 		}
 	}
@@ -672,8 +846,8 @@ AddTransactionResult BlockChainState::add_transaction(const Hash &tid, const Tra
 		if (input.type() == typeid(KeyInput)) {
 			const KeyInput &in = boost::get<KeyInput>(input);
 			if (read_keyimage(in.key_image, conflict_height)) {
-
-				return AddTransactionResult::OUTPUT_ALREADY_SPENT;  // Already spent in main chain
+				*result = AddTransactionResult::OUTPUT_ALREADY_SPENT;  // Already spent in main chain
+				return false;
 			}
 		}
 	}
@@ -682,8 +856,30 @@ AddTransactionResult BlockChainState::add_transaction(const Hash &tid, const Tra
 	if (!validate_result.empty()) {
 		m_log(logging::WARNING) << "add_transaction validation failed " << validate_result << " in transaction " << tid
 			<< std::endl;
-		return AddTransactionResult::BAN;
+		*result = AddTransactionResult::BAN;
+		return false;
 	}
+	if (my_fee != my_fee3)
+		m_log(logging::ERROR) << "Inconsistent fees " << my_fee << ", " << my_fee3 << " in transaction " << tid
+		<< std::endl;
+	return true;
+}
+
+AddTransactionResult BlockChainState::add_transaction(const Hash &tid, const Transaction &tx,
+	const BinaryArray &binary_tx, Height unlock_height, Timestamp unlock_timestamp, Height *conflict_height,
+	bool check_sigs, const std::string &source_address) {
+	AddTransactionResult result = AddTransactionResult::BROADCAST_ALL;
+	if (!precheck_transaction(tid, tx, binary_tx.size(), conflict_height, check_sigs, &result))
+		return result;
+	return add_prechecked_transaction(tid, tx, binary_tx, unlock_height, unlock_timestamp, conflict_height, check_sigs);
+}
+
+AddTransactionResult BlockChainState::add_prechecked_transaction(const Hash &tid, const Transaction &tx,
+	const BinaryArray &binary_tx, Height unlock_height, Timestamp unlock_timestamp, Height *conflict_height,
+	bool check_sigs) {
+	const size_t my_size = binary_tx.size();
+	const Amount my_fee = cryonerocoin::get_tx_fee(tx);
+	const Amount my_fee_per_byte = my_fee / my_size;
 	DeltaState memory_state(unlock_height, unlock_timestamp, this);
 	BlockGlobalIndices global_indices;
 	const std::string redo_result =
@@ -694,9 +890,6 @@ AddTransactionResult BlockChainState::add_transaction(const Hash &tid, const Tra
 			<< std::endl;
 		return AddTransactionResult::FAILED_TO_REDO;  // Not a ban because reorg can change indices
 	}
-	if (my_fee != my_fee3)
-		m_log(logging::ERROR) << "Inconsistent fees " << my_fee << ", " << my_fee3 << " in transaction " << tid
-		<< std::endl;
 
 	for (auto &&ki : memory_state.get_keyimages()) {
 		auto tit = m_memory_state_ki_tx.find(ki.first);
@@ -705,9 +898,9 @@ AddTransactionResult BlockChainState::add_transaction(const Hash &tid, const Tra
 		const PoolTransaction &other_tx = m_memory_state_tx.at(tit->second);
 		const Amount other_fee_per_byte = other_tx.fee_per_byte();
 		if (my_fee_per_byte < other_fee_per_byte)
-			return AddTransactionResult::INCREASE_FEE;  // Never because checked above
+			return AddTransactionResult::INCREASE_FEE;  // Never because checked in precheck_transaction
 		if (my_fee_per_byte == other_fee_per_byte && tid < tit->second)
-			return AddTransactionResult::INCREASE_FEE;  // Never because checked above
+			return AddTransactionResult::INCREASE_FEE;  // Never because checked in precheck_transaction
 		remove_from_pool(tit->second);
 	}
 	bool all_inserted = true;
@@ -715,13 +908,14 @@ AddTransactionResult BlockChainState::add_transaction(const Hash &tid, const Tra
 		if (!m_memory_state_ki_tx.insert(std::make_pair(ki.first, tid)).second)
 			all_inserted = false;
 	}
-	if (!m_memory_state_tx.insert(std::make_pair(tid, PoolTransaction(tx, binary_tx, my_fee, 0)))
-		.second)
+	auto pit = m_memory_state_tx.insert(std::make_pair(tid, PoolTransaction(tx, binary_tx, my_fee, 0)));
+	if (!pit.second)
 		all_inserted = false;
 	if (!m_memory_state_fee_tx[my_fee_per_byte].insert(tid).second)
 		all_inserted = false;
 	invariant(all_inserted, "memory_state_fee_tx empty");
 	m_memory_state_total_size += my_size;
+	mining_template_add(tid, pit.first->second);
 	while (m_memory_state_total_size > MAX_POOL_SIZE) {
 		invariant(!m_memory_state_fee_tx.empty(), "memory_state_fee_tx empty");
 		auto &be = m_memory_state_fee_tx.begin()->second;
@@ -781,6 +975,7 @@ void BlockChainState::remove_from_pool(Hash tid) {
 	auto tit = m_memory_state_tx.find(tid);
 	if (tit == m_memory_state_tx.end())
 		return;
+	mining_template_remove(tid, tit->second);
 	bool all_erased = true;
 	const Transaction &tx = tit->second.tx;
 	for (const auto &input : tx.inputs) {
@@ -860,9 +1055,12 @@ std::string BlockChainState::redo_transaction_get_error(bool generating, const T
 				std::for_each(output_keys.begin(), output_keys.end(),
 					[&output_key_pointers](const PublicKey &key) { output_key_pointers.push_back(&key); });
 				bool key_corrupted = false;
-				if (check_sigs &&
-					!check_ring_signature(tx_prefix_hash, in.key_image, output_key_pointers.data(),
-						output_key_pointers.size(), transaction.signatures[input_index].data(), true, &key_corrupted)) {
+				bool sigs_valid    = true;
+				if (check_sigs && !ring_checker.take_batch_result(tx_prefix_hash, in.key_image, output_keys,
+					transaction.signatures[input_index], &sigs_valid, &key_corrupted))
+					sigs_valid = check_ring_signature(tx_prefix_hash, in.key_image, output_key_pointers.data(),
+						output_key_pointers.size(), transaction.signatures[input_index].data(), true, &key_corrupted);
+				if (!sigs_valid) {
 					if (key_corrupted)  // TODO - db corrupted
 						return "INPUT_CORRUPTED_SIGNATURES";
 					return "INPUT_INVALID_SIGNATURES";
@@ -920,6 +1118,11 @@ bool BlockChainState::redo_block(const Block &block,
 	return true;
 }
 
+void BlockChainState::start_speculative_checks(const Block &block, Height height) const {
+	if (!m_currency.is_in_sw_checkpoint_zone(height + 1))
+		ring_checker.start_speculative_work(this, block);
+}
+
 bool BlockChainState::redo_block(const Hash &bhash, const Block &block, const api::BlockHeader &info) {
 	DeltaState delta(info.height, info.timestamp, this);
 	BlockGlobalIndices global_indices;
@@ -934,10 +1137,9 @@ bool BlockChainState::redo_block(const Hash &bhash, const Block &block, const ap
 	delta.apply(this);
 	m_tx_pool_version = 2;
 
-	auto key =
-		BLOCK_GLOBAL_INDICES_PREFIX + DB::to_binary_key(bhash.data, sizeof(bhash.data)) + BLOCK_GLOBAL_INDICES_SUFFIX;
+	const auto key = DBKey().append(bhash.data, sizeof(bhash.data));
 	BinaryArray ba = seria::to_binary(global_indices);
-	m_db.put(key, ba, true);
+	m_db.put(m_global_indices_table, key, ba, true);
 
 
 	auto now = std::chrono::steady_clock::now();
@@ -958,23 +1160,79 @@ void BlockChainState::undo_block(const Hash &bhash, const Block &block, Height h
 
 	m_log(logging::INFO) << "undo_block height=" << height << " bid=" << bhash
 		<< " new tip_bid=" << block.header.previous_block_hash << std::endl;
+	ring_checker.drop_speculative_results();
 	for (auto tit = block.transactions.rbegin(); tit != block.transactions.rend(); ++tit) {
 		undo_transaction(this, height, *tit);
 	}
 	undo_transaction(this, height, block.header.base_transaction);
 
-	auto key =
-		BLOCK_GLOBAL_INDICES_PREFIX + DB::to_binary_key(bhash.data, sizeof(bhash.data)) + BLOCK_GLOBAL_INDICES_SUFFIX;
-	m_db.del(key, true);
+	const auto key = DBKey().append(bhash.data, sizeof(bhash.data));
+	m_db.del(m_global_indices_table, key, true);
+}
+
+void BlockChainState::undo_journal_applied(const std::vector<DB::UndoOp> &undo) {
+	ring_checker.drop_speculative_results();
+	const std::string &outputs_table_name = m_db.get_table_name(m_amount_outputs_table);
+	for (auto &&uop : undo) {  // reverse key order, so popped outputs of each amount come from the end
+		if (m_db.get_table_name(uop.table) != outputs_table_name)
+			continue;
+		invariant(uop.key.size() == sizeof(Amount) + sizeof(uint32_t), "amount outputs undo record corrupted");
+		const Amount amount = from_be_key(uop.key, 0, sizeof(Amount));
+		const auto global_index = static_cast<uint32_t>(from_be_key(uop.key, sizeof(Amount), sizeof(uint32_t)));
+		if (!m_index_outputs_in_memory) {
+			m_next_gi_for_amount.erase(amount);  // read from DB again when needed
+			continue;
+		}
+		auto &columns = m_outputs_index.at(amount);
+		if (uop.existed) {
+			UnlockTimePublickKeyHeightSpent unp;
+			seria::from_binary(unp, uop.value.data(), uop.value.size());
+			columns.spent.at(global_index) = unp.spent;
+			continue;
+		}
+		invariant(global_index + 1 == columns.heights.size(), "amount outputs undo record pops not last output");
+		columns.public_keys.pop_back();
+		columns.unlock_times.pop_back();
+		columns.heights.pop_back();
+		columns.spent.pop_back();
+	}
+}
+
+void BlockChainState::test_save_memory_indexes() {
+	m_test_saved_outputs_index      = m_outputs_index;
+	m_test_saved_next_gi_for_amount = m_next_gi_for_amount;
+}
+
+void BlockChainState::test_swap_memory_indexes() {
+	std::swap(m_outputs_index, m_test_saved_outputs_index);
+	std::swap(m_next_gi_for_amount, m_test_saved_next_gi_for_amount);
+}
+
+bool BlockChainState::test_memory_indexes_equal_saved() const {
+	if (!m_index_outputs_in_memory) {  // undo record drops counts instead of decrementing, they are read again
+		for (auto &&git : m_test_saved_next_gi_for_amount)
+			if (next_global_index_for_amount(git.first) != git.second)
+				return false;
+		return true;
+	}
+	if (m_outputs_index.size() != m_test_saved_outputs_index.size())
+		return false;
+	for (auto &&oit : m_outputs_index) {
+		auto sit = m_test_saved_outputs_index.find(oit.first);
+		if (sit == m_test_saved_outputs_index.end() || oit.second.public_keys != sit->second.public_keys ||
+		    oit.second.unlock_times != sit->second.unlock_times || oit.second.heights != sit->second.heights ||
+		    oit.second.spent != sit->second.spent)
+			return false;
+	}
+	return true;
 }
 
 bool BlockChainState::read_block_output_global_indices(const Hash &bid, BlockGlobalIndices *indices) const {
-	BinaryArray rb;
-	auto key =
-		BLOCK_GLOBAL_INDICES_PREFIX + DB::to_binary_key(bid.data, sizeof(bid.data)) + BLOCK_GLOBAL_INDICES_SUFFIX;
-	if (!m_db.get(key, rb))
+	DB::Value rb;
+	const auto key = DBKey().append(bid.data, sizeof(bid.data));
+	if (!m_db.get(m_global_indices_table, key, rb))
 		return false;
-	seria::from_binary(*indices, rb);
+	seria::from_binary(*indices, rb.data(), rb.size());
 	return true;
 }
 
@@ -1031,8 +1289,9 @@ std::vector<api::Output> BlockChainState::get_random_outputs(
 }
 
 void BlockChainState::store_keyimage(const KeyImage &key_image, Height height) {
-	auto key = KEYIMAGE_PREFIX + DB::to_binary_key(key_image.data, sizeof(key_image.data));
-	m_db.put(key, seria::to_binary(height), true);
+	const auto key = DBKey().append(key_image.data, sizeof(key_image.data));
+	m_db.put(m_keyimages_table, key, seria::to_binary(height), true);
+	m_keyimages_filter.insert(key_image.data, sizeof(key_image.data));
 	auto tit = m_memory_state_ki_tx.find(key_image);
 	if (tit == m_memory_state_ki_tx.end())
 		return;
@@ -1040,25 +1299,35 @@ void BlockChainState::store_keyimage(const KeyImage &key_image, Height height) {
 }
 
 void BlockChainState::delete_keyimage(const KeyImage &key_image) {
-	auto key = KEYIMAGE_PREFIX + DB::to_binary_key(key_image.data, sizeof(key_image.data));
-	m_db.del(key, true);
+	const auto key = DBKey().append(key_image.data, sizeof(key_image.data));
+	m_db.del(m_keyimages_table, key, true);
 }
 
 bool BlockChainState::read_keyimage(const KeyImage &key_image, Height *height) const {
-	auto key = KEYIMAGE_PREFIX + DB::to_binary_key(key_image.data, sizeof(key_image.data));
-	BinaryArray rb;
-	if (!m_db.get(key, rb))
+	if (!m_keyimages_filter.may_contain(key_image.data, sizeof(key_image.data)))
+		return false;
+	const auto key = DBKey().append(key_image.data, sizeof(key_image.data));
+	DB::Value rb;
+	if (!m_db.get(m_keyimages_table, key, rb))
 		return false;
-	seria::from_binary(*height, rb);
+	seria::from_binary(*height, rb.data(), rb.size());
 	return true;
 }
 
 uint32_t BlockChainState::push_amount_output(Amount amount, UnlockMoment unlock_time, Height block_height, const PublicKey &pk) {
 	uint32_t my_gi = next_global_index_for_amount(amount);
-	auto key = AMOUNT_OUTPUT_PREFIX + common::write_varint_sqlite4(amount) + common::write_varint_sqlite4(my_gi);
+	const auto key = DBKey().append_be(amount, sizeof(Amount)).append_be(my_gi, sizeof(uint32_t));
 	BinaryArray ba = seria::to_binary(UnlockTimePublickKeyHeightSpent{ unlock_time, pk, block_height });
-	m_db.put(key, ba, true);
-	m_next_gi_for_amount[amount] += 1;
+	m_db.put(m_amount_outputs_table, key, ba, true);
+	if (!m_index_outputs_in_memory)
+		m_next_gi_for_amount[amount] += 1;
+	else {
+		auto &columns = m_outputs_index[amount];
+		columns.public_keys.push_back(pk);
+		columns.unlock_times.push_back(unlock_time);
+		columns.heights.push_back(block_height);
+		columns.spent.push_back(false);
+	}
 	return my_gi;
 }
 
@@ -1066,48 +1335,72 @@ void BlockChainState::pop_amount_output(Amount amount, UnlockMoment unlock_time,
 	uint32_t next_gi = next_global_index_for_amount(amount);
 	invariant(next_gi != 0, "BlockChainState::pop_amount_output underflow");
 	next_gi -= 1;
-	m_next_gi_for_amount[amount] -= 1;
-	auto key = AMOUNT_OUTPUT_PREFIX + common::write_varint_sqlite4(amount) + common::write_varint_sqlite4(next_gi);
+	if (!m_index_outputs_in_memory)
+		m_next_gi_for_amount[amount] -= 1;
+	const auto key = DBKey().append_be(amount, sizeof(Amount)).append_be(next_gi, sizeof(uint32_t));
 
 	UnlockTimePublickKeyHeightSpent unp;
 	invariant(read_amount_output(amount, next_gi, &unp), "BlockChainState::pop_amount_output element does not exist");
 	// TODO - check also was_height after upgrade to version 4 ?
 	invariant(!unp.spent && unp.unlock_time == unlock_time && unp.public_key == pk,
 		"BlockChainState::pop_amount_output popping wrong element");
-	m_db.del(key, true);
+	m_db.del(m_amount_outputs_table, key, true);
+	if (m_index_outputs_in_memory) {
+		auto &columns = m_outputs_index.at(amount);
+		columns.public_keys.pop_back();
+		columns.unlock_times.pop_back();
+		columns.heights.pop_back();
+		columns.spent.pop_back();
+	}
 }
 
 uint32_t BlockChainState::next_global_index_for_amount(Amount amount) const {
+	if (m_index_outputs_in_memory) {
+		auto cit = m_outputs_index.find(amount);
+		return cit == m_outputs_index.end() ? 0 : static_cast<uint32_t>(cit->second.heights.size());
+	}
 	auto it = m_next_gi_for_amount.find(amount);
 	if (it != m_next_gi_for_amount.end())
 		return it->second;
-	std::string prefix = AMOUNT_OUTPUT_PREFIX + common::write_varint_sqlite4(amount);
-	DB::Cursor cur2 = m_db.rbegin(prefix);
-	uint32_t alt_in = cur2.end() ? 0 : boost::lexical_cast<Height>(common::read_varint_sqlite4(cur2.get_suffix())) + 1;
+	DB::Cursor cur2 = m_db.rbegin(m_amount_outputs_table, to_be_key(amount, sizeof(Amount)));
+	uint32_t alt_in = cur2.end() ? 0 : static_cast<uint32_t>(from_be_key(cur2.get_suffix(), 0, sizeof(uint32_t))) + 1;
 	m_next_gi_for_amount[amount] = alt_in;
 	return alt_in;
 }
 
 bool BlockChainState::read_amount_output(
 	Amount amount, uint32_t global_index, UnlockTimePublickKeyHeightSpent *unp) const {
-	auto key = AMOUNT_OUTPUT_PREFIX + common::write_varint_sqlite4(amount) + common::write_varint_sqlite4(global_index);
-	BinaryArray rb;
-	if (!m_db.get(key, rb))
+	if (m_index_outputs_in_memory) {
+		auto cit = m_outputs_index.find(amount);
+		if (cit == m_outputs_index.end() || global_index >= cit->second.heights.size())
+			return false;
+		const auto &columns = cit->second;
+		unp->public_key     = columns.public_keys[global_index];
+		unp->unlock_time    = columns.unlock_times[global_index];
+		unp->height         = columns.heights[global_index];
+		unp->spent          = columns.spent[global_index];
+		return true;
+	}
+	const auto key = DBKey().append_be(amount, sizeof(Amount)).append_be(global_index, sizeof(uint32_t));
+	DB::Value rb;
+	if (!m_db.get(m_amount_outputs_table, key, rb))
 		return false;
-	seria::from_binary(*unp, rb);
+	seria::from_binary(*unp, rb.data(), rb.size());
 	return true;
 }
 
 void BlockChainState::spend_output(Amount amount, uint32_t global_index) { spend_output(amount, global_index, true); }
 void BlockChainState::spend_output(Amount amount, uint32_t global_index, bool spent) {
-	auto key = AMOUNT_OUTPUT_PREFIX + common::write_varint_sqlite4(amount) + common::write_varint_sqlite4(global_index);
-	BinaryArray rb;
-	if (!m_db.get(key, rb))
+	const auto key = DBKey().append_be(amount, sizeof(Amount)).append_be(global_index, sizeof(uint32_t));
+	DB::Value rb;
+	if (!m_db.get(m_amount_outputs_table, key, rb))
 		return;
 	UnlockTimePublickKeyHeightSpent was;
-	seria::from_binary(was, rb);
+	seria::from_binary(was, rb.data(), rb.size());
 	was.spent = spent;
-	m_db.put(key, seria::to_binary(was), false);
+	m_db.put(m_amount_outputs_table, key, seria::to_binary(was), false);
+	if (m_index_outputs_in_memory)
+		m_outputs_index.at(amount).spent.at(global_index) = spent;
 }
 
 void BlockChainState::test_print_outputs() {
@@ -1115,13 +1408,13 @@ void BlockChainState::test_print_outputs() {
 	uint32_t next_global_index = 0;
 	int total_counter = 0;
 	std::map<Amount, uint32_t> coins;
-	for (DB::Cursor cur = m_db.begin(AMOUNT_OUTPUT_PREFIX); !cur.end(); cur.next()) {
-		const char *be = cur.get_suffix().data();
-		const char *en = be + cur.get_suffix().size();
-		auto amount = common::read_varint_sqlite4(be, en);
-		uint32_t global_index = boost::lexical_cast<uint32_t>(common::read_varint_sqlite4(be, en));
-		if (be != en)
-			std::cout << "Excess value bytes for amount=" << amount << " global_index=" << global_index << std::endl;
+	for (DB::Cursor cur = m_db.begin(m_amount_outputs_table, std::string()); !cur.end(); cur.next()) {
+		if (cur.get_suffix().size() != sizeof(Amount) + sizeof(uint32_t)) {
+			std::cout << "Bad key size=" << cur.get_suffix().size() << std::endl;
+			continue;
+		}
+		Amount amount = from_be_key(cur.get_suffix(), 0, sizeof(Amount));
+		uint32_t global_index = static_cast<uint32_t>(from_be_key(cur.get_suffix(), sizeof(Amount), sizeof(uint32_t)));
 		if (amount != previous_amount) {
 			if (previous_amount != (Amount)-1) {
 				if (!coins.insert(std::make_pair(previous_amount, next_global_index)).second) {
@@ -1155,3 +1448,24 @@ void BlockChainState::test_print_outputs() {
 		}
 	}
 }
+
+Hash BlockChainState::test_state_hash() const {
+	std::string data;
+	for (auto &&table : {m_tip_chain_table, m_transactions_table, m_keyimages_table, m_amount_outputs_table,
+	         m_global_indices_table}) {
+		for (DB::Cursor cur = m_db.begin(table, std::string()); !cur.end(); cur.next())
+			data += cur.get_suffix() + cur.get_value_string();
+		data += '\0';
+	}
+	for (DB::Cursor cur = m_db.begin(m_amount_outputs_table, std::string()); !cur.end(); cur.next()) {
+		UnlockTimePublickKeyHeightSpent unp, in_table;  // in-memory index must follow table
+		seria::from_binary(in_table, cur.get_value_array());
+		const Amount amount = from_be_key(cur.get_suffix(), 0, sizeof(Amount));
+		const auto global_index = static_cast<uint32_t>(from_be_key(cur.get_suffix(), sizeof(Amount), sizeof(uint32_t)));
+		invariant(read_amount_output(amount, global_index, &unp) && unp.public_key == in_table.public_key &&
+		              unp.unlock_time == in_table.unlock_time && unp.height == in_table.height &&
+		              unp.spent == in_table.spent,
+		    "amount output differs from amount outputs table");
+	}
+	return crypto::cn_fast_hash(data.data(), data.size());
+}
@@ -10,6 +10,7 @@
 #include <unordered_map>
 #include <unordered_set>
 #include "BlockChain.hpp"
+#include "common/Math.hpp"
 #include "RingCheckerMulticore.hpp"
 #include "crypto/hash.hpp"
 
@@ -40,6 +41,7 @@ public:
 class BlockChainState : public BlockChain, private IBlockChainState {
 public:
 	BlockChainState(logging::ILogger &, const Config &, const Currency &, bool read_only);
+	~BlockChainState() override;
 
 	const Currency &get_currency() const { return m_currency; }
 	uint32_t get_next_effective_median_size() const;
@@ -51,6 +53,10 @@ public:
 
 	Amount minimum_pool_fee_per_byte(Hash *minimal_tid) const;
 	AddTransactionResult add_transaction(const Hash &tid, const Transaction &, const BinaryArray &binary_tx, Timestamp now, Height *conflict_height, const std::string &source_address);
+	// Rejections of add_transaction which do not read rings, so relayed junk is dropped before signatures are checked
+	bool precheck_transaction(const Hash &tid, const Transaction &, size_t binary_size, Height *conflict_height, AddTransactionResult *result) const;
+	// Checks ring signatures on checker threads, add_transaction then uses results. Pass only transactions which passed precheck
+	void check_transactions_batch(const std::vector<const Transaction *> &transactions) const;
 
 
 	bool get_largest_referenced_height(const TransactionPrefix &tx, Height *block_height) const;
@@ -73,9 +79,14 @@ public:
 	bool create_mining_block_template2(BlockTemplate *, const AccountPublicAddress &, const BinaryArray &extra_nonce, Difficulty *, Hash) const;
 	BroadcastAction add_mined_block(const BinaryArray &raw_block_template, RawBlock *, api::BlockHeader *);
 
+	// Ring checks of block expected at height start on idle checker threads while earlier blocks are applied
+	void start_speculative_checks(const Block &block, Height height) const;
+
 	static api::BlockHeader fill_genesis(Hash genesis_bid, const BlockTemplate &);
 
 	void test_print_outputs();
+	// Of tables which depend only on main chain, so nodes with the same tip have the same hash however they got there
+	Hash test_state_hash() const;
 
 protected:
 	virtual std::string check_standalone_consensus(const PreparedBlock &pb, api::BlockHeader *info, const api::BlockHeader &prev_info, bool check_pow) const override;
@@ -126,11 +137,29 @@ private:
 
 	void undo_transaction(IBlockChainState *delta_state, Height, const Transaction &);
 
-	mutable crypto::CryptoNightContext m_hash_crypto_context;
+	const DB::Table m_keyimages_table;       // key image -> height
+	const DB::Table m_amount_outputs_table;  // amount, global index -> UnlockTimePublickKeyHeightSpent
+	const DB::Table m_global_indices_table;  // bid -> BlockGlobalIndices
+	common::BloomFilter m_keyimages_filter;
+	void rebuild_filters_if_needed() override;
+
+	// Optional copy of amount outputs table, columns are indexed by global index
+	struct OutputColumns {
+		std::vector<PublicKey> public_keys;
+		std::vector<UnlockMoment> unlock_times;
+		std::vector<Height> heights;
+		std::vector<bool> spent;
+	};
+	const bool m_index_outputs_in_memory;
+	std::unordered_map<Amount, OutputColumns> m_outputs_index;
+	void build_outputs_index();
+
 	mutable std::unordered_map<Amount, uint32_t>
 	    m_next_gi_for_amount;  
 
 	AddTransactionResult add_transaction(const Hash &tid, const Transaction &tx, const BinaryArray &binary_tx,  Height unlock_height, Timestamp unlock_timestamp, Height *conflict_height, bool check_sigs,  const std::string &source_address);
+	bool precheck_transaction(const Hash &tid, const Transaction &tx, size_t binary_size, Height *conflict_height, bool check_sigs, AddTransactionResult *result) const;
+	AddTransactionResult add_prechecked_transaction(const Hash &tid, const Transaction &tx, const BinaryArray &binary_tx, Height unlock_height, Timestamp unlock_timestamp, Height *conflict_height, bool check_sigs);
 	void remove_from_pool(Hash tid);
 
 	uint32_t m_tx_pool_version = 2;  
@@ -142,14 +171,48 @@ private:
 	mutable std::map<Hash, std::pair<BinaryArray, Height>> m_mining_transactions;
 	void clear_mining_transactions() const;
 
+	// Transactions of block template, greedy by fee per byte. Pool transactions have distinct key images and
+	// were redone against tip when added, so selection needs no redo and is updated as pool and tip change
+	struct MiningTemplate {
+		Hash tip_bid;
+		Difficulty difficulty = 0;
+		size_t max_total_size = 0;
+		std::vector<Hash> transaction_hashes;  // can contain removed ones, compacted when used or appended to
+		std::unordered_set<Hash> transaction_set;
+		size_t txs_size = 0;
+		Amount fee      = 0;
+		bool complete   = false;  // all pool transactions fit, so added ones can be appended
+		bool valid      = false;  // selection matches pool
+	};
+	mutable MiningTemplate m_mining_template;
+	void update_mining_template(size_t max_total_size) const;
+	void mining_template_add(const Hash &tid, const PoolTransaction &ptx);
+	void mining_template_remove(const Hash &tid, const PoolTransaction &ptx);
+
 	Timestamp m_next_median_timestamp = 0;
 	uint32_t m_next_median_size       = 0;
+	template<class T>
+	struct ConsensusWindow {  // main chain blocks ending at tip, moved by tip_changed() instead of rebuilding
+		Height first = 0;
+		std::deque<std::pair<Hash, T>> blocks;  // bid, value at heights first, first + 1, ...
+		common::SlidingMedian<T> values;
+	};
+	ConsensusWindow<uint32_t> m_sizes_window;
+	ConsensusWindow<Timestamp> m_timestamps_window;
+	template<class T>
+	void move_window(ConsensusWindow<T> *window, Height first, T ChainHeader::*field) const;
 	virtual void tip_changed() override;  // Updates values above
 	virtual void on_reorganization(
 	    const std::map<Hash, std::pair<Transaction, BinaryArray>> &undone_transactions, bool undone_blocks) override;
+	virtual void undo_journal_applied(const std::vector<DB::UndoOp> &undo) override;
+	std::unordered_map<Amount, OutputColumns> m_test_saved_outputs_index;
+	std::unordered_map<Amount, uint32_t> m_test_saved_next_gi_for_amount;
+	virtual void test_save_memory_indexes() override;
+	virtual void test_swap_memory_indexes() override;
+	virtual bool test_memory_indexes_equal_saved() const override;
 	void calculate_consensus_values(const api::BlockHeader &prev_info, uint32_t *next_median_size, Timestamp *next_median_timestamp) const;
 
-	RingCheckerMulticore ring_checker;
+	mutable RingCheckerMulticore ring_checker;
 	std::chrono::steady_clock::time_point log_redo_block_timestamp;
 };
 
@@ -47,7 +47,8 @@ Config::Config(common::CommandLine &cmd)
     , p2p_whitelist_connections_percent(P2P_DEFAULT_WHITELIST_CONNECTIONS_PERCENT)
     , p2p_block_ids_sync_default_count(BLOCKS_IDS_SYNCHRONIZING_DEFAULT_COUNT)
     , p2p_blocks_sync_default_count(BLOCKS_SYNCHRONIZING_DEFAULT_COUNT)
-    , rpc_get_blocks_fast_max_count(COMMAND_RPC_GET_BLOCKS_FAST_MAX_COUNT) {
+    , rpc_get_blocks_fast_max_count(COMMAND_RPC_GET_BLOCKS_FAST_MAX_COUNT)
+    , index_outputs_in_memory(cmd.get_bool("--index-outputs-in-memory")) {
 	common::pod_from_hex(P2P_STAT_TRUSTED_PUBLIC_KEY, trusted_public_key);
 
 	if (is_testnet) {
@@ -65,6 +66,10 @@ Config::Config(common::CommandLine &cmd)
 	}
 	if (const char *pa = cmd.get("--p2p-external-port"))
 		p2p_external_port = boost::lexical_cast<uint16_t>(pa);
+	if (const char *pa = cmd.get("--prune-blocks-below-depth"))
+		prune_blocks_below_depth = boost::lexical_cast<Height>(pa);
+	if (const char *pa = cmd.get("--worker-threads"))
+		worker_threads = boost::lexical_cast<size_t>(pa);
 	if (const char *pa = cmd.get("--wallet-rpc-bind-address")) {
 		if (!common::parse_ip_address_and_port(pa, &walletd_bind_ip, &walletd_bind_port))
 			throw std::runtime_error("Wrong address format " + std::string(pa) + ", should be ip:port");
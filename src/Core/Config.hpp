@@ -66,6 +66,9 @@ public:
 	PublicKey trusted_public_key{};
 
 	std::string data_folder;
+	bool index_outputs_in_memory;
+	Height prune_blocks_below_depth = 0;  // 0 keeps all block bodies
+	size_t worker_threads           = 0;  // 0 for 3/4 of cores
 
 	std::string get_data_folder() const { return data_folder; }  
 	std::string get_data_folder(const std::string &subdir) const;
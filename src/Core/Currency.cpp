@@ -213,8 +213,7 @@ bool Currency::construct_miner_tx(uint8_t block_major_version, Height height, si
 	tx->outputs.clear();
 	tx->extra.clear();
 
-	KeyPair txkey = crypto::random_keypair();
-	add_transaction_public_key_to_extra(tx->extra, txkey.public_key);
+	add_transaction_public_key_to_extra(tx->extra, PublicKey{});  // set with output keys by set_miner_tx_key
 	if (!extra_nonce.empty()) {
 		if (!add_extra_nonce_to_transaction_extra(tx->extra, extra_nonce)) {
 			return false;
@@ -244,29 +243,9 @@ bool Currency::construct_miner_tx(uint8_t block_major_version, Height height, si
 
 	Amount summary_amounts = 0;
 	for (size_t no = 0; no < out_amounts.size(); no++) {
-		crypto::KeyDerivation derivation{};
-		crypto::PublicKey out_ephemeral_pub_key{};
-
-		bool r = crypto::generate_key_derivation(miner_address.view_public_key, txkey.secret_key, derivation);
-
-		if (!r) {
-
-			return false;
-		}
-
-		r = crypto::derive_public_key(derivation, no, miner_address.spend_public_key, out_ephemeral_pub_key);
-
-		if (!r) {
-
-			return false;
-		}
-
-		KeyOutput tk;
-		tk.key = out_ephemeral_pub_key;
-
 		TransactionOutput out;
 		summary_amounts += out.amount = out_amounts[no];
-		out.target                    = tk;
+		out.target                    = KeyOutput{};
 		tx->outputs.push_back(out);
 	}
 
@@ -279,6 +258,24 @@ bool Currency::construct_miner_tx(uint8_t block_major_version, Height height, si
 	// lock
 	tx->unlock_time = height + mined_money_unlock_window;
 	tx->inputs.push_back(in);
+	return set_miner_tx_key(miner_address, tx);
+}
+
+bool Currency::set_miner_tx_key(const AccountPublicAddress &miner_address, Transaction *tx) const {
+	if (tx->extra.size() < 1 + sizeof(PublicKey) || tx->extra[0] != TransactionExtraPublicKey::tag)
+		return false;  // construct_miner_tx puts key first
+	KeyPair txkey = crypto::random_keypair();
+	std::copy(std::begin(txkey.public_key.data), std::end(txkey.public_key.data), tx->extra.begin() + 1);
+
+	crypto::KeyDerivation derivation{};
+	if (!crypto::generate_key_derivation(miner_address.view_public_key, txkey.secret_key, derivation))
+		return false;
+	for (size_t no = 0; no < tx->outputs.size(); no++) {
+		KeyOutput tk;
+		if (!crypto::derive_public_key(derivation, no, miner_address.spend_public_key, tk.key))
+			return false;
+		tx->outputs[no].target = tk;
+	}
 	return true;
 }
 
@@ -417,7 +414,7 @@ bool Currency::parse_amount(size_t number_of_decimal_places, const std::string &
 }
 
 Difficulty Currency::next_difficulty(Height block_index,
-	std::vector<Timestamp> timestamps, std::vector<Difficulty> cumulative_difficulties) const {
+	const std::vector<Timestamp> &timestamps, const std::vector<Difficulty> &cumulative_difficulties) const {
 	if (block_index <= hardfork_v2_height)
 	{
 		return next_difficulty_v1(block_index, timestamps, cumulative_difficulties);
@@ -532,7 +529,7 @@ Difficulty Currency::next_difficulty_v1(Height block_index, std::vector<Timestam
 }
 
 
-Difficulty Currency::next_difficulty_v2(std::vector<Timestamp> timestamps, std::vector<Difficulty> cumulative_difficulties) const
+Difficulty Currency::next_difficulty_v2(const std::vector<Timestamp> &timestamps, const std::vector<Difficulty> &cumulative_difficulties) const
 {
 	int64_t T = difficulty_target;
 	int64_t N = difficulty_window_v2;
@@ -679,25 +676,53 @@ Hash cryonerocoin::get_auxiliary_block_header_hash(const BlockTemplate &bh) {
 	return get_object_hash(get_block_hashing_binary_array(bh));
 }
 
-Hash cryonerocoin::get_block_long_hash(const BlockTemplate &bh, crypto::CryptoNightContext &crypto_ctx) {
-	if (bh.major_version == 1) {
-		auto raw_hashing_block = get_block_hashing_binary_array(bh);
-		return crypto_ctx.cn_slow_hash(raw_hashing_block.data(), raw_hashing_block.size());
-	}
-	if (bh.major_version >= 2 && bh.major_version < 4) {
-		auto serializer               = make_parent_block_serializer(bh, true, true);
-		BinaryArray raw_hashing_block = seria::to_binary(serializer);
-		return crypto_ctx.cn_slow_hash(raw_hashing_block.data(), raw_hashing_block.size());
-	}
-	if (bh.major_version >= 4) {
+static BinaryArray get_block_long_hashing_data(const BlockTemplate &bh, bool *lite) {
+	*lite = bh.major_version >= 4;
+	if (bh.major_version == 1)
+		return get_block_hashing_binary_array(bh);
+	if (bh.major_version >= 2) {
 		auto serializer = make_parent_block_serializer(bh, true, true);
-		BinaryArray raw_hashing_block = seria::to_binary(serializer);
-		return crypto_ctx.cn_lite_slow_hash_v1(raw_hashing_block.data(), raw_hashing_block.size());
+		return seria::to_binary(serializer);
 	}
-
 	throw std::runtime_error("Unknown block major version.");
 }
 
+Hash cryonerocoin::get_block_long_hash(const BlockTemplate &bh, crypto::CryptoNightContext &crypto_ctx) {
+	bool lite                     = false;
+	BinaryArray raw_hashing_block = get_block_long_hashing_data(bh, &lite);
+	if (lite)
+		return crypto_ctx.cn_lite_slow_hash_v1(raw_hashing_block.data(), raw_hashing_block.size());
+	return crypto_ctx.cn_slow_hash(raw_hashing_block.data(), raw_hashing_block.size());
+}
+
+std::vector<Hash> cryonerocoin::get_block_long_hashes(
+    const std::vector<const BlockTemplate *> &bhs, crypto::CryptoNightContext &crypto_ctx) {
+	std::vector<BinaryArray> raw_hashing_blocks(bhs.size());
+	std::vector<size_t> indexes[2];  // full and lite hashes are interleaved separately
+	for (size_t i = 0; i != bhs.size(); ++i) {
+		bool lite             = false;
+		raw_hashing_blocks[i] = get_block_long_hashing_data(*bhs[i], &lite);
+		indexes[lite].push_back(i);
+	}
+	std::vector<Hash> result(bhs.size());
+	for (size_t lite = 0; lite != 2; ++lite) {
+		std::vector<const void *> datas;
+		std::vector<size_t> lengths;
+		for (auto i : indexes[lite]) {
+			datas.push_back(raw_hashing_blocks[i].data());
+			lengths.push_back(raw_hashing_blocks[i].size());
+		}
+		std::vector<Hash> hashes(datas.size());
+		if (lite)
+			crypto_ctx.cn_lite_slow_hash_v1_multi(datas.data(), lengths.data(), hashes.data(), hashes.size());
+		else
+			crypto_ctx.cn_slow_hash_multi(datas.data(), lengths.data(), hashes.data(), hashes.size());
+		for (size_t j = 0; j != hashes.size(); ++j)
+			result.at(indexes[lite][j]) = hashes[j];
+	}
+	return result;
+}
+
 Height Currency::get_timestamp_check_window(Height height) const
 {
 	return height >= hardfork_v2_height ? timestamp_check_window_v2 : timestamp_check_window;
@@ -96,6 +96,9 @@ namespace cryonerocoin
 			Amount already_generated_coins, size_t current_block_size, Amount fee,
 			const AccountPublicAddress &miner_address, Transaction *tx, const BinaryArray &extra_nonce = BinaryArray(),
 			size_t max_outs = 1) const;
+		// Gives miner tx made by construct_miner_tx new random key and outputs to miner_address, size and amounts
+		// stay, so block template can be shared between miners
+		bool set_miner_tx_key(const AccountPublicAddress &miner_address, Transaction *tx) const;
 
 		std::string account_address_as_string(const AccountPublicAddress &account_public_address) const;
 		bool parse_account_address_string(const std::string &str, AccountPublicAddress *addr) const;
@@ -107,11 +110,11 @@ namespace cryonerocoin
 		}
 
 		Difficulty next_difficulty(Height block_index,
-			std::vector<Timestamp> timestamps, std::vector<Difficulty> cumulative_difficulties) const;
+			const std::vector<Timestamp> &timestamps, const std::vector<Difficulty> &cumulative_difficulties) const;
 
 		Difficulty next_difficulty_v1(Height block_index, std::vector<Timestamp> timestamps, std::vector<Difficulty> cumulative_difficulties) const;
 
-		Difficulty next_difficulty_v2(std::vector<Timestamp> timestamps, std::vector<Difficulty> cumulative_difficulties) const;
+		Difficulty next_difficulty_v2(const std::vector<Timestamp> &timestamps, const std::vector<Difficulty> &cumulative_difficulties) const;
 
 		bool check_proof_of_work_v1(
 			const Hash &long_block_hash, const BlockTemplate &block, Difficulty current_difficulty) const;
@@ -145,6 +148,8 @@ namespace cryonerocoin
 
 	Hash get_block_hash(const BlockTemplate &);
 	Hash get_block_long_hash(const BlockTemplate &, crypto::CryptoNightContext &);
+	// Interleaves hashing of up to crypto_ctx.get_ways() blocks on one core
+	std::vector<Hash> get_block_long_hashes(const std::vector<const BlockTemplate *> &, crypto::CryptoNightContext &crypto_ctx);
 	Hash get_auxiliary_block_header_hash(const BlockTemplate &);  // Without parent block, for merge mining calculations
 
 } 
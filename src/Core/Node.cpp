@@ -52,11 +52,19 @@ Node::Node(logging::ILogger &log, const Config &config, BlockChainState &block_c
 		    config.ssl_certificate_pem_file,
 		    config.ssl_certificate_password ? config.ssl_certificate_password.get() : std::string()));
 
+	m_main_loop = platform::EventLoop::current();
 	m_commit_timer.once(DB_COMMIT_PERIOD_CRYONEROD);
 	advance_long_poll();
 }
 
+Node::~Node() {
+	std::unique_lock<std::mutex> lock(m_worker_replies->mu);
+	m_worker_token.cancel();  // under mutex, so no task wakes main loop after
+	m_worker_replies->cv.wait(lock, [&]() { return m_worker_replies->running == 0; });
+}
+
 bool Node::on_idle() {
+	write_worker_replies();
 	if (!m_block_chain_reader1 && !m_block_chain_reader2 &&
 	    m_block_chain.get_tip_height() >= m_block_chain.internal_import_known_height())
 		return m_downloader.on_idle();
@@ -95,6 +103,7 @@ Node::P2PClientCryonero::get_sync_data() const {
 	CORE_SYNC_DATA sync_data;
 	sync_data.current_height = m_node->m_block_chain.get_tip_height();
 	sync_data.top_id         = m_node->m_block_chain.get_tip_bid();
+	sync_data.pruned_height  = m_node->m_block_chain.get_pruned_height();
 	return sync_data;
 }
 
@@ -236,19 +245,43 @@ void Node::P2PClientCryonero::on_msg_notify_new_transactions(NOTIFY_NEW_TRANSACT
 		return;  // We cannot check tx while downloading anyway
 	NOTIFY_NEW_TRANSACTIONS::request msg;
 	Hash any_tid;
-	for (auto &&raw_tx : req.txs) {
-		Transaction tx;
+	std::vector<std::pair<Hash, Transaction>> transactions(req.txs.size());
+	for (size_t i = 0; i != req.txs.size(); ++i) {
 		try {
-			seria::from_binary(tx, raw_tx);
+			seria::from_binary(transactions[i].second, req.txs[i]);
 		} catch (const std::exception &ex) {
 			disconnect("NOTIFY_NEW_TRANSACTIONS add_transaction BAN from_binary failed " + std::string(ex.what()));
 			return;
 		}
-		const Hash tid = get_transaction_hash(tx);
-		any_tid        = tid;
+		transactions[i].first = get_transaction_hash(transactions[i].second);
+	}
+	// Cheap rejections first, then signatures of survivors are checked in parallel, then survivors are added in
+	// order resolving key image conflicts, so peer cannot make us check signatures of junk
+	std::vector<bool> prechecked(req.txs.size());
+	std::vector<const Transaction *> batch;
+	for (size_t i = 0; i != req.txs.size(); ++i) {
+		Height conflict_height = 0;
+		auto action            = AddTransactionResult::BROADCAST_ALL;
+		prechecked[i]          = m_node->m_block_chain.precheck_transaction(
+		    transactions[i].first, transactions[i].second, req.txs[i].size(), &conflict_height, &action);
+		if (action == AddTransactionResult::BAN) {
+			disconnect("NOTIFY_NEW_TRANSACTIONS add_transaction BAN");
+			return;
+		}
+		if (prechecked[i])
+			batch.push_back(&transactions[i].second);
+	}
+	m_node->m_block_chain.check_transactions_batch(batch);
+	for (size_t i = 0; i != req.txs.size(); ++i) {
+		const BinaryArray &raw_tx = req.txs[i];
+		const Hash &tid           = transactions[i].first;
+		any_tid                   = tid;
+		if (!prechecked[i])
+			continue;
 		Height conflict_height = 0;
-		auto action            = m_node->m_block_chain.add_transaction(tid, tx, raw_tx, m_node->m_p2p.get_local_time(),
-		    &conflict_height, common::ip_address_and_port_to_string(get_address().ip, get_address().port));
+		auto action = m_node->m_block_chain.add_transaction(tid, transactions[i].second, raw_tx,
+		    m_node->m_p2p.get_local_time(), &conflict_height,
+		    common::ip_address_and_port_to_string(get_address().ip, get_address().port));
 		switch (action) {
 		case AddTransactionResult::BAN:
 			disconnect("NOTIFY_NEW_TRANSACTIONS add_transaction BAN");
@@ -336,6 +369,7 @@ void Node::advance_long_poll() {
 	if (prevent_sleep &&
 	    m_block_chain.get_tip().timestamp > now - m_block_chain.get_currency().get_block_future_time_limit(m_block_chain.get_tip_height() + 1) * 2)
 		prevent_sleep = nullptr;
+	prebuild_block_templates();
 	if (m_long_poll_http_clients.empty())
 		return;
 	api::cryonerod::GetStatus::Response resp = create_status_response3();
@@ -354,22 +388,20 @@ void Node::advance_long_poll() {
 			++lit;
 			continue;
 		}
-		http::ResponseData last_http_response;
-		last_http_response.r.headers.push_back({"Content-Type", "application/json; charset=utf-8"});
-		last_http_response.r.status             = 200;
-		last_http_response.r.http_version_major = lit->original_request.r.http_version_major;
-		last_http_response.r.http_version_minor = lit->original_request.r.http_version_minor;
-		last_http_response.r.keep_alive         = lit->original_request.r.keep_alive;
-		if (method_status) {
-			last_json_resp.set_id(lit->original_json_request.get_id());
-			last_http_response.set_body(last_json_resp.get_body());
-		} else {
-			json_rpc::Response gbt_json_resp;
+		json_rpc::Response gbt_json_resp;
+		if (!method_status) {
 			try {
 				api::cryonerod::GetBlockTemplate::Request gbt_req;
 				lit->original_json_request.load_params(gbt_req);
 				api::cryonerod::GetBlockTemplate::Response gbt_res;
-				getblocktemplate(std::move(gbt_req), gbt_res);
+				getblocktemplate(gbt_req, gbt_res);
+				if (gbt_req.template_id != Hash{} && gbt_res.template_id == gbt_req.template_id) {
+					// Only pool transactions not fitting into block changed, not worth interrupting miner
+					lit->original_get_status.top_block_hash           = resp.top_block_hash;
+					lit->original_get_status.transaction_pool_version = resp.transaction_pool_version;
+					++lit;
+					continue;
+				}
 				gbt_json_resp.set_result(gbt_res);
 				gbt_json_resp.set_id(lit->original_json_request.get_id());
 			} catch (const json_rpc::Error &err) {
@@ -377,8 +409,18 @@ void Node::advance_long_poll() {
 			} catch (const std::exception &e) {
 				gbt_json_resp.set_error(json_rpc::Error(json_rpc::INTERNAL_ERROR, e.what()));
 			}
-			last_http_response.set_body(gbt_json_resp.get_body());
 		}
+		http::ResponseData last_http_response;
+		last_http_response.r.headers.push_back({"Content-Type", "application/json; charset=utf-8"});
+		last_http_response.r.status             = 200;
+		last_http_response.r.http_version_major = lit->original_request.r.http_version_major;
+		last_http_response.r.http_version_minor = lit->original_request.r.http_version_minor;
+		last_http_response.r.keep_alive         = lit->original_request.r.keep_alive;
+		if (method_status) {
+			last_json_resp.set_id(lit->original_json_request.get_id());
+			last_http_response.set_body(last_json_resp.get_body());
+		} else
+			last_http_response.set_body(gbt_json_resp.get_body());
 		lit->original_who->write(std::move(last_http_response));
 		lit = m_long_poll_http_clients.erase(lit);
 	}
@@ -436,6 +478,66 @@ void Node::on_api_http_disconnect(http::Client *who) {
 			lit = m_long_poll_http_clients.erase(lit);
 		else
 			++lit;
+	for (auto wit = m_worker_reply_clients.begin(); wit != m_worker_reply_clients.end();)
+		if (wit->second == who)
+			wit = m_worker_reply_clients.erase(wit);
+		else
+			++wit;
+}
+
+void Node::submit_worker_json_rpc(http::Client *who, const http::RequestData &request,
+    const json_rpc::Request &json_request, std::function<void(json_rpc::Response &)> &&work) {
+	const uint64_t reply_id = m_next_worker_reply++;
+	m_worker_reply_clients[reply_id] = who;
+	{
+		std::unique_lock<std::mutex> lock(m_worker_replies->mu);
+		m_worker_replies->running += 1;
+	}
+	// Decremented when task is destroyed, also when executor drops it after cancel
+	std::shared_ptr<void> running(nullptr, [replies = m_worker_replies](void *) {
+		std::unique_lock<std::mutex> lock(replies->mu);
+		replies->running -= 1;
+		replies->cv.notify_all();
+	});
+	common::Executor::instance().submit(common::Executor::RPC, m_worker_token,
+	    [replies = m_worker_replies, token = m_worker_token, loop = m_main_loop, running, reply_id,
+	        original_request = request.r, id = json_request.get_id(), work = std::move(work)]() {
+		    json_rpc::Response json_resp;
+		    json_resp.set_id(id);
+		    try {
+			    work(json_resp);
+		    } catch (const json_rpc::Error &err) {
+			    json_resp.set_error(err);
+		    } catch (const std::exception &e) {
+			    json_resp.set_error(json_rpc::Error(json_rpc::INTERNAL_ERROR, e.what()));
+		    }
+		    http::ResponseData response(original_request);
+		    response.r.add_headers_nocache();
+		    response.r.headers.push_back({"Access-Control-Allow-Origin", "*"});
+		    response.r.headers.push_back({"Content-Type", "application/json; charset=utf-8"});
+		    response.r.status = 200;
+		    response.set_body(json_resp.get_body());
+		    std::unique_lock<std::mutex> lock(replies->mu);
+		    if (token.is_cancelled())
+			    return;
+		    replies->ready.emplace_back(reply_id, std::move(response));
+		    loop->wake();
+	    });
+}
+
+void Node::write_worker_replies() {
+	std::vector<std::pair<uint64_t, http::ResponseData>> ready;
+	{
+		std::unique_lock<std::mutex> lock(m_worker_replies->mu);
+		ready.swap(m_worker_replies->ready);
+	}
+	for (auto &&reply : ready) {
+		auto wit = m_worker_reply_clients.find(reply.first);
+		if (wit == m_worker_reply_clients.end())
+			continue;  // client disconnected
+		wit->second->write(std::move(reply.second));
+		m_worker_reply_clients.erase(wit);
+	}
 }
 
 namespace {
@@ -503,7 +605,8 @@ bool Node::on_get_raw_block(http::Client *, http::RequestData &&, json_rpc::Requ
 	BlockChainState::BlockGlobalIndices global_indices;
 
 	RawBlock rb;
-	invariant(m_block_chain.read_block(request.hash, &rb), "Block must be there, but it is not there");
+	if (!m_block_chain.read_block(request.hash, &rb))
+		throw json_rpc::Error(-5, "Block body is pruned on this node");
 	Block block;
 	invariant(block.from_raw_block(rb), "RawBlock failed to convert into block");
 
@@ -563,6 +666,9 @@ api::cryonerod::GetStatus::Response Node::create_status_response3() const {
 	res.recommended_fee_per_byte = m_block_chain.get_currency().coin() / 1000000;  // TODO - calculate
 	res.next_block_effective_median_size = m_block_chain.get_next_effective_median_size();
 	res.transaction_pool_version         = m_block_chain.get_tx_pool_version();
+	const auto db_stats                  = m_block_chain.get_db_commit_stats();
+	res.last_db_commit_ms                = db_stats.last_commit_ms;
+	res.pruned_height                    = m_block_chain.get_pruned_height();
 	return res;
 }
 
@@ -615,6 +721,9 @@ bool Node::on_wallet_sync3(http::Client *, http::RequestData &&, json_rpc::Reque
 		start_block_index = full_offset;
 	}
 
+	if (!supplement.empty() && start_block_index < m_block_chain.get_pruned_height())
+		throw json_rpc::Error(json_rpc::INVALID_PARAMS, "Blocks below height " +
+		    common::to_string(m_block_chain.get_pruned_height()) + " are pruned on this node");
 	res.start_height = start_block_index;
 	res.blocks.resize(supplement.size());
 	for (size_t i = 0; i != supplement.size(); ++i) {
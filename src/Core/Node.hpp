@@ -13,6 +13,7 @@
 #include <thread>
 #include "BlockChainFileFormat.hpp"
 #include "BlockChainState.hpp"
+#include "common/Executor.hpp"
 #include "http/JsonRpc.hpp"
 #include "http/Server.hpp"
 #include "p2p/P2P.hpp"
@@ -37,6 +38,7 @@ public:
 	using JSONRPCHandlerFunction = std::function<bool(Node *, http::Client *, http::RequestData &&, json_rpc::Request &&, json_rpc::Response &)>;
 
 	explicit Node(logging::ILogger &, const Config &, BlockChainState &);
+	~Node();
 	bool on_idle();
 
 	// binary method
@@ -109,6 +111,36 @@ protected:
 	};
 	std::list<LongPollClient> m_long_poll_http_clients;
 	void advance_long_poll();
+	// Read-only json_rpc methods can build reply on executor thread from DB snapshot, main loop writes it later
+	struct WorkerReplies {
+		std::mutex mu;
+		std::condition_variable cv;
+		size_t running = 0;  // queued or running tasks, they use block chain, so ~Node waits for them
+		std::vector<std::pair<uint64_t, http::ResponseData>> ready;  // by reply id
+	};
+	std::shared_ptr<WorkerReplies> m_worker_replies = std::make_shared<WorkerReplies>();
+	common::CancelToken m_worker_token;
+	platform::EventLoop *m_main_loop = nullptr;
+	std::map<uint64_t, http::Client *> m_worker_reply_clients;  // replies to disconnected clients are dropped
+	uint64_t m_next_worker_reply = 0;
+	void submit_worker_json_rpc(http::Client *who, const http::RequestData &request,
+	    const json_rpc::Request &json_request, std::function<void(json_rpc::Response &)> &&work);
+	void write_worker_replies();
+	// Built once per template_id and reserve_size, each miner gets copy with own timestamp and coinbase key,
+	// reserved bytes for extra nonce are filled by miner. Reserve sizes asked for are rebuilt on tip change
+	// before long-poll waiters are answered
+	struct SharedBlockTemplate {
+		BlockTemplate block_template;
+		AccountPublicAddress address;  // built with, any miner's
+		Difficulty difficulty = 0;
+		Height height         = 0;
+		Hash top_block_hash;
+		uint32_t transaction_pool_version = 0;
+		Hash template_id;
+	};
+	std::map<uint32_t, SharedBlockTemplate> m_block_templates;  // by reserve_size, all of the same template_id
+	const SharedBlockTemplate &get_shared_block_template(const AccountPublicAddress &, uint32_t reserve_size);
+	void prebuild_block_templates();
 
 	bool m_block_chain_was_far_behind;
 	logging::LoggerRef m_log;
@@ -183,6 +215,7 @@ protected:
 			RawBlock rb;
 			enum Status { DOWNLOADING, DOWNLOADED, PREPARING, PREPARED } status = DOWNLOADING;
 			bool protect_from_disconnect = false;
+			bool speculated              = false;  // ring checks started before previous blocks were added
 			PreparedBlock pb;
 		};
 		std::deque<DownloadCell>
@@ -195,16 +228,20 @@ protected:
 		std::chrono::steady_clock::time_point log_request_timestamp;
 		std::chrono::steady_clock::time_point log_response_timestamp;
 
-		// multicore preparator
-		std::vector<std::thread> threads;
-		std::mutex mu;
-		std::map<Hash, PreparedBlock> prepared_blocks;
-		std::deque<std::tuple<Hash, bool, RawBlock>> work;
-		std::condition_variable have_work;
+		// multicore preparator, results are shared with executor tasks, which can outlive downloader
+		struct PreparedBlocks {
+			std::mutex mu;
+			std::map<Hash, PreparedBlock> blocks;
+		};
+		std::shared_ptr<PreparedBlocks> prepared_blocks = std::make_shared<PreparedBlocks>();
+		common::CancelToken prepare_token;
 		platform::EventLoop *main_loop = nullptr;
-		bool quit                      = false;
-		void add_work(std::tuple<Hash, bool, RawBlock> &&wo);
-		void thread_run();
+		struct PrepareWork {
+			Hash bid;
+			bool check_pow = false;
+			RawBlock rb;
+		};
+		void add_work(std::vector<PrepareWork> &&work);
 
 		void start_download(DownloadCell &dc, P2PClientCryonero *who);
 		void stop_download(DownloadCell &dc, bool success);
@@ -14,6 +14,9 @@ using namespace cryonerocoin;
 
 static const bool multicore = true;
 
+// Scratchpads of 2 lite PoW hashes fit into L2 of common CPUs, 4 do not and are not faster than 2
+static const size_t POW_WAYS = 2;
+
 Node::DownloaderV11::DownloaderV11(Node *node, BlockChainState &block_chain)
     : m_node(node)
     , m_block_chain(block_chain)
@@ -22,53 +25,54 @@ Node::DownloaderV11::DownloaderV11(Node *node, BlockChainState &block_chain)
     , log_request_timestamp(std::chrono::steady_clock::now())
     , log_response_timestamp(std::chrono::steady_clock::now()) {
 	if (multicore) {
-		auto th_count = std::max<size_t>(2, std::thread::hardware_concurrency() / 2);
-
-		for (size_t i = 0; i != th_count; ++i)
-			threads.emplace_back(&DownloaderV11::thread_run, this);
 		main_loop = platform::EventLoop::current();
+		auto &pool = crypto::CryptoNightContextPool::instance();
+		pool.warm_up(common::Executor::instance().get_thread_count(), POW_WAYS);
+		m_node->m_log(logging::INFO) << "PoW scratchpads use " << pool.acquire(POW_WAYS)->get_pages_name()
+		                             << std::endl;
 	}
 	m_download_timer.once(SYNC_TIMEOUT / 8); 
 }
 
 Node::DownloaderV11::~DownloaderV11() {
-	{
-		std::unique_lock<std::mutex> lock(mu);
-		quit = true;
-		have_work.notify_all();
-	}
-	for (auto &&th : threads)
-		th.join();
-}
-
-void Node::DownloaderV11::add_work(std::tuple<Hash, bool, RawBlock> &&wo) {
-	std::unique_lock<std::mutex> lock(mu);
-	work.push_back(std::move(wo));
-	have_work.notify_all();
+	std::unique_lock<std::mutex> lock(prepared_blocks->mu);
+	prepare_token.cancel();  // under mutex, so no task wakes main loop after
 }
 
-void Node::DownloaderV11::thread_run() {
-	crypto::CryptoNightContext hash_crypto_context;
-	while (true) {
-		std::tuple<Hash, bool, RawBlock> wo;
-		{
-			std::unique_lock<std::mutex> lock(mu);
-			if (quit)
-				return;
-			if (work.empty()) {
-				have_work.wait(lock);
-				continue;
+void Node::DownloaderV11::add_work(std::vector<PrepareWork> &&work) {
+	// Fewer blocks per task when there are not enough for all executor threads
+	const size_t threads = common::Executor::instance().get_thread_count();
+	const size_t group   = std::max<size_t>(1, std::min(POW_WAYS, work.size() / threads));
+	std::vector<common::Executor::Task> tasks;
+	for (size_t pos = 0; pos < work.size(); pos += group) {
+		std::vector<PrepareWork> items(std::make_move_iterator(work.begin() + pos),
+		    std::make_move_iterator(work.begin() + std::min(work.size(), pos + group)));
+		tasks.push_back([pbs = prepared_blocks, token = prepare_token, loop = main_loop,
+		                    items = std::move(items)]() mutable {
+			std::vector<PreparedBlock> results;
+			std::vector<const BlockTemplate *> pow_headers;
+			results.reserve(items.size());
+			for (auto &&item : items) {
+				results.emplace_back(std::move(item.rb), nullptr);
+				if (item.check_pow)
+					pow_headers.push_back(&results.back().block.header);
 			}
-			wo = std::move(work.front());
-			work.pop_front();
-		}
-		PreparedBlock result(std::move(std::get<2>(wo)), std::get<1>(wo) ? &hash_crypto_context : nullptr);
-		{
-			std::unique_lock<std::mutex> lock(mu);
-			prepared_blocks[std::get<0>(wo)] = std::move(result);
-			main_loop->wake(); 
-		}
+			if (!pow_headers.empty()) {
+				auto hash_crypto_context = crypto::CryptoNightContextPool::instance().acquire(POW_WAYS);
+				const auto long_hashes   = get_block_long_hashes(pow_headers, *hash_crypto_context);
+				for (size_t i = 0, j = 0; i != items.size(); ++i)
+					if (items[i].check_pow)
+						results[i].long_block_hash = long_hashes.at(j++);
+			}
+			std::unique_lock<std::mutex> lock(pbs->mu);
+			if (token.is_cancelled())
+				return;
+			for (size_t i = 0; i != items.size(); ++i)
+				pbs->blocks[items[i].bid] = std::move(results[i]);
+			loop->wake();
+		});
 	}
+	common::Executor::instance().submit_batch(common::Executor::SYNC, prepare_token, std::move(tasks));
 }
 
 uint32_t Node::DownloaderV11::get_known_block_count(uint32_t my) const {
@@ -170,8 +174,9 @@ void Node::DownloaderV11::advance_chain() {
 		if (who.first->get_last_received_sync_data().current_height + GOOD_LAG < m_node->m_block_chain.get_tip_height())
 			lagging_clients.push_back(who.first);
 		api::BlockHeader info;
-		if (!m_node->m_block_chain.read_header(who.first->get_last_received_sync_data().top_id, &info))
-			worth_clients.push_back(who.first);
+		if (!m_node->m_block_chain.read_header(who.first->get_last_received_sync_data().top_id, &info) &&
+		    who.first->get_last_received_sync_data().pruned_height <= m_node->m_block_chain.get_tip_height() + 1)
+			worth_clients.push_back(who.first);  // pruned peers cannot give us blocks we need
 	}
 	if (lagging_clients.size() > m_node->m_config.p2p_default_connections_count / 4) {
 		auto who = lagging_clients.front();
@@ -236,6 +241,7 @@ void Node::DownloaderV11::stop_download(DownloadCell &dc, bool success) {
 
 void Node::DownloaderV11::on_msg_notify_request_objects(P2PClientCryonero *who,
     const NOTIFY_RESPONSE_GET_OBJECTS::request &req) {
+	std::vector<PrepareWork> work;  // prepared together, so PoW of several blocks is interleaved
 	for (auto &&rb : req.blocks) {
 		Hash bid;
 		try {
@@ -267,9 +273,9 @@ void Node::DownloaderV11::on_msg_notify_request_objects(P2PClientCryonero *who,
 			cell_found = true;
 			if (multicore) {
 				dc.status = DownloadCell::PREPARING;
-				add_work(std::tuple<Hash, bool, RawBlock>(dc.bid,
+				work.push_back(PrepareWork{dc.bid,
 				    !m_node->m_block_chain.get_currency().is_in_sw_checkpoint_zone(dc.expected_height),
-				    std::move(dc.rb)));
+				    std::move(dc.rb)});
 			} else {
 				dc.pb     = PreparedBlock(std::move(dc.rb), nullptr);
 				dc.status = DownloadCell::PREPARED;
@@ -281,6 +287,7 @@ void Node::DownloaderV11::on_msg_notify_request_objects(P2PClientCryonero *who,
 
 		}
 	}
+	add_work(std::move(work));
 	for (auto &&bid : req.missed_ids) {
 		for (size_t dit_counter = 0; dit_counter != m_download_chain.size(); ++dit_counter) {
 			auto & dit = m_download_chain.at(dit_counter);
@@ -307,8 +314,8 @@ void Node::DownloaderV11::on_msg_notify_request_objects(P2PClientCryonero *who,
 bool Node::DownloaderV11::on_idle() {
 	int added_counter = 0;
 	if (multicore) {
-		std::unique_lock<std::mutex> lock(mu);
-		for (auto &&pb : prepared_blocks) {
+		std::unique_lock<std::mutex> lock(prepared_blocks->mu);
+		for (auto &&pb : prepared_blocks->blocks) {
 			for (auto &&dc : m_download_chain)
 				if (dc.status == DownloadCell::PREPARING && dc.bid == pb.first) {
 					dc.pb     = std::move(pb.second);
@@ -316,12 +323,22 @@ bool Node::DownloaderV11::on_idle() {
 					break;
 				}
 		}
-		prepared_blocks.clear();
+		prepared_blocks->blocks.clear();
 	}
+	const size_t SPECULATIVE_BLOCKS = 8;
 	auto idea_start = std::chrono::high_resolution_clock::now();
 	while (!m_download_chain.empty() && m_download_chain.front().status == DownloadCell::PREPARED) {
 		DownloadCell dc = std::move(m_download_chain.front());
 		m_download_chain.pop_front();
+		// checker threads are idle while dc is written to DB, so they check next blocks
+		for (size_t i = 0; i != std::min(SPECULATIVE_BLOCKS, m_download_chain.size()); ++i) {
+			auto &next = m_download_chain.at(i);
+			if (next.status != DownloadCell::PREPARED)
+				break;
+			if (!next.speculated)
+				m_block_chain.start_speculative_checks(next.pb.block, next.expected_height);
+			next.speculated = true;
+		}
 		api::BlockHeader info;
 		auto action = m_block_chain.add_block(
 		    dc.pb, &info, common::ip_address_and_port_to_string(dc.block_source.ip, dc.block_source.port));
@@ -418,14 +435,16 @@ void Node::DownloaderV11::advance_download() {
 			size_t speed =
 			    std::max<size_t>(1, std::min<size_t>(TOTAL_DOWNLOAD_BLOCKS / 4, who_downloaded_counter[who.first]));
 
-			if (who.second * ready_speed < ready_counter * speed &&
-			    who.first->get_last_received_sync_data().current_height >= dit.expected_height) {
+			const auto &sync_data = who.first->get_last_received_sync_data();
+			if (who.second * ready_speed < ready_counter * speed && sync_data.current_height >= dit.expected_height &&
+			    sync_data.pruned_height <= dit.expected_height) {
 				ready_client  = who.first;
 				ready_counter = who.second;
 				ready_speed   = speed;
 			}
 		}
-		if (!ready_client && m_chain_client)
+		if (!ready_client && m_chain_client &&
+		    m_chain_client->get_last_received_sync_data().pruned_height <= dit.expected_height)
 			ready_client = m_chain_client;
 		if (!ready_client) { 
 			m_node->m_log(logging::INFO)
@@ -10,6 +10,7 @@
 #include "Node.hpp"
 #include "TransactionExtra.hpp"
 #include "common/JsonValue.hpp"
+#include "platform/Time.hpp"
 #include "seria/BinaryInputStream.hpp"
 #include "seria/BinaryOutputStream.hpp"
 #include "seria/KVBinaryInputStream.hpp"
@@ -82,6 +83,13 @@ bool Node::on_getblocktemplate(http::Client *who, http::RequestData &&raw_reques
 	m_log(logging::INFO) << "Node received getblocktemplate CUR transaction_pool_version="
 	                     << m_block_chain.get_tx_pool_version() << " top_block_hash=" << m_block_chain.get_tip_bid()
 	                     << std::endl;
+	if (req.template_id != Hash{}) {
+		getblocktemplate(req, res);
+		if (res.template_id != req.template_id)
+			return true;
+		sta.top_block_hash           = m_block_chain.get_tip_bid();
+		sta.transaction_pool_version = m_block_chain.get_tx_pool_version();
+	}
 	if (sta.top_block_hash == m_block_chain.get_tip_bid() &&
 	    sta.transaction_pool_version == m_block_chain.get_tx_pool_version()) {
 
@@ -97,6 +105,56 @@ bool Node::on_getblocktemplate(http::Client *who, http::RequestData &&raw_reques
 	return true;
 }
 
+void Node::prebuild_block_templates() {
+	if (m_block_templates.empty() || m_block_templates.begin()->second.top_block_hash == m_block_chain.get_tip_bid())
+		return;
+	std::vector<std::pair<uint32_t, AccountPublicAddress>> keys;
+	for (auto &&bt : m_block_templates)
+		keys.push_back(std::make_pair(bt.first, bt.second.address));
+	for (auto &&key : keys) {
+		try {
+			get_shared_block_template(key.second, key.first);
+		} catch (const std::exception &ex) {
+			m_log(logging::WARNING) << "Failed to prebuild block template, what=" << ex.what() << std::endl;
+		}
+	}
+}
+
+const Node::SharedBlockTemplate &Node::get_shared_block_template(
+    const AccountPublicAddress &acc, uint32_t reserve_size) {
+	const Hash tip_bid          = m_block_chain.get_tip_bid();
+	const uint32_t pool_version = m_block_chain.get_tx_pool_version();
+	auto bit                    = m_block_templates.find(reserve_size);
+	if (bit != m_block_templates.end() && bit->second.top_block_hash == tip_bid &&
+	    bit->second.transaction_pool_version == pool_version)
+		return bit->second;
+
+	SharedBlockTemplate st;
+	BinaryArray blob_reserve;
+	blob_reserve.resize(reserve_size, 0);
+
+	if (!m_block_chain.create_mining_block_template(
+	        &st.block_template, acc, blob_reserve, &st.difficulty, &st.height)) {
+		m_log(logging::ERROR) << "Failed to create block template";
+		throw json_rpc::Error{CORE_RPC_ERROR_CODE_INTERNAL_ERROR, "Internal error: failed to create block template"};
+	}
+	st.address                  = acc;
+	st.top_block_hash           = tip_bid;
+	st.transaction_pool_version = pool_version;
+
+	BinaryArray id_data(std::begin(tip_bid.data), std::end(tip_bid.data));
+	for (auto &&tid : st.block_template.transaction_hashes)
+		id_data.insert(id_data.end(), std::begin(tid.data), std::end(tid.data));
+	st.template_id = crypto::cn_fast_hash(id_data.data(), id_data.size());
+
+	if (!m_block_templates.empty() && m_block_templates.begin()->second.template_id == st.template_id) {
+		for (auto &&bt : m_block_templates)  // pool changed only past selection, others are still valid
+			bt.second.transaction_pool_version = pool_version;
+	} else
+		m_block_templates.clear();
+	return m_block_templates[reserve_size] = std::move(st);
+}
+
 void Node::getblocktemplate(const api::cryonerod::GetBlockTemplate::Request &req,
     api::cryonerod::GetBlockTemplate::Response &res) {
 	if (req.reserve_size > TX_EXTRA_NONCE_MAX_COUNT) {
@@ -110,14 +168,15 @@ void Node::getblocktemplate(const api::cryonerod::GetBlockTemplate::Request &req
 		throw json_rpc::Error{CORE_RPC_ERROR_CODE_WRONG_WALLET_ADDRESS, "Failed to parse wallet address"};
 	}
 
-	BlockTemplate block_template{};
-	BinaryArray blob_reserve;
-	blob_reserve.resize(req.reserve_size, 0);
-
-	if (!m_block_chain.create_mining_block_template(&block_template, acc, blob_reserve, &res.difficulty, &res.height)) {
-		m_log(logging::ERROR) << "Failed to create block template";
+	const SharedBlockTemplate &st = get_shared_block_template(acc, req.reserve_size);
+	BlockTemplate block_template  = st.block_template;
+	block_template.timestamp      = std::max(block_template.timestamp, platform::now_unix_timestamp());
+	if (!m_block_chain.get_currency().set_miner_tx_key(acc, &block_template.base_transaction)) {
+		m_log(logging::ERROR) << "Failed to set coinbase key of block template";
 		throw json_rpc::Error{CORE_RPC_ERROR_CODE_INTERNAL_ERROR, "Internal error: failed to create block template"};
 	}
+	res.difficulty = st.difficulty;
+	res.height     = st.height;
 
 	BinaryArray block_blob = seria::to_binary(block_template);
 	PublicKey tx_pub_key   = get_transaction_public_key_from_extra(block_template.base_transaction.extra);
@@ -146,10 +205,11 @@ void Node::getblocktemplate(const api::cryonerod::GetBlockTemplate::Request &req
 	}
 
 	res.blocktemplate_blob       = block_blob;
-	res.top_block_hash           = m_block_chain.get_tip_bid();
+	res.top_block_hash           = st.top_block_hash;
 	res.transaction_pool_version = m_block_chain.get_tx_pool_version();
 	res.previous_block_hash = m_block_chain.get_tip().previous_block_hash;
 	res.status                   = CORE_RPC_STATUS_OK;
+	res.template_id              = st.template_id;
 }
 
 bool Node::on_get_currency_id(http::Client *, http::RequestData &&, json_rpc::Request &&,
@@ -5,6 +5,11 @@
 // Licensed under the GNU Lesser General Public License. See LICENSE for details.
 
 #include "RingCheckerMulticore.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <iterator>
 #include "BlockChainState.hpp"
 #include "Currency.hpp"
 #include "TransactionExtra.hpp"
@@ -12,74 +17,73 @@
 
 using namespace cryonerocoin;
 
-RingCheckerMulticore::RingCheckerMulticore() {
-	auto th_count = std::max<size_t>(2, 3 * std::thread::hardware_concurrency() / 4);
-	for (size_t i = 0; i != th_count; ++i)
-		threads.emplace_back(&RingCheckerMulticore::thread_run, this);
+static const size_t MAX_SPECULATIVE_RESULTS = 100000;  // failed speculations are never consumed
+
+bool RingSignatureArg::same_input(
+    const Hash &other_prefix_hash, const KeyInput &in, const std::vector<Signature> &other_signatures) const {
+	return tx_prefix_hash == other_prefix_hash && key_image == in.key_image && amount == in.amount &&
+	       output_indexes == in.output_indexes && signatures.size() == other_signatures.size() &&
+	       std::memcmp(signatures.data(), other_signatures.data(), signatures.size() * sizeof(Signature)) == 0;
 }
 
-RingCheckerMulticore::~RingCheckerMulticore() {
-	{
-		std::unique_lock<std::mutex> lock(mu);
-		quit = true;
-		have_work.notify_all();
+static const size_t RING_CHECK_BATCH = 16;  // inputs per task, they share one field inversion
+
+// checks[i].result and checks[i].key_corrupted are results for args[i]
+static std::vector<crypto::RingSignatureCheck> check_args(const std::vector<RingSignatureArg> &args) {
+	std::vector<std::vector<const PublicKey *>> output_key_pointers(args.size());
+	std::vector<crypto::RingSignatureCheck> checks(args.size());
+	for (size_t i = 0; i != args.size(); ++i) {
+		const RingSignatureArg &arg = args[i];
+		for (const auto &key : arg.output_keys)
+			output_key_pointers[i].push_back(&key);
+		checks[i].prefix_hash = &arg.tx_prefix_hash;
+		checks[i].image       = &arg.key_image;
+		checks[i].pubs        = output_key_pointers[i].data();
+		checks[i].pubs_count  = output_key_pointers[i].size();
+		checks[i].sigs        = arg.signatures.data();
 	}
-	for (auto &&th : threads)
-		th.join();
+	crypto::check_ring_signatures(checks.data(), checks.size());
+	return checks;
 }
 
-void RingCheckerMulticore::thread_run() {
-	while (true) {
-		RingSignatureArg arg;
-		int local_work_counter = 0;
-		{
-			std::unique_lock<std::mutex> lock(mu);
-			if (quit)
-				return;
-			if (args.empty()) {
-				have_work.wait(lock);
-				continue;
-			}
-			local_work_counter = work_counter;
-			arg                = std::move(args.front());
-			args.pop_front();
-		}
-		std::vector<const PublicKey *> output_key_pointers;
-		output_key_pointers.reserve(arg.output_keys.size());
-		std::for_each(arg.output_keys.begin(), arg.output_keys.end(),
-		    [&output_key_pointers](const PublicKey &key) { output_key_pointers.push_back(&key); });
-		bool key_corrupted = false;
-		bool result        = check_ring_signature(arg.tx_prefix_hash, arg.key_image, output_key_pointers.data(),
-            output_key_pointers.size(), arg.signatures.data(), true, &key_corrupted);
-		{
-			std::unique_lock<std::mutex> lock(mu);
-			if (local_work_counter == work_counter) {
-				ready_counter += 1;
-				if (!result && key_corrupted)  // TODO - db corrupted
-					errors.push_back("INPUT_CORRUPTED_SIGNATURES");
-				if (!result && !key_corrupted)
-					errors.push_back("INPUT_INVALID_SIGNATURES");
-				result_ready.notify_all();
-			}
-		}
-	}
+// Smaller groups for small blocks, so all executor threads get work
+static std::vector<std::vector<RingSignatureArg>> split_args(std::vector<RingSignatureArg> &&args) {
+	const size_t threads = common::Executor::instance().get_thread_count();
+	const size_t group   = std::max<size_t>(1, std::min(RING_CHECK_BATCH, args.size() / threads));
+	std::vector<std::vector<RingSignatureArg>> groups;
+	for (size_t pos = 0; pos < args.size(); pos += group)
+		groups.emplace_back(std::make_move_iterator(args.begin() + pos),
+		    std::make_move_iterator(args.begin() + std::min(args.size(), pos + group)));
+	return groups;
+}
+
+RingCheckerMulticore::RingCheckerMulticore() {}
+
+RingCheckerMulticore::~RingCheckerMulticore() {
+	work_token.cancel();
+	lifetime_token.cancel();
 }
+
 void RingCheckerMulticore::cancel_work() {
-	std::unique_lock<std::mutex> lock(mu);
-	args.clear();
-	work_counter += 1;
+	std::unique_lock<std::mutex> lock(results->mu);
+	work_token.cancel();
+	work_token = common::CancelToken();
+	// Cancelled tasks never report, so dropped checks count as finished for signatures_valid
+	results->ready_counter = total_counter;
+	results->result_ready.notify_all();
 }
 
 std::string RingCheckerMulticore::start_work_get_error(IBlockChainState *state, const Currency &currency,
     const Block &block, Height unlock_height, Timestamp unlock_timestamp) {
 	{
-		std::unique_lock<std::mutex> lock(mu);
-		args.clear();
-		errors.clear();
-		ready_counter = 0;
-		work_counter += 1;
+		std::unique_lock<std::mutex> lock(results->mu);
+		work_token.cancel();
+		work_token = common::CancelToken();
+		results->errors.clear();
+		results->ready_counter = 0;
 	}
 	total_counter = 0;
+	std::vector<RingSignatureArg> new_args;
 	for (auto &&transaction : block.transactions) {
 		auto tx_prefix_hash = get_transaction_prefix_hash(transaction);
 		size_t input_index  = 0;
@@ -87,15 +91,36 @@ std::string RingCheckerMulticore::start_work_get_error(IBlockChainState *state,
 			if (input.type() == typeid(CoinbaseInput)) {
 			} else if (input.type() == typeid(KeyInput)) {
 				const KeyInput &in = boost::get<KeyInput>(input);
-				RingSignatureArg arg;
-				arg.tx_prefix_hash = tx_prefix_hash;
-				arg.key_image      = in.key_image;
-				arg.signatures     = transaction.signatures[input_index];
 				Height height      = 0;
 				if (state->read_keyimage(in.key_image, &height))
 					return "INPUT_KEYIMAGE_ALREADY_SPENT";
 				if (in.output_indexes.empty())
 					return "INPUT_UNKNOWN_TYPE";
+				total_counter += 1;
+				{
+					std::unique_lock<std::mutex> lock(results->mu);
+					auto sit = results->speculative_results.find(in.key_image);
+					if (sit != results->speculative_results.end()) {
+						const SpeculativeResult spec = std::move(sit->second);
+						results->speculative_results.erase(sit);
+						if (spec.arg.same_input(tx_prefix_hash, in, transaction.signatures[input_index])) {
+							for (auto &&unlock_time : spec.arg.unlock_times)
+								if (!currency.is_transaction_spend_time_unlocked(
+								        unlock_time, unlock_height, unlock_timestamp))
+									return "INPUT_SPEND_LOCKED_OUT";
+							results->ready_counter += 1;
+							if (!spec.result)
+								results->errors.push_back(
+								    spec.key_corrupted ? "INPUT_CORRUPTED_SIGNATURES" : "INPUT_INVALID_SIGNATURES");
+							input_index++;
+							continue;
+						}
+					}
+				}
+				RingSignatureArg arg;
+				arg.tx_prefix_hash = tx_prefix_hash;
+				arg.key_image      = in.key_image;
+				arg.signatures     = transaction.signatures[input_index];
 				std::vector<uint32_t> global_indexes(in.output_indexes.size());
 				global_indexes[0] = in.output_indexes[0];
 				for (size_t i = 1; i < in.output_indexes.size(); ++i) {
@@ -110,26 +135,239 @@ std::string RingCheckerMulticore::start_work_get_error(IBlockChainState *state,
 						return "INPUT_SPEND_LOCKED_OUT";
 					arg.output_keys[i] = unp.public_key;
 				}
-
-				total_counter += 1;
-				std::unique_lock<std::mutex> lock(mu);
-				args.push_back(std::move(arg));
-				have_work.notify_all();
+				new_args.push_back(std::move(arg));
 			}
 			input_index++;
 		}
 	}
+	std::vector<common::Executor::Task> tasks;
+	for (auto &&group : split_args(std::move(new_args)))
+		tasks.push_back([res = results, token = work_token, group = std::move(group)]() {
+			const auto checks = check_args(group);
+			std::unique_lock<std::mutex> lock(res->mu);
+			if (token.is_cancelled())
+				return;
+			for (const auto &check : checks) {
+				res->ready_counter += 1;
+				if (!check.result && check.key_corrupted)  // TODO - db corrupted
+					res->errors.push_back("INPUT_CORRUPTED_SIGNATURES");
+				if (!check.result && !check.key_corrupted)
+					res->errors.push_back("INPUT_INVALID_SIGNATURES");
+			}
+			res->result_ready.notify_all();
+		});
+	common::Executor::instance().submit_batch(common::Executor::CONSENSUS, work_token, std::move(tasks));
 	return std::string();
 }
 
-bool RingCheckerMulticore::signatures_valid() const {
-	while (true) {
-		std::unique_lock<std::mutex> lock(mu);
-		if (ready_counter != total_counter) {
-			result_ready.wait(lock);
-			continue;
+static void add_resolved_args(
+    const IBlockChainState *state, const Transaction &transaction, std::vector<RingSignatureArg> *new_args) {
+	auto tx_prefix_hash = get_transaction_prefix_hash(transaction);
+	size_t input_index  = 0;
+	for (const auto &input : transaction.inputs) {
+		if (input.type() == typeid(KeyInput) && input_index < transaction.signatures.size()) {
+			const KeyInput &in = boost::get<KeyInput>(input);
+			Height height      = 0;
+			bool resolved      = !in.output_indexes.empty() && !state->read_keyimage(in.key_image, &height);
+			RingSignatureArg arg;
+			uint32_t global_index = 0;
+			for (size_t i = 0; resolved && i != in.output_indexes.size(); ++i) {
+				global_index += in.output_indexes[i];
+				IBlockChainState::UnlockTimePublickKeyHeightSpent unp;
+				resolved = state->read_amount_output(in.amount, global_index, &unp);
+				arg.output_keys.push_back(unp.public_key);
+				arg.unlock_times.push_back(unp.unlock_time);
+			}
+			if (resolved) {  // unlock is checked by redo with unlock_times, it does not change signature validity
+				arg.tx_prefix_hash = tx_prefix_hash;
+				arg.key_image      = in.key_image;
+				arg.signatures     = transaction.signatures[input_index];
+				arg.amount         = in.amount;
+				arg.output_indexes = in.output_indexes;
+				new_args->push_back(std::move(arg));
+			}
 		}
-		return errors.empty();
+		input_index++;
 	}
 }
 
+void RingCheckerMulticore::start_speculative_work(const IBlockChainState *state, const Block &block) {
+	std::vector<RingSignatureArg> new_args;
+	for (auto &&transaction : block.transactions)
+		add_resolved_args(state, transaction, &new_args);
+	uint64_t generation = 0;
+	{
+		std::unique_lock<std::mutex> lock(results->mu);
+		generation = results->speculative_generation;
+	}
+	std::vector<common::Executor::Task> tasks;
+	for (auto &&group : split_args(std::move(new_args)))
+		tasks.push_back([res = results, generation, group = std::move(group)]() mutable {
+			const auto checks = check_args(group);
+			std::unique_lock<std::mutex> lock(res->mu);
+			if (res->speculative_generation != generation)
+				return;
+			if (res->speculative_results.size() >= MAX_SPECULATIVE_RESULTS)
+				res->speculative_results.clear();
+			for (size_t i = 0; i != group.size(); ++i) {
+				const KeyImage key_image = group[i].key_image;
+				res->speculative_results[key_image] =
+				    SpeculativeResult{std::move(group[i]), checks[i].result, checks[i].key_corrupted};
+			}
+		});
+	common::Executor::instance().submit_batch(common::Executor::SYNC, lifetime_token, std::move(tasks));
+}
+
+void RingCheckerMulticore::drop_speculative_results() {
+	std::unique_lock<std::mutex> lock(results->mu);
+	results->speculative_generation += 1;
+	results->speculative_results.clear();
+}
+
+void RingCheckerMulticore::check_batch(
+    const IBlockChainState *state, const std::vector<const Transaction *> &transactions) {
+	std::vector<RingSignatureArg> new_args;
+	for (auto &&transaction : transactions)
+		add_resolved_args(state, *transaction, &new_args);
+	std::vector<common::Executor::Task> tasks;
+	for (auto &&group : split_args(std::move(new_args)))
+		tasks.push_back([res = results, group = std::move(group)]() mutable {
+			const auto checks = check_args(group);
+			std::unique_lock<std::mutex> lock(res->mu);
+			for (size_t i = 0; i != group.size(); ++i) {
+				const KeyImage key_image = group[i].key_image;
+				res->batch_results[key_image] =
+				    SpeculativeResult{std::move(group[i]), checks[i].result, checks[i].key_corrupted};
+			}
+			res->batch_pending -= 1;
+			res->result_ready.notify_all();
+		});
+	std::unique_lock<std::mutex> lock(results->mu);
+	results->batch_results.clear();  // results of previous batch were consumed or are for rejected transactions
+	results->batch_pending += tasks.size();
+	common::Executor::instance().submit_batch(common::Executor::CONSENSUS, lifetime_token, std::move(tasks));
+	while (results->batch_pending != 0)
+		results->result_ready.wait(lock);
+}
+
+bool RingCheckerMulticore::take_batch_result(const Hash &tx_prefix_hash, const KeyImage &key_image,
+    const std::vector<PublicKey> &output_keys, const std::vector<Signature> &signatures, bool *result,
+    bool *key_corrupted) {
+	std::unique_lock<std::mutex> lock(results->mu);
+	auto bit = results->batch_results.find(key_image);
+	if (bit == results->batch_results.end())
+		return false;
+	const RingSignatureArg &arg = bit->second.arg;
+	const bool same = arg.tx_prefix_hash == tx_prefix_hash && arg.output_keys == output_keys &&
+	                  arg.signatures.size() == signatures.size() &&
+	                  std::memcmp(arg.signatures.data(), signatures.data(), signatures.size() * sizeof(Signature)) == 0;
+	if (same) {
+		*result        = bit->second.result;
+		*key_corrupted = bit->second.key_corrupted;
+	}
+	results->batch_results.erase(bit);
+	return same;
+}
+
+namespace {
+
+// Serves outputs for benchmark transactions, all of amount 0
+class BenchmarkState : public IBlockChainState {
+public:
+	std::vector<PublicKey> outputs;
+	void store_keyimage(const KeyImage &, Height) override {}
+	void delete_keyimage(const KeyImage &) override {}
+	bool read_keyimage(const KeyImage &, Height *) const override { return false; }
+	uint32_t push_amount_output(Amount, UnlockMoment, Height, const PublicKey &) override { return 0; }
+	void pop_amount_output(Amount, UnlockMoment, const PublicKey &) override {}
+	uint32_t next_global_index_for_amount(Amount) const override { return static_cast<uint32_t>(outputs.size()); }
+	bool read_amount_output(Amount, uint32_t global_index, UnlockTimePublickKeyHeightSpent *unp) const override {
+		if (global_index >= outputs.size())
+			return false;
+		unp->public_key = outputs[global_index];
+		return true;
+	}
+	void spend_output(Amount, uint32_t) override {}
+};
+
+}  // anonymous namespace
+
+void cryonerocoin::run_ring_check_benchmark(size_t tx_count) {
+	const size_t INPUTS = 2, RING_SIZE = 4;
+	BenchmarkState state;
+	std::vector<SecretKey> secrets;
+	for (size_t i = 0; i != tx_count * INPUTS + RING_SIZE; ++i) {
+		const auto keys = crypto::random_keypair();
+		state.outputs.push_back(keys.public_key);
+		secrets.push_back(keys.secret_key);
+	}
+	std::vector<Transaction> transactions(tx_count);
+	for (size_t t = 0; t != tx_count; ++t) {
+		Transaction &tx = transactions[t];
+		for (size_t j = 0; j != INPUTS; ++j) {  // real output is the last one in ring
+			const uint32_t real_index = static_cast<uint32_t>(RING_SIZE + t * INPUTS + j);
+			KeyInput in;
+			in.output_indexes.assign(RING_SIZE, 1);
+			in.output_indexes[0] = real_index - static_cast<uint32_t>(RING_SIZE - 1);
+			crypto::generate_key_image(state.outputs[real_index], secrets[real_index], in.key_image);
+			tx.inputs.push_back(in);
+		}
+		const Hash tx_prefix_hash = get_transaction_prefix_hash(tx);
+		for (auto &&input : tx.inputs) {
+			const KeyInput &in = boost::get<KeyInput>(input);
+			const uint32_t real_index =
+			    in.output_indexes[0] + static_cast<uint32_t>(RING_SIZE - 1);
+			std::vector<const PublicKey *> pubs;
+			for (size_t i = 0; i != RING_SIZE; ++i)
+				pubs.push_back(&state.outputs.at(in.output_indexes[0] + i));
+			tx.signatures.emplace_back(RING_SIZE);
+			crypto::generate_ring_signature(tx_prefix_hash, in.key_image, pubs.data(), pubs.size(),
+			    secrets[real_index], RING_SIZE - 1, tx.signatures.back().data());
+		}
+	}
+	std::cout << "Ring check benchmark of " << tx_count << " transactions with " << INPUTS << " inputs of ring size "
+	          << RING_SIZE << std::endl;
+	RingCheckerMulticore checker;
+	for (int batch = 0; batch != 2; ++batch) {
+		const auto start = std::chrono::steady_clock::now();
+		size_t valid = 0;
+		if (batch) {
+			std::vector<const Transaction *> pointers;
+			for (auto &&tx : transactions)
+				pointers.push_back(&tx);
+			checker.check_batch(&state, pointers);
+		}
+		for (auto &&tx : transactions) {  // same work redo_transaction_get_error does per input
+			const Hash tx_prefix_hash = get_transaction_prefix_hash(tx);
+			for (size_t j = 0; j != tx.inputs.size(); ++j) {
+				const KeyInput &in = boost::get<KeyInput>(tx.inputs[j]);
+				std::vector<PublicKey> output_keys;
+				std::vector<const PublicKey *> output_key_pointers;
+				for (size_t i = 0; i != RING_SIZE; ++i)
+					output_keys.push_back(state.outputs.at(in.output_indexes[0] + i));
+				for (auto &&key : output_keys)
+					output_key_pointers.push_back(&key);
+				bool result = false, key_corrupted = false;
+				if (!checker.take_batch_result(
+				        tx_prefix_hash, in.key_image, output_keys, tx.signatures[j], &result, &key_corrupted))
+					result = crypto::check_ring_signature(tx_prefix_hash, in.key_image, output_key_pointers,
+					    tx.signatures[j].data(), true, &key_corrupted);
+				valid += result ? 1 : 0;
+			}
+		}
+		const auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+		if (valid != tx_count * INPUTS)
+			throw std::runtime_error("run_ring_check_benchmark signature check failed");
+		std::cout << (batch ? "batch" : "inline") << ": " << us.count() / 1000 << " ms, "
+		          << static_cast<uint64_t>(tx_count * 1000000.0 / std::max<int64_t>(1, us.count())) << " tx/sec"
+		          << std::endl;
+	}
+}
+
+bool RingCheckerMulticore::signatures_valid() const {
+	std::unique_lock<std::mutex> lock(results->mu);
+	while (results->ready_counter != total_counter)
+		results->result_ready.wait(lock);
+	return results->errors.empty();
+}
+
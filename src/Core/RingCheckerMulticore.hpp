@@ -7,10 +7,11 @@
 #pragma once
 
 #include <condition_variable>
-#include <deque>
+#include <map>
+#include <memory>
 #include <mutex>
-#include <thread>
 #include "CryptoNote.hpp"
+#include "common/Executor.hpp"
 #include "rpc_api.hpp"
 
 
@@ -25,22 +26,37 @@ struct RingSignatureArg {
 	KeyImage key_image;
 	std::vector<PublicKey> output_keys;
 	std::vector<Signature> signatures;
+	// ring as resolved from state, so block redo can take speculative result without reading outputs again
+	Amount amount = 0;
+	std::vector<uint32_t> output_indexes;
+	std::vector<UnlockMoment> unlock_times;
+	bool same_input(const Hash &tx_prefix_hash, const KeyInput &in, const std::vector<Signature> &signatures) const;
 };
 
 class RingCheckerMulticore {
-	std::vector<std::thread> threads;
-	mutable std::mutex mu;
-	mutable std::condition_variable have_work;
-	mutable std::condition_variable result_ready;
-	bool quit = false;
-
+	// Checks for blocks not yet applied, done with lower priority than work for current block. Signature
+	// validity depends only on args, so result is used if current block produces exactly the same args.
+	struct SpeculativeResult {
+		RingSignatureArg arg;
+		bool result;
+		bool key_corrupted;
+	};
+	struct Results {  // shared with executor tasks, which can outlive checker
+		std::mutex mu;
+		std::condition_variable result_ready;
+		size_t ready_counter = 0;
+		std::vector<std::string> errors;
+		std::map<KeyImage, SpeculativeResult> speculative_results;
+		uint64_t speculative_generation = 0;  // changed when outputs are undone, results of earlier tasks are dropped
+		// Checks for pool transactions received in batch. Redo of the same input takes result instead of
+		// checking inline
+		size_t batch_pending = 0;
+		std::map<KeyImage, SpeculativeResult> batch_results;
+	};
+	std::shared_ptr<Results> results = std::make_shared<Results>();
 	size_t total_counter = 0;
-	size_t ready_counter = 0;
-	std::vector<std::string> errors;
-
-	std::deque<RingSignatureArg> args;
-	int work_counter = 0;
-	void thread_run();
+	common::CancelToken work_token;  // replaced for each block
+	common::CancelToken lifetime_token;
 
 public:
 	RingCheckerMulticore();
@@ -49,7 +65,15 @@ public:
 	std::string start_work_get_error(IBlockChainState *state, const Currency &currency, const Block &block,
 	    Height unlock_height, Timestamp unlock_timestamp);  
 	bool signatures_valid() const;
+	void start_speculative_work(const IBlockChainState *state, const Block &block);  // inputs state cannot resolve yet are skipped
+	void drop_speculative_results();  // call when outputs are undone, rings resolved before may be stale
+	void check_batch(const IBlockChainState *state, const std::vector<const Transaction *> &transactions);  // waits
+	bool take_batch_result(const Hash &tx_prefix_hash, const KeyImage &key_image,
+	    const std::vector<PublicKey> &output_keys, const std::vector<Signature> &signatures, bool *result,
+	    bool *key_corrupted);
 };
 
+void run_ring_check_benchmark(size_t tx_count);  // inline vs batch checking of pool transactions
+
 
 }
@@ -14,21 +14,9 @@ using namespace cryonerocoin;
 
 
 
-WalletPreparatorMulticore::WalletPreparatorMulticore() {
-	auto th_count = std::max<size_t>(2, 3 * std::thread::hardware_concurrency() / 4);
-	for (auto i = 0; i != th_count; ++i)
-		threads.emplace_back(&WalletPreparatorMulticore::thread_run, this);
-}
+WalletPreparatorMulticore::WalletPreparatorMulticore() {}
 
-WalletPreparatorMulticore::~WalletPreparatorMulticore() {
-	{
-		std::unique_lock<std::mutex> lock(mu);
-		quit = true;
-		have_work.notify_all();
-	}
-	for (auto &&th : threads)
-		th.join();
-}
+WalletPreparatorMulticore::~WalletPreparatorMulticore() { work_token.cancel(); }
 
 PreparedWalletTransaction::PreparedWalletTransaction(TransactionPrefix &&ttx, const SecretKey &view_secret_key)
     : tx(std::move(ttx)) {
@@ -62,66 +50,41 @@ PreparedWalletBlock::PreparedWalletBlock(BlockTemplate &&bc_header, std::vector<
 	}
 }
 
-void WalletPreparatorMulticore::thread_run() {
-	while (true) {
-		SecretKey view_secret_key;
-		Height height          = 0;
-		int local_work_counter = 0;
-		api::cryonerod::GetRawBlock::Response sync_block;
-		std::vector<std::vector<uint32_t>> global_indices;
-		{
-			std::unique_lock<std::mutex> lock(mu);
-			if (quit)
-				return;
-			if (work.blocks.empty()) {
-				have_work.wait(lock);
-				continue;
-			}
-			local_work_counter = work_counter;
-			view_secret_key    = work_secret_key;
-			height             = work.start_height;
-			sync_block         = std::move(work.blocks.front());
-			work.start_height += 1;
-			work.blocks.erase(work.blocks.begin());
-		}
-		PreparedWalletBlock result(std::move(sync_block.raw_header), std::move(sync_block.raw_transactions),
-		    sync_block.base_transaction_hash, view_secret_key);
-		{
-			std::unique_lock<std::mutex> lock(mu);
-			if (local_work_counter == work_counter) {
-				prepared_blocks[height] = std::move(result);
-				result_ready.notify_all();
-			}
-		}
-	}
-}
-
 void WalletPreparatorMulticore::cancel_work() {
-	std::unique_lock<std::mutex> lock(mu);
-	work = api::cryonerod::SyncBlocks::Response();
-	prepared_blocks.clear();
-	work_counter += 1;
+	std::unique_lock<std::mutex> lock(results->mu);
+	work_token.cancel();
+	work_token = common::CancelToken();
+	results->prepared_blocks.clear();
 }
 
 void WalletPreparatorMulticore::start_work(const api::cryonerod::SyncBlocks::Response &new_work,
     const SecretKey &view_secret_key) {
-	std::unique_lock<std::mutex> lock(mu);
-	work            = new_work;
-	work_secret_key = view_secret_key;
-	work_counter += 1;
-	have_work.notify_all();
+	cancel_work();
+	std::vector<common::Executor::Task> tasks;
+	for (size_t i = 0; i != new_work.blocks.size(); ++i)
+		tasks.push_back([res = results, token = work_token, height = new_work.start_height + Height(i),
+		                    sync_block = new_work.blocks[i], view_secret_key]() mutable {
+			PreparedWalletBlock result(std::move(sync_block.raw_header), std::move(sync_block.raw_transactions),
+			    sync_block.base_transaction_hash, view_secret_key);
+			std::unique_lock<std::mutex> lock(res->mu);
+			if (token.is_cancelled())
+				return;
+			res->prepared_blocks[height] = std::move(result);
+			res->result_ready.notify_all();
+		});
+	common::Executor::instance().submit_batch(common::Executor::SYNC, work_token, std::move(tasks));
 }
 
 PreparedWalletBlock WalletPreparatorMulticore::get_ready_work(Height height) {
+	std::unique_lock<std::mutex> lock(results->mu);
 	while (true) {
-		std::unique_lock<std::mutex> lock(mu);
-		auto pit = prepared_blocks.find(height);
-		if (pit == prepared_blocks.end()) {
-			result_ready.wait(lock);
+		auto pit = results->prepared_blocks.find(height);
+		if (pit == results->prepared_blocks.end()) {
+			results->result_ready.wait(lock);
 			continue;
 		}
 		PreparedWalletBlock result = std::move(pit->second);
-		pit                        = prepared_blocks.erase(pit);
+		results->prepared_blocks.erase(pit);
 		return result;
 	}
 }
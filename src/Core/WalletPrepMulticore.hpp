@@ -7,10 +7,11 @@
 #pragma once
 
 #include <condition_variable>
-#include <deque>
+#include <map>
+#include <memory>
 #include <mutex>
-#include <thread>
 #include "CryptoNote.hpp"
+#include "common/Executor.hpp"
 #include "rpc_api.hpp"
 
 
@@ -40,17 +41,13 @@ struct PreparedWalletBlock {
 };
 
 class WalletPreparatorMulticore {
-	std::vector<std::thread> threads;
-	std::mutex mu;
-	std::condition_variable have_work;
-	std::condition_variable result_ready;
-	bool quit = false;
-
-	std::map<Height, PreparedWalletBlock> prepared_blocks;
-	api::cryonerod::SyncBlocks::Response work;
-	int work_counter = 0;
-	SecretKey work_secret_key;
-	void thread_run();
+	struct Results {  // shared with executor tasks, which can outlive preparator
+		std::mutex mu;
+		std::condition_variable result_ready;
+		std::map<Height, PreparedWalletBlock> prepared_blocks;
+	};
+	std::shared_ptr<Results> results = std::make_shared<Results>();
+	common::CancelToken work_token;  // replaced for each work
 
 public:
 	WalletPreparatorMulticore();
@@ -172,10 +172,10 @@ void WalletStateBasic::reset_chain(Height new_tail_height) {
 }
 
 bool WalletStateBasic::read_chain(uint32_t height, api::BlockHeader &header) const {
-	BinaryArray rb;
-	if (!m_db.get(INDEX_HEIGHT_to_HEADER + common::write_varint_sqlite4(height), rb))
+	DB::Value rb;
+	if (!m_db.get(DBKey(INDEX_HEIGHT_to_HEADER).append_varint(height), rb))
 		return false;
-	seria::from_binary(header, rb);
+	seria::from_binary(header, rb.data(), rb.size());
 	return true;
 }
 
@@ -233,11 +233,11 @@ void WalletStateBasic::save_db_state(uint32_t state, const UndoMap &undo_map) {
 }
 void WalletStateBasic::undo_db_state(uint32_t state) {
 	const auto key = INDEX_UID_to_STATE + common::write_varint_sqlite4(state);
-	common::BinaryArray value;
+	DB::Value value;
 	if (!m_db.get(key, value))
 		return;
 	UndoMap undo_map;
-	seria::from_binary(undo_map, value);
+	seria::from_binary(undo_map, value.data(), value.size());
 	m_db.del(key, true);
 	for (auto &&uv : undo_map) {
 		if (uv.second.exists)
@@ -318,16 +318,16 @@ Amount WalletStateBasic::add_incoming_keyimage(Height block_height, const KeyIma
 		uint32_t gi            = boost::lexical_cast<uint32_t>(common::read_varint_sqlite4(be, en));
 		invariant(en - be == 0, "");
 		UnlockMoment unl = 0;
-		seria::from_binary(unl, cur.get_value_array());
+		const auto &value = cur.get_value();
+		seria::from_binary(unl, value.data(), value.size());
 		uint32_t clamped_unlock_time = static_cast<uint32_t>(std::min<UnlockMoment>(unl, 0xFFFFFFFF));
-		std::string unkey = m_currency.is_transaction_spend_time_block(unl) ? LOCKED_INDEX_HEIGHT_AM_GI_to_OUTPUT
-		                                                                    : LOCKED_INDEX_TIMESTAMP_AM_GI_to_OUTPUT;
-		unkey += common::write_varint_sqlite4(clamped_unlock_time) + common::write_varint_sqlite4(am) +
-		         common::write_varint_sqlite4(gi);
-		BinaryArray output_ba;
+		DBKey unkey(m_currency.is_transaction_spend_time_block(unl) ? LOCKED_INDEX_HEIGHT_AM_GI_to_OUTPUT
+		                                                            : LOCKED_INDEX_TIMESTAMP_AM_GI_to_OUTPUT);
+		unkey.append_varint(clamped_unlock_time).append_varint(am).append_varint(gi);
+		DB::Value output_ba;
 		invariant(m_db.get(unkey, output_ba), "");
 		api::Output output;
-		seria::from_binary(output, output_ba);
+		seria::from_binary(output, output_ba.data(), output_ba.size());
 		found_in_locked.push_back(output);
 	}
 	for (auto &&lo : found_in_locked) {
@@ -362,16 +362,16 @@ bool WalletStateBasic::try_adding_incoming_keyimage(const KeyImage &key_image, a
 		if (candidate_found && am <= spending_output->amount)
 			continue;
 		UnlockMoment unl = 0;
-		seria::from_binary(unl, cur.get_value_array());
+		const auto &value = cur.get_value();
+		seria::from_binary(unl, value.data(), value.size());
 		uint32_t clamped_unlock_time = static_cast<uint32_t>(std::min<UnlockMoment>(unl, 0xFFFFFFFF));
-		std::string unkey = m_currency.is_transaction_spend_time_block(unl) ? LOCKED_INDEX_HEIGHT_AM_GI_to_OUTPUT
-		                                                                    : LOCKED_INDEX_TIMESTAMP_AM_GI_to_OUTPUT;
-		unkey += common::write_varint_sqlite4(clamped_unlock_time) + common::write_varint_sqlite4(am) +
-		         common::write_varint_sqlite4(gi);
-		BinaryArray output_ba;
+		DBKey unkey(m_currency.is_transaction_spend_time_block(unl) ? LOCKED_INDEX_HEIGHT_AM_GI_to_OUTPUT
+		                                                            : LOCKED_INDEX_TIMESTAMP_AM_GI_to_OUTPUT);
+		unkey.append_varint(clamped_unlock_time).append_varint(am).append_varint(gi);
+		DB::Value output_ba;
 		invariant(m_db.get(unkey, output_ba), "");
 		api::Output output;
-		seria::from_binary(output, output_ba);
+		seria::from_binary(output, output_ba.data(), output_ba.size());
 		invariant(output.amount == am && output.global_index == gi, "");
 		if (candidate_found && output.address != spending_output->address)
 			continue;
@@ -505,10 +505,10 @@ std::vector<api::Output> WalletStateBasic::api_get_locked_or_unconfirmed_unspent
 
 api::Balance WalletStateBasic::get_balance(const std::string &address, Height confirmed_height) const {
 	auto bakey = INDEX_ADDRESS_to_BALANCE + address;
-	BinaryArray ba;
+	DB::Value ba;
 	api::Balance balance;
 	if (m_db.get(bakey, ba))
-		seria::from_binary(balance, ba);
+		seria::from_binary(balance, ba.data(), ba.size());
 
 	for_each_in_unspent_index(
 	    address, confirmed_height, std::numeric_limits<Height>::max(), [&](const api::Output &output) -> bool {
@@ -547,18 +547,18 @@ api::Balance WalletStateBasic::get_balance(const std::string &address, Height co
 }
 
 bool WalletStateBasic::has_transaction(Hash tid) const {
-	auto trkey = INDEX_TID_to_TRANSACTIONS + DB::to_binary_key(tid.data, sizeof(tid.data));
-	BinaryArray data;
+	const auto trkey = DBKey(INDEX_TID_to_TRANSACTIONS).append(tid.data, sizeof(tid.data));
+	DB::Value data;
 	return m_db.get(trkey, data);
 }
 
 bool WalletStateBasic::get_transaction(Hash tid, TransactionPrefix *tx, api::Transaction *ptx) const {
-	auto trkey = INDEX_TID_to_TRANSACTIONS + DB::to_binary_key(tid.data, sizeof(tid.data));
-	BinaryArray data;
+	const auto trkey = DBKey(INDEX_TID_to_TRANSACTIONS).append(tid.data, sizeof(tid.data));
+	DB::Value data;
 	if (!m_db.get(trkey, data))
 		return false;
 	std::pair<TransactionPrefix, api::Transaction> pa;
-	seria::from_binary(pa, data);
+	seria::from_binary(pa, data.data(), data.size());
 	*tx  = std::move(pa.first);
 	*ptx = std::move(pa.second);
 	return true;
@@ -587,7 +587,8 @@ void WalletStateBasic::read_unlock_index(std::map<std::pair<Amount, uint32_t>, a
 		if (height > end)
 			break;
 		api::Output output;
-		seria::from_binary(output, cur.get_value_array());
+		const auto &value = cur.get_value();
+		seria::from_binary(output, value.data(), value.size());
 
 		invariant(output.global_index == global_index, "Index corrupted");
 		if (address.empty() || output.address == address)
@@ -608,13 +609,13 @@ std::map<std::pair<Amount, uint32_t>, api::Output> WalletStateBasic::api_get_unl
 void WalletStateBasic::modify_balance(const api::Output &output, int locked_op, int spendable_op) {
 	auto bakey  = INDEX_ADDRESS_to_BALANCE + output.address;
 	auto bakey2 = INDEX_ADDRESS_to_BALANCE;
-	BinaryArray ba;
+	DB::Value ba;
 	api::Balance balance;
 	api::Balance balance2;
 	if (m_db.get(bakey, ba))
-		seria::from_binary(balance, ba);
+		seria::from_binary(balance, ba.data(), ba.size());
 	if (m_db.get(bakey2, ba))
-		seria::from_binary(balance2, ba);
+		seria::from_binary(balance2, ba.data(), ba.size());
 
 	combine_balance(balance, output, locked_op, spendable_op);
 	combine_balance(balance2, output, locked_op, spendable_op);
@@ -688,12 +689,14 @@ void WalletStateBasic::unlock(Height now_height, Timestamp now) {
 }
 
 bool WalletStateBasic::read_from_unspent_index(const HeightAmounGi &value, api::Output *output) const {
-	auto keyun = INDEX_HE_AM_GI_to_OUTPUT + common::write_varint_sqlite4(value.height) +
-	             common::write_varint_sqlite4(value.amount) + common::write_varint_sqlite4(value.global_index);
-	BinaryArray ba;
+	const auto keyun = DBKey(INDEX_HE_AM_GI_to_OUTPUT)
+	                       .append_varint(value.height)
+	                       .append_varint(value.amount)
+	                       .append_varint(value.global_index);
+	DB::Value ba;
 	if (!m_db.get(keyun, ba))
 		return false;
-	seria::from_binary(*output, ba);
+	seria::from_binary(*output, ba.data(), ba.size());
 	return true;
 }
 bool WalletStateBasic::for_each_in_unspent_index(
@@ -715,8 +718,10 @@ bool WalletStateBasic::for_each_in_unspent_index(
 			HeightAmounGi heamgi{he, am, gi};
 			invariant(read_from_unspent_index(heamgi, &output), "unspent indexes do not match");
 			invariant(output.address == address, "output is in wrong index by address");
-		} else
-			seria::from_binary(output, cur.get_value_array());
+		} else {
+			const auto &value = cur.get_value();
+			seria::from_binary(output, value.data(), value.size());
+		}
 		if (!fun(output))
 			return false;
 	}
@@ -748,11 +753,11 @@ void WalletStateBasic::remove_from_unspent_index(const api::Output &output) {
 }
 
 bool WalletStateBasic::read_by_keyimage(const KeyImage &ki, HeightAmounGi *value) const {
-	auto keyun = INDEX_KEYIMAGE_to_HE_AM_GI + DB::to_binary_key(ki.data, sizeof(ki.data));
-	BinaryArray ba;
+	const auto keyun = DBKey(INDEX_KEYIMAGE_to_HE_AM_GI).append(ki.data, sizeof(ki.data));
+	DB::Value ba;
 	if (!m_db.get(keyun, ba))
 		return false;
-	seria::from_binary(*value, ba);
+	seria::from_binary(*value, ba.data(), ba.size());
 	return true;
 }
 void WalletStateBasic::update_keyimage(const KeyImage &ki, const HeightAmounGi &value, bool nooverwrite) {
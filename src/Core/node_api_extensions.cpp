@@ -86,40 +86,33 @@ namespace extensions
     }
   }
 
-bool Node::on_get_blocks_json(http::Client *, http::RequestData &&, json_rpc::Request &&,
-	api::extensions::GetBlocks::Request &&request, api::extensions::GetBlocks::Response &response)
+// Reads through snapshot on any thread, or through live DB on event loop thread if snapshot is null
+static api::extensions::GetBlocks::Response get_blocks_preview(
+	const BlockChain *block_chain, const platform::DB::Snapshot *snapshot, uint32_t height, uint32_t last)
 {
-	m_log(logging::INFO) << "API_EX: get_blocks_json, height=" << request.height;
-
-	if (request.height > m_block_chain.get_tip_height())
-	{
-		throw json_rpc::Error(json_rpc::INVALID_PARAMS, "Invalid block height");
-	}
-
-	uint32_t count = 30;
-	uint32_t last;
-	if (request.height <= count) 
-	{ 
-		last = 0;
-		count = request.height;
-	}
-	else
-	{
-		last = request.height - count;
-	}
-	
-	response.blocks.reserve(count);
+	api::extensions::GetBlocks::Response response;
+	response.blocks.reserve(height - last + 1);
 
-	for (uint32_t i = request.height; i >= last; i--)
+	for (uint32_t i = height; i >= last; i--)
 	{
-		crypto::Hash bid = extensions::get_block_hash(&m_block_chain, i);
+		crypto::Hash bid;
+		invariant(snapshot ? block_chain->read_chain(*snapshot, i, &bid) : block_chain->read_chain(i, &bid),
+			"Tip chain has no block at height");
 
 		api::extensions::BlockPreview bp = api::extensions::BlockPreview();
 		RawBlock rb;
+		BinaryArray block_data;
 		api::BlockHeader bh; 
 
-		m_block_chain.read_block(bid, &rb);
-		m_block_chain.read_header(bid, &bh);
+		if (!(snapshot ? block_chain->read_block(*snapshot, bid, &block_data, &rb)
+		               : block_chain->read_block(bid, &block_data, &rb)))
+		{
+			throw json_rpc::Error(-5, "Block body is pruned on this node");
+		}
+		if (snapshot)
+			block_chain->read_header(*snapshot, bid, &bh);
+		else
+			block_chain->read_header(bid, &bh, i);
 
 		bp.height = i;
 		std::copy(std::begin(bid.data), std::end(bid.data), std::begin(bp.hash.data));
@@ -132,8 +125,46 @@ bool Node::on_get_blocks_json(http::Client *, http::RequestData &&, json_rpc::Re
 
 		if (i == 0) break;
 	}
-	
-	return true;
+	return response;
+}
+
+bool Node::on_get_blocks_json(http::Client *who, http::RequestData &&raw_request, json_rpc::Request &&raw_js_request,
+	api::extensions::GetBlocks::Request &&request, api::extensions::GetBlocks::Response &response)
+{
+	m_log(logging::INFO) << "API_EX: get_blocks_json, height=" << request.height;
+
+	if (request.height > m_block_chain.get_tip_height())
+	{
+		throw json_rpc::Error(json_rpc::INVALID_PARAMS, "Invalid block height");
+	}
+
+	const uint32_t height = request.height;
+	uint32_t count = 30;
+	uint32_t last;
+	if (height <= count) 
+	{ 
+		last = 0;
+		count = height;
+	}
+	else
+	{
+		last = height - count;
+	}
+
+	// Blocks above last db_commit are not in snapshot, so read on event loop
+	if (height > m_block_chain.get_committed_tip_height())
+	{
+		response = get_blocks_preview(&m_block_chain, nullptr, height, last);
+		return true;
+	}
+	// Reads 30 block bodies, so served from snapshot on executor thread
+	std::shared_ptr<platform::DB::Snapshot> snapshot = m_block_chain.create_db_snapshot();
+	const BlockChain *block_chain = &m_block_chain;
+	submit_worker_json_rpc(who, raw_request, raw_js_request,
+		[snapshot, block_chain, height, last](json_rpc::Response &json_resp) {
+		json_resp.set_result(get_blocks_preview(block_chain, snapshot.get(), height, last));
+	});
+	return false;
 }
 
 bool Node::on_get_block_json(http::Client *, http::RequestData &&, json_rpc::Request &&,
@@ -163,7 +194,10 @@ bool Node::on_get_block_json(http::Client *, http::RequestData &&, json_rpc::Req
 	RawBlock raw_block;
 	Block block;
 
-	m_block_chain.read_block(request.hash, &raw_block);
+	if (!m_block_chain.read_block(request.hash, &raw_block))
+	{
+		throw json_rpc::Error(-5, "Block body is pruned on this node");
+	}
 	block.from_raw_block(raw_block);
 
 	auto bh = &response.block.header;
@@ -215,7 +249,10 @@ bool Node::on_get_transaction_json(http::Client *, http::RequestData &&, json_rp
 	RawBlock rb;
 	api::BlockHeader bh;
 
-	m_block_chain.read_block(bid, &rb);
+	if (!m_block_chain.read_block(bid, &rb))
+	{
+		throw json_rpc::Error(-5, "Block body is pruned on this node");
+	}
 	m_block_chain.read_header(bid, &bh);
 
 	response.block.height = bh.height;
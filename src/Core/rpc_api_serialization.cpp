@@ -400,6 +400,8 @@ void ser_members(api::cryonerod::GetStatus::Response &v, ISeria &s) {
 	seria_kv("recommended_fee_per_byte", v.recommended_fee_per_byte, s);
 	seria_kv("next_block_effective_median_size", v.next_block_effective_median_size, s);
 	seria_kv("top_known_block_height", v.top_known_block_height, s);
+	seria_kv("last_db_commit_ms", v.last_db_commit_ms, s, true);
+	seria_kv("pruned_height", v.pruned_height, s, true);
 }
 void ser_members(cryonerocoin::api::cryonerod::GetRawBlock::Request &v, ISeria &s) {
 	seria_kv("hash", v.hash, s);
@@ -471,6 +473,7 @@ void ser_members(cryonerocoin::api::cryonerod::GetBlockTemplate::Request &v, ISe
 	seria_kv("wallet_address", v.wallet_address, s);
 	seria_kv("top_block_hash", v.top_block_hash, s);
 	seria_kv("transaction_pool_version", v.transaction_pool_version, s);
+	seria_kv("template_id", v.template_id, s, true);
 }
 void ser_members(cryonerocoin::api::cryonerod::GetBlockTemplate::Response &v, ISeria &s) {
 	seria_kv("difficulty", v.difficulty, s);
@@ -481,6 +484,7 @@ void ser_members(cryonerocoin::api::cryonerod::GetBlockTemplate::Response &v, IS
 	seria_kv("top_block_hash", v.top_block_hash, s);
 	seria_kv("transaction_pool_version", v.transaction_pool_version, s);
 	seria_kv("previous_block_hash", v.previous_block_hash, s);
+	seria_kv("template_id", v.template_id, s, true);
 }
 void ser_members(cryonerocoin::api::cryonerod::GetCurrencyId::Response &v, ISeria &s) {
 	seria_kv("currency_id_blob", v.currency_id_blob, s);
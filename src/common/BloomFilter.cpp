@@ -0,0 +1,82 @@
+// Copyright (c) 2019, The Cryonero developers.
+// Licensed under the GNU Lesser General Public License. See LICENSE for details.
+
+#include "BloomFilter.hpp"
+#include <algorithm>
+#include <cstring>
+#include "Invariant.hpp"
+
+using namespace common;
+
+static const char BLOOM_MAGIC[] = "bloom1";
+
+void BloomFilter::reset(size_t new_capacity) {
+	capacity                 = std::max<size_t>(new_capacity, 1);
+	const size_t block_count = (capacity * BITS_PER_KEY + BLOCK_WORDS * 64 - 1) / (BLOCK_WORDS * 64);
+	blocks.assign(block_count * BLOCK_WORDS, 0);
+	count = 0;
+}
+
+const uint64_t *BloomFilter::get_block(const unsigned char *key, size_t size) const {
+	invariant(size >= MIN_KEY_SIZE, "BloomFilter key too short");
+	uint64_t first = 0;
+	std::memcpy(&first, key, sizeof(first));
+	return blocks.data() + (first % (blocks.size() / BLOCK_WORDS)) * BLOCK_WORDS;
+}
+
+void BloomFilter::insert(const unsigned char *key, size_t size) {
+	if (!is_built())
+		return;
+	uint64_t *block = const_cast<uint64_t *>(get_block(key, size));
+	for (size_t i = 0; i != K_BITS; ++i) {
+		const size_t bit = (key[8 + 2 * i] | (key[9 + 2 * i] << 8)) % (BLOCK_WORDS * 64);
+		block[bit / 64] |= uint64_t(1) << (bit % 64);
+	}
+	count += 1;
+}
+
+bool BloomFilter::may_contain(const unsigned char *key, size_t size) const {
+	if (!is_built())
+		return true;
+	const uint64_t *block = get_block(key, size);
+	for (size_t i = 0; i != K_BITS; ++i) {
+		const size_t bit = (key[8 + 2 * i] | (key[9 + 2 * i] << 8)) % (BLOCK_WORDS * 64);
+		if ((block[bit / 64] & (uint64_t(1) << (bit % 64))) == 0)
+			return false;
+	}
+	return true;
+}
+
+// Native byte order, file is local cache of DB
+BinaryArray BloomFilter::to_binary(const std::string &stamp) const {
+	const uint64_t header[] = {stamp.size(), count, capacity, blocks.size()};
+	BinaryArray result;
+	result.reserve(sizeof(BLOOM_MAGIC) + sizeof(header) + stamp.size() + blocks.size() * sizeof(uint64_t));
+	const auto magic_data = reinterpret_cast<const uint8_t *>(BLOOM_MAGIC);
+	append(result, magic_data, magic_data + sizeof(BLOOM_MAGIC));
+	const auto header_data = reinterpret_cast<const uint8_t *>(header);
+	append(result, header_data, header_data + sizeof(header));
+	const auto stamp_data = reinterpret_cast<const uint8_t *>(stamp.data());
+	append(result, stamp_data, stamp_data + stamp.size());
+	const auto blocks_data = reinterpret_cast<const uint8_t *>(blocks.data());
+	append(result, blocks_data, blocks_data + blocks.size() * sizeof(uint64_t));
+	return result;
+}
+
+bool BloomFilter::from_binary(const BinaryArray &data, const std::string &stamp) {
+	uint64_t header[4]{};
+	if (data.size() < sizeof(BLOOM_MAGIC) + sizeof(header) ||
+	    std::memcmp(data.data(), BLOOM_MAGIC, sizeof(BLOOM_MAGIC)) != 0)
+		return false;
+	std::memcpy(header, data.data() + sizeof(BLOOM_MAGIC), sizeof(header));
+	const size_t pos = sizeof(BLOOM_MAGIC) + sizeof(header);
+	if (header[0] != stamp.size() || header[3] == 0 || header[3] % BLOCK_WORDS != 0 ||
+	    data.size() != pos + stamp.size() + header[3] * sizeof(uint64_t) ||
+	    std::memcmp(data.data() + pos, stamp.data(), stamp.size()) != 0)
+		return false;
+	count    = static_cast<size_t>(header[1]);
+	capacity = static_cast<size_t>(header[2]);
+	blocks.resize(static_cast<size_t>(header[3]));
+	std::memcpy(blocks.data(), data.data() + pos + stamp.size(), blocks.size() * sizeof(uint64_t));
+	return true;
+}
@@ -0,0 +1,43 @@
+// Copyright (c) 2019, The Cryonero developers.
+// Licensed under the GNU Lesser General Public License. See LICENSE for details.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "BinaryArray.hpp"
+
+namespace common
+{
+
+	// Blocked Bloom filter for keys which are already uniformly random (hashes, key images), so key bytes are
+	// used instead of hash functions. All bits of key are in one 64-byte block, lookup touches one cache line.
+	// Insert only. Keys deleted from DB stay in filter and give a bit more false positives, never false negatives.
+	class BloomFilter
+	{
+	public:
+		static constexpr size_t MIN_KEY_SIZE = 24;
+
+		bool is_built() const { return !blocks.empty(); }  // not built filter may contain everything
+		void reset(size_t capacity);  // builds empty filter
+		void clear() { blocks.clear(); count = 0; capacity = 0; }
+		size_t get_count() const { return count; }
+		size_t get_capacity() const { return capacity; }  // false positive rate grows fast after that
+
+		void insert(const unsigned char *key, size_t size);
+		bool may_contain(const unsigned char *key, size_t size) const;
+
+		BinaryArray to_binary(const std::string &stamp) const;
+		bool from_binary(const BinaryArray &data, const std::string &stamp);  // false if format or stamp differ
+
+	private:
+		static constexpr size_t BLOCK_WORDS  = 8;   // 512 bits
+		static constexpr size_t K_BITS       = 8;   // bits per key, 9 bits of key each
+		static constexpr size_t BITS_PER_KEY = 12;  // ~0.5% false positives at capacity
+		std::vector<uint64_t> blocks;
+		size_t count    = 0;
+		size_t capacity = 0;
+		const uint64_t *get_block(const unsigned char *key, size_t size) const;
+	};
+}
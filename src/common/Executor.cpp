@@ -0,0 +1,95 @@
+// Copyright (c) 2019, The Cryonero developers.
+// Licensed under the GNU Lesser General Public License. See LICENSE for details.
+
+#include "Executor.hpp"
+#include <algorithm>
+
+using namespace common;
+
+size_t Executor::s_thread_count = 0;
+
+void Executor::set_thread_count(size_t count) { s_thread_count = count; }
+
+Executor &Executor::instance() {
+	static Executor executor(
+	    s_thread_count != 0 ? s_thread_count : std::max<size_t>(2, 3 * std::thread::hardware_concurrency() / 4));
+	return executor;
+}
+
+Executor::Executor(size_t thread_count) {
+	for (size_t i = 0; i != thread_count; ++i)
+		m_workers.push_back(std::make_unique<Worker>());
+	for (size_t i = 0; i != thread_count; ++i)
+		m_workers[i]->th = std::thread(&Executor::thread_run, this, i);
+}
+
+Executor::~Executor() {
+	{
+		std::unique_lock<std::mutex> lock(m_sleep_mu);
+		m_quit = true;
+		m_have_work.notify_all();
+	}
+	for (auto &&worker : m_workers)
+		worker->th.join();
+}
+
+void Executor::submit(Priority priority, const CancelToken &token, Task &&task) {
+	std::vector<Task> tasks;
+	tasks.push_back(std::move(task));
+	submit_batch(priority, token, std::move(tasks));
+}
+
+void Executor::submit_batch(Priority priority, const CancelToken &token, std::vector<Task> &&tasks) {
+	if (tasks.empty())
+		return;
+	m_pending += tasks.size();
+	// Contiguous chunks, so each worker mutex is locked once per batch
+	const size_t chunk = (tasks.size() + m_workers.size() - 1) / m_workers.size();
+	size_t w           = m_next_worker.fetch_add(1) % m_workers.size();
+	for (size_t pos = 0; pos < tasks.size(); pos += chunk, w = (w + 1) % m_workers.size()) {
+		Worker &worker = *m_workers[w];
+		std::unique_lock<std::mutex> lock(worker.mu);
+		for (size_t i = pos; i != std::min(tasks.size(), pos + chunk); ++i)
+			worker.queues[priority].push_back(Item{token, std::move(tasks[i])});
+	}
+	std::unique_lock<std::mutex> lock(m_sleep_mu);
+	if (tasks.size() == 1)
+		m_have_work.notify_one();
+	else
+		m_have_work.notify_all();
+}
+
+bool Executor::pop(size_t self, Item *item) {
+	for (size_t p = 0; p != PRIORITY_COUNT; ++p)
+		for (size_t i = 0; i != m_workers.size(); ++i) {
+			Worker &worker = *m_workers[(self + i) % m_workers.size()];
+			std::unique_lock<std::mutex> lock(worker.mu);
+			auto &queue = worker.queues[p];
+			if (queue.empty())
+				continue;
+			if (i == 0) {  // own work in submission order
+				*item = std::move(queue.front());
+				queue.pop_front();
+			} else {  // steal from the other end
+				*item = std::move(queue.back());
+				queue.pop_back();
+			}
+			m_pending -= 1;
+			return true;
+		}
+	return false;
+}
+
+void Executor::thread_run(size_t self) {
+	while (!m_quit) {
+		Item item;
+		if (pop(self, &item)) {
+			if (!item.token.is_cancelled())
+				item.task();
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(m_sleep_mu);
+		if (!m_quit && m_pending == 0)
+			m_have_work.wait(lock);
+	}
+}
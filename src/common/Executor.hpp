@@ -0,0 +1,69 @@
+// Copyright (c) 2019, The Cryonero developers.
+// Licensed under the GNU Lesser General Public License. See LICENSE for details.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Nocopy.hpp"
+
+namespace common {
+
+// Copies share state. Queued tasks of cancelled token are dropped, running ones should check is_cancelled
+// under owner's mutex before publishing results. Owner replaces token to start new generation of work
+class CancelToken {
+	std::shared_ptr<std::atomic<bool>> m_cancelled = std::make_shared<std::atomic<bool>>(false);
+
+public:
+	void cancel() const { *m_cancelled = true; }
+	bool is_cancelled() const { return *m_cancelled; }
+};
+
+// Process-wide threads for CPU heavy work - signature checks, block and wallet preparation. Each worker has
+// deque per priority, batches are spread between workers and idle workers steal from others, so submitters
+// and workers mostly take different mutexes. Tasks can outlive their submitter, so they must own what they use
+class Executor : private Nocopy {
+public:
+	// CONSENSUS - checks of block or transactions being added, SYNC - preparation of downloaded blocks and wallet
+	// outputs, speculative checks, RPC - json_rpc replies built from DB snapshot, so they never delay sync
+	enum Priority { CONSENSUS, SYNC, RPC, PRIORITY_COUNT };  // earlier runs first
+	using Task = std::function<void()>;
+
+	static void set_thread_count(size_t count);  // call before first instance(), 0 for default
+	static Executor &instance();
+	~Executor();
+
+	void submit(Priority priority, const CancelToken &token, Task &&task);
+	void submit_batch(Priority priority, const CancelToken &token, std::vector<Task> &&tasks);
+	size_t get_thread_count() const { return m_workers.size(); }
+
+private:
+	struct Item {
+		CancelToken token;
+		Task task;
+	};
+	struct Worker {
+		std::mutex mu;
+		std::deque<Item> queues[PRIORITY_COUNT];
+		std::thread th;
+	};
+	std::vector<std::unique_ptr<Worker>> m_workers;
+	std::atomic<size_t> m_next_worker{0};
+	std::atomic<size_t> m_pending{0};  // incremented before push, so sleeping with items queued is impossible
+	std::atomic<bool> m_quit{false};
+	std::mutex m_sleep_mu;
+	std::condition_variable m_have_work;
+
+	static size_t s_thread_count;
+	explicit Executor(size_t thread_count);
+	bool pop(size_t self, Item *item);
+	void thread_run(size_t self);
+};
+
+}  // namespace common
@@ -0,0 +1,49 @@
+// Copyright (c) 2019, The Cryonero developers.
+// Licensed under the GNU Lesser General Public License. See LICENSE for details.
+
+#include "Math.hpp"
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+namespace common {
+
+template<class T>
+static void check_sliding_median_of(const char *name, size_t iterations, uint64_t value_range, std::mt19937_64 &rnd) {
+	SlidingMedian<T> sliding;
+	std::deque<T> window;  // oldest first, like consensus windows
+	for (size_t i = 0; i != iterations; ++i) {
+		const size_t action = rnd() % 8;
+		if (action < 4 || window.empty()) {
+			const T value = static_cast<T>(rnd() % value_range);
+			window.push_back(value);
+			sliding.insert(value);
+		} else if (action < 6) {  // slide, as tip_changed does
+			sliding.erase(window.front());
+			window.pop_front();
+		} else if (action < 7) {  // erase from anywhere, as undo does
+			const size_t pos = rnd() % window.size();
+			sliding.erase(window[pos]);
+			window.erase(window.begin() + pos);
+		} else if (rnd() % 64 == 0) {
+			sliding.clear();
+			window.clear();
+		}
+		std::vector<T> values(window.begin(), window.end());
+		if (sliding.size() != values.size() || sliding.median() != median_value(&values))
+			throw std::logic_error(std::string("SlidingMedian<") + name + "> differs from median_value at step " +
+			                       std::to_string(i));
+	}
+}
+
+void check_sliding_median(size_t iterations) {
+	std::mt19937_64 rnd(iterations);
+	check_sliding_median_of<uint32_t>("uint32_t few values", iterations, 8, rnd);  // many duplicates
+	check_sliding_median_of<uint32_t>("uint32_t", iterations, uint64_t(1) << 32, rnd);
+	check_sliding_median_of<uint64_t>("uint64_t", iterations, uint64_t(-1), rnd);
+	std::cout << "SlidingMedian matches median_value in " << iterations << " random steps" << std::endl;
+}
+}  // namespace common
@@ -6,6 +6,7 @@
 #pragma once
 
 #include <algorithm>
+#include <set>
 #include <vector>
 
 namespace common
@@ -24,4 +25,57 @@ namespace common
 			return (*v)[n];
 		return ((*v)[n - 1] + (*v)[n]) / 2;  // 2, 4, 6...
 	}
+
+	// Median of values kept in two halves, insert and erase are O(log n). Same result as median_value
+	template<class T>
+	class SlidingMedian
+	{
+		std::multiset<T> low;   // low.size() == high.size() or high.size() + 1
+		std::multiset<T> high;  // every element >= every element of low
+		void rebalance()
+		{
+			if (low.size() > high.size() + 1) {
+				high.insert(*low.rbegin());
+				low.erase(std::prev(low.end()));
+			} else if (high.size() > low.size()) {
+				low.insert(*high.begin());
+				high.erase(high.begin());
+			}
+		}
+
+	public:
+		size_t size() const { return low.size() + high.size(); }
+		void clear()
+		{
+			low.clear();
+			high.clear();
+		}
+		void insert(T value)
+		{
+			if (low.empty() || value <= *low.rbegin())
+				low.insert(value);
+			else
+				high.insert(value);
+			rebalance();
+		}
+		void erase(T value)  // value must be present
+		{
+			if (!low.empty() && value <= *low.rbegin())
+				low.erase(low.find(value));
+			else
+				high.erase(high.find(value));
+			rebalance();
+		}
+		T median() const
+		{
+			if (low.empty())
+				return T();
+			if (low.size() > high.size())  // 1, 3, 5...
+				return *low.rbegin();
+			return (*low.rbegin() + *high.begin()) / 2;  // 2, 4, 6...
+		}
+	};
+
+	// Random inserts, slides and erases compared with median_value, throws on first difference
+	void check_sliding_median(size_t iterations);
 }
@@ -99,59 +99,64 @@ namespace common
 
 	std::string str(const unsigned char *buf, size_t len) { return std::string((const char *)buf, len); }
 
-	std::string write_varint_sqlite4(uint64_t val)
+	size_t write_varint_sqlite4(unsigned char *buf, uint64_t val)
 	{
-		unsigned char buf[9];
 		if (val <= 240)
 		{
 			buf[0] = static_cast<unsigned char>(val);
-			return str(buf, 1);
+			return 1;
 		}
 		if (val <= 2287)
 		{
 			buf[0] = static_cast<unsigned char>((val - 240) / 256 + 241);
 			buf[1] = static_cast<unsigned char>(val - 240);
-			return str(buf, 2);
+			return 2;
 		}
 		if (val <= 67823) 
 		{
 			buf[0] = 249;
 			buf[1] = static_cast<unsigned char>((val - 2288) / 256);
 			buf[2] = static_cast<unsigned char>(val - 2288);
-			return str(buf, 3);
+			return 3;
 		}
 		if (val <= 16777215)
 		{
 			buf[0] = 250;
 			uint_be_to_bytes<uint64_t>(buf + 1, 3, val);
-			return str(buf, 4);
+			return 4;
 		}
 		if (val <= 4294967295)
 		{
 			buf[0] = 251;
 			uint_be_to_bytes<uint64_t>(buf + 1, 4, val);
-			return str(buf, 5);
+			return 5;
 		}
 		if (val <= 1099511627775)
 		{
 			buf[0] = 252;
 			uint_be_to_bytes<uint64_t>(buf + 1, 5, val);
-			return str(buf, 6);
+			return 6;
 		}
 		if (val <= 281474976710655) 
 		{
 			buf[0] = 253;
 			uint_be_to_bytes<uint64_t>(buf + 1, 6, val);
-			return str(buf, 7);
+			return 7;
 		}
 		if (val <= 72057594037927935)
 		{
 			buf[0] = 254;
 			uint_be_to_bytes<uint64_t>(buf + 1, 7, val);
-			return str(buf, 8);
+			return 8;
 		}
 		buf[0] = 255;
 		uint_be_to_bytes<uint64_t>(buf + 1, 8, val);
-		return str(buf, 9);
+		return 9;
+	}
+
+	std::string write_varint_sqlite4(uint64_t val)
+	{
+		unsigned char buf[9];
+		return str(buf, write_varint_sqlite4(buf, val));
 	}
 }
@@ -79,5 +79,6 @@ namespace common
 	}
 
 	uint64_t read_varint_sqlite4(const std::string &str);
+	size_t write_varint_sqlite4(unsigned char *buf, uint64_t val);  // buf must fit 9 bytes, returns size
 	std::string write_varint_sqlite4(uint64_t val);
 }
@@ -0,0 +1,84 @@
+// Copyright (c) 2019, The Cryonero developers.
+// Licensed under the GNU Lesser General Public License. See LICENSE for details.
+
+// No protection from double-include, this file is included twice in crypto-ops.c
+
+/*
+Radix 2^51 fe_mul and fe_sq, 25 64x64->128 multiplications instead of 100 32x32->64.
+With BMI2 compiler uses mulx, which does not touch flags, so products and carries interleave better.
+Same results and postconditions as ref10 versions, inputs may be larger (see fe51_load).
+*/
+
+#if defined(FE51_BMI2)
+#define FE51_TARGET __attribute__((target("bmi2")))
+#define FE51_NAME(name) name##_bmi2
+#else
+#define FE51_TARGET
+#define FE51_NAME(name) name##_generic
+#endif
+
+FE51_TARGET static void FE51_NAME(fe51_mul)(fe h, const fe f, const fe g) {
+  uint64_t a[5], b[5];
+  fe51_uint128 r[5];
+  uint64_t b1_19, b2_19, b3_19, b4_19;
+  fe51_load(a, f);
+  fe51_load(b, g);
+  b1_19 = 19 * b[1];
+  b2_19 = 19 * b[2];
+  b3_19 = 19 * b[3];
+  b4_19 = 19 * b[4];
+  r[0] = (fe51_uint128) a[0] * b[0] + (fe51_uint128) a[1] * b4_19 + (fe51_uint128) a[2] * b3_19 + (fe51_uint128) a[3] * b2_19 + (fe51_uint128) a[4] * b1_19;
+  r[1] = (fe51_uint128) a[0] * b[1] + (fe51_uint128) a[1] * b[0] + (fe51_uint128) a[2] * b4_19 + (fe51_uint128) a[3] * b3_19 + (fe51_uint128) a[4] * b2_19;
+  r[2] = (fe51_uint128) a[0] * b[2] + (fe51_uint128) a[1] * b[1] + (fe51_uint128) a[2] * b[0] + (fe51_uint128) a[3] * b4_19 + (fe51_uint128) a[4] * b3_19;
+  r[3] = (fe51_uint128) a[0] * b[3] + (fe51_uint128) a[1] * b[2] + (fe51_uint128) a[2] * b[1] + (fe51_uint128) a[3] * b[0] + (fe51_uint128) a[4] * b4_19;
+  r[4] = (fe51_uint128) a[0] * b[4] + (fe51_uint128) a[1] * b[3] + (fe51_uint128) a[2] * b[2] + (fe51_uint128) a[3] * b[1] + (fe51_uint128) a[4] * b[0];
+  fe51_carry(a, r);
+  fe51_store(h, a);
+}
+
+FE51_TARGET static void FE51_NAME(fe51_sq_products)(fe51_uint128 r[5], const uint64_t a[5]) {
+  uint64_t a0_2 = 2 * a[0];
+  uint64_t a1_2 = 2 * a[1];
+  uint64_t a1_38 = 38 * a[1];
+  uint64_t a2_38 = 38 * a[2];
+  uint64_t a3_19 = 19 * a[3];
+  uint64_t a3_38 = 38 * a[3];
+  uint64_t a4_19 = 19 * a[4];
+  r[0] = (fe51_uint128) a[0] * a[0] + (fe51_uint128) a1_38 * a[4] + (fe51_uint128) a2_38 * a[3];
+  r[1] = (fe51_uint128) a0_2 * a[1] + (fe51_uint128) a2_38 * a[4] + (fe51_uint128) a3_19 * a[3];
+  r[2] = (fe51_uint128) a0_2 * a[2] + (fe51_uint128) a[1] * a[1] + (fe51_uint128) a3_38 * a[4];
+  r[3] = (fe51_uint128) a0_2 * a[3] + (fe51_uint128) a1_2 * a[2] + (fe51_uint128) a4_19 * a[4];
+  r[4] = (fe51_uint128) a0_2 * a[4] + (fe51_uint128) a1_2 * a[3] + (fe51_uint128) a[2] * a[2];
+}
+
+/* h = f * f, or 2 * f * f if dbl */
+FE51_TARGET static void FE51_NAME(fe51_sq)(fe h, const fe f, int dbl) {
+  uint64_t a[5];
+  fe51_uint128 r[5];
+  int i;
+  fe51_load(a, f);
+  FE51_NAME(fe51_sq_products)(r, a);
+  if (dbl) {
+    for (i = 0; i < 5; i++) {
+      r[i] <<= 1;
+    }
+  }
+  fe51_carry(a, r);
+  fe51_store(h, a);
+}
+
+/* h = f^(2^n), stays in radix 2^51 between squarings */
+FE51_TARGET static void FE51_NAME(fe51_sqn)(fe h, const fe f, int n) {
+  uint64_t a[5];
+  fe51_uint128 r[5];
+  int i;
+  fe51_load(a, f);
+  for (i = 0; i < n; i++) {
+    FE51_NAME(fe51_sq_products)(r, a);
+    fe51_carry(a, r);
+  }
+  fe51_store(h, a);
+}
+
+#undef FE51_TARGET
+#undef FE51_NAME
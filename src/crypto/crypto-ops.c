@@ -11,10 +11,16 @@
 #include "crypto-ops-data.h"
 #include "crypto-util.h"
 
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <cpuid.h>
+#include "initializer.h"
+#endif
+
 /* Predeclarations */
 
 static void fe_mul(fe, const fe, const fe);
 static void fe_sq(fe, const fe);
+static void fe_sqn(fe, const fe, int);
 static void fe_tobytes(unsigned char *, const fe);
 static void ge_madd(ge_p1p1 *, const ge_p3 *, const ge_precomp *);
 static void ge_msub(ge_p1p1 *, const ge_p3 *, const ge_precomp *);
@@ -237,7 +243,6 @@ static void fe_invert(fe out, const fe z) {
   fe t1;
   fe t2;
   fe t3;
-  int i;
 
   fe_sq(t0, z);
   fe_sq(t1, t0);
@@ -247,44 +252,28 @@ static void fe_invert(fe out, const fe z) {
   fe_sq(t2, t0);
   fe_mul(t1, t1, t2);
   fe_sq(t2, t1);
-  for (i = 0; i < 4; ++i) {
-    fe_sq(t2, t2);
-  }
+  fe_sqn(t2, t2, 4);
   fe_mul(t1, t2, t1);
   fe_sq(t2, t1);
-  for (i = 0; i < 9; ++i) {
-    fe_sq(t2, t2);
-  }
+  fe_sqn(t2, t2, 9);
   fe_mul(t2, t2, t1);
   fe_sq(t3, t2);
-  for (i = 0; i < 19; ++i) {
-    fe_sq(t3, t3);
-  }
+  fe_sqn(t3, t3, 19);
   fe_mul(t2, t3, t2);
   fe_sq(t2, t2);
-  for (i = 0; i < 9; ++i) {
-    fe_sq(t2, t2);
-  }
+  fe_sqn(t2, t2, 9);
   fe_mul(t1, t2, t1);
   fe_sq(t2, t1);
-  for (i = 0; i < 49; ++i) {
-    fe_sq(t2, t2);
-  }
+  fe_sqn(t2, t2, 49);
   fe_mul(t2, t2, t1);
   fe_sq(t3, t2);
-  for (i = 0; i < 99; ++i) {
-    fe_sq(t3, t3);
-  }
+  fe_sqn(t3, t3, 99);
   fe_mul(t2, t3, t2);
   fe_sq(t2, t2);
-  for (i = 0; i < 49; ++i) {
-    fe_sq(t2, t2);
-  }
+  fe_sqn(t2, t2, 49);
   fe_mul(t1, t2, t1);
   fe_sq(t1, t1);
-  for (i = 0; i < 4; ++i) {
-    fe_sq(t1, t1);
-  }
+  fe_sqn(t1, t1, 4);
   fe_mul(out, t1, t0);
 
   return;
@@ -351,7 +340,7 @@ Can get away with 11 carries, but then data flow is much deeper.
 With tighter constraints on inputs can squeeze carries into int32.
 */
 
-static void fe_mul(fe h, const fe f, const fe g) {
+static void fe_mul_ref10(fe h, const fe f, const fe g) {
   int32_t f0 = f[0];
   int32_t f1 = f[1];
   int32_t f2 = f[2];
@@ -631,7 +620,7 @@ Postconditions:
 See fe_mul.c for discussion of implementation strategy.
 */
 
-static void fe_sq(fe h, const fe f) {
+static void fe_sq_ref10(fe h, const fe f) {
   int32_t f0 = f[0];
   int32_t f1 = f[1];
   int32_t f2 = f[2];
@@ -779,7 +768,7 @@ Postconditions:
 See fe_mul.c for discussion of implementation strategy.
 */
 
-static void fe_sq2(fe h, const fe f) {
+static void fe_sq2_ref10(fe h, const fe f) {
   int32_t f0 = f[0];
   int32_t f1 = f[1];
   int32_t f2 = f[2];
@@ -921,6 +910,165 @@ static void fe_sq2(fe h, const fe f) {
   h[9] = (int32_t) h9;
 }
 
+/* h = f^(2^n) */
+
+static void fe_sqn_ref10(fe h, const fe f, int n) {
+  int i;
+  fe_copy(h, f);
+  for (i = 0; i < n; ++i) {
+    fe_sq_ref10(h, h);
+  }
+}
+
+/* fe_mul, fe_sq, fe_sq2 and fe_sqn backend selected at startup */
+
+#if defined(__GNUC__) && defined(__x86_64__)
+
+typedef unsigned __int128 fe51_uint128;
+
+static const uint64_t fe51_mask = ((uint64_t) 1 << 51) - 1;
+
+/*
+a = f + 16 * p in radix 2^51, so limbs are positive.
+Preconditions:
+   |f| bounded by 2^30,2^28,2^30,2^28,etc.
+Postconditions:
+   a bounded by 2^56
+*/
+
+static void fe51_load(uint64_t a[5], const fe f) {
+  static const uint64_t bias[5] = {
+    ((uint64_t) 1 << 55) - 304, ((uint64_t) 1 << 55) - 16, ((uint64_t) 1 << 55) - 16,
+    ((uint64_t) 1 << 55) - 16, ((uint64_t) 1 << 55) - 16
+  };
+  int i;
+  for (i = 0; i < 5; i++) {
+    /* unsigned arithmetic wraps, sum is positive */
+    a[i] = (uint64_t) (int64_t) f[2 * i] + ((uint64_t) (int64_t) f[2 * i + 1] << 26) + bias[i];
+  }
+}
+
+/* Carries radix 2^51 products into limbs bounded by 2^51+2^22 */
+
+static void fe51_carry(uint64_t l[5], fe51_uint128 r[5]) {
+  fe51_uint128 t;
+  r[1] += r[0] >> 51; l[0] = (uint64_t) r[0] & fe51_mask;
+  r[2] += r[1] >> 51; l[1] = (uint64_t) r[1] & fe51_mask;
+  r[3] += r[2] >> 51; l[2] = (uint64_t) r[2] & fe51_mask;
+  r[4] += r[3] >> 51; l[3] = (uint64_t) r[3] & fe51_mask;
+  l[4] = (uint64_t) r[4] & fe51_mask;
+  t = (fe51_uint128) l[0] + (r[4] >> 51) * 19;
+  l[0] = (uint64_t) t & fe51_mask;
+  l[1] += (uint64_t) (t >> 51);
+}
+
+/* Splits radix 2^51 limbs into ref10 representation with ref10 postconditions */
+
+static void fe51_store(fe h, const uint64_t l[5]) {
+  int64_t h0, h1, h2, h3, h4, h5, h6, h7, h8, h9;
+  int64_t carry0, carry1, carry2, carry3, carry4, carry5, carry6, carry7, carry8, carry9;
+
+  h0 = (int64_t) (l[0] & ((1 << 26) - 1)); h1 = (int64_t) (l[0] >> 26);
+  h2 = (int64_t) (l[1] & ((1 << 26) - 1)); h3 = (int64_t) (l[1] >> 26);
+  h4 = (int64_t) (l[2] & ((1 << 26) - 1)); h5 = (int64_t) (l[2] >> 26);
+  h6 = (int64_t) (l[3] & ((1 << 26) - 1)); h7 = (int64_t) (l[3] >> 26);
+  h8 = (int64_t) (l[4] & ((1 << 26) - 1)); h9 = (int64_t) (l[4] >> 26);
+
+  carry0 = (h0 + (int64_t) (1<<25)) >> 26; h1 += carry0; h0 -= carry0 << 26;
+  carry1 = (h1 + (int64_t) (1<<24)) >> 25; h2 += carry1; h1 -= carry1 << 25;
+  carry2 = (h2 + (int64_t) (1<<25)) >> 26; h3 += carry2; h2 -= carry2 << 26;
+  carry3 = (h3 + (int64_t) (1<<24)) >> 25; h4 += carry3; h3 -= carry3 << 25;
+  carry4 = (h4 + (int64_t) (1<<25)) >> 26; h5 += carry4; h4 -= carry4 << 26;
+  carry5 = (h5 + (int64_t) (1<<24)) >> 25; h6 += carry5; h5 -= carry5 << 25;
+  carry6 = (h6 + (int64_t) (1<<25)) >> 26; h7 += carry6; h6 -= carry6 << 26;
+  carry7 = (h7 + (int64_t) (1<<24)) >> 25; h8 += carry7; h7 -= carry7 << 25;
+  carry8 = (h8 + (int64_t) (1<<25)) >> 26; h9 += carry8; h8 -= carry8 << 26;
+  carry9 = (h9 + (int64_t) (1<<24)) >> 25; h0 += carry9 * 19; h9 -= carry9 << 25;
+  carry0 = (h0 + (int64_t) (1<<25)) >> 26; h1 += carry0; h0 -= carry0 << 26;
+
+  h[0] = (int32_t) h0;
+  h[1] = (int32_t) h1;
+  h[2] = (int32_t) h2;
+  h[3] = (int32_t) h3;
+  h[4] = (int32_t) h4;
+  h[5] = (int32_t) h5;
+  h[6] = (int32_t) h6;
+  h[7] = (int32_t) h7;
+  h[8] = (int32_t) h8;
+  h[9] = (int32_t) h9;
+}
+
+#include "crypto-ops-fe51.inl"
+#define FE51_BMI2
+#include "crypto-ops-fe51.inl"
+#undef FE51_BMI2
+
+static void fe_sq_ref10_dbl(fe h, const fe f, int dbl) {
+  if (dbl) {
+    fe_sq2_ref10(h, f);
+  } else {
+    fe_sq_ref10(h, f);
+  }
+}
+
+/* ref10 until detect_fe_backend runs, it is only faster, not different */
+static void (*fe_mul_fp)(fe, const fe, const fe) = fe_mul_ref10;
+static void (*fe_sq_fp)(fe, const fe, int) = fe_sq_ref10_dbl;
+static void (*fe_sqn_fp)(fe, const fe, int) = fe_sqn_ref10;
+
+static int cpu_has_bmi2(void) {
+  unsigned int a, b, c, d;
+  return __get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & (1 << 8)) ? 1 : 0;
+}
+
+INITIALIZER(detect_fe_backend) {
+  if (cpu_has_bmi2()) {
+    fe_mul_fp = fe51_mul_bmi2;
+    fe_sq_fp = fe51_sq_bmi2;
+    fe_sqn_fp = fe51_sqn_bmi2;
+  } else {
+    fe_mul_fp = fe51_mul_generic;
+    fe_sq_fp = fe51_sq_generic;
+    fe_sqn_fp = fe51_sqn_generic;
+  }
+}
+
+static void fe_mul(fe h, const fe f, const fe g) {
+  fe_mul_fp(h, f, g);
+}
+
+static void fe_sq(fe h, const fe f) {
+  fe_sq_fp(h, f, 0);
+}
+
+static void fe_sq2(fe h, const fe f) {
+  fe_sq_fp(h, f, 1);
+}
+
+static void fe_sqn(fe h, const fe f, int n) {
+  fe_sqn_fp(h, f, n);
+}
+
+#else
+
+static void fe_mul(fe h, const fe f, const fe g) {
+  fe_mul_ref10(h, f, g);
+}
+
+static void fe_sq(fe h, const fe f) {
+  fe_sq_ref10(h, f);
+}
+
+static void fe_sq2(fe h, const fe f) {
+  fe_sq2_ref10(h, f);
+}
+
+static void fe_sqn(fe h, const fe f, int n) {
+  fe_sqn_ref10(h, f, n);
+}
+
+#endif
+
 /* From fe_sub.c */
 
 /*
@@ -1600,6 +1748,39 @@ void ge_tobytes(struct EllipticCurvePoint *ss, const ge_p2 *h) {
   s[31] ^= fe_isnegative(x) << 7;
 }
 
+/* New code */
+
+/* Same bytes as ge_tobytes of each point, with one fe_invert for all (Montgomery trick). scratch has count elements */
+void ge_tobytes_batch(struct EllipticCurvePoint *ss, const ge_p2 *h, size_t count, fe *scratch) {
+  fe acc;
+  fe inv;
+  fe recip;
+  fe x;
+  fe y;
+  size_t i;
+
+  fe_1(acc);
+  for (i = 0; i != count; ++i) {
+    fe_copy(scratch[i], acc); /* product of nonzero Z before i */
+    if (fe_isnonzero(h[i].Z)) {
+      fe_mul(acc, acc, h[i].Z);
+    }
+  }
+  fe_invert(inv, acc);
+  for (i = count; i-- > 0;) {
+    if (fe_isnonzero(h[i].Z)) {
+      fe_mul(recip, inv, scratch[i]);
+      fe_mul(inv, inv, h[i].Z);
+    } else {
+      fe_0(recip); /* fe_invert of zero is zero */
+    }
+    fe_mul(x, h[i].X, recip);
+    fe_mul(y, h[i].Y, recip);
+    fe_tobytes(ss[i].data, y);
+    ss[i].data[31] ^= fe_isnegative(x) << 7;
+  }
+}
+
 /* From sc_reduce.c */
 
 /*
@@ -1844,7 +2025,6 @@ void sc_reduce(struct EllipticCurveScalar * aa, const unsigned char s[64]) {
 
 static void fe_divpowm1(fe r, const fe u, const fe v) {
   fe v3, uv7, t0, t1, t2;
-  int i;
 
   fe_sq(v3, v);
   fe_mul(v3, v3, v); /* v3 = v^3 */
@@ -1864,37 +2044,23 @@ static void fe_divpowm1(fe r, const fe u, const fe v) {
   fe_sq(t0, t0);
   fe_mul(t0, t1, t0);
   fe_sq(t1, t0);
-  for (i = 0; i < 4; ++i) {
-    fe_sq(t1, t1);
-  }
+  fe_sqn(t1, t1, 4);
   fe_mul(t0, t1, t0);
   fe_sq(t1, t0);
-  for (i = 0; i < 9; ++i) {
-    fe_sq(t1, t1);
-  }
+  fe_sqn(t1, t1, 9);
   fe_mul(t1, t1, t0);
   fe_sq(t2, t1);
-  for (i = 0; i < 19; ++i) {
-    fe_sq(t2, t2);
-  }
+  fe_sqn(t2, t2, 19);
   fe_mul(t1, t2, t1);
-  for (i = 0; i < 10; ++i) {
-    fe_sq(t1, t1);
-  }
+  fe_sqn(t1, t1, 10);
   fe_mul(t0, t1, t0);
   fe_sq(t1, t0);
-  for (i = 0; i < 49; ++i) {
-    fe_sq(t1, t1);
-  }
+  fe_sqn(t1, t1, 49);
   fe_mul(t1, t1, t0);
   fe_sq(t2, t1);
-  for (i = 0; i < 99; ++i) {
-    fe_sq(t2, t2);
-  }
+  fe_sqn(t2, t2, 99);
   fe_mul(t1, t2, t1);
-  for (i = 0; i < 50; ++i) {
-    fe_sq(t1, t1);
-  }
+  fe_sqn(t1, t1, 50);
   fe_mul(t0, t1, t0);
   fe_sq(t0, t0);
   fe_sq(t0, t0);
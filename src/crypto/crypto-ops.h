@@ -6,6 +6,7 @@
 
 #pragma once
 
+#include <stddef.h>
 #include "c_types.h"
 #if defined(__cplusplus)
 namespace crypto { extern "C" {
@@ -99,6 +100,7 @@ void ge_sub(ge_p1p1 *, const ge_p3 *, const ge_cached *);
 /* From ge_tobytes.c */
 
 void ge_tobytes(struct EllipticCurvePoint *, const ge_p2 *);
+void ge_tobytes_batch(struct EllipticCurvePoint *, const ge_p2 *, size_t, fe *); /* New code */
 
 /* From sc_reduce.c */
 
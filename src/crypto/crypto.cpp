@@ -4,6 +4,7 @@
 // Copyright (c) 2019, The Cryonero developers.
 // Licensed under the GNU Lesser General Public License. See LICENSE for details.
 
+#include <algorithm>
 #include <cassert>
 #include <cstddef>
 #include <cstdint>
@@ -12,6 +13,7 @@
 #include <iostream>
 #include <memory>
 #include <mutex>
+#include <vector>
 
 #include "crypto-ops.h"
 #include "crypto.hpp"
@@ -308,6 +310,51 @@ void hash_to_ec(const PublicKey &key, EllipticCurvePoint &res) {
 	ge_p3_tobytes(&res, &tmp);
 }
 
+// Decompressed key and hash_to_ec of ring members depend only on key, and popular recent outputs are members
+// of many rings. Direct mapped by key bytes with striped locks, so memory is fixed (~11 MB) and colliding keys
+// just replace each other
+namespace {
+struct RingMemberPoints {
+	PublicKey key;
+	bool valid = false;
+	ge_p3 point;
+	ge_p3 hash_point;
+};
+const size_t RING_MEMBER_CACHE_SIZE  = 1 << 15;
+const size_t RING_MEMBER_CACHE_LOCKS = 64;
+struct RingMemberCache {
+	std::vector<RingMemberPoints> entries{RING_MEMBER_CACHE_SIZE};
+	std::mutex locks[RING_MEMBER_CACHE_LOCKS];
+};
+}  // anonymous namespace
+
+static bool get_ring_member_points(const PublicKey &key, ge_p3 *point, ge_p3 *hash_point) {
+	static RingMemberCache cache;
+	uint32_t index = 0;
+	memcpy(&index, key.data, sizeof(index));
+	index %= RING_MEMBER_CACHE_SIZE;
+	std::mutex &lock_for_index = cache.locks[index % RING_MEMBER_CACHE_LOCKS];
+	{
+		std::lock_guard<std::mutex> lock(lock_for_index);
+		const RingMemberPoints &entry = cache.entries[index];
+		if (entry.valid && entry.key == key) {
+			*point      = entry.point;
+			*hash_point = entry.hash_point;
+			return true;
+		}
+	}
+	if (ge_frombytes_vartime(point, &key) != 0)
+		return false;
+	hash_to_ec(key, *hash_point);
+	std::lock_guard<std::mutex> lock(lock_for_index);
+	RingMemberPoints &entry = cache.entries[index];
+	entry.key               = key;
+	entry.valid             = true;
+	entry.point             = *point;
+	entry.hash_point        = *hash_point;
+	return true;
+}
+
 
 void generate_key_image(const PublicKey &pub, const SecretKey &sec, KeyImage &image) {
 	ge_p3 point;
@@ -390,8 +437,10 @@ bool generate_ring_signature(const Hash &prefix_hash, const KeyImage &image, con
 	return true;
 }
 
-bool check_ring_signature(const Hash &prefix_hash, const KeyImage &image, const PublicKey *const pubs[],
-    size_t pubs_count, const Signature sigs[], bool check_key_image, bool *key_corrupted) {
+#if cryonero_CHECK_RING_BATCH  // compare batch results with reference implementation, slow
+static bool check_ring_signature_reference(const Hash &prefix_hash, const KeyImage &image,
+    const PublicKey *const pubs[], size_t pubs_count, const Signature sigs[], bool check_key_image,
+    bool *key_corrupted) {
 	if (key_corrupted)
 		*key_corrupted = false;
 	ge_p3 image_unp;
@@ -410,10 +459,11 @@ bool check_ring_signature(const Hash &prefix_hash, const KeyImage &image, const
 	buf->h = prefix_hash;
 	for (size_t i = 0; i < pubs_count; i++) {
 		ge_p2 tmp2;
-		ge_p3 tmp3;
+		ge_p3 tmp3, hash_point;
 		if (!sc_isvalid_vartime(&sigs[i].c) || !sc_isvalid_vartime(&sigs[i].r)) {
 			return false;
 		}
+		hash_to_ec(*pubs[i], hash_point);
 		if (ge_frombytes_vartime(&tmp3, pubs[i]) != 0) {
 			if (key_corrupted)
 				*key_corrupted = true;
@@ -422,8 +472,7 @@ bool check_ring_signature(const Hash &prefix_hash, const KeyImage &image, const
 		}
 		ge_double_scalarmult_base_vartime(&tmp2, &sigs[i].c, &tmp3, &sigs[i].r);
 		ge_tobytes(&buf->ab[i].a, &tmp2);
-		hash_to_ec(*pubs[i], tmp3);
-		ge_double_scalarmult_precomp_vartime(&tmp2, &sigs[i].r, &tmp3, &sigs[i].c, image_pre);
+		ge_double_scalarmult_precomp_vartime(&tmp2, &sigs[i].r, &hash_point, &sigs[i].c, image_pre);
 		ge_tobytes(&buf->ab[i].b, &tmp2);
 		sc_add(&sum, &sum, &sigs[i].c);
 	}
@@ -431,6 +480,102 @@ bool check_ring_signature(const Hash &prefix_hash, const KeyImage &image, const
 	sc_sub(&h, &h, &sum);
 	return sc_iszero(&h);
 }
+#endif
+
+// Computes a and b points of all members, false if ring is rejected before hashing
+static bool prepare_ring(RingSignatureCheck &check, ge_p2 *points) {
+	ge_p3 image_unp;
+	ge_dsmp image_pre;
+	if (ge_frombytes_vartime(&image_unp, check.image) != 0) {
+		return false;
+	}
+	ge_dsm_precomp(image_pre, &image_unp);
+	if (check.check_key_image && ge_check_subgroup_precomp_vartime(image_pre) != 0) {
+		return false;
+	}
+	for (size_t i = 0; i < check.pubs_count; i++) {
+		const Signature &sig = check.sigs[i];
+		ge_p3 tmp3, hash_point;
+		if (!sc_isvalid_vartime(&sig.c) || !sc_isvalid_vartime(&sig.r)) {
+			return false;
+		}
+		if (!get_ring_member_points(*check.pubs[i], &tmp3, &hash_point)) {
+			check.key_corrupted = true;
+			assert(false);
+			return false;
+		}
+		ge_double_scalarmult_base_vartime(&points[2 * i], &sig.c, &tmp3, &sig.r);
+		ge_double_scalarmult_precomp_vartime(&points[2 * i + 1], &sig.r, &hash_point, &sig.c, image_pre);
+	}
+	return true;
+}
+
+void check_ring_signatures(RingSignatureCheck checks[], size_t count) {
+	size_t total_points = 0;
+	for (size_t c = 0; c != count; ++c)
+		total_points += 2 * checks[c].pubs_count;
+	std::vector<ge_p2> points(total_points);
+	std::vector<EllipticCurvePoint> compressed(total_points);
+	std::unique_ptr<fe[]> scratch(new fe[total_points]);
+	std::vector<size_t> starts(count);
+	std::vector<bool> prepared(count);
+	size_t pos         = 0;
+	size_t max_members = 0;
+	for (size_t c = 0; c != count; ++c) {
+		checks[c].result        = false;
+		checks[c].key_corrupted = false;
+		prepared[c]             = prepare_ring(checks[c], points.data() + pos);
+		if (!prepared[c])
+			continue;
+		starts[c] = pos;
+		pos += 2 * checks[c].pubs_count;
+		max_members = std::max(max_members, checks[c].pubs_count);
+	}
+	ge_tobytes_batch(compressed.data(), points.data(), pos, scratch.get());
+	std::vector<unsigned char> buf_data(rs_comm_size(max_members));
+	rs_comm *const buf = reinterpret_cast<rs_comm *>(buf_data.data());
+	for (size_t c = 0; c != count; ++c) {
+		RingSignatureCheck &check = checks[c];
+		if (!prepared[c])
+			continue;
+		EllipticCurveScalar sum, h;
+		const size_t buf_size = rs_comm_size(check.pubs_count);
+		sc_0(&sum);
+		buf->h = *check.prefix_hash;
+		for (size_t i = 0; i < check.pubs_count; i++) {
+			buf->ab[i].a = compressed[starts[c] + 2 * i];
+			buf->ab[i].b = compressed[starts[c] + 2 * i + 1];
+			sc_add(&sum, &sum, &check.sigs[i].c);
+		}
+		hash_to_scalar(buf, buf_size, h);
+		sc_sub(&h, &h, &sum);
+		check.result = sc_iszero(&h) != 0;
+	}
+#if cryonero_CHECK_RING_BATCH
+	for (size_t c = 0; c != count; ++c) {
+		bool key_corrupted = false;
+		const bool result  = check_ring_signature_reference(*checks[c].prefix_hash, *checks[c].image,
+		    checks[c].pubs, checks[c].pubs_count, checks[c].sigs, checks[c].check_key_image, &key_corrupted);
+		if (result != checks[c].result || key_corrupted != checks[c].key_corrupted)
+			throw std::logic_error("check_ring_signatures differs from reference implementation");
+	}
+#endif
+}
+
+bool check_ring_signature(const Hash &prefix_hash, const KeyImage &image, const PublicKey *const pubs[],
+    size_t pubs_count, const Signature sigs[], bool check_key_image, bool *key_corrupted) {
+	RingSignatureCheck check;
+	check.prefix_hash     = &prefix_hash;
+	check.image           = &image;
+	check.pubs            = pubs;
+	check.pubs_count      = pubs_count;
+	check.sigs            = sigs;
+	check.check_key_image = check_key_image;
+	check_ring_signatures(&check, 1);
+	if (key_corrupted)
+		*key_corrupted = check.key_corrupted;
+	return check.result;
+}
 
 #pragma pack(push, 1)
 struct sp_comm {
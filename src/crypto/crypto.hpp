@@ -90,6 +90,20 @@ bool generate_ring_signature(const Hash &prefix_hash, const KeyImage &image, con
 bool check_ring_signature(const Hash &prefix_hash, const KeyImage &image, const PublicKey *const pubs[],
     size_t pubs_count, const Signature sigs[], bool check_key_image, bool *key_corrupted = nullptr);
 
+// One ring for check_ring_signatures, result and key_corrupted are outputs
+struct RingSignatureCheck {
+	const Hash *prefix_hash         = nullptr;
+	const KeyImage *image           = nullptr;
+	const PublicKey *const *pubs    = nullptr;
+	size_t pubs_count               = 0;
+	const Signature *sigs           = nullptr;
+	bool check_key_image            = true;
+	bool result                     = false;
+	bool key_corrupted              = false;
+};
+// Same results as check_ring_signature of each ring, but points of all rings are compressed with one field inversion
+void check_ring_signatures(RingSignatureCheck checks[], size_t count);
+
 inline bool generate_ring_signature(const Hash &prefix_hash, const KeyImage &image,
     const std::vector<const PublicKey *> &pubs, const SecretKey &sec, size_t sec_index, Signature sigs[]) {
 	return generate_ring_signature(prefix_hash, image, pubs.data(), pubs.size(), sec, sec_index, sigs);
@@ -5,6 +5,9 @@
 // Licensed under the GNU Lesser General Public License. See LICENSE for details.
 
 #include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
 #include <new>
 
 #include "hash.hpp"
@@ -21,8 +24,8 @@ enum { MAP_SIZE = SLOW_HASH_CONTEXT_SIZE + ((-SLOW_HASH_CONTEXT_SIZE) & 0xfff) }
 
 #if defined(_WIN32)
 
-CryptoNightContext::CryptoNightContext() {
-	data = VirtualAlloc(nullptr, MAP_SIZE, MEM_COMMIT, PAGE_READWRITE);
+CryptoNightContext::CryptoNightContext(size_t ways) : ways(ways), map_size(MAP_SIZE * ways) {
+	data = VirtualAlloc(nullptr, map_size, MEM_COMMIT, PAGE_READWRITE);
 	if (data == nullptr) {
 		throw std::bad_alloc();
 	}
@@ -35,22 +38,127 @@ CryptoNightContext::~CryptoNightContext() {
 
 #else
 
-CryptoNightContext::CryptoNightContext() {
+#if defined(MAP_HUGETLB) || defined(MADV_HUGEPAGE)
+enum { HUGE_PAGE_SIZE = 1 << 21 };
+
+static size_t round_to_huge_pages(size_t size) { return (size + HUGE_PAGE_SIZE - 1) & ~size_t(HUGE_PAGE_SIZE - 1); }
+#endif
+
+// With 4K pages each hash misses TLB all over 512 pages of scratchpad
+CryptoNightContext::CryptoNightContext(size_t ways) : ways(ways), map_size(MAP_SIZE * ways) {
+#if defined(MAP_HUGETLB)
+	// Fails immediately if administrator did not reserve enough huge pages
+	data = mmap(nullptr, round_to_huge_pages(map_size), PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+	if (data != MAP_FAILED) {
+		map_size = round_to_huge_pages(map_size);
+		pages    = HUGE_PAGES;
+		return;
+	}
+#endif
+#if defined(MADV_HUGEPAGE)
+	// Kernel backs only aligned 2M ranges with transparent huge pages, so we align mapping ourselves
+	const size_t aligned_size = round_to_huge_pages(map_size);
+	void *raw = mmap(nullptr, aligned_size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (raw != MAP_FAILED) {
+		unsigned char *begin   = static_cast<unsigned char *>(raw);
+		unsigned char *aligned = begin + ((HUGE_PAGE_SIZE - reinterpret_cast<uintptr_t>(begin)) & (HUGE_PAGE_SIZE - 1));
+		if (aligned != begin)
+			munmap(begin, aligned - begin);
+		if (aligned + aligned_size != begin + aligned_size + HUGE_PAGE_SIZE)
+			munmap(aligned + aligned_size, begin + aligned_size + HUGE_PAGE_SIZE - (aligned + aligned_size));
+		if (madvise(aligned, aligned_size, MADV_HUGEPAGE) == 0) {
+			data     = aligned;
+			map_size = aligned_size;
+			pages    = TRANSPARENT_HUGE_PAGES;
+			memset(data, 0, map_size);  // fault pages in now, not during first hash
+			mlock(data, map_size);
+			return;
+		}
+		munmap(aligned, aligned_size);
+	}
+#endif
 #if !defined(__APPLE__)
-	data = mmap(nullptr, MAP_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	data = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
 #else
-	data = mmap(nullptr, MAP_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+	data = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
 #endif
 	if (data == MAP_FAILED) {
 		throw std::bad_alloc();
 	}
-	mlock(data, MAP_SIZE);
+	mlock(data, map_size);
 }
 
 CryptoNightContext::~CryptoNightContext() {
-	if (munmap(data, MAP_SIZE) != 0)
+	if (munmap(data, map_size) != 0)
 		assert(false);
 }
 
 #endif
+
+const char *CryptoNightContext::get_pages_name() const {
+	switch (pages) {
+	case HUGE_PAGES:
+		return "huge pages (MAP_HUGETLB)";
+	case TRANSPARENT_HUGE_PAGES:
+		return "transparent huge pages (MADV_HUGEPAGE)";
+	default:
+		return "normal pages";
+	}
+}
+
+void CryptoNightContextPool::Release::operator()(CryptoNightContext *context) const {
+	CryptoNightContextPool &pool = CryptoNightContextPool::instance();
+	std::unique_lock<std::mutex> lock(pool.mu);
+	pool.free_contexts.emplace_back(context);
+}
+
+CryptoNightContextPool &CryptoNightContextPool::instance() {
+	static CryptoNightContextPool *pool = new CryptoNightContextPool();
+	return *pool;
+}
+
+void CryptoNightContextPool::warm_up(size_t count, size_t ways) {
+	std::unique_lock<std::mutex> lock(mu);
+	size_t have = std::count_if(free_contexts.begin(), free_contexts.end(),
+	    [ways](const std::unique_ptr<CryptoNightContext> &context) { return context->get_ways() >= ways; });
+	for (; have < count; ++have)
+		free_contexts.push_back(std::make_unique<CryptoNightContext>(ways));
+}
+
+CryptoNightContextPool::Lease CryptoNightContextPool::acquire(size_t ways) {
+	{
+		std::unique_lock<std::mutex> lock(mu);
+		for (auto it = free_contexts.begin(); it != free_contexts.end(); ++it)
+			if ((*it)->get_ways() >= ways) {
+				Lease result((*it).release());
+				free_contexts.erase(it);
+				return result;
+			}
+	}
+	return Lease(new CryptoNightContext(ways));  // allocated without lock, this can take milliseconds
+}
+
+void CryptoNightContext::slow_hash_multi(
+    const void *const src_data[], const size_t lengths[], Hash hashes[], size_t count, int lite, int variant) {
+	void *contexts[4]{};
+	void *results[4]{};
+	for (size_t i = 0; i != std::min<size_t>(ways, 4); ++i)
+		contexts[i] = static_cast<unsigned char *>(data) + i * MAP_SIZE;
+	for (size_t pos = 0; pos != count;) {
+		const size_t left = count - pos;
+		for (size_t i = 0; i != std::min<size_t>(left, 4); ++i)
+			results[i] = hashes[pos + i].data;
+		if (left >= 4 && ways >= 4) {
+			crypto::cn_slow_hash_x4(contexts, src_data + pos, lengths + pos, results, lite, variant);
+			pos += 4;
+		} else if (left >= 2 && ways >= 2) {
+			crypto::cn_slow_hash_x2(contexts, src_data + pos, lengths + pos, results, lite, variant);
+			pos += 2;
+		} else {
+			crypto::cn_slow_hash(data, src_data[pos], lengths[pos], results[0], lite, variant);
+			pos += 1;
+		}
+	}
+}
 }
@@ -20,6 +20,9 @@ void cn_fast_hash(const void *data, size_t length, unsigned char *hash);
 
 
 void cn_slow_hash(void *, const void *, size_t, void *, int, int);
+// Independent hashes interleaved on one core, each with own context
+void cn_slow_hash_x2(void *const contexts[2], const void *const data[2], const size_t lengths[2], void *const hashes[2], int, int);
+void cn_slow_hash_x4(void *const contexts[4], const void *const data[4], const size_t lengths[4], void *const hashes[4], int, int);
 
 void tree_hash(const unsigned char (*hashes)[HASH_SIZE], size_t count, unsigned char *root_hash);
 size_t tree_depth(size_t count);
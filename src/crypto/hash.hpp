@@ -7,6 +7,9 @@
 #pragma once
 
 #include <stddef.h>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 #include "hash-ops.h"
 #include "types.hpp"
@@ -23,9 +26,13 @@ inline Hash cn_fast_hash(const void *data, size_t length) {
 
 class CryptoNightContext {
 public:
-	CryptoNightContext();
+	explicit CryptoNightContext(size_t ways = 1);  // scratchpad per way, for interleaved hashing
 	~CryptoNightContext();
 
+	enum Pages { NORMAL_PAGES, TRANSPARENT_HUGE_PAGES, HUGE_PAGES };  // tried from HUGE_PAGES down
+	Pages get_pages() const { return pages; }
+	const char *get_pages_name() const;
+
 	CryptoNightContext(const CryptoNightContext &) = delete;
 	void operator=(const CryptoNightContext &) = delete;
 
@@ -47,8 +54,39 @@ public:
 		return hash;
 	}
 
+	// Independent hashes, up to get_ways() of them interleaved on one core
+	void cn_slow_hash_multi(const void *const src_data[], const size_t lengths[], Hash hashes[], size_t count) {
+		slow_hash_multi(src_data, lengths, hashes, count, 0, 0);
+	}
+	void cn_lite_slow_hash_v1_multi(const void *const src_data[], const size_t lengths[], Hash hashes[], size_t count) {
+		slow_hash_multi(src_data, lengths, hashes, count, 1, 1);
+	}
+	size_t get_ways() const { return ways; }
+
 private:
 	void *data;
+	size_t ways;
+	size_t map_size;
+	Pages pages = NORMAL_PAGES;
+	void slow_hash_multi(
+	    const void *const src_data[], const size_t lengths[], Hash hashes[], size_t count, int lite, int variant);
+};
+
+// Contexts take milliseconds to create, so threads hashing now and then borrow warmed up ones
+class CryptoNightContextPool {
+public:
+	struct Release {
+		void operator()(CryptoNightContext *context) const;  // back to pool
+	};
+	using Lease = std::unique_ptr<CryptoNightContext, Release>;
+
+	static CryptoNightContextPool &instance();  // never destroyed, executor tasks can release leases during exit
+	void warm_up(size_t count, size_t ways);    // so that count contexts with ways are ready
+	Lease acquire(size_t ways);                 // free context with at least ways, or new one
+
+private:
+	std::mutex mu;
+	std::vector<std::unique_ptr<CryptoNightContext>> free_contexts;
 };
 
 inline Hash tree_hash(const Hash *hashes, size_t count) {
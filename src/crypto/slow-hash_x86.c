@@ -175,6 +175,56 @@ static void (*const extra_hashes[4])(const void *, size_t, unsigned char *) =
 #include "slow-hash_x86.inl"
 #define AESNI
 #include "slow-hash_x86.inl"
+#undef ctx
+
+// Scratchpad fill and final pass of cn_slow_hash_aesni, already 8 blocks in parallel
+static void cn_explode_aesni(struct cn_ctx *ctx, size_t memory)
+{
+  ALIGNED_DECL(uint8_t ExpandedKey[256], 16);
+  __m128i *longoutput = (__m128i *) ctx->long_state;
+  __m128i *expkey = (__m128i *) ExpandedKey;
+  __m128i *xmminput = (__m128i *) ctx->text;
+  size_t i, j, k;
+
+  memcpy(ExpandedKey, ctx->state.hs.b, AES_KEY_SIZE);
+  ExpandAESKey256(ExpandedKey);
+  for (i = 0; likely(i < memory); i += INIT_SIZE_BYTE)
+  {
+    for (j = 0; j < 10; j++)
+      for (k = 0; k < INIT_SIZE_BLK; k++)
+        xmminput[k] = _mm_aesenc_si128(xmminput[k], expkey[j]);
+    for (k = 0; k < INIT_SIZE_BLK; k++)
+      _mm_store_si128(&(longoutput[(i >> 4) + k]), xmminput[k]);
+  }
+}
+
+static void cn_implode_aesni(struct cn_ctx *ctx, size_t memory)
+{
+  ALIGNED_DECL(uint8_t ExpandedKey[256], 16);
+  __m128i *longoutput = (__m128i *) ctx->long_state;
+  __m128i *expkey = (__m128i *) ExpandedKey;
+  __m128i *xmminput = (__m128i *) ctx->text;
+  size_t i, j, k;
+
+  memcpy(ctx->text, ctx->state.init, INIT_SIZE_BYTE);
+  memcpy(ExpandedKey, &ctx->state.hs.b[32], AES_KEY_SIZE);
+  ExpandAESKey256(ExpandedKey);
+  for (i = 0; likely(i < memory); i += INIT_SIZE_BYTE)
+  {
+    for (k = 0; k < INIT_SIZE_BLK; k++)
+      xmminput[k] = _mm_xor_si128(longoutput[(i >> 4) + k], xmminput[k]);
+    for (j = 0; j < 10; j++)
+      for (k = 0; k < INIT_SIZE_BLK; k++)
+        xmminput[k] = _mm_aesenc_si128(xmminput[k], expkey[j]);
+  }
+}
+
+#define WAYS 2
+#include "slow-hash_x86_multi.inl"
+#undef WAYS
+#define WAYS 4
+#include "slow-hash_x86_multi.inl"
+#undef WAYS
 
 static int cpu_has_aesni(void){
   int ecx;
@@ -202,9 +252,40 @@ void cn_slow_hash(void * a, const void * b, size_t c, void * d, int lite, int va
   (*cn_slow_hash_fp)(a, b, c, d, lite, variant);
 }
 
+static void cn_slow_hash_multi_aesni(void *const a[], const void *const b[], const size_t c[], void *const d[], size_t ways, int lite, int variant){
+  if (ways == 4)
+    cn_slow_hash_x4_aesni(a, b, c, d, lite, variant);
+  else
+    cn_slow_hash_x2_aesni(a, b, c, d, lite, variant);
+}
+
+static void cn_slow_hash_multi_noaesni(void *const a[], const void *const b[], const size_t c[], void *const d[], size_t ways, int lite, int variant){
+  size_t i;
+  for (i = 0; i < ways; i++)
+    cn_slow_hash_noaesni(a[i], b[i], c[i], d[i], lite, variant);
+}
+
+static void cn_slow_hash_multi_runtime_aes_check(void *const a[], const void *const b[], const size_t c[], void *const d[], size_t ways, int lite, int variant){
+  if( cpu_has_aesni() )
+    cn_slow_hash_multi_aesni(a, b, c, d, ways, lite, variant);
+  else
+    cn_slow_hash_multi_noaesni(a, b, c, d, ways, lite, variant);
+}
+
+static void (*cn_slow_hash_multi_fp)(void *const [], const void *const [], const size_t [], void *const [], size_t, int lite, int variant) = cn_slow_hash_multi_runtime_aes_check;
+
+void cn_slow_hash_x2(void *const a[2], const void *const b[2], const size_t c[2], void *const d[2], int lite, int variant){
+  (*cn_slow_hash_multi_fp)(a, b, c, d, 2, lite, variant);
+}
+
+void cn_slow_hash_x4(void *const a[4], const void *const b[4], const size_t c[4], void *const d[4], int lite, int variant){
+  (*cn_slow_hash_multi_fp)(a, b, c, d, 4, lite, variant);
+}
+
 // If INITIALIZER fails to compile on your platform, just comment out 3 lines below
 INITIALIZER(detect_aes) {
   cn_slow_hash_fp = cpu_has_aesni() ? &cn_slow_hash_aesni : &cn_slow_hash_noaesni;
+  cn_slow_hash_multi_fp = cpu_has_aesni() ? &cn_slow_hash_multi_aesni : &cn_slow_hash_multi_noaesni;
 }
 
 #endif // !TARGET_OS_IPHONE
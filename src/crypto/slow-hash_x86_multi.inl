@@ -0,0 +1,93 @@
+// Copyright (c) 2019, The Cryonero developers.
+// Licensed under the GNU Lesser General Public License. See LICENSE for details.
+
+// No protection from double-include, this file is included with WAYS 2 and 4 in slow-hash_x86.c
+
+static void
+#if WAYS == 2
+cn_slow_hash_x2_aesni
+#else
+cn_slow_hash_x4_aesni
+#endif
+(void *const contexts[], const void *const datas[], const size_t lengths[], void *const hashes[], int lite, int variant)
+{
+  struct cn_ctx *ctxs[WAYS];
+  uint64_t tweaks1_2[WAYS];
+  ALIGNED_DECL(uint64_t a[WAYS][2], 16);
+  __m128i b_x[WAYS];
+  size_t i, w;
+  size_t memory = lite ? LITE_MEMORY : MEMORY;
+  size_t iterations = lite ? LITE_ITER : ITER;
+  size_t mask = lite ? LITE_MASK : MASK;
+
+  for (w = 0; w < WAYS; w++)
+  {
+    struct cn_ctx *ctx = (struct cn_ctx *) contexts[w];
+    const void *data = datas[w];
+    size_t length = lengths[w];
+    ctxs[w] = ctx;
+    hash_process(&ctx->state.hs, (const uint8_t*) data, length);
+    memcpy(ctx->text, ctx->state.init, INIT_SIZE_BYTE);
+    {
+      VARIANT1_INIT64();
+      tweaks1_2[w] = tweak1_2;
+    }
+    cn_explode_aesni(ctx, memory);
+    for (i = 0; i < 2; i++)
+    {
+      ctx->a[i] = ((uint64_t *)ctx->state.k)[i] ^  ((uint64_t *)ctx->state.k)[i+4];
+      ctx->b[i] = ((uint64_t *)ctx->state.k)[i+2] ^  ((uint64_t *)ctx->state.k)[i+6];
+    }
+    b_x[w] = _mm_load_si128((__m128i *)ctx->b);
+    a[w][0] = ctx->a[0];
+    a[w][1] = ctx->a[1];
+  }
+
+  // Same steps as in cn_slow_hash_aesni, independent chains of all ways overlap in the pipeline
+  for(i = 0; likely(i < iterations); i++)
+  {
+    for (w = 0; w < WAYS; w++)
+    {
+      uint8_t *long_state = ctxs[w]->long_state;
+      __m128i c_x = _mm_load_si128((__m128i *)&long_state[a[w][0] & mask]);
+      __m128i a_x = _mm_load_si128((__m128i *)a[w]);
+      ALIGNED_DECL(uint64_t c[2], 16);
+      ALIGNED_DECL(uint64_t b[2], 16);
+      uint64_t *nextblock, *dst;
+      uint64_t hi, lo;
+
+      c_x = _mm_aesenc_si128(c_x, a_x);
+      _mm_store_si128((__m128i *)c, c_x);
+
+      b_x[w] = _mm_xor_si128(b_x[w], c_x);
+      _mm_store_si128((__m128i *)&long_state[a[w][0] & mask], b_x[w]);
+      VARIANT1_1(&long_state[a[w][0] & mask]);
+
+      nextblock = (uint64_t *)&long_state[c[0] & mask];
+      b[0] = nextblock[0];
+      b[1] = nextblock[1];
+
+      lo = mul128(c[0], b[0], &hi);
+      a[w][0] += hi;
+      a[w][1] += lo;
+      dst = (uint64_t *) &long_state[c[0] & mask];
+      dst[0] = a[w][0];
+      dst[1] = a[w][1];
+
+      a[w][0] ^= b[0];
+      a[w][1] ^= b[1];
+      if (variant > 0)
+        xor64(dst + 1, tweaks1_2[w]);
+      b_x[w] = c_x;
+    }
+  }
+
+  for (w = 0; w < WAYS; w++)
+  {
+    struct cn_ctx *ctx = ctxs[w];
+    cn_implode_aesni(ctx, memory);
+    memcpy(ctx->state.init, ctx->text, INIT_SIZE_BYTE);
+    hash_permutation(&ctx->state.hs);
+    extra_hashes[ctx->state.hs.b[0] & 3](&ctx->state, 200, hashes[w]);
+  }
+}
@@ -0,0 +1,448 @@
+// Copyright (c) 2019, The Cryonero developers.
+// Licensed under the GNU Lesser General Public License. See LICENSE for details.
+
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <thread>
+#include "Core/BlockChainState.hpp"
+#include "Core/Config.hpp"
+#include "Core/CryptoNoteTools.hpp"
+#include "Core/Currency.hpp"
+#include "Core/TransactionBuilder.hpp"
+#include "Core/TransactionExtra.hpp"
+#include "common/CommandLine.hpp"
+#include "common/ConsoleTools.hpp"
+#include "common/Executor.hpp"
+#include "common/Math.hpp"
+#include "crypto/crypto.hpp"
+#include "logging/ConsoleLogger.hpp"
+#include "platform/DB.hpp"
+#include "platform/PathTools.hpp"
+#include "seria/BinaryInputStream.hpp"
+#include "seria/BinaryOutputStream.hpp"
+#include "version.hpp"
+
+using namespace cryonerocoin;
+
+static const char USAGE[] =
+R"(checks )" cryonerocoin_VERSION_STRING R"(.
+
+Differential checks of incremental, batched and cached algorithms against straightforward ones. Library is built
+with cryonero_CHECK_* definitions, so consensus windows, undo records, mining template and Bloom filters are also
+compared inside it, while local testnet chain is mined, synced to second node and reorganized. DB snapshot
+reads are compared on other thread.
+
+Usage:
+  checks [options]
+  checks --help | -h
+
+Options:
+  --data-folder=<full-path>            Scratch folder, blockchain data in it is deleted [default: checks_data].
+)";
+
+// Random rings of different sizes, some of them broken. Batch must give the same result as checking each ring
+// alone, and check_ring_signatures compares each ring with reference implementation itself. Second pass is
+// served from ring member cache.
+static void check_ring_signatures_batch(size_t count) {
+	struct Ring {
+		Hash prefix_hash;
+		KeyImage image;
+		std::vector<PublicKey> pubs;
+		std::vector<const PublicKey *> pub_pointers;
+		std::vector<Signature> sigs;
+		bool valid = true;
+	};
+	std::mt19937_64 rnd(count);
+	std::vector<Ring> rings(count);
+	for (auto &&ring : rings) {
+		const size_t size      = 1 + rnd() % 8;
+		const size_t sec_index = rnd() % size;
+		SecretKey sec;
+		for (size_t i = 0; i != size; ++i) {
+			const auto keys = crypto::random_keypair();
+			ring.pubs.push_back(keys.public_key);
+			if (i == sec_index)
+				sec = keys.secret_key;
+		}
+		for (auto &&pub : ring.pubs)
+			ring.pub_pointers.push_back(&pub);
+		ring.prefix_hash = crypto::rand<Hash>();
+		crypto::generate_key_image(ring.pubs[sec_index], sec, ring.image);
+		ring.sigs.resize(size);
+		crypto::generate_ring_signature(ring.prefix_hash, ring.image, ring.pub_pointers, sec, sec_index,
+		    ring.sigs.data());
+		switch (rnd() % 8) {
+		case 0:
+			ring.sigs[rnd() % size].c.data[rnd() % 32] ^= 1;
+			ring.valid = false;
+			break;
+		case 1:
+			ring.sigs[rnd() % size].r.data[0] ^= 1;
+			ring.valid = false;
+			break;
+		case 2:
+			ring.prefix_hash.data[0] ^= 1;
+			ring.valid = false;
+			break;
+		case 3:
+			ring.image = crypto::rand<KeyImage>();  // usually not a point at all
+			ring.valid = false;
+			break;
+		}
+	}
+	for (int pass = 0; pass != 2; ++pass) {
+		std::vector<crypto::RingSignatureCheck> checks(rings.size());
+		for (size_t i = 0; i != rings.size(); ++i) {
+			checks[i].prefix_hash = &rings[i].prefix_hash;
+			checks[i].image       = &rings[i].image;
+			checks[i].pubs        = rings[i].pub_pointers.data();
+			checks[i].pubs_count  = rings[i].pub_pointers.size();
+			checks[i].sigs        = rings[i].sigs.data();
+		}
+		crypto::check_ring_signatures(checks.data(), checks.size());
+		for (size_t i = 0; i != rings.size(); ++i) {
+			const bool single = crypto::check_ring_signature(
+			    rings[i].prefix_hash, rings[i].image, rings[i].pub_pointers, rings[i].sigs.data(), true);
+			if (checks[i].result != single || single != rings[i].valid)
+				throw std::runtime_error("check_ring_signatures differs from check_ring_signature at ring " +
+				                         std::to_string(i) + " pass " + std::to_string(pass));
+		}
+	}
+	std::cout << "Batch ring signature checks match single checks for " << count << " rings" << std::endl;
+}
+
+static Config make_config(const std::string &folder, std::vector<std::string> options) {
+	options.insert(options.begin(), "checks");
+	options.push_back("--testnet");
+	options.push_back("--data-folder=" + folder);
+	std::vector<const char *> argv;
+	for (auto &&option : options)
+		argv.push_back(option.c_str());
+	common::CommandLine cmd(static_cast<int>(argv.size()), argv.data());
+	return Config(cmd);
+}
+
+static void delete_node_data(const std::string &folder) {
+	platform::DB::delete_db(folder + "/blockchain");
+	platform::remove_file(folder + "/blockchain.transactions.filter");
+	platform::remove_file(folder + "/blockchain.keyimages.filter");
+	for (auto &&name : platform::get_filenames_in_folder(folder + "/block_segments"))
+		platform::remove_file(folder + "/block_segments/" + name);
+}
+
+namespace {
+struct CheckNode {
+	const std::string name;
+	const Config config;
+	BlockChainState state;
+	CheckNode(logging::ILogger &log, const Currency &currency, const std::string &name, const std::string &folder,
+	    const std::vector<std::string> &options)
+	    : name(name), config(make_config(folder, options)), state(log, config, currency, false) {}
+};
+}  // anonymous namespace
+
+static BlockTemplate create_template(CheckNode &node, const AccountPublicAddress &address, Difficulty *difficulty) {
+	BlockTemplate block;
+	Height height = 0;
+	if (!node.state.create_mining_block_template(&block, address, BinaryArray{}, difficulty, &height))
+		throw std::runtime_error(node.name + " create_mining_block_template failed");
+	return block;
+}
+
+// Timestamps are 1 second apart, so testnet difficulty stays minimal and first nonces pass
+static RawBlock mine_template(CheckNode &node, BlockTemplate block, Difficulty difficulty) {
+	const Height height = node.state.get_tip_height() + 1;
+	block.timestamp     = node.state.get_tip().timestamp + 1;
+	auto context        = crypto::CryptoNightContextPool::instance().acquire(1);
+	for (block.nonce = 0;; ++block.nonce) {
+		fix_merge_mining_tag(block);
+		if (node.state.get_currency().check_proof_of_work(get_block_long_hash(block, *context), block, difficulty))
+			break;
+	}
+	RawBlock raw_block;
+	api::BlockHeader info;
+	node.state.add_mined_block(seria::to_binary(block), &raw_block, &info);
+	if (node.state.get_tip_height() != height || node.state.get_tip_bid() != get_block_hash(block))
+		throw std::runtime_error(node.name + " did not accept mined block at height " + std::to_string(height));
+	return raw_block;
+}
+
+static RawBlock mine_block(CheckNode &node, const AccountPublicAddress &address) {
+	Difficulty difficulty = 0;
+	BlockTemplate block   = create_template(node, address, &difficulty);
+	return mine_template(node, std::move(block), difficulty);
+}
+
+// As block arrives from p2p, ring checks start speculatively before it is added
+static void add_block(CheckNode &node, const RawBlock &raw_block) {
+	PreparedBlock pb(RawBlock(raw_block), nullptr);
+	node.state.start_speculative_checks(pb.block, node.state.get_tip_height() + 1);
+	api::BlockHeader info;
+	if (node.state.add_block(pb, &info, "checks") == BroadcastAction::BAN)
+		throw std::runtime_error(node.name + " rejected block " + common::pod_to_hex(pb.bid));
+}
+
+// Biggest coinbase output of main chain block, all coinbase outputs belong to keys
+static api::Output coinbase_output(const CheckNode &node, Height height, const AccountKeys &keys) {
+	Hash bid;
+	RawBlock raw_block;
+	Block block;
+	BlockChainState::BlockGlobalIndices global_indices;
+	if (!node.state.read_chain(height, &bid) || !node.state.read_block(bid, &raw_block) ||
+	    !block.from_raw_block(raw_block) || !node.state.read_block_output_global_indices(bid, &global_indices))
+		throw std::runtime_error(node.name + " failed to read block at height " + std::to_string(height));
+	const Transaction &tx = block.header.base_transaction;
+	api::Output output;
+	for (size_t i = 0; i != tx.outputs.size(); ++i) {
+		if (tx.outputs[i].amount <= output.amount)
+			continue;
+		output.amount                 = tx.outputs[i].amount;
+		output.public_key             = boost::get<KeyOutput>(tx.outputs[i].target).key;
+		output.global_index           = global_indices.at(0).at(i);
+		output.unlock_time            = tx.unlock_time;
+		output.index_in_transaction   = static_cast<uint32_t>(i);
+		output.height                 = height;
+		output.transaction_public_key = get_transaction_public_key_from_extra(tx.extra);
+	}
+	KeyPair ephemeral;
+	TransactionBuilder::generate_key_image_helper(
+	    keys, output.transaction_public_key, output.index_in_transaction, ephemeral, output.key_image);
+	return output;
+}
+
+// padding_outputs of 1 atomic unit each make transaction bigger
+static std::pair<Hash, Transaction> spend(const CheckNode &node, const AccountKeys &keys, const api::Output &output,
+    Amount fee, size_t mixins, size_t padding_outputs = 0) {
+	std::vector<api::Output> mix_outputs;
+	for (auto &&mix : node.state.get_random_outputs(
+	         output.amount, mixins + 1, node.state.get_tip_height(), node.state.get_tip().timestamp))
+		if (mix.global_index != output.global_index && mix_outputs.size() < mixins)
+			mix_outputs.push_back(mix);
+	TransactionBuilder builder(node.state.get_currency(), 0);
+	builder.add_input(keys, output, mix_outputs);
+	builder.add_output(output.amount - fee - padding_outputs, keys.address);
+	for (size_t i = 0; i != padding_outputs; ++i)
+		builder.add_output(1, keys.address);
+	Transaction tx = builder.sign(crypto::rand<Hash>());
+	return std::make_pair(get_transaction_hash(tx), tx);
+}
+
+static void check_same_state(const CheckNode &a, const CheckNode &b, const std::string &phase) {
+	if (a.state.get_tip_bid() != b.state.get_tip_bid())
+		throw std::runtime_error("Nodes have different tips after " + phase);
+	if (a.state.test_state_hash() != b.state.test_state_hash())
+		throw std::runtime_error("Nodes have different state with the same tip after " + phase);
+	std::cout << "Nodes have the same state after " << phase << ", height=" << a.state.get_tip_height() << std::endl;
+}
+
+// Snapshot is read on other thread while node commits one block and keeps adding another, reads must give the
+// same blocks as before and not see blocks added after snapshot was created
+static void check_snapshot_reads(CheckNode &node, const AccountPublicAddress &address) {
+	node.state.db_commit();
+	const Height height = node.state.get_tip_height();
+	std::vector<BinaryArray> expected(height + 1);
+	for (Height h = 0; h <= height; ++h) {
+		Hash bid;
+		if (!node.state.read_chain(h, &bid) || !node.state.read_block(bid, &expected[h], nullptr))
+			throw std::runtime_error(node.name + " failed to read block at height " + std::to_string(h));
+	}
+	const auto snapshot = node.state.create_db_snapshot();
+	mine_block(node, address);
+	node.state.db_commit();
+	std::string error;
+	std::thread reader([&]() {
+		try {
+			for (Height h = 0; h <= height; ++h) {
+				Hash bid;
+				BinaryArray block_data;
+				api::BlockHeader header;
+				if (!node.state.read_chain(*snapshot, h, &bid) ||
+				    !node.state.read_block(*snapshot, bid, &block_data, nullptr) ||
+				    !node.state.read_header(*snapshot, bid, &header) || block_data != expected[h] ||
+				    header.height != h)
+					error = "Snapshot read differs at height " + std::to_string(h);
+			}
+			Hash bid;
+			if (node.state.read_chain(*snapshot, height + 1, &bid))
+				error = "Snapshot sees block committed after it was created";
+		} catch (const std::exception &ex) {
+			error = std::string("Snapshot read failed - ") + ex.what();
+		}
+	});
+	mine_block(node, address);
+	reader.join();
+	if (!error.empty())
+		throw std::runtime_error(node.name + " " + error);
+	std::cout << "Snapshot reads on other thread match for " << height + 1 << " blocks" << std::endl;
+}
+
+static void add_pool_transaction(CheckNode &node, const std::pair<Hash, Transaction> &tx) {
+	Height conflict_height = 0;
+	const auto result      = node.state.add_transaction(
+	    tx.first, tx.second, seria::to_binary(tx.second), node.state.get_tip().timestamp, &conflict_height, "checks");
+	if (result != AddTransactionResult::BROADCAST_ALL)
+		throw std::runtime_error("Unexpected add_transaction result " + std::to_string(int(result)) +
+		                         " for transaction " + common::pod_to_hex(tx.first));
+}
+
+// Miner gets template with transaction, which is displaced from rebuilt template by bigger transaction paying more
+// per byte, then leaves pool because of double spend. Block mined from first template must still be accepted.
+static void check_displaced_template_transaction(CheckNode &node, const AccountKeys &keys, Height first_unspent) {
+	const Amount FEE   = 1000000;
+	const size_t zone  = node.state.get_currency().block_granted_full_reward_zone_by_block_version(
+	    node.state.get_tip().major_version);
+	const size_t big   = zone * 7 / 10 / 34;  // padding output takes 34 bytes, two such transactions never fit
+	const auto output  = coinbase_output(node, first_unspent, keys);
+	const auto cheaper = spend(node, keys, output, FEE, 2, big);
+	add_pool_transaction(node, cheaper);
+	Difficulty difficulty = 0;
+	const BlockTemplate first_template = create_template(node, keys.address, &difficulty);
+	if (first_template.transaction_hashes != std::vector<Hash>{cheaper.first})
+		throw std::runtime_error("Mining template does not contain pool transaction");
+	add_pool_transaction(node, spend(node, keys, coinbase_output(node, first_unspent + 1, keys), 10 * FEE, 2, big));
+	Difficulty rebuilt_difficulty = 0;
+	const BlockTemplate rebuilt   = create_template(node, keys.address, &rebuilt_difficulty);
+	if (std::count(rebuilt.transaction_hashes.begin(), rebuilt.transaction_hashes.end(), cheaper.first) != 0)
+		throw std::runtime_error("Rebuilt mining template did not displace cheaper transaction");
+	add_pool_transaction(node, spend(node, keys, output, FEE, 2));
+	if (node.state.get_memory_state_transactions().count(cheaper.first) != 0)
+		throw std::runtime_error("Double spend did not remove displaced transaction from pool");
+	mine_template(node, first_template, difficulty);
+	std::cout << "Block mined from template with displaced transaction is accepted" << std::endl;
+}
+
+// Node a indexes outputs in memory, node b does not. Node a gets transactions from p2p, mines them,
+// then reorganizes to longer chain of b, returning them to pool, and mines them again. State of both nodes must
+// be the same whenever tips are the same, however nodes got there.
+static void check_chain(const std::string &folder) {
+	const Height PREMINE = 30;  // coinbase outputs unlock after mined_money_unlock_window
+	const Height SPENDS  = 6;
+	const Amount FEE     = 1000000;
+	logging::ConsoleLogger log(logging::WARNING);
+	Currency currency(true);
+	AccountKeys keys;
+	crypto::random_keypair(keys.address.spend_public_key, keys.spend_secret_key);
+	crypto::random_keypair(keys.address.view_public_key, keys.view_secret_key);
+	for (auto &&name : {"a", "b"}) {
+		if (!platform::create_folder_if_necessary(folder + "/" + name))
+			throw std::runtime_error("Could not create folder " + folder + "/" + name);
+		delete_node_data(folder + "/" + name);
+	}
+	Hash state_hash;
+	{
+		CheckNode a(log, currency, "a", folder + "/a", {"--index-outputs-in-memory"});
+		CheckNode b(log, currency, "b", folder + "/b", {});
+		std::vector<BlockTemplate> headers;
+		for (Height h = 1; h <= PREMINE; ++h) {
+			const RawBlock raw_block = mine_block(a, keys.address);
+			add_block(b, raw_block);
+			Block block;
+			block.from_raw_block(raw_block);
+			headers.push_back(block.header);
+		}
+		a.state.db_commit();
+		b.state.db_commit();
+		check_same_state(a, b, "sync");
+
+		std::vector<const BlockTemplate *> header_pointers;
+		for (auto &&header : headers)
+			header_pointers.push_back(&header);
+		auto context          = crypto::CryptoNightContextPool::instance().acquire(header_pointers.size());
+		const auto long_hashes = get_block_long_hashes(header_pointers, *context);
+		for (size_t i = 0; i != headers.size(); ++i)
+			if (long_hashes[i] != get_block_long_hash(headers[i], *context))
+				throw std::runtime_error("get_block_long_hashes differs from get_block_long_hash");
+		std::cout << "Interleaved PoW hashes match single hashes for " << headers.size() << " blocks" << std::endl;
+
+		std::vector<std::pair<Hash, Transaction>> transactions;
+		for (Height h = 1; h <= SPENDS; ++h)
+			transactions.push_back(spend(a, keys, coinbase_output(a, h, keys), FEE, 2));
+		const auto double_spend = spend(a, keys, coinbase_output(a, 1, keys), FEE / 2, 2);
+		auto broken             = spend(a, keys, coinbase_output(a, SPENDS + 1, keys), FEE, 2);
+		broken.second.signatures.at(0).at(0).c.data[0] ^= 1;
+		broken.first = get_transaction_hash(broken.second);
+		std::vector<std::pair<std::pair<Hash, Transaction>, AddTransactionResult>> relayed;
+		for (auto &&tx : transactions)
+			relayed.push_back(std::make_pair(tx, AddTransactionResult::BROADCAST_ALL));
+		relayed.push_back(std::make_pair(transactions.front(), AddTransactionResult::ALREADY_IN_POOL));
+		relayed.push_back(std::make_pair(double_spend, AddTransactionResult::INCREASE_FEE));
+		relayed.push_back(std::make_pair(broken, AddTransactionResult::FAILED_TO_REDO));
+		std::vector<const Transaction *> batch;
+		for (auto &&rel : relayed) {
+			Height conflict_height = 0;
+			auto result            = AddTransactionResult::BROADCAST_ALL;
+			if (a.state.precheck_transaction(rel.first.first, rel.first.second,
+			        seria::to_binary(rel.first.second).size(), &conflict_height, &result))
+				batch.push_back(&rel.first.second);
+		}
+		a.state.check_transactions_batch(batch);
+		for (auto &&rel : relayed) {
+			Height conflict_height = 0;
+			const auto result      = a.state.add_transaction(rel.first.first, rel.first.second,
+			    seria::to_binary(rel.first.second), a.state.get_tip().timestamp, &conflict_height, "checks");
+			if (result != rel.second)
+				throw std::runtime_error("Unexpected add_transaction result " + std::to_string(int(result)) +
+				                         " for transaction " + common::pod_to_hex(rel.first.first));
+		}
+		if (a.state.get_memory_state_transactions().size() != SPENDS)
+			throw std::runtime_error("Pool does not contain relayed transactions");
+
+		for (int i = 0; i != 3; ++i)
+			mine_block(a, keys.address);
+		if (!a.state.get_memory_state_transactions().empty())
+			throw std::runtime_error("Mined block does not contain pool transactions");
+		a.state.db_commit();
+		std::vector<RawBlock> side_chain;
+		while (side_chain.size() < 2 ||
+		       b.state.get_tip().cumulative_difficulty <= a.state.get_tip().cumulative_difficulty)
+			side_chain.push_back(mine_block(b, keys.address));
+		for (auto &&raw_block : side_chain)
+			add_block(a, raw_block);
+		a.state.db_commit();
+		b.state.db_commit();
+		check_same_state(a, b, "reorganization");
+		if (a.state.get_memory_state_transactions().size() != SPENDS)
+			throw std::runtime_error("Transactions of undone blocks did not return to pool");
+
+		add_block(b, mine_block(a, keys.address));
+		if (!a.state.get_memory_state_transactions().empty())
+			throw std::runtime_error("Mined block does not contain transactions returned to pool");
+		a.state.db_commit();
+		b.state.db_commit();
+		check_same_state(a, b, "mining transactions again");
+		state_hash = a.state.test_state_hash();
+	}
+	CheckNode a(log, currency, "a", folder + "/a", {});  // filters are loaded from files saved on exit
+	if (a.state.test_state_hash() != state_hash)
+		throw std::runtime_error("State differs after reopening node");
+	a.state.db_commit();
+	std::cout << "State is the same after reopening node" << std::endl;
+	check_snapshot_reads(a, keys.address);
+	check_displaced_template_transaction(a, keys, SPENDS + 2);
+}
+
+int main(int argc, const char *argv[]) try {
+	common::console::UnicodeConsoleSetup console_setup;
+	common::CommandLine cmd(argc, argv);
+	std::string folder = "checks_data";
+	if (const char *pa = cmd.get("--data-folder"))
+		folder = pa;
+	if (cmd.should_quit(USAGE, cryonerocoin::app_version()))
+		return 0;
+	if (!platform::create_folders_if_necessary(folder)) {
+		std::cout << "Could not create folder " << folder << std::endl;
+		return 1;
+	}
+	common::Executor::set_thread_count(2);
+
+	common::check_sliding_median(100000);
+	check_ring_signatures_batch(500);
+	platform::run_db_benchmark(folder + "/db_benchmark", 20000);
+	check_chain(folder);
+	std::cout << "All checks passed" << std::endl;
+	return 0;
+} catch (const std::exception &ex) {
+	std::cout << "Check failed - " << ex.what() << std::endl;
+	return 1;
+}
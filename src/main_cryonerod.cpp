@@ -8,12 +8,14 @@
 #include "Core/Config.hpp"
 #include "Core/Node.hpp"
 #include "common/CommandLine.hpp"
+#include "common/Executor.hpp"
 #include "common/ConsoleTools.hpp"
 #include "logging/ConsoleLogger.hpp"
 #include "logging/LoggerManager.hpp"
 #include "platform/ExclusiveLock.hpp"
 #include "platform/Network.hpp"
 #include "platform/PathTools.hpp"
+#include "platform/SegmentedFile.hpp"
 #include "version.hpp"
 
 using namespace cryonerocoin;
@@ -36,9 +38,14 @@ Options:
   --exclusive-node-address=<ip:port>   Specify list (one or more) of nodes to connect to only. All other nodes including seed nodes will be ignored.
   --export-blocks=<folder-path>        Perform hot export of blockchain into specified folder as blocks.bin and blockindexes.bin, then exit. This overwrites existing files.
   --backup-blockchain=<folder-path>         Perform hot backup of blockchain into specified backup data folder, then exit.
+  --export-state=<folder-path>         Perform hot export of checksummed blockchain state snapshot into specified folder, then exit. Blockchain must contain last checkpoint.
+  --import-state=<folder-path>,<snapshot-id>  Bootstrap empty data folder from state snapshot with id printed by --export-state, rewind it to checkpoint and continue normal sync from there. State tables are trusted, not rechecked, so use only snapshot id you got from source you trust.
   --data-folder=<full-path>            Folder for blockchain, logs and peer DB [default: )" platform_DEFAULT_DATA_FOLDER_PATH_PREFIX
 	R"(cryonero].
   --rpc-authorization=<usr:pass> HTTP authorization for RPC.
+  --index-outputs-in-memory            Keep copy of all outputs in memory for faster random outputs and block verification. Needs several GB of RAM.
+  --prune-blocks-below-depth=<depth>   Delete bodies of blocks deeper than depth (at least 10000), keeping headers and state. Node will not serve old blocks to peers and wallets.
+  --worker-threads=<count>             Threads for signature checks and block preparation [default: 3/4 of CPU cores].
 )"
 #if platform_USE_SSL
 R"(  --ssl-certificate-pem-file=<file-path>    Full path to file containing both server SSL certificate and private key in PEM format.
@@ -59,19 +66,46 @@ int main(int argc, const char *argv[]) try {
 	std::string backup_blockchain;
 	if (const char *pa = cmd.get("--backup-blockchain"))
 		backup_blockchain = pa;
+	std::string export_state;
+	if (const char *pa = cmd.get("--export-state"))
+		export_state = pa;
+	std::string import_state;
+	Hash import_state_id;
+	if (const char *pa = cmd.get("--import-state")) {
+		import_state     = pa;
+		const size_t pos = import_state.rfind(',');
+		if (pos == std::string::npos || !common::pod_from_hex(import_state.substr(pos + 1), import_state_id)) {
+			std::cout << "--import-state requires <folder-path>,<snapshot-id>" << std::endl;
+			return api::CRYONEROD_WRONG_ARGS;
+		}
+		import_state.resize(pos);
+	}
 	cryonerocoin::Config config(cmd);
+	common::Executor::set_thread_count(config.worker_threads);
 	cryonerocoin::Currency currency(config.is_testnet);
 
 	Height print_structure = Height(-1);
 	if (const char *pa = cmd.get("--print-structure"))
 		print_structure = std::stoi(pa);
 	const bool print_outputs = cmd.get_bool("--print-outputs");
+	const bool db_benchmark  = cmd.get_bool("--db-benchmark");  // undocumented, for comparing DB backends
+	const bool tx_benchmark  = cmd.get_bool("--tx-benchmark");  // undocumented, for pool admission signature checks
 	if (cmd.should_quit(USAGE, cryonerocoin::app_version()))
 		return 0;
 
 	const std::string coin_folder = config.get_data_folder();
-	if (!export_blocks.empty() && !backup_blockchain.empty()) {
-		std::cout << "You can either export blocks or backup blockchain on one run of cryonerod" << std::endl;
+	if (db_benchmark) {
+		platform::run_db_benchmark(coin_folder + "/db_benchmark", 1000000);
+		return 0;
+	}
+	if (tx_benchmark) {
+		cryonerocoin::run_ring_check_benchmark(2000);
+		return 0;
+	}
+	if (int(!export_blocks.empty()) + int(!backup_blockchain.empty()) + int(!export_state.empty()) +
+	        int(!import_state.empty()) > 1) {
+		std::cout << "You can either export blocks, backup blockchain, export or import state on one run of cryonerod"
+		          << std::endl;
 		return api::CRYONEROD_WRONG_ARGS;
 	}
 	if (!backup_blockchain.empty()) {
@@ -86,11 +120,17 @@ int main(int argc, const char *argv[]) try {
 			<< std::endl;
 		common::console::set_text_color(common::console::Default);
 		std::cout << "Starting blockchain backup..." << std::endl;
+		// Running node can prune segments while DB is copied, so they are copied before DB too. Copying after DB
+		// adds segments appended meanwhile. Segments committed in DB of backup are not copied again
+		platform::SegmentedFile::copy_folder(coin_folder + "/block_segments", backup_blockchain + "/block_segments",
+		    BlockChain::read_committed_segments_end(backup_blockchain + "/blockchain"));
 		platform::DB::backup_db(coin_folder + "/blockchain", backup_blockchain + "/blockchain");
+		platform::SegmentedFile::copy_folder(coin_folder + "/block_segments", backup_blockchain + "/block_segments",
+		    BlockChain::read_committed_segments_end(backup_blockchain + "/blockchain"));
 		std::cout << "Finished blockchain backup." << std::endl;
 		return 0;
 	}
-	if (!export_blocks.empty() || print_structure != Height(-1) || print_outputs) {
+	if (!export_blocks.empty() || !export_state.empty() || print_structure != Height(-1) || print_outputs) {
 		logging::ConsoleLogger log_console;
 		BlockChainState block_chain_read_only(log_console, config, currency, true);
 
@@ -99,6 +139,10 @@ int main(int argc, const char *argv[]) try {
 				return 1;
 			return 0;
 		}
+		if (!export_state.empty()) {
+			block_chain_read_only.export_state(export_state);
+			return 0;
+		}
 		if (print_structure != Height(-1))
 			block_chain_read_only.test_print_structure(print_structure);
 		if (print_outputs)
@@ -120,7 +164,20 @@ int main(int argc, const char *argv[]) try {
 	logging::LoggerManager log_manager;
 	log_manager.configure_default(config.get_data_folder("logs"), "cryonerod-");
 
+	std::pair<Height, Hash> import_state_checkpoint{Height(-1), Hash{}};
+	if (!import_state.empty())
+		import_state_checkpoint = BlockChain::import_state(import_state, import_state_id, config, currency);
 	BlockChainState block_chain(log_manager, config, currency, false);
+	if (import_state_checkpoint.first != Height(-1)) {
+		std::cout << "Rewinding imported state from height " << block_chain.get_tip_height() << " to checkpoint "
+		          << import_state_checkpoint.first << std::endl;
+		block_chain.undo_to_height(import_state_checkpoint.first);
+		block_chain.db_commit();
+		if (block_chain.get_tip_height() != import_state_checkpoint.first ||
+		    block_chain.get_tip_bid() != import_state_checkpoint.second)
+			throw std::runtime_error("Failed to rewind imported state to checkpoint " +
+			                         common::pod_to_hex(import_state_checkpoint.second));
+	}
 	if (import_blocks) 
 	{
 		LegacyBlockChainReader::import_blockchain2(coin_folder, &block_chain, 300000);
@@ -12,6 +12,7 @@
 #include "Core/WalletNode.hpp"
 #include "common/Base64.hpp"
 #include "common/CommandLine.hpp"
+#include "common/Executor.hpp"
 #include "common/ConsoleTools.hpp"
 #include "logging/LoggerManager.hpp"
 #include "platform/ExclusiveLock.hpp"
@@ -44,6 +45,7 @@ Options:
   --daemon-remote-address=<ip:port> Connect to remote cryonerod and suppress running built-in cryonerod.
   --rpc-authorization=<usr:pass> HTTP authorization for RCP.
   --backup-wallet-data=<folder-path>           Perform hot backup of wallet file and wallet cache into specified backup data folder, then exit.
+  --worker-threads=<count>             Threads for wallet and built-in cryonerod block preparation [default: 3/4 of CPU cores].
 
 Options for built-in cryonerod (run when no --daemon-remote-address specified):
   --p2p-bind-address=<ip:port>         Interface and port for P2P network protocol [default: 0.0.0.0:18640].
@@ -96,6 +98,7 @@ int main(int argc, const char *argv[]) try {
 	}
 
 	cryonerocoin::Config config(cmd);
+	common::Executor::set_thread_count(config.worker_threads);
 
 	cryonerocoin::Currency currency(config.is_testnet);
 
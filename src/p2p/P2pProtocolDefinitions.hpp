@@ -37,6 +37,7 @@ struct CORE_SYNC_DATA {
 	uint32_t current_height = 0;  // crazy, but this one is top block + 1 instead of top block
 	// We conform to legacy by sending incremented field on wire
 	crypto::Hash top_id;
+	uint32_t pruned_height = 0;  // peer has no bodies of blocks below, optional on wire, legacy nodes ignore it
 };
 
 enum { P2P_COMMANDS_POOL_BASE = 1000 };
@@ -99,6 +99,7 @@ namespace seria {
 			s(on_wire);
 		}
 		seria_kv("top_id", v.top_id, s);
+		seria_kv("pruned_height", v.pruned_height, s, true);
 	}
 
 	void ser_members(cryonerocoin::COMMAND_HANDSHAKE::request &v, seria::ISeria &s) {
@@ -87,12 +87,12 @@ void PeerDB::read_db(const std::string &prefix, peers_indexed &list) {
 }
 
 void PeerDB::update_db(const std::string &prefix, const Entry &entry) {
-	auto key = prefix + common::to_string(entry.adr.ip) + ":" + common::to_string(entry.adr.port);
+	const auto key = DBKey(prefix).append_decimal(entry.adr.ip).append(":", 1).append_decimal(entry.adr.port);
 	db.put(key, seria::to_binary(entry), false);
 }
 
 void PeerDB::del_db(const std::string &prefix, const NetworkAddress &addr) {
-	auto key = prefix + common::to_string(addr.ip) + ":" + common::to_string(addr.port);
+	const auto key = DBKey(prefix).append_decimal(addr.ip).append(":", 1).append_decimal(addr.port);
 	db.del(key, false);
 }
 
@@ -0,0 +1,193 @@
+// Copyright (c) 2019, The Cryonero developers.
+// Licensed under the GNU Lesser General Public License. See LICENSE for details.
+
+#include "DB.hpp"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <random>
+#include <vector>
+
+namespace platform {
+
+static std::string random_key(std::mt19937_64 &rnd, size_t size) {
+	std::string result(size, '\0');
+	for (auto &ch : result)
+		ch = static_cast<char>(rnd());
+	return result;
+}
+
+class BenchmarkPhase {
+	const char *name;
+	const size_t count;
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+public:
+	BenchmarkPhase(const char *name, size_t count) : name(name), count(count) {}
+	~BenchmarkPhase() {
+		const auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+		std::cout << name << ": " << us.count() / 1000 << " ms, "
+		          << static_cast<uint64_t>(count * 1000000.0 / std::max<int64_t>(1, us.count())) << " ops/sec"
+		          << std::endl;
+	}
+};
+
+static std::map<std::string, std::string> dump_table(const DB &db, const DB::Table &table) {
+	std::map<std::string, std::string> result;
+	for (auto cur = db.begin(table, std::string()); !cur.end(); cur.next())
+		result[cur.get_suffix()] = cur.get_value_string();
+	return result;
+}
+
+// Paths which block sync uses rarely or only on reorgs, so broken backend shows here first
+static void check_db_paths(const std::string &path) {
+	std::mt19937_64 rnd(path.size());
+	DB::delete_db(path);
+	{
+		DB db(false, path);
+		const DB::Table table     = db.open_table("check");
+		const DB::Table int_table = db.open_table("check_int", true);
+		db.put("check_default", std::string("d"), true);
+		std::map<std::string, std::string> model;
+		for (size_t i = 0; i != 1000; ++i) {
+			const std::string key = random_key(rnd, 8);
+			db.put(table, key, std::string("v0"), true);
+			model[key] = "v0";
+		}
+		db.commit_db_txn();
+		const auto before = model;
+		// Batch mixes keys inside existing range with keys past the end, which are appended
+		std::vector<DB::UndoOp> undo;
+		{
+			DB::WriteBatch batch(db);
+			for (size_t i = 0; i != 1000; ++i) {
+				std::string key = random_key(rnd, 8);
+				if (i % 2)
+					key[0] = char(0xff);
+				db.put(table, key, std::string("v1"), false);
+				model[key] = "v1";
+			}
+			auto bit = before.begin();
+			for (size_t i = 0; i != 100; ++i, ++bit) {
+				db.del(table, bit->first, true);
+				model.erase(bit->first);
+			}
+			for (uint32_t k : {1u, 256u, 2u, 65536u, 3u, 0x01000000u})
+				db.put(int_table, DB::to_integer_key(k), std::string("i"), true);
+			{
+				auto cur = db.rbegin(table, std::string());  // flushes batch midway, undo must survive
+			}
+			for (auto &&kv : model)
+				if (kv.second == "v1") {  // written again after flush
+					db.put(table, kv.first, std::string("v2"), false);
+					kv.second = "v2";
+				}
+			batch.get_undo(&undo);
+			batch.apply();
+		}
+		if (dump_table(db, table) != model)
+			throw std::runtime_error("check_db_paths table differs from model after WriteBatch");
+		std::vector<uint32_t> int_keys;
+		for (auto cur = db.begin(int_table, std::string()); !cur.end(); cur.next())
+			int_keys.push_back(DB::from_integer_key(cur.get_suffix()));
+		if (int_keys != std::vector<uint32_t>{1, 2, 3, 256, 65536, 0x01000000})
+			throw std::runtime_error("check_db_paths integer key table is not in numeric order");
+		size_t default_count = 0;  // table names are keys of default table in lmdb, cursors must skip them
+		for (auto cur = db.begin(std::string()); !cur.end(); cur.next())
+			default_count += 1;
+		if (default_count != 1)
+			throw std::runtime_error("check_db_paths default table cursor sees table names");
+		db.commit_db_txn();
+		for (auto &&uop : undo)
+			if (uop.existed)
+				db.put(uop.table, uop.key, uop.value, false);
+			else
+				db.del(uop.table, uop.key, true);
+		db.commit_db_txn();
+		if (dump_table(db, table) != before || !db.begin(int_table, std::string()).end())
+			throw std::runtime_error("check_db_paths undo record did not restore state before WriteBatch");
+	}
+	DB::delete_db(path);
+	std::cout << "DB paths check passed" << std::endl;
+}
+
+// Mimics blockchain workload - 32-byte hash keys with short values, commits every COMMIT_EVERY ops
+void run_db_benchmark(const std::string &path, size_t count) {
+	check_db_paths(path + "_check");
+	const size_t COMMIT_EVERY = 10000;
+	std::mt19937_64 rnd(count);
+	std::vector<std::string> keys;
+	keys.reserve(count);
+	for (size_t i = 0; i != count; ++i)
+		keys.push_back(random_key(rnd, 32));
+	const std::string value(100, 'v');
+
+	std::cout << "DB benchmark of " << count << " items in " << path << std::endl;
+	DB::delete_db(path);
+	{
+		DB db(false, path);
+		const DB::Table table = db.open_table("bench");
+		{
+			BenchmarkPhase phase("put", count / 2);
+			for (size_t i = 0; i != count / 2; ++i) {
+				db.put(table, keys[i], value, true);
+				if (i % COMMIT_EVERY == COMMIT_EVERY - 1)
+					db.commit_db_txn();
+			}
+			db.commit_db_txn();
+		}
+		{
+			BenchmarkPhase phase("put in WriteBatch", count - count / 2);
+			for (size_t i = count / 2; i < count; i += COMMIT_EVERY) {
+				DB::WriteBatch batch(db);
+				for (size_t j = i; j != std::min(count, i + COMMIT_EVERY); ++j)
+					db.put(table, keys[j], value, true);
+				batch.apply();
+				db.commit_db_txn();
+			}
+		}
+		std::shuffle(keys.begin(), keys.end(), rnd);
+		{
+			BenchmarkPhase phase("get existing", count);
+			std::string result;
+			for (auto &&key : keys)
+				if (!db.get(table, key, result))
+					throw std::runtime_error("run_db_benchmark key not found");
+		}
+		{
+			BenchmarkPhase phase("get missing", count);
+			std::string result;
+			for (size_t i = 0; i != count; ++i)
+				if (db.get(table, random_key(rnd, 32), result))
+					throw std::runtime_error("run_db_benchmark random key found");
+		}
+		{
+			BenchmarkPhase phase("cursor scan", count);
+			size_t found = 0;
+			for (auto cur = db.begin(table, std::string()); !cur.end(); cur.next())
+				found += 1;
+			if (found != count)
+				throw std::runtime_error("run_db_benchmark cursor scan found wrong number of keys");
+		}
+		{
+			BenchmarkPhase phase("short cursors", count / 10);
+			for (size_t i = 0; i != count / 10; ++i) {
+				auto cur = db.rbegin(table, keys[i].substr(0, 2));
+				for (size_t j = 0; j != 4 && !cur.end(); ++j)
+					cur.next();
+			}
+		}
+		{
+			BenchmarkPhase phase("del", count);
+			for (size_t i = 0; i != count; ++i) {
+				db.del(table, keys[i], true);
+				if (i % COMMIT_EVERY == COMMIT_EVERY - 1)
+					db.commit_db_txn();
+			}
+			db.commit_db_txn();
+		}
+	}
+	DB::delete_db(path);
+}
+}
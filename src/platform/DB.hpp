@@ -6,6 +6,9 @@
 
 #pragma once
 
+#include <cstdint>
+#include <string>
+
 #if platform_USE_SQLITE
 #include "platform/DBsqlite3.hpp"
 namespace platform {
@@ -17,3 +20,23 @@ namespace platform {
 using DB = DBlmdb;
 }
 #endif
+
+namespace platform {
+// Both backends keep each logical table (DB::open_table) in separate B-tree. Keys of composite tables are
+// concatenated fixed-width big-endian parts, so they sort numerically and prefix iteration works.
+inline std::string to_be_key(uint64_t value, size_t size) {
+	std::string result(size, '\0');
+	for (size_t i = size; i-- > 0; value >>= 8)
+		result[i] = static_cast<char>(value & 0xff);
+	return result;
+}
+inline uint64_t from_be_key(const std::string &key, size_t pos, size_t size) {
+	uint64_t result = 0;
+	for (size_t i = 0; i != size; ++i)
+		result = (result << 8) | static_cast<unsigned char>(key.at(pos + i));
+	return result;
+}
+
+// Prints timings of typical operations, compare backends by running builds with and without USE_SQLITE
+void run_db_benchmark(const std::string &path, size_t count);
+}
@@ -0,0 +1,61 @@
+// Copyright (c) 2019, The Cryonero developers.
+// Licensed under the GNU Lesser General Public License. See LICENSE for details.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include "common/Varint.hpp"
+
+namespace platform {
+
+// Fixed capacity key assembled on stack, for hot paths where concatenating std::string parts would allocate.
+// Produces exactly the same bytes as equivalent std::string expression, so both can be used for the same keys.
+class DBKey {
+public:
+	static constexpr size_t CAPACITY = 128;  // same as max key size of sqlite backend
+
+	DBKey() = default;
+	explicit DBKey(const std::string &str) { append(str); }
+	DBKey &append(const void *data, size_t size) {
+		if (size > CAPACITY - m_size)
+			throw std::length_error("DBKey capacity exceeded");
+		std::memcpy(m_data + m_size, data, size);
+		m_size += size;
+		return *this;
+	}
+	DBKey &append(const std::string &str) { return append(str.data(), str.size()); }
+	DBKey &append_be(uint64_t value, size_t size) {  // same as to_be_key
+		if (size > CAPACITY - m_size)
+			throw std::length_error("DBKey capacity exceeded");
+		for (size_t i = size; i-- > 0; value >>= 8)
+			m_data[m_size + i] = static_cast<unsigned char>(value & 0xff);
+		m_size += size;
+		return *this;
+	}
+	DBKey &append_varint(uint64_t value) {  // same as common::write_varint_sqlite4
+		unsigned char buf[9];
+		return append(buf, common::write_varint_sqlite4(buf, value));
+	}
+	DBKey &append_decimal(uint64_t value) {  // same as common::to_string
+		unsigned char buf[20];
+		size_t pos = sizeof(buf);
+		do {
+			buf[--pos] = static_cast<unsigned char>('0' + value % 10);
+			value /= 10;
+		} while (value != 0);
+		return append(buf + pos, sizeof(buf) - pos);
+	}
+
+	const char *data() const { return reinterpret_cast<const char *>(m_data); }
+	size_t size() const { return m_size; }
+	bool empty() const { return m_size == 0; }
+	std::string to_string() const { return std::string(data(), m_size); }
+
+private:
+	unsigned char m_data[CAPACITY];
+	size_t m_size = 0;
+};
+}
@@ -6,8 +6,10 @@
 
 #include "DBlmdb.hpp"
 #include <boost/lexical_cast.hpp>
+#include <chrono>
 #include <iostream>
 #include "PathTools.hpp"
+#include "common/Invariant.hpp"
 #include "common/string.hpp"
 
 using namespace platform;
@@ -38,8 +40,10 @@ platform::lmdb::Env::~Env() {
 	handle = nullptr;
 }
 
-platform::lmdb::Txn::Txn(Env &db_env) {
-	lmdb_check(::mdb_txn_begin(db_env.handle, nullptr, db_env.m_read_only ? MDB_RDONLY : 0, &handle), "mdb_txn_begin ");
+platform::lmdb::Txn::Txn(Env &db_env) : Txn(db_env, db_env.m_read_only) {}
+
+platform::lmdb::Txn::Txn(const Env &db_env, bool read_only) {
+	lmdb_check(::mdb_txn_begin(db_env.handle, nullptr, read_only ? MDB_RDONLY : 0, &handle), "mdb_txn_begin ");
 }
 
 void platform::lmdb::Txn::commit() {
@@ -64,8 +68,10 @@ bool platform::lmdb::Dbi::get(Txn &db_txn, MDB_val *const key, MDB_val *const da
 	return (rc == MDB_SUCCESS);
 }
 
-platform::lmdb::Cur::Cur(Txn &db_txn, Dbi &db_dbi) {
-	lmdb_check(::mdb_cursor_open(db_txn.handle, db_dbi.handle, &handle), "mdb_cursor_open ");
+platform::lmdb::Cur::Cur(Txn &db_txn, Dbi &db_dbi) : Cur(db_txn, db_dbi.handle) {}
+
+platform::lmdb::Cur::Cur(Txn &db_txn, MDB_dbi dbi) {
+	lmdb_check(::mdb_cursor_open(db_txn.handle, dbi, &handle), "mdb_cursor_open ");
 }
 
 platform::lmdb::Cur::Cur(Cur &&other) noexcept { std::swap(handle, other.handle); }
@@ -85,13 +91,48 @@ DBlmdb::DBlmdb(bool read_only, const std::string &full_path, uint64_t max_db_siz
     : full_path(full_path), db_env(read_only) {
 	//	std::cout << "lmdb libversion=" << mdb_version(nullptr, nullptr, nullptr) << std::endl;
 	lmdb_check(::mdb_env_set_mapsize(db_env.handle, max_db_size), "mdb_env_set_mapsize ");
+	lmdb_check(::mdb_env_set_maxdbs(db_env.handle, 32), "mdb_env_set_maxdbs ");
 	// VALGRIND is limited to 32GB, modify line above to use (max_db_size > 28000000000 ? 28000000000 : max_db_size)
 	create_folders_if_necessary(full_path);
-	lmdb_check(::mdb_env_open(db_env.handle, full_path.c_str(), MDB_NOMETASYNC | (read_only ? MDB_RDONLY : 0), 0644),
+	lmdb_check(::mdb_env_open(db_env.handle, full_path.c_str(), MDB_NOMETASYNC | MDB_NOTLS | (read_only ? MDB_RDONLY : 0), 0644),
 	    "Failed to open database " + full_path + " in mdb_env_open ");
 	// MDB_NOMETASYNC - We agree to trade chance of losing 1 last transaction for 2x performance boost
+	// MDB_NOTLS - read txns of snapshots are not bound to threads
 	db_txn.reset(new lmdb::Txn(db_env));
 	db_dbi.reset(new lmdb::Dbi(*db_txn));
+	tables.push_back(TableInfo{db_dbi->handle, false, std::string()});
+}
+
+DBlmdb::Table DBlmdb::open_table(const std::string &name, bool integer_key) {
+	invariant(tables.size() < 32, "");
+	MDB_dbi handle = 0;
+	const unsigned int flags = (db_env.m_read_only ? 0 : MDB_CREATE) | (integer_key ? MDB_INTEGERKEY : 0);
+	const int rc = ::mdb_dbi_open(db_txn->handle, name.c_str(), flags, &handle);
+	if (rc == MDB_NOTFOUND && db_env.m_read_only)
+		throw lmdb::Error("Table " + name + " not found in read-only database " + full_path);
+	lmdb_check(rc, "mdb_dbi_open " + name + " ");
+	tables.push_back(TableInfo{handle, integer_key, name});
+	table_names.insert(name);
+	Table result;
+	result.index = tables.size() - 1;
+	return result;
+}
+
+DBlmdb::Table DBlmdb::find_table(const std::string &name) const {
+	for (size_t i = 0; i != tables.size(); ++i)
+		if (tables[i].name == name) {
+			Table result;
+			result.index = i;
+			return result;
+		}
+	throw lmdb::Error("DBlmdb::find_table table not opened " + name);
+}
+
+std::vector<DBlmdb::Table> DBlmdb::get_tables() const {
+	std::vector<Table> result(tables.size());
+	for (size_t i = 0; i != tables.size(); ++i)
+		result[i].index = i;
+	return result;
 }
 
 size_t DBlmdb::test_get_approximate_size() const {
@@ -106,9 +147,9 @@ size_t DBlmdb::get_approximate_items_count() const {
 	return sta.ms_entries;
 }
 
-DBlmdb::Cursor::Cursor(
-    lmdb::Cur &&cur, const std::string &prefix, const std::string &middle, size_t max_key_size, bool forward)
-    : db_cur(std::move(cur)), prefix(prefix), forward(forward) {
+DBlmdb::Cursor::Cursor(lmdb::Cur &&cur, const std::string &prefix, const std::string &middle, size_t max_key_size,
+    bool forward, const std::set<std::string> *hidden_keys)
+    : db_cur(std::move(cur)), prefix(prefix), forward(forward), hidden_keys(hidden_keys) {
 	std::string start = prefix + middle;
 	lmdb::Val itkey(start);
 	if (forward)
@@ -141,7 +182,9 @@ void DBlmdb::Cursor::erase() {
 	next();
 }
 
-void DBlmdb::Cursor::check_prefix(const lmdb::Val &itkey) {
+void DBlmdb::Cursor::check_prefix(lmdb::Val &itkey) {
+	while (!is_end && hidden_keys && hidden_keys->count(std::string(itkey.data(), itkey.size())) != 0)
+		is_end = !db_cur.get(itkey, &*data, forward ? MDB_NEXT : MDB_PREV);  // named table records
 	if (is_end || itkey.size() < prefix.size() ||
 	    std::char_traits<char>::compare(prefix.data(), itkey.data(), prefix.size()) != 0) {
 		is_end = true;
@@ -157,26 +200,94 @@ common::BinaryArray DBlmdb::Cursor::get_value_array() const {
 	return common::BinaryArray(data.data(), data.data() + data.size());
 }
 
-DBlmdb::Cursor DBlmdb::begin(const std::string &prefix, const std::string &middle) const {
+DBlmdb::Cursor DBlmdb::begin(const Table &table, const std::string &prefix, const std::string &middle) const {
+	if (write_batch && write_batch->has_prefix(table, prefix))
+		write_batch->flush();
 	int max_key_size = ::mdb_env_get_maxkeysize(db_env.handle);
-	return Cursor(lmdb::Cur(*db_txn, *db_dbi), prefix, middle, max_key_size, true);
+	return Cursor(lmdb::Cur(*db_txn, tables.at(table.index).handle), prefix, middle, max_key_size, true,
+	    table.index == 0 ? &table_names : nullptr);
 }
 
-DBlmdb::Cursor DBlmdb::rbegin(const std::string &prefix, const std::string &middle) const {
+DBlmdb::Cursor DBlmdb::rbegin(const Table &table, const std::string &prefix, const std::string &middle) const {
+	if (write_batch && write_batch->has_prefix(table, prefix))
+		write_batch->flush();
 	int max_key_size = ::mdb_env_get_maxkeysize(db_env.handle);
-	return Cursor(lmdb::Cur(*db_txn, *db_dbi), prefix, middle, max_key_size, false);
+	return Cursor(lmdb::Cur(*db_txn, tables.at(table.index).handle), prefix, middle, max_key_size, false,
+	    table.index == 0 ? &table_names : nullptr);
+}
+
+DBlmdb::Snapshot::Snapshot(const DBlmdb &db) : db(db), txn(db.db_env, true) {}
+
+bool DBlmdb::Snapshot::get_impl(const Table &table, const lmdb::Val &key, Value &value) const {
+	lmdb::Val temp_key(key);
+	const int rc = ::mdb_get(txn.handle, db.tables.at(table.index).handle, temp_key, value);
+	if (rc != MDB_SUCCESS && rc != MDB_NOTFOUND)
+		lmdb::Error::do_throw("mdb_get ", rc);
+	return (rc == MDB_SUCCESS);
+}
+
+bool DBlmdb::Snapshot::get(const Table &table, const std::string &key, common::BinaryArray &value) const {
+	lmdb::Val val1;
+	if (!get_impl(table, lmdb::Val(key), val1))
+		return false;
+	value.assign(val1.data(), val1.data() + val1.size());
+	return true;
+}
+
+bool DBlmdb::Snapshot::get(const Table &table, const std::string &key, std::string &value) const {
+	lmdb::Val val1;
+	if (!get_impl(table, lmdb::Val(key), val1))
+		return false;
+	value = std::string(val1.data(), val1.size());
+	return true;
+}
+
+bool DBlmdb::Snapshot::get(const Table &table, const DBKey &key, common::BinaryArray &value) const {
+	lmdb::Val val1;
+	if (!get_impl(table, lmdb::Val(key), val1))
+		return false;
+	value.assign(val1.data(), val1.data() + val1.size());
+	return true;
+}
+
+bool DBlmdb::Snapshot::get(const Table &table, const DBKey &key, std::string &value) const {
+	lmdb::Val val1;
+	if (!get_impl(table, lmdb::Val(key), val1))
+		return false;
+	value = std::string(val1.data(), val1.size());
+	return true;
+}
+
+DBlmdb::Cursor DBlmdb::Snapshot::begin(const Table &table, const std::string &prefix, const std::string &middle) const {
+	int max_key_size = ::mdb_env_get_maxkeysize(db.db_env.handle);
+	return Cursor(lmdb::Cur(txn, db.tables.at(table.index).handle), prefix, middle, max_key_size, true,
+	    table.index == 0 ? &db.table_names : nullptr);
+}
+
+DBlmdb::Cursor DBlmdb::Snapshot::rbegin(const Table &table, const std::string &prefix, const std::string &middle) const {
+	int max_key_size = ::mdb_env_get_maxkeysize(db.db_env.handle);
+	return Cursor(lmdb::Cur(txn, db.tables.at(table.index).handle), prefix, middle, max_key_size, false,
+	    table.index == 0 ? &db.table_names : nullptr);
 }
 
 void DBlmdb::commit_db_txn() {
+	const auto idea_start = std::chrono::steady_clock::now();
+	if (write_batch)
+		write_batch->flush();
 	db_txn->commit();
 	db_txn.reset();
 	db_txn.reset(new lmdb::Txn(db_env));
+	const auto idea_ms =
+	    std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - idea_start);
+	commit_stats.last_commit_ms = static_cast<uint32_t>(idea_ms.count());
+	commit_stats.durable_commits = commit_stats.commits;  // meta page of previous commit was fsynced with data pages
+	commit_stats.commits += 1;
 }
 
-void DBlmdb::put(const std::string &key, const common::BinaryArray &value, bool nooverwrite) {
-	lmdb::Val temp_value(value.data(), value.size());
-	const int rc =
-	    ::mdb_put(db_txn->handle, db_dbi->handle, lmdb::Val(key), temp_value, nooverwrite ? MDB_NOOVERWRITE : 0);
+void DBlmdb::put_impl(const TableInfo &table, const lmdb::Val &key, const lmdb::Val &value, bool nooverwrite) {
+	lmdb::Val temp_key(key);
+	lmdb::Val temp_value(value);
+	const int rc = ::mdb_put(db_txn->handle, table.handle, temp_key, temp_value, nooverwrite ? MDB_NOOVERWRITE : 0);
 	if (rc != MDB_SUCCESS && rc != MDB_KEYEXIST)
 		lmdb::Error::do_throw("DBlmdb::put failed " + std::string(key.data(), key.size()), rc);
 	if (nooverwrite && rc == MDB_KEYEXIST)
@@ -184,37 +295,48 @@ void DBlmdb::put(const std::string &key, const common::BinaryArray &value, bool
 		    "DBlmdb::put failed or nooverwrite key already exists " + std::string(key.data(), key.size()), rc);
 }
 
-void DBlmdb::put(const std::string &key, const std::string &value, bool nooverwrite) {
-	lmdb::Val temp_value(value.data(), value.size());
-	const int rc =
-	    ::mdb_put(db_txn->handle, db_dbi->handle, lmdb::Val(key), temp_value, nooverwrite ? MDB_NOOVERWRITE : 0);
-	if (rc != MDB_SUCCESS && rc != MDB_KEYEXIST)
-		lmdb::Error::do_throw("DBlmdb::put failed " + std::string(key.data(), key.size()), rc);
-	if (nooverwrite && rc == MDB_KEYEXIST)
-		lmdb::Error::do_throw(
-		    "DBlmdb::put failed or nooverwrite key already exists " + std::string(key.data(), key.size()), rc);
+void DBlmdb::put_any(const Table &table, const lmdb::Val &key, const lmdb::Val &value, bool nooverwrite) {
+	if (write_batch)
+		return write_batch->put(
+		    table, std::string(key.data(), key.size()), std::string(value.data(), value.size()), nooverwrite);
+	put_impl(tables.at(table.index), key, value, nooverwrite);
+}
+
+bool DBlmdb::get_impl(const Table &table, const lmdb::Val &key, lmdb::Val &value) const {
+	if (write_batch) {
+		if (auto op = write_batch->find(table, std::string(key.data(), key.size()))) {
+			if (!op->put)
+				return false;
+			value = lmdb::Val(op->value);
+			return true;
+		}
+	}
+	lmdb::Val temp_key(key);
+	const int rc = ::mdb_get(db_txn->handle, tables.at(table.index).handle, temp_key, value);
+	if (rc != MDB_SUCCESS && rc != MDB_NOTFOUND)
+		lmdb::Error::do_throw("mdb_get ", rc);
+	return (rc == MDB_SUCCESS);
 }
 
-bool DBlmdb::get(const std::string &key, common::BinaryArray &value) const {
+bool DBlmdb::get_array(const Table &table, const lmdb::Val &key, common::BinaryArray &value) const {
 	lmdb::Val val1;
-	if (!db_dbi->get(*db_txn, lmdb::Val(key), val1))
+	if (!get_impl(table, key, val1))
 		return false;
 	value.assign(val1.data(), val1.data() + val1.size());
 	return true;
 }
 
-bool DBlmdb::get(const std::string &key, std::string &value) const {
+bool DBlmdb::get_string(const Table &table, const lmdb::Val &key, std::string &value) const {
 	lmdb::Val val1;
-	if (!db_dbi->get(*db_txn, lmdb::Val(key), val1))
+	if (!get_impl(table, key, val1))
 		return false;
 	value = std::string(val1.data(), val1.size());
 	return true;
 }
 
-bool DBlmdb::get(const std::string &key, Value &value) const { return db_dbi->get(*db_txn, lmdb::Val(key), value); }
-
-void DBlmdb::del(const std::string &key, bool mustexist) {
-	const int rc = ::mdb_del(db_txn->handle, db_dbi->handle, lmdb::Val(key), nullptr);
+void DBlmdb::del_impl(const TableInfo &table, const lmdb::Val &key, bool mustexist) {
+	lmdb::Val temp_key(key);
+	const int rc = ::mdb_del(db_txn->handle, table.handle, temp_key, nullptr);
 	if (rc != MDB_SUCCESS && rc != MDB_NOTFOUND)
 		lmdb::Error::do_throw("DBlmdb::del failed " + std::string(key.data(), key.size()), rc);
 	if (mustexist &&
@@ -222,6 +344,153 @@ void DBlmdb::del(const std::string &key, bool mustexist) {
 		lmdb::Error::do_throw("DBlmdb::del key does not exist " + std::string(key.data(), key.size()), rc);
 }
 
+void DBlmdb::del_any(const Table &table, const lmdb::Val &key, bool mustexist) {
+	if (write_batch)
+		return write_batch->del(table, std::string(key.data(), key.size()), mustexist);
+	del_impl(tables.at(table.index), key, mustexist);
+}
+
+int DBlmdb::compare_keys(const TableInfo &table, const std::string &a, const std::string &b) {
+	if (table.integer_key && a.size() == b.size() && a.size() == sizeof(uint32_t)) {
+		const uint32_t ia = from_integer_key(a);
+		const uint32_t ib = from_integer_key(b);
+		return ia < ib ? -1 : ia > ib ? 1 : 0;
+	}
+	return a.compare(b);  // std::string compares as memcmp, same as lmdb default
+}
+
+bool DBlmdb::WriteBatch::OpLess::operator()(
+    const std::pair<size_t, std::string> &a, const std::pair<size_t, std::string> &b) const {
+	if (a.first != b.first)
+		return a.first < b.first;
+	return compare_keys(db->tables.at(a.first), a.second, b.second) < 0;
+}
+
+DBlmdb::WriteBatch::WriteBatch(DBlmdb &db) : db(db), ops(OpLess{&db}), prevs(OpLess{&db}) {
+	if (db.write_batch)
+		throw lmdb::Error("DBlmdb::WriteBatch nested batches are not supported");
+	db.write_batch = this;
+}
+
+DBlmdb::WriteBatch::~WriteBatch() { db.write_batch = nullptr; }
+
+const DBlmdb::WriteBatch::Op *DBlmdb::WriteBatch::find(const Table &table, const std::string &key) const {
+	auto it = ops.find(std::make_pair(table.index, key));
+	return it == ops.end() ? nullptr : &it->second;
+}
+
+bool DBlmdb::WriteBatch::has_prefix(const Table &table, const std::string &prefix) const {
+	if (db.tables.at(table.index).integer_key) {  // prefix order differs from table order, any key counts
+		auto it = ops.lower_bound(std::make_pair(table.index, std::string()));
+		return it != ops.end() && it->first.first == table.index;
+	}
+	auto it = ops.lower_bound(std::make_pair(table.index, prefix));
+	return it != ops.end() && it->first.first == table.index && it->first.second.compare(0, prefix.size(), prefix) == 0;
+}
+
+void DBlmdb::WriteBatch::remember(const std::pair<size_t, std::string> &op_key, bool nooverwrite) {
+	if (prevs.count(op_key) != 0)
+		return;
+	Prev prev{false, std::string()};
+	lmdb::Val val;  // nooverwrite put succeeds only if key did not exist
+	if (!nooverwrite && ::mdb_get(db.db_txn->handle, db.tables.at(op_key.first).handle, lmdb::Val(op_key.second),
+	                        val) == MDB_SUCCESS) {
+		prev.existed = true;
+		prev.value   = std::string(val.data(), val.size());
+	}
+	prevs.emplace(op_key, std::move(prev));
+}
+
+void DBlmdb::WriteBatch::put(const Table &table, const std::string &key, std::string &&value, bool nooverwrite) {
+	remember(std::make_pair(table.index, key), nooverwrite);
+	auto it = ops.find(std::make_pair(table.index, key));
+	if (it == ops.end()) {
+		ops.emplace(std::make_pair(table.index, key), Op{true, nooverwrite, std::move(value)});
+		return;
+	}
+	if (it->second.put && nooverwrite)
+		throw lmdb::Error("DBlmdb::put nooverwrite key already exists " + std::string(key.data(), key.size()));
+	if (!it->second.put)  // deleted in this batch, so does not exist
+		it->second.nooverwrite = false;
+	it->second.put   = true;
+	it->second.value = std::move(value);
+}
+
+void DBlmdb::WriteBatch::del(const Table &table, const std::string &key, bool mustexist) {
+	remember(std::make_pair(table.index, key), false);
+	auto it = ops.find(std::make_pair(table.index, key));
+	if (it == ops.end()) {
+		lmdb::Val val;  // mustexist is checked immediately, nooverwrite when applied
+		if (mustexist &&
+		    ::mdb_get(db.db_txn->handle, db.tables.at(table.index).handle, lmdb::Val(key), val) != MDB_SUCCESS)
+			throw lmdb::Error("DBlmdb::del key does not exist " + std::string(key.data(), key.size()));
+		ops.emplace(std::make_pair(table.index, key), Op{false, false, std::string()});
+		return;
+	}
+	if (!it->second.put && mustexist)
+		throw lmdb::Error("DBlmdb::del key does not exist " + std::string(key.data(), key.size()));
+	it->second = Op{false, false, std::string()};
+}
+
+void DBlmdb::WriteBatch::flush() {
+	std::unique_ptr<lmdb::Cur> cur;
+	size_t cur_table = 0;
+	std::string last;
+	bool append        = false;
+	bool append_failed = false;  // key order of table differs from ours, no MDB_APPEND for the rest of it
+	for (auto &&op : ops) {
+		const TableInfo &table = db.tables.at(op.first.first);
+		if (!cur || cur_table != op.first.first) {
+			cur_table = op.first.first;
+			cur.reset(new lmdb::Cur(*db.db_txn, table.handle));
+			lmdb::Val last_key, last_data;
+			append        = !cur->get(last_key, last_data, MDB_LAST);
+			append_failed = false;
+			last          = std::string(last_key.data(), last_key.size());
+		}
+		const std::string &key = op.first.second;
+		if (!op.second.put) {
+			db.del_impl(table, lmdb::Val(key), false);
+			continue;
+		}
+		append = !append_failed && (append || compare_keys(table, key, last) > 0);
+		lmdb::Val temp_value(op.second.value);
+		int rc = ::mdb_cursor_put(cur->handle, lmdb::Val(key), temp_value,
+		    append ? MDB_APPEND : op.second.nooverwrite ? MDB_NOOVERWRITE : 0);
+		if (append && rc == MDB_KEYEXIST) {  // key not after last one, MDB_APPEND did not write anything
+			append        = false;
+			append_failed = true;
+			lmdb::Val retry_value(op.second.value);
+			rc = ::mdb_cursor_put(
+			    cur->handle, lmdb::Val(key), retry_value, op.second.nooverwrite ? MDB_NOOVERWRITE : 0);
+		}
+		if (rc != MDB_SUCCESS && rc != MDB_KEYEXIST)
+			lmdb::Error::do_throw("DBlmdb::put failed " + std::string(key.data(), key.size()), rc);
+		if (op.second.nooverwrite && rc == MDB_KEYEXIST)
+			lmdb::Error::do_throw(
+			    "DBlmdb::put failed or nooverwrite key already exists " + std::string(key.data(), key.size()), rc);
+	}
+	ops.clear();
+}
+
+void DBlmdb::WriteBatch::get_undo(std::vector<UndoOp> *undo) const {
+	undo->clear();
+	undo->reserve(prevs.size());
+	for (auto it = prevs.rbegin(); it != prevs.rend(); ++it) {
+		UndoOp uop;
+		uop.table.index = it->first.first;
+		uop.key         = it->first.second;
+		uop.existed     = it->second.existed;
+		uop.value       = it->second.value;
+		undo->push_back(std::move(uop));
+	}
+}
+
+void DBlmdb::WriteBatch::apply() {
+	flush();
+	db.write_batch = nullptr;
+}
+
 std::string DBlmdb::to_ascending_key(uint32_t key) {
 	char buf[32] = {};
 	sprintf(buf, "%08X", key);
@@ -232,6 +501,14 @@ uint32_t DBlmdb::from_ascending_key(const std::string &key) {
 	return boost::lexical_cast<uint32_t>(std::stoull(key, nullptr, 16));
 }
 
+uint32_t DBlmdb::from_integer_key(const std::string &key) {
+	uint32_t result = 0;
+	if (key.size() != sizeof(result))
+		throw lmdb::Error("DBlmdb::from_integer_key wrong key size " + common::to_string(key.size()));
+	std::char_traits<char>::copy(reinterpret_cast<char *>(&result), key.data(), sizeof(result));
+	return result;
+}
+
 std::string DBlmdb::clean_key(const std::string &key) {
 	std::string result = key;
 	for (char &ch : result) {
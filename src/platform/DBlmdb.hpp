@@ -8,10 +8,14 @@
 
 #include <lmdb.h>
 #include <algorithm>
+#include <map>
 #include <memory>
+#include <set>
 #include <string>
+#include <vector>
 #include "common/BinaryArray.hpp"
 #include "common/Nocopy.hpp"
+#include "platform/DBKey.hpp"
 
 namespace platform {
 
@@ -21,6 +25,7 @@ struct Val {
 
 	Val() noexcept {}
 	explicit Val(const std::string &data) noexcept : Val{data.data(), data.size()} {}
+	explicit Val(const DBKey &data) noexcept : Val{data.data(), data.size()} {}
 	Val(const void *const data, const std::size_t size) noexcept : impl{size, const_cast<void *>(data)} {}
 	operator MDB_val *() noexcept { return &impl; }
 	operator const MDB_val *() const noexcept { return &impl; }
@@ -38,6 +43,7 @@ struct Env : private common::Nocopy {
 struct Txn : private common::Nocopy {
 	MDB_txn *handle = nullptr;
 	explicit Txn(Env &db_env);
+	Txn(const Env &db_env, bool read_only);
 	void commit();
 	~Txn();
 };
@@ -49,6 +55,7 @@ struct Dbi : private common::Nocopy {
 struct Cur : private common::Nocopy {
 	MDB_cursor *handle = nullptr;
 	explicit Cur(Txn &db_txn, Dbi &db_dbi);
+	explicit Cur(Txn &db_txn, MDB_dbi dbi);
 	explicit Cur(Cur &&other) noexcept;
 	bool get(MDB_val *const key, MDB_val *const data, const MDB_cursor_op op);
 	~Cur();
@@ -61,29 +68,115 @@ public:
 }
 
 class DBlmdb {
+public:
+	class WriteBatch;
+	class Table {  // Separate B-tree, default constructed refers to unnamed table
+		size_t index = 0;
+		friend class DBlmdb;
+
+	public:
+		Table() = default;
+	};
+	struct CommitStats {
+		uint32_t last_commit_ms  = 0;  // main thread was blocked for
+		uint64_t commits         = 0;  // since DB was opened
+		uint64_t durable_commits = 0;  // of them are on disk, meta page of last one is not (MDB_NOMETASYNC)
+	};
+	struct UndoOp {  // state of key before WriteBatch, put(value) or del(key) when undoing
+		Table table;
+		std::string key;
+		bool existed = false;
+		std::string value;
+	};
+
+private:
+	struct TableInfo {
+		MDB_dbi handle;
+		bool integer_key;
+		std::string name;
+	};
 	const std::string full_path; // TODO - change fields to m_
 	lmdb::Env db_env;
 	std::unique_ptr<lmdb::Dbi> db_dbi;
 	std::unique_ptr<lmdb::Txn> db_txn;
+	std::vector<TableInfo> tables;      // [0] is unnamed table
+	std::set<std::string> table_names;  // are keys in unnamed table, cursors skip them
+	WriteBatch *write_batch = nullptr;
+	CommitStats commit_stats;
+	void put_impl(const TableInfo &table, const lmdb::Val &key, const lmdb::Val &value, bool nooverwrite);
+	void del_impl(const TableInfo &table, const lmdb::Val &key, bool mustexist);
+	bool get_impl(const Table &table, const lmdb::Val &key, lmdb::Val &value) const;
+	// Both std::string and DBKey overloads end here
+	void put_any(const Table &table, const lmdb::Val &key, const lmdb::Val &value, bool nooverwrite);
+	void del_any(const Table &table, const lmdb::Val &key, bool mustexist);
+	bool get_array(const Table &table, const lmdb::Val &key, common::BinaryArray &value) const;
+	bool get_string(const Table &table, const lmdb::Val &key, std::string &value) const;
+	static int compare_keys(const TableInfo &table, const std::string &a, const std::string &b);
+
 public:
 	explicit DBlmdb(bool read_only, const std::string &full_path,
 	    uint64_t max_db_size = 0x8000000000);  // 0.5 Tb default, out of total 4 Tb on windows
 	const std::string & get_path()const { return full_path; }
 	void commit_db_txn();
+	CommitStats get_commit_stats() const { return commit_stats; }
+	Table open_table(const std::string &name, bool integer_key = false);  // integer_key tables use to_integer_key
+	const std::string &get_table_name(const Table &table) const { return tables.at(table.index).name; }
+	Table find_table(const std::string &name) const;  // among opened, persisted records refer to tables by name
+	bool is_integer_key(const Table &table) const { return tables.at(table.index).integer_key; }
+	std::vector<Table> get_tables() const;  // all opened, [0] is default
 	size_t test_get_approximate_size() const;
 	size_t get_approximate_items_count() const;
 
-	void put(const std::string &key, const common::BinaryArray &value, bool nooverwrite);
-	void put(const std::string &key, const std::string &value, bool nooverwrite);
-
-	bool get(const std::string &key, common::BinaryArray &value) const;
-	bool get(const std::string &key, std::string &value) const;
+	void put(const Table &table, const std::string &key, const common::BinaryArray &value, bool nooverwrite) {
+		put_any(table, lmdb::Val(key), lmdb::Val(value.data(), value.size()), nooverwrite);
+	}
+	void put(const Table &table, const std::string &key, const std::string &value, bool nooverwrite) {
+		put_any(table, lmdb::Val(key), lmdb::Val(value), nooverwrite);
+	}
+	void put(const std::string &key, const common::BinaryArray &value, bool nooverwrite) {
+		put(Table(), key, value, nooverwrite);
+	}
+	void put(const std::string &key, const std::string &value, bool nooverwrite) { put(Table(), key, value, nooverwrite); }
+	void put(const Table &table, const DBKey &key, const common::BinaryArray &value, bool nooverwrite) {
+		put_any(table, lmdb::Val(key), lmdb::Val(value.data(), value.size()), nooverwrite);
+	}
+	void put(const Table &table, const DBKey &key, const std::string &value, bool nooverwrite) {
+		put_any(table, lmdb::Val(key), lmdb::Val(value), nooverwrite);
+	}
+	void put(const DBKey &key, const common::BinaryArray &value, bool nooverwrite) {
+		put(Table(), key, value, nooverwrite);
+	}
+	void put(const DBKey &key, const std::string &value, bool nooverwrite) { put(Table(), key, value, nooverwrite); }
 
+	bool get(const Table &table, const std::string &key, common::BinaryArray &value) const {
+		return get_array(table, lmdb::Val(key), value);
+	}
+	bool get(const Table &table, const std::string &key, std::string &value) const {
+		return get_string(table, lmdb::Val(key), value);
+	}
+	bool get(const std::string &key, common::BinaryArray &value) const { return get(Table(), key, value); }
+	bool get(const std::string &key, std::string &value) const { return get(Table(), key, value); }
+	bool get(const Table &table, const DBKey &key, common::BinaryArray &value) const {
+		return get_array(table, lmdb::Val(key), value);
+	}
+	bool get(const Table &table, const DBKey &key, std::string &value) const {
+		return get_string(table, lmdb::Val(key), value);
+	}
+	bool get(const DBKey &key, common::BinaryArray &value) const { return get(Table(), key, value); }
+	bool get(const DBKey &key, std::string &value) const { return get(Table(), key, value); }
 
 	using Value = lmdb::Val;
-	bool get(const std::string &key, Value &value) const;
+	bool get(const Table &table, const std::string &key, Value &value) const {
+		return get_impl(table, lmdb::Val(key), value);
+	}
+	bool get(const std::string &key, Value &value) const { return get(Table(), key, value); }
+	bool get(const Table &table, const DBKey &key, Value &value) const { return get_impl(table, lmdb::Val(key), value); }
+	bool get(const DBKey &key, Value &value) const { return get(Table(), key, value); }
 
-	void del(const std::string &key, bool mustexist);
+	void del(const Table &table, const std::string &key, bool mustexist) { del_any(table, lmdb::Val(key), mustexist); }
+	void del(const std::string &key, bool mustexist) { del(Table(), key, mustexist); }
+	void del(const Table &table, const DBKey &key, bool mustexist) { del_any(table, lmdb::Val(key), mustexist); }
+	void del(const DBKey &key, bool mustexist) { del(Table(), key, mustexist); }
 
 	class Cursor {
 		lmdb::Cur db_cur;
@@ -92,21 +185,107 @@ public:
 		bool is_end = false;
 		const std::string prefix;
 		const bool forward;
-		void check_prefix(const lmdb::Val &itkey);
+		const std::set<std::string> *const hidden_keys;
+		void check_prefix(lmdb::Val &itkey);
 		friend class DBlmdb;
 		Cursor(lmdb::Cur &&db_cur, const std::string &prefix, const std::string &middle, size_t max_key_size,
-		    bool forward);
+		    bool forward, const std::set<std::string> *hidden_keys);
 
 	public:
 		const std::string &get_suffix() const noexcept { return suffix; }
+		const lmdb::Val &get_value() const noexcept { return data; }  // valid until cursor moves
 		std::string get_value_string() const;
 		common::BinaryArray get_value_array() const;
 		bool end() const noexcept { return is_end; }
 		void next();
 		void erase();  // moves to the next value
 	};
-	Cursor begin(const std::string &prefix, const std::string &middle = std::string()) const;
-	Cursor rbegin(const std::string &prefix, const std::string &middle = std::string()) const;
+	Cursor begin(const Table &table, const std::string &prefix, const std::string &middle = std::string()) const;
+	Cursor rbegin(const Table &table, const std::string &prefix, const std::string &middle = std::string()) const;
+	Cursor begin(const std::string &prefix, const std::string &middle = std::string()) const {
+		return begin(Table(), prefix, middle);
+	}
+	Cursor rbegin(const std::string &prefix, const std::string &middle = std::string()) const {
+		return rbegin(Table(), prefix, middle);
+	}
+	Cursor begin(const Table &table, const DBKey &prefix, const std::string &middle = std::string()) const {
+		return begin(table, prefix.to_string(), middle);  // cursor keeps prefix for its lifetime
+	}
+	Cursor rbegin(const Table &table, const DBKey &prefix, const std::string &middle = std::string()) const {
+		return rbegin(table, prefix.to_string(), middle);
+	}
+
+	// Read-only view of state as of last commit_db_txn(), does not see current txn. Can be created and used on
+	// any thread (env is opened with MDB_NOTLS), while main thread continues writing and committing.
+	// Keep short-lived, pages of living snapshot cannot be reused, so DB file grows.
+	class Snapshot : private common::Nocopy {
+		const DBlmdb &db;
+		mutable lmdb::Txn txn;
+		bool get_impl(const Table &table, const lmdb::Val &key, Value &value) const;
+
+	public:
+		explicit Snapshot(const DBlmdb &db);
+		bool get(const Table &table, const std::string &key, common::BinaryArray &value) const;
+		bool get(const Table &table, const std::string &key, std::string &value) const;
+		bool get(const Table &table, const std::string &key, Value &value) const {  // valid while snapshot alive
+			return get_impl(table, lmdb::Val(key), value);
+		}
+		bool get(const std::string &key, common::BinaryArray &value) const { return get(Table(), key, value); }
+		bool get(const std::string &key, std::string &value) const { return get(Table(), key, value); }
+		bool get(const std::string &key, Value &value) const { return get(Table(), key, value); }
+		bool get(const Table &table, const DBKey &key, common::BinaryArray &value) const;
+		bool get(const Table &table, const DBKey &key, std::string &value) const;
+		bool get(const Table &table, const DBKey &key, Value &value) const {
+			return get_impl(table, lmdb::Val(key), value);
+		}
+
+		Cursor begin(const Table &table, const std::string &prefix, const std::string &middle = std::string()) const;
+		Cursor rbegin(const Table &table, const std::string &prefix, const std::string &middle = std::string()) const;
+		Cursor begin(const std::string &prefix, const std::string &middle = std::string()) const {
+			return begin(Table(), prefix, middle);
+		}
+		Cursor rbegin(const std::string &prefix, const std::string &middle = std::string()) const {
+			return rbegin(Table(), prefix, middle);
+		}
+	};
+
+	// While alive, collects all put/del of db, get sees collected values. apply() writes them sorted by key
+	// through single cursor, appending with MDB_APPEND when key is past the end of db. commit_db_txn() and
+	// cursors over prefix with collected keys flush collected values into db transaction first, flushed values
+	// stay there and are committed even if batch is never applied. Only values collected since last flush are
+	// discarded by destroying not applied batch. nooverwrite put of key existing in db throws on flush, not on put.
+	class WriteBatch : private common::Nocopy {
+		struct Op {
+			bool put;
+			bool nooverwrite;
+			std::string value;
+		};
+		struct Prev {  // state of key before batch
+			bool existed;
+			std::string value;
+		};
+		struct OpLess {
+			const DBlmdb *db;
+			bool operator()(const std::pair<size_t, std::string> &a, const std::pair<size_t, std::string> &b) const;
+		};
+		DBlmdb &db;
+		std::map<std::pair<size_t, std::string>, Op, OpLess> ops;  // sorted by table, then like in table
+		std::map<std::pair<size_t, std::string>, Prev, OpLess> prevs;  // of all keys ever in ops, kept by flush
+		friend class DBlmdb;
+		void remember(const std::pair<size_t, std::string> &op_key, bool nooverwrite);
+		void put(const Table &table, const std::string &key, std::string &&value, bool nooverwrite);
+		void del(const Table &table, const std::string &key, bool mustexist);
+		const Op *find(const Table &table, const std::string &key) const;
+		bool has_prefix(const Table &table, const std::string &prefix) const;
+		void flush();
+
+	public:
+		explicit WriteBatch(DBlmdb &db);
+		~WriteBatch();
+		size_t size() const { return ops.size(); }
+		void get_undo(std::vector<UndoOp> *undo) const;  // all keys written so far, in reverse key order
+		void apply();
+	};
 
 	static std::string to_binary_key(const unsigned char *data, size_t size) {
 		std::string result;
@@ -120,6 +299,8 @@ public:
 
 	static std::string to_ascending_key(uint32_t key);
 	static uint32_t from_ascending_key(const std::string &key);
+	static std::string to_integer_key(uint32_t key) { return std::string(reinterpret_cast<const char *>(&key), 4); }
+	static uint32_t from_integer_key(const std::string &key);
 	static std::string clean_key(const std::string &key);  // replace invalid chars for printing
 
 	static void run_tests();
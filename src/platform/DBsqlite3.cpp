@@ -6,6 +6,7 @@
 
 #include "DBsqlite3.hpp"
 #include <boost/lexical_cast.hpp>
+#include <chrono>
 #include <iostream>
 #include "PathTools.hpp"
 #include "common/string.hpp"
@@ -36,21 +37,15 @@ DBsqlite::DBsqlite(bool read_only, const std::string &full_path, uint64_t max_db
 	//	create_directories_if_necessary(full_path);
 	sqlite_check(sqlite3_open(this->full_path.c_str(), &db_dbi.handle), "sqlite3_open ");
 	char *err_msg = nullptr;  // TODO - we leak err_msg
-	sqlite_check(
-	    sqlite3_exec(db_dbi.handle,
-	        "CREATE TABLE IF NOT EXISTS kv_table(kk BLOB PRIMARY KEY COLLATE BINARY, vv BLOB NOT NULL) WITHOUT ROWID",
-	        0, 0, &err_msg),
+	sqlite_check(sqlite3_exec(db_dbi.handle, "PRAGMA journal_mode=WAL", 0, 0, &err_msg), err_msg);
+	// WAL - snapshots read last committed state without blocking our commits
+	// reads of mapped pages avoid copying through read(), page cache in KiB (negative) is for writes and misses
+	const std::string mmap_size = common::to_string(sizeof(void *) >= 8 ? 1ULL << 30 : 64ULL << 20);
+	sqlite_check(sqlite3_exec(db_dbi.handle,
+	                 ("PRAGMA mmap_size=" + mmap_size + "; PRAGMA cache_size=-65536; PRAGMA temp_store=MEMORY").c_str(),
+	                 0, 0, &err_msg),
 	    err_msg);
-	sqlite_check(sqlite3_prepare_v2(db_dbi.handle, "SELECT kk, vv FROM kv_table WHERE kk = ?", -1, &stmt_get.handle, 0),
-	    "sqlite3_prepare_v2 stmt_get ");
-	sqlite_check(
-	    sqlite3_prepare_v2(db_dbi.handle, "INSERT INTO kv_table (kk, vv) VALUES (?, ?)", -1, &stmt_insert.handle, 0),
-	    "sqlite3_prepare_v2 stmt_insert ");
-	sqlite_check(
-	    sqlite3_prepare_v2(db_dbi.handle, "REPLACE INTO kv_table (kk, vv) VALUES (?, ?)", -1, &stmt_update.handle, 0),
-	    "sqlite3_prepare_v2 stmt_update ");
-	sqlite_check(sqlite3_prepare_v2(db_dbi.handle, "DELETE FROM kv_table WHERE kk = ?", -1, &stmt_del.handle, 0),
-	    "sqlite3_prepare_v2 stmt_del ");
+	create_table("kv_table");
 	sqlite_check(sqlite3_prepare_v2(db_dbi.handle, "SELECT count(kk) FROM kv_table", -1, &stmt_select_star.handle, 0),
 	    "sqlite3_prepare_v2 stmt_select_star ");
 
@@ -60,6 +55,69 @@ DBsqlite::DBsqlite(bool read_only, const std::string &full_path, uint64_t max_db
 	                  //	std::cout << "rows=" << get_approximate_items_count() << std::endl;
 }
 
+void DBsqlite::create_table(const std::string &name) {
+	for (char ch : name)
+		if (!std::isalnum(static_cast<unsigned char>(ch)) && ch != '_')
+			throw platform::sqlite::Error("DBsqlite table name invalid " + name);
+	char *err_msg = nullptr;  // TODO - we leak err_msg
+	sqlite_check(sqlite3_exec(db_dbi.handle,
+	                 ("CREATE TABLE IF NOT EXISTS " + name +
+	                     "(kk BLOB PRIMARY KEY COLLATE BINARY, vv BLOB NOT NULL) WITHOUT ROWID")
+	                     .c_str(),
+	                 0, 0, &err_msg),
+	    err_msg);
+	std::unique_ptr<TableInfo> table(new TableInfo{});
+	table->name = name;
+	sqlite_check(sqlite3_prepare_v2(db_dbi.handle, ("SELECT kk, vv FROM " + name + " WHERE kk = ?").c_str(), -1,
+	                 &table->stmt_get.handle, 0),
+	    "sqlite3_prepare_v2 stmt_get ");
+	sqlite_check(sqlite3_prepare_v2(db_dbi.handle, ("INSERT INTO " + name + " (kk, vv) VALUES (?, ?)").c_str(), -1,
+	                 &table->stmt_insert.handle, 0),
+	    "sqlite3_prepare_v2 stmt_insert ");
+	sqlite_check(sqlite3_prepare_v2(db_dbi.handle, ("REPLACE INTO " + name + " (kk, vv) VALUES (?, ?)").c_str(), -1,
+	                 &table->stmt_update.handle, 0),
+	    "sqlite3_prepare_v2 stmt_update ");
+	sqlite_check(sqlite3_prepare_v2(db_dbi.handle, ("DELETE FROM " + name + " WHERE kk = ?").c_str(), -1,
+	                 &table->stmt_del.handle, 0),
+	    "sqlite3_prepare_v2 stmt_del ");
+	std::string values = "(?, ?)";
+	for (size_t i = 1; i != ROWS_PER_INSERT; ++i)
+		values += ", (?, ?)";
+	sqlite_check(sqlite3_prepare_v2(db_dbi.handle, ("INSERT INTO " + name + " (kk, vv) VALUES " + values).c_str(), -1,
+	                 &table->stmt_insert_many.handle, 0),
+	    "sqlite3_prepare_v2 stmt_insert_many ");
+	sqlite_check(sqlite3_prepare_v2(db_dbi.handle, ("REPLACE INTO " + name + " (kk, vv) VALUES " + values).c_str(), -1,
+	                 &table->stmt_update_many.handle, 0),
+	    "sqlite3_prepare_v2 stmt_update_many ");
+	tables.push_back(std::move(table));
+}
+
+DBsqlite::Table DBsqlite::open_table(const std::string &name, bool integer_key) {
+	create_table("t_" + name);  // integer keys are stored as big-endian BLOBs
+	tables.back()->open_name   = name;
+	tables.back()->integer_key = integer_key;
+	Table result;
+	result.index = tables.size() - 1;
+	return result;
+}
+
+DBsqlite::Table DBsqlite::find_table(const std::string &name) const {
+	for (size_t i = 0; i != tables.size(); ++i)
+		if (tables[i]->open_name == name) {
+			Table result;
+			result.index = i;
+			return result;
+		}
+	throw platform::sqlite::Error("DBsqlite::find_table table not opened " + name);
+}
+
+std::vector<DBsqlite::Table> DBsqlite::get_tables() const {
+	std::vector<Table> result(tables.size());
+	for (size_t i = 0; i != tables.size(); ++i)
+		result[i].index = i;
+	return result;
+}
+
 size_t DBsqlite::test_get_approximate_size() const { return 0; }
 
 size_t DBsqlite::get_approximate_items_count() const {
@@ -74,31 +132,50 @@ size_t DBsqlite::get_approximate_items_count() const {
 
 static const size_t max_key_size = 128;
 
-DBsqlite::Cursor::Cursor(
-    const DBsqlite *db, const sqlite::Dbi &db_dbi, const std::string &prefix, const std::string &middle, bool forward)
-    : db(db), prefix(prefix), forward(forward) {
+DBsqlite::Cursor::Cursor(const DBsqlite *db, sqlite3 *connection, const Table &table, const std::string &prefix,
+    const std::string &middle, bool forward)
+    : db(db), connection(connection), table(table), prefix(prefix), forward(forward) {
 	std::string start  = prefix + middle;
 	std::string finish = start;
 	if (finish.size() < max_key_size)
 		finish += std::string(max_key_size - finish.size(), char(0xff));  // char('~')
-	std::string sql = forward ? "SELECT kk, vv FROM kv_table WHERE kk >= ? ORDER BY kk ASC"
-	                          : "SELECT kk, vv FROM kv_table WHERE kk <= ? ORDER BY kk DESC";
-	sqlite_check(
-	    sqlite3_prepare_v2(db_dbi.handle, sql.c_str(), -1, &stmt_get.handle, 0), "sqlite3_prepare_v2 Cursor stmt_get ");
+	TableInfo &info = *db->tables.at(table.index);
+	auto &cached    = info.cursor_stmts[forward];
+	if (connection == db->db_dbi.handle && !cached.empty()) {
+		std::swap(stmt_get.handle, cached.back().handle);
+		cached.pop_back();
+	} else {
+		std::string sql = forward ? "SELECT kk, vv FROM " + info.name + " WHERE kk >= ? ORDER BY kk ASC"
+		                          : "SELECT kk, vv FROM " + info.name + " WHERE kk <= ? ORDER BY kk DESC";
+		sqlite_check(sqlite3_prepare_v2(connection, sql.c_str(), -1, &stmt_get.handle, 0),
+		    "sqlite3_prepare_v2 Cursor stmt_get ");
+	}
 	sqlite_check(sqlite3_bind_blob(stmt_get.handle, 1, forward ? start.data() : finish.data(),
 	                 static_cast<int>(forward ? start.size() : finish.size()), SQLITE_TRANSIENT),
 	    "DB::Cursor sqlite3_bind_blob 1 ");
 	step_and_check();
 }
 
+DBsqlite::Cursor::~Cursor() {
+	if (!stmt_get.handle || connection != db->db_dbi.handle)
+		return;  // moved from or snapshot cursor
+	sqlite3_reset(stmt_get.handle);
+	sqlite3_clear_bindings(stmt_get.handle);
+	auto &cached = db->tables.at(table.index)->cursor_stmts[forward];
+	cached.emplace_back();
+	std::swap(cached.back().handle, stmt_get.handle);
+}
+
 void DBsqlite::Cursor::next() { step_and_check(); }
 
 void DBsqlite::Cursor::erase() {
 	if (is_end)
 		return;  // Some precaution
+	if (connection != db->db_dbi.handle)
+		throw platform::sqlite::Error("DB::Cursor erase is not allowed on snapshot");
 	sqlite3_reset(stmt_get.handle);
 	std::string mykey = prefix + suffix;
-	const_cast<DBsqlite *>(db)->del(mykey, true);
+	const_cast<DBsqlite *>(db)->del(table, mykey, true);
 	sqlite_check(sqlite3_bind_blob(stmt_get.handle, 1, mykey.data(), static_cast<int>(mykey.size()), SQLITE_TRANSIENT),
 	    "DB::Cursor erase sqlite3_bind_blob 1 ");
 	step_and_check();
@@ -144,43 +221,59 @@ void DBsqlite::Cursor::step_and_check() {
 std::string DBsqlite::Cursor::get_value_string() const { return std::string(data, size); }
 common::BinaryArray DBsqlite::Cursor::get_value_array() const { return common::BinaryArray(data, data + size); }
 
-DBsqlite::Cursor DBsqlite::begin(const std::string &prefix, const std::string &middle) const {
-	return Cursor(this, db_dbi, prefix, middle, true);
+DBsqlite::Cursor DBsqlite::begin(const Table &table, const std::string &prefix, const std::string &middle) const {
+	if (write_batch && write_batch->has_prefix(table, prefix))
+		write_batch->flush();
+	return Cursor(this, db_dbi.handle, table, prefix, middle, true);
 }
 
-DBsqlite::Cursor DBsqlite::rbegin(const std::string &prefix, const std::string &middle) const {
-	return Cursor(this, db_dbi, prefix, middle, false);
+DBsqlite::Cursor DBsqlite::rbegin(const Table &table, const std::string &prefix, const std::string &middle) const {
+	if (write_batch && write_batch->has_prefix(table, prefix))
+		write_batch->flush();
+	return Cursor(this, db_dbi.handle, table, prefix, middle, false);
 }
 
 void DBsqlite::commit_db_txn() {
+	const auto idea_start = std::chrono::steady_clock::now();
+	if (write_batch)
+		write_batch->flush();
 	char *err_msg = nullptr;  // TODO - we leak err_msg
+	commit_stats.commits += 1;
 	sqlite_check(sqlite3_exec(db_dbi.handle, "COMMIT TRANSACTION", 0, 0, &err_msg), err_msg);
 	sqlite_check(sqlite3_exec(db_dbi.handle, "BEGIN TRANSACTION", 0, 0, &err_msg), err_msg);
+	commit_stats.durable_commits = commit_stats.commits;
+	const auto idea_ms =
+	    std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - idea_start);
+	commit_stats.last_commit_ms = static_cast<uint32_t>(idea_ms.count());
 }
 
-static void put(sqlite::Stmt &stmt, const std::string &key, const void *data, size_t size) {
+static void put(sqlite::Stmt &stmt, const char *key, size_t key_size, const void *data, size_t size) {
 	sqlite3_reset(stmt.handle);
-	sqlite_check(sqlite3_bind_blob(stmt.handle, 1, key.data(), static_cast<int>(key.size()), 0), "DB::put sqlite3_bind_blob 1 ");
+	sqlite_check(sqlite3_bind_blob(stmt.handle, 1, key, static_cast<int>(key_size), 0), "DB::put sqlite3_bind_blob 1 ");
 	sqlite_check(sqlite3_bind_blob(stmt.handle, 2, data, static_cast<int>(size), 0), "DB::put sqlite3_bind_blob 2 ");
 	auto rc = sqlite3_step(stmt.handle);
 	if (rc != SQLITE_DONE)
 		throw platform::sqlite::Error("DB::put failed sqlite3_step in put " + common::to_string(rc));
 }
 
-void DBsqlite::put(const std::string &key, const common::BinaryArray &value, bool nooverwrite) {
-	sqlite::Stmt &stmt = nooverwrite ? stmt_insert : stmt_update;
-	::put(stmt, key, value.data(), value.size());
+void DBsqlite::put_impl(
+    TableInfo &table, const char *key, size_t key_size, const void *data, size_t size, bool nooverwrite) {
+	sqlite::Stmt &stmt = nooverwrite ? table.stmt_insert : table.stmt_update;
+	::put(stmt, key, key_size, data, size);
 }
 
-void DBsqlite::put(const std::string &key, const std::string &value, bool nooverwrite) {
-	sqlite::Stmt &stmt = nooverwrite ? stmt_insert : stmt_update;
-	::put(stmt, key, value.data(), value.size());
+void DBsqlite::put_any(
+    const Table &table, const char *key, size_t key_size, const void *data, size_t size, bool nooverwrite) {
+	if (write_batch)
+		return write_batch->put(table, std::string(key, key_size),
+		    std::string(reinterpret_cast<const char *>(data), size), nooverwrite);
+	put_impl(*tables.at(table.index), key, key_size, data, size, nooverwrite);
 }
 
-static std::pair<const unsigned char *, size_t> get(const sqlite::Stmt &stmt, const std::string &key) {
+static std::pair<const unsigned char *, size_t> get(const sqlite::Stmt &stmt, const char *key, size_t key_size) {
 	sqlite3_reset(stmt.handle);
 	sqlite_check(
-	    sqlite3_bind_blob(stmt.handle, 1, key.data(), static_cast<int>(key.size()), 0), "DB::get sqlite3_bind_blob 1 ");
+	    sqlite3_bind_blob(stmt.handle, 1, key, static_cast<int>(key_size), 0), "DB::get sqlite3_bind_blob 1 ");
 	auto rc = sqlite3_step(stmt.handle);
 	if (rc == SQLITE_DONE)
 		return std::make_pair(nullptr, 0);
@@ -190,30 +283,126 @@ static std::pair<const unsigned char *, size_t> get(const sqlite::Stmt &stmt, co
 	auto da = reinterpret_cast<const unsigned char *>(sqlite3_column_blob(stmt.handle, 0));
 	si      = sqlite3_column_bytes(stmt.handle, 1);
 	da      = reinterpret_cast<const unsigned char *>(sqlite3_column_blob(stmt.handle, 1));
+	static const unsigned char empty_value = 0;
+	if (!da)  // sqlite returns nullptr for empty blob, but nullptr means absent key for callers
+		da = &empty_value;
 	return std::make_pair(da, si);
 }
 
-bool DBsqlite::get(const std::string &key, common::BinaryArray &value) const {
-	auto result = ::get(stmt_get, key);
+bool DBsqlite::get_impl(
+    const Table &table, const char *key, size_t key_size, const unsigned char *&data, size_t &size) const {
+	if (write_batch) {
+		if (auto op = write_batch->find(table, std::string(key, key_size))) {
+			if (!op->put)
+				return false;
+			data = reinterpret_cast<const unsigned char *>(op->value.data());
+			size = op->value.size();
+			return true;
+		}
+	}
+	auto result = ::get(tables.at(table.index)->stmt_get, key, key_size);
 	if (!result.first)
 		return false;
-	value.assign(result.first, result.first + result.second);
+	data = result.first;
+	size = result.second;
+	return true;
+}
+
+bool DBsqlite::get_array(const Table &table, const char *key, size_t key_size, common::BinaryArray &value) const {
+	const unsigned char *data = nullptr;
+	size_t size               = 0;
+	if (!get_impl(table, key, key_size, data, size))
+		return false;
+	value.assign(data, data + size);
+	return true;
+}
+
+bool DBsqlite::get_string(const Table &table, const char *key, size_t key_size, std::string &value) const {
+	const unsigned char *data = nullptr;
+	size_t size               = 0;
+	if (!get_impl(table, key, key_size, data, size))
+		return false;
+	value.assign(data, data + size);
 	return true;
 }
 
-bool DBsqlite::get(const std::string &key, std::string &value) const {
-	auto result = ::get(stmt_get, key);
+DBsqlite::Snapshot::Snapshot(const DBsqlite &db) : db(db), stmt_gets(db.tables.size()) {
+	sqlite_check(sqlite3_open_v2(db.full_path.c_str(), &connection.handle, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, 0),
+	    "sqlite3_open_v2 Snapshot ");
+	sqlite3_busy_timeout(connection.handle, 5000);
+	char *err_msg = nullptr;  // TODO - we leak err_msg
+	// deferred txn starts reading on first SELECT, we want snapshot fixed right now
+	sqlite_check(sqlite3_exec(connection.handle, "BEGIN TRANSACTION; SELECT count(*) FROM sqlite_master", 0, 0, &err_msg),
+	    err_msg);
+}
+
+bool DBsqlite::Snapshot::get_impl(
+    const Table &table, const char *key, size_t key_size, const unsigned char *&data, size_t &size) const {
+	auto &stmt = stmt_gets.at(table.index);
+	if (!stmt) {
+		stmt.reset(new sqlite::Stmt());
+		const std::string &name = db.tables.at(table.index)->name;
+		sqlite_check(sqlite3_prepare_v2(connection.handle, ("SELECT kk, vv FROM " + name + " WHERE kk = ?").c_str(),
+		                 -1, &stmt->handle, 0),
+		    "sqlite3_prepare_v2 Snapshot stmt_get ");
+	}
+	auto result = ::get(*stmt, key, key_size);
 	if (!result.first)
 		return false;
-	value.assign(result.first, result.first + result.second);
+	data = result.first;
+	size = result.second;
+	return true;
+}
+
+bool DBsqlite::Snapshot::get(const Table &table, const std::string &key, common::BinaryArray &value) const {
+	const unsigned char *data = nullptr;
+	size_t size               = 0;
+	if (!get_impl(table, key.data(), key.size(), data, size))
+		return false;
+	value.assign(data, data + size);
 	return true;
 }
 
-void DBsqlite::del(const std::string &key, bool mustexist) {
-	sqlite3_reset(stmt_del.handle);
-	sqlite_check(sqlite3_bind_blob(stmt_del.handle, 1, key.data(), static_cast<int>(key.size()), 0),
+bool DBsqlite::Snapshot::get(const Table &table, const std::string &key, std::string &value) const {
+	const unsigned char *data = nullptr;
+	size_t size               = 0;
+	if (!get_impl(table, key.data(), key.size(), data, size))
+		return false;
+	value.assign(data, data + size);
+	return true;
+}
+
+bool DBsqlite::Snapshot::get(const Table &table, const DBKey &key, common::BinaryArray &value) const {
+	const unsigned char *data = nullptr;
+	size_t size               = 0;
+	if (!get_impl(table, key.data(), key.size(), data, size))
+		return false;
+	value.assign(data, data + size);
+	return true;
+}
+
+bool DBsqlite::Snapshot::get(const Table &table, const DBKey &key, std::string &value) const {
+	const unsigned char *data = nullptr;
+	size_t size               = 0;
+	if (!get_impl(table, key.data(), key.size(), data, size))
+		return false;
+	value.assign(data, data + size);
+	return true;
+}
+
+DBsqlite::Cursor DBsqlite::Snapshot::begin(const Table &table, const std::string &prefix, const std::string &middle) const {
+	return Cursor(&db, connection.handle, table, prefix, middle, true);
+}
+
+DBsqlite::Cursor DBsqlite::Snapshot::rbegin(const Table &table, const std::string &prefix, const std::string &middle) const {
+	return Cursor(&db, connection.handle, table, prefix, middle, false);
+}
+
+void DBsqlite::del_impl(TableInfo &table, const char *key, size_t key_size, bool mustexist) {
+	sqlite3_reset(table.stmt_del.handle);
+	sqlite_check(sqlite3_bind_blob(table.stmt_del.handle, 1, key, static_cast<int>(key_size), 0),
 	    "DB::del sqlite3_bind_blob 1 ");
-	auto rc = sqlite3_step(stmt_del.handle);
+	auto rc = sqlite3_step(table.stmt_del.handle);
 	if (rc != SQLITE_DONE)
 		throw platform::sqlite::Error("DB::del failed sqlite3_step in del " + common::to_string(rc));
 	int deleted_rows = sqlite3_changes(db_dbi.handle);
@@ -221,6 +410,133 @@ void DBsqlite::del(const std::string &key, bool mustexist) {
 		throw platform::sqlite::Error("DB::del row does not exits");
 }
 
+void DBsqlite::del_any(const Table &table, const char *key, size_t key_size, bool mustexist) {
+	if (write_batch)
+		return write_batch->del(table, std::string(key, key_size), mustexist);
+	del_impl(*tables.at(table.index), key, key_size, mustexist);
+}
+
+DBsqlite::WriteBatch::WriteBatch(DBsqlite &db) : db(db) {
+	if (db.write_batch)
+		throw platform::sqlite::Error("DBsqlite::WriteBatch nested batches are not supported");
+	db.write_batch = this;
+}
+
+DBsqlite::WriteBatch::~WriteBatch() { db.write_batch = nullptr; }
+
+const DBsqlite::WriteBatch::Op *DBsqlite::WriteBatch::find(const Table &table, const std::string &key) const {
+	auto it = ops.find(std::make_pair(table.index, key));
+	return it == ops.end() ? nullptr : &it->second;
+}
+
+bool DBsqlite::WriteBatch::has_prefix(const Table &table, const std::string &prefix) const {
+	auto it = ops.lower_bound(std::make_pair(table.index, prefix));
+	return it != ops.end() && it->first.first == table.index && it->first.second.compare(0, prefix.size(), prefix) == 0;
+}
+
+void DBsqlite::WriteBatch::remember(const std::pair<size_t, std::string> &op_key, bool nooverwrite) {
+	if (prevs.count(op_key) != 0)
+		return;
+	Prev prev{false, std::string()};
+	if (!nooverwrite) {  // nooverwrite put succeeds only if key did not exist
+		auto result = ::get(db.tables.at(op_key.first)->stmt_get, op_key.second.data(), op_key.second.size());
+		if (result.first) {
+			prev.existed = true;
+			prev.value.assign(reinterpret_cast<const char *>(result.first), result.second);
+		}
+	}
+	prevs.emplace(op_key, std::move(prev));
+}
+
+void DBsqlite::WriteBatch::put(const Table &table, const std::string &key, std::string &&value, bool nooverwrite) {
+	remember(std::make_pair(table.index, key), nooverwrite);
+	auto it = ops.find(std::make_pair(table.index, key));
+	if (it == ops.end()) {
+		ops.emplace(std::make_pair(table.index, key), Op{true, nooverwrite, std::move(value)});
+		return;
+	}
+	if (it->second.put && nooverwrite)
+		throw platform::sqlite::Error("DB::put nooverwrite key already exists");
+	if (!it->second.put)  // deleted in this batch, so does not exist
+		it->second.nooverwrite = false;
+	it->second.put   = true;
+	it->second.value = std::move(value);
+}
+
+void DBsqlite::WriteBatch::del(const Table &table, const std::string &key, bool mustexist) {
+	remember(std::make_pair(table.index, key), false);
+	auto it = ops.find(std::make_pair(table.index, key));
+	if (it == ops.end()) {  // mustexist is checked immediately, nooverwrite when applied
+		if (mustexist && !::get(db.tables.at(table.index)->stmt_get, key.data(), key.size()).first)
+			throw platform::sqlite::Error("DB::del row does not exits");
+		ops.emplace(std::make_pair(table.index, key), Op{false, false, std::string()});
+		return;
+	}
+	if (!it->second.put && mustexist)
+		throw platform::sqlite::Error("DB::del row does not exits");
+	it->second = Op{false, false, std::string()};
+}
+
+void DBsqlite::WriteBatch::flush() {
+	// Runs of puts to the same table go ROWS_PER_INSERT rows per statement, remainder one by one
+	std::vector<const std::pair<const std::pair<size_t, std::string>, Op> *> run;
+	auto put_run = [&]() {
+		for (auto op : run)
+			db.put_impl(*db.tables.at(op->first.first), op->first.second.data(), op->first.second.size(),
+			    op->second.value.data(), op->second.value.size(), op->second.nooverwrite);
+		run.clear();
+	};
+	for (auto &&op : ops) {
+		if (!run.empty() && (!op.second.put || run.front()->first.first != op.first.first ||
+		                        run.front()->second.nooverwrite != op.second.nooverwrite))
+			put_run();
+		if (!op.second.put) {
+			db.del_impl(*db.tables.at(op.first.first), op.first.second.data(), op.first.second.size(), false);
+			continue;
+		}
+		run.push_back(&op);
+		if (run.size() != ROWS_PER_INSERT)
+			continue;
+		TableInfo &table   = *db.tables.at(op.first.first);
+		sqlite::Stmt &stmt = op.second.nooverwrite ? table.stmt_insert_many : table.stmt_update_many;
+		sqlite3_reset(stmt.handle);
+		for (size_t i = 0; i != run.size(); ++i) {
+			const auto &key   = run[i]->first.second;
+			const auto &value = run[i]->second.value;
+			sqlite_check(sqlite3_bind_blob(stmt.handle, static_cast<int>(2 * i + 1), key.data(),
+			                 static_cast<int>(key.size()), 0),
+			    "DB::WriteBatch sqlite3_bind_blob key ");
+			sqlite_check(sqlite3_bind_blob(stmt.handle, static_cast<int>(2 * i + 2), value.data(),
+			                 static_cast<int>(value.size()), 0),
+			    "DB::WriteBatch sqlite3_bind_blob value ");
+		}
+		auto rc = sqlite3_step(stmt.handle);
+		if (rc != SQLITE_DONE)
+			throw platform::sqlite::Error("DB::WriteBatch failed sqlite3_step in flush " + common::to_string(rc));
+		run.clear();
+	}
+	put_run();
+	ops.clear();
+}
+
+void DBsqlite::WriteBatch::get_undo(std::vector<UndoOp> *undo) const {
+	undo->clear();
+	undo->reserve(prevs.size());
+	for (auto it = prevs.rbegin(); it != prevs.rend(); ++it) {
+		UndoOp uop;
+		uop.table.index = it->first.first;
+		uop.key         = it->first.second;
+		uop.existed     = it->second.existed;
+		uop.value       = it->second.value;
+		undo->push_back(std::move(uop));
+	}
+}
+
+void DBsqlite::WriteBatch::apply() {
+	flush();
+	db.write_batch = nullptr;
+}
+
 std::string DBsqlite::to_ascending_key(uint32_t key) {
 	char buf[32] = {};
 	sprintf(buf, "%08X", key);
@@ -234,6 +550,18 @@ uint32_t DBsqlite::from_ascending_key(const std::string &key) {
 	return boost::lexical_cast<uint32_t>(val);  // TODO - std::stoull(key, nullptr, 16) when Google updates NDK compiler
 }
 
+std::string DBsqlite::to_integer_key(uint32_t key) {
+	char buf[4] = {char(key >> 24), char(key >> 16), char(key >> 8), char(key)};
+	return std::string(buf, sizeof(buf));
+}
+
+uint32_t DBsqlite::from_integer_key(const std::string &key) {
+	if (key.size() != 4)
+		throw platform::sqlite::Error("DBsqlite::from_integer_key wrong key size " + common::to_string(key.size()));
+	const auto *data = reinterpret_cast<const unsigned char *>(key.data());
+	return (uint32_t(data[0]) << 24) | (uint32_t(data[1]) << 16) | (uint32_t(data[2]) << 8) | uint32_t(data[3]);
+}
+
 std::string DBsqlite::clean_key(const std::string &key) {
 	std::string result = key;
 	for (char &ch : result) {
@@ -249,10 +577,10 @@ std::string DBsqlite::clean_key(const std::string &key) {
 	return result;
 }
 
-void DBsqlite::delete_db(const std::string &path) {
-	//	std::remove((path + "/data.mdb").c_str());
-	//	std::remove((path + "/lock.mdb").c_str());
-	std::remove(path.c_str());
+void DBsqlite::delete_db(const std::string &path) {  // same path as constructor gets
+	std::remove((path + ".sqlite-wal").c_str());
+	std::remove((path + ".sqlite-shm").c_str());
+	std::remove((path + ".sqlite").c_str());
 }
 void DBsqlite::backup_db(const std::string &path, const std::string &dst_path){
 	throw platform::sqlite::Error("SQlite backed does not support hot backup - stop daemons, then copy database");
@@ -8,10 +8,14 @@
 
 #include <sqlite3.h>
 #include <algorithm>
+#include <map>
 #include <memory>
 #include <string>
+#include <vector>
 #include "common/BinaryArray.hpp"
 #include "common/Nocopy.hpp"
+#include "common/StringView.hpp"
+#include "platform/DBKey.hpp"
 
 namespace platform {
 
@@ -33,13 +37,58 @@ namespace platform {
 		};
 	}
 	class DBsqlite {
+	public:
+		class WriteBatch;
+		class Table {  // Separate SQL table, default constructed refers to kv_table
+			size_t index = 0;
+			friend class DBsqlite;
+
+		public:
+			Table() = default;
+		};
+		struct CommitStats {
+			uint32_t last_commit_ms  = 0;  // main thread was blocked for
+			uint64_t commits         = 0;  // since DB was opened
+			uint64_t durable_commits = 0;  // of them are on disk, all as WAL is fsynced on commit
+		};
+		struct UndoOp {  // state of key before WriteBatch, put(value) or del(key) when undoing
+			Table table;
+			std::string key;
+			bool existed = false;
+			std::string value;
+		};
+
+	private:
+		struct TableInfo {
+			std::string name;       // of SQL table
+			std::string open_name;  // passed to open_table, empty for kv_table
+			bool integer_key = false;
+			sqlite::Stmt stmt_get;
+			sqlite::Stmt stmt_insert;
+			sqlite::Stmt stmt_update;
+			sqlite::Stmt stmt_del;
+			sqlite::Stmt stmt_insert_many;  // ROWS_PER_INSERT rows, used by WriteBatch
+			sqlite::Stmt stmt_update_many;
+			std::vector<sqlite::Stmt> cursor_stmts[2];  // [forward], reset statements of finished main cursors
+		};
+		static constexpr size_t ROWS_PER_INSERT = 32;
 		const std::string full_path;
 		sqlite::Dbi db_dbi;
-		sqlite::Stmt stmt_get;
-		sqlite::Stmt stmt_insert;
-		sqlite::Stmt stmt_update;
-		sqlite::Stmt stmt_del;
+		std::vector<std::unique_ptr<TableInfo>> tables;  // [0] is kv_table
 		sqlite::Stmt stmt_select_star;
+		WriteBatch *write_batch = nullptr;
+		CommitStats commit_stats;
+		void create_table(const std::string &name);
+		void put_impl(TableInfo &table, const char *key, size_t key_size, const void *data, size_t size, bool nooverwrite);
+		void del_impl(TableInfo &table, const char *key, size_t key_size, bool mustexist);
+		bool get_impl(
+		    const Table &table, const char *key, size_t key_size, const unsigned char *&data, size_t &size) const;
+		// Both std::string and DBKey overloads end here
+		void put_any(const Table &table, const char *key, size_t key_size, const void *data, size_t size,
+		    bool nooverwrite);
+		void del_any(const Table &table, const char *key, size_t key_size, bool mustexist);
+		bool get_array(const Table &table, const char *key, size_t key_size, common::BinaryArray &value) const;
+		bool get_string(const Table &table, const char *key, size_t key_size, std::string &value) const;
 
 	public:
 		explicit DBsqlite(
@@ -47,23 +96,71 @@ namespace platform {
 		const std::string & get_path()const { return full_path; }
 
 		void commit_db_txn();
+		CommitStats get_commit_stats() const { return commit_stats; }
+		Table open_table(const std::string &name, bool integer_key = false);  // integer_key tables use to_integer_key
+		const std::string &get_table_name(const Table &table) const { return tables.at(table.index)->open_name; }
+		Table find_table(const std::string &name) const;  // among opened, persisted records refer to tables by name
+		bool is_integer_key(const Table &table) const { return tables.at(table.index)->integer_key; }
+		std::vector<Table> get_tables() const;  // all opened, [0] is default
 		size_t test_get_approximate_size() const;
 		size_t get_approximate_items_count() const;
 
-		void put(const std::string &key, const common::BinaryArray &value, bool nooverwrite);
-		void put(const std::string &key, const std::string &value, bool nooverwrite);
-
-		bool get(const std::string &key, common::BinaryArray &value) const;
-		bool get(const std::string &key, std::string &value) const;
+		void put(const Table &table, const std::string &key, const common::BinaryArray &value, bool nooverwrite) {
+			put_any(table, key.data(), key.size(), value.data(), value.size(), nooverwrite);
+		}
+		void put(const Table &table, const std::string &key, const std::string &value, bool nooverwrite) {
+			put_any(table, key.data(), key.size(), value.data(), value.size(), nooverwrite);
+		}
+		void put(const std::string &key, const common::BinaryArray &value, bool nooverwrite) {
+			put(Table(), key, value, nooverwrite);
+		}
+		void put(const std::string &key, const std::string &value, bool nooverwrite) {
+			put(Table(), key, value, nooverwrite);
+		}
+		void put(const Table &table, const DBKey &key, const common::BinaryArray &value, bool nooverwrite) {
+			put_any(table, key.data(), key.size(), value.data(), value.size(), nooverwrite);
+		}
+		void put(const Table &table, const DBKey &key, const std::string &value, bool nooverwrite) {
+			put_any(table, key.data(), key.size(), value.data(), value.size(), nooverwrite);
+		}
+		void put(const DBKey &key, const common::BinaryArray &value, bool nooverwrite) {
+			put(Table(), key, value, nooverwrite);
+		}
+		void put(const DBKey &key, const std::string &value, bool nooverwrite) { put(Table(), key, value, nooverwrite); }
 
+		bool get(const Table &table, const std::string &key, common::BinaryArray &value) const {
+			return get_array(table, key.data(), key.size(), value);
+		}
+		bool get(const Table &table, const std::string &key, std::string &value) const {
+			return get_string(table, key.data(), key.size(), value);
+		}
+		bool get(const std::string &key, common::BinaryArray &value) const { return get(Table(), key, value); }
+		bool get(const std::string &key, std::string &value) const { return get(Table(), key, value); }
+		bool get(const Table &table, const DBKey &key, common::BinaryArray &value) const {
+			return get_array(table, key.data(), key.size(), value);
+		}
+		bool get(const Table &table, const DBKey &key, std::string &value) const {
+			return get_string(table, key.data(), key.size(), value);
+		}
+		bool get(const DBKey &key, common::BinaryArray &value) const { return get(Table(), key, value); }
+		bool get(const DBKey &key, std::string &value) const { return get(Table(), key, value); }
 
 		using Value = std::string;
 		//	bool get(const std::string &key, lmdb::Val &value) const;
 
-		void del(const std::string &key, bool mustexist);
+		void del(const Table &table, const std::string &key, bool mustexist) {
+			del_any(table, key.data(), key.size(), mustexist);
+		}
+		void del(const std::string &key, bool mustexist) { del(Table(), key, mustexist); }
+		void del(const Table &table, const DBKey &key, bool mustexist) {
+			del_any(table, key.data(), key.size(), mustexist);
+		}
+		void del(const DBKey &key, bool mustexist) { del(Table(), key, mustexist); }
 
 		class Cursor {
 			const DBsqlite *const db;
+			sqlite3 *const connection;  // snapshot cursors use their own
+			const Table table;
 			sqlite::Stmt stmt_get;
 			std::string suffix;
 			const char *data = nullptr;
@@ -73,19 +170,97 @@ namespace platform {
 			const bool forward;
 			void step_and_check();
 			friend class DBsqlite;
-			Cursor(const DBsqlite *db, const sqlite::Dbi &db_dbi, const std::string &prefix, const std::string &middle,
-				bool forward);
+			Cursor(const DBsqlite *db, sqlite3 *connection, const Table &table, const std::string &prefix,
+			    const std::string &middle, bool forward);
 
 		public:
+			Cursor(Cursor &&) = default;
+			~Cursor();  // returns statement of main connection cursor to its table for reuse
 			const std::string &get_suffix() const noexcept { return suffix; }
+			common::StringView get_value() const noexcept { return common::StringView(data, size); }  // valid until cursor moves
 			std::string get_value_string() const;
 			common::BinaryArray get_value_array() const;
 			bool end() const noexcept { return is_end; }
 			void next();
 			void erase();  // moves to the next value
 		};
-		Cursor begin(const std::string &prefix, const std::string &middle = std::string()) const;
-		Cursor rbegin(const std::string &prefix, const std::string &middle = std::string()) const;
+		Cursor begin(const Table &table, const std::string &prefix, const std::string &middle = std::string()) const;
+		Cursor rbegin(const Table &table, const std::string &prefix, const std::string &middle = std::string()) const;
+		Cursor begin(const std::string &prefix, const std::string &middle = std::string()) const {
+			return begin(Table(), prefix, middle);
+		}
+		Cursor rbegin(const std::string &prefix, const std::string &middle = std::string()) const {
+			return rbegin(Table(), prefix, middle);
+		}
+		Cursor begin(const Table &table, const DBKey &prefix, const std::string &middle = std::string()) const {
+			return begin(table, prefix.to_string(), middle);  // cursor keeps prefix for its lifetime
+		}
+		Cursor rbegin(const Table &table, const DBKey &prefix, const std::string &middle = std::string()) const {
+			return rbegin(table, prefix.to_string(), middle);
+		}
+
+		// Read-only view of state as of last commit_db_txn(), does not see current txn. Separate read connection
+		// in WAL mode, so can be used on other thread, while main thread continues writing and committing.
+		// Keep short-lived, WAL cannot be checkpointed past living snapshot.
+		class Snapshot : private common::Nocopy {
+			const DBsqlite &db;
+			sqlite::Dbi connection;
+			mutable std::vector<std::unique_ptr<sqlite::Stmt>> stmt_gets;  // by table index, prepared on first use
+			bool get_impl(
+			    const Table &table, const char *key, size_t key_size, const unsigned char *&data, size_t &size) const;
+
+		public:
+			explicit Snapshot(const DBsqlite &db);
+			bool get(const Table &table, const std::string &key, common::BinaryArray &value) const;
+			bool get(const Table &table, const std::string &key, std::string &value) const;
+			bool get(const std::string &key, common::BinaryArray &value) const { return get(Table(), key, value); }
+			bool get(const std::string &key, std::string &value) const { return get(Table(), key, value); }
+			bool get(const Table &table, const DBKey &key, common::BinaryArray &value) const;
+			bool get(const Table &table, const DBKey &key, std::string &value) const;
+
+			Cursor begin(const Table &table, const std::string &prefix, const std::string &middle = std::string()) const;
+			Cursor rbegin(const Table &table, const std::string &prefix, const std::string &middle = std::string()) const;
+			Cursor begin(const std::string &prefix, const std::string &middle = std::string()) const {
+				return begin(Table(), prefix, middle);
+			}
+			Cursor rbegin(const std::string &prefix, const std::string &middle = std::string()) const {
+				return rbegin(Table(), prefix, middle);
+			}
+		};
+
+		// While alive, collects all put/del of db, get sees collected values. apply() writes them sorted by key,
+		// so inserts go to B-tree pages in order. commit_db_txn() and cursors over prefix with collected keys
+		// flush collected values into db transaction first, flushed values stay there and are committed even if
+		// batch is never applied. Only values collected since last flush are discarded by destroying not applied
+		// batch. nooverwrite put of key existing in db throws on flush, not on put.
+		class WriteBatch : private common::Nocopy {
+			struct Op {
+				bool put;
+				bool nooverwrite;
+				std::string value;
+			};
+			struct Prev {  // state of key before batch
+				bool existed;
+				std::string value;
+			};
+			DBsqlite &db;
+			std::map<std::pair<size_t, std::string>, Op> ops;  // integer keys are big-endian, so sorted as in table
+			std::map<std::pair<size_t, std::string>, Prev> prevs;  // of all keys ever in ops, kept by flush
+			friend class DBsqlite;
+			void remember(const std::pair<size_t, std::string> &op_key, bool nooverwrite);
+			void put(const Table &table, const std::string &key, std::string &&value, bool nooverwrite);
+			void del(const Table &table, const std::string &key, bool mustexist);
+			const Op *find(const Table &table, const std::string &key) const;
+			bool has_prefix(const Table &table, const std::string &prefix) const;
+			void flush();
+
+		public:
+			explicit WriteBatch(DBsqlite &db);
+			~WriteBatch();
+			size_t size() const { return ops.size(); }
+			void get_undo(std::vector<UndoOp> *undo) const;  // all keys written so far, in reverse key order
+			void apply();
+		};
 
 		static std::string to_binary_key(const unsigned char *data, size_t size) {
 			std::string result;
@@ -99,6 +274,8 @@ namespace platform {
 
 		static std::string to_ascending_key(uint32_t key);
 		static uint32_t from_ascending_key(const std::string &key);
+		static std::string to_integer_key(uint32_t key);  // big-endian, BLOB order is numeric order
+		static uint32_t from_integer_key(const std::string &key);
 		static std::string clean_key(const std::string &key);  // replace invalid chars for printing
 
 		static void run_tests();
@@ -112,6 +112,54 @@ size_t FileStream::read_some(void *data, size_t size) {
 #endif
 }
 
+void FileStream::read_at(uint64_t pos, void *data, size_t size) const {
+	auto ptr = reinterpret_cast<unsigned char *>(data);
+	while (size != 0) {
+		const size_t chunk = std::min(size, MAX_CHUNK);
+#ifdef _WIN32
+		OVERLAPPED ov{};  // handle is synchronous, so offset is used and pointer ends after read bytes
+		ov.Offset     = static_cast<DWORD>(pos);
+		ov.OffsetHigh = static_cast<DWORD>(pos >> 32);
+		DWORD si      = 0;
+		if (!ReadFile(handle, ptr, static_cast<DWORD>(chunk), &si, &ov))
+			throw common::StreamError("Error reading file, GetLastError()=" + common::to_string(GetLastError()));
+#else
+		const ssize_t si = ::pread(fd, ptr, chunk, static_cast<off_t>(pos));
+		if (si == -1)
+			throw common::StreamError("Error reading file, errno=" + common::to_string(errno));
+#endif
+		if (si == 0)
+			throw common::StreamError("Unexpected end of file in read_at");
+		ptr += si;
+		pos += si;
+		size -= si;
+	}
+}
+
+void FileStream::write_at(uint64_t pos, const void *data, size_t size) {
+	auto ptr = reinterpret_cast<const unsigned char *>(data);
+	while (size != 0) {
+		const size_t chunk = std::min(size, MAX_CHUNK);
+#ifdef _WIN32
+		OVERLAPPED ov{};  // handle is synchronous, so offset is used and pointer ends after written bytes
+		ov.Offset     = static_cast<DWORD>(pos);
+		ov.OffsetHigh = static_cast<DWORD>(pos >> 32);
+		DWORD si      = 0;
+		if (!WriteFile(handle, ptr, static_cast<DWORD>(chunk), &si, &ov))
+			throw common::StreamError("Error writing file, GetLastError()=" + common::to_string(GetLastError()));
+#else
+		const ssize_t si = ::pwrite(fd, ptr, chunk, static_cast<off_t>(pos));
+		if (si == -1)
+			throw common::StreamError("Error writing file, errno=" + common::to_string(errno));
+#endif
+		if (si == 0)
+			throw common::StreamError("Zero bytes written in write_at");
+		ptr += si;
+		pos += si;
+		size -= si;
+	}
+}
+
 void FileStream::fsync() {
 #ifdef _WIN32
 	if (!FlushFileBuffers(handle))
@@ -27,6 +27,10 @@ public:
 	uint64_t seek(uint64_t pos, int whence);  // SEEK_SET, SEEK_CUR, SEEK_END
 	uint64_t tellp() const { return const_cast<FileStream *>(this)->seek(0, SEEK_CUR); }
 	void fsync();              // top reason for existence of this class
+	// Positional read and write, can be called from many threads if file is accessed only by them. On Windows they
+	// move file pointer, so they must not be mixed with seek, read_some, write_some done concurrently
+	void read_at(uint64_t pos, void *data, size_t size) const;
+	void write_at(uint64_t pos, const void *data, size_t size);
 	void truncate(uint64_t size);  // also sets pointer to the new end of file
 
 #ifdef _WIN32
@@ -0,0 +1,139 @@
+// Copyright (c) 2019, The Cryonero developers.
+// Licensed under the GNU Lesser General Public License. See LICENSE for details.
+
+#include "SegmentedFile.hpp"
+#include <algorithm>
+#include <cstdio>
+#include "PathTools.hpp"
+#include "common/string.hpp"
+
+using namespace platform;
+
+SegmentedFile::SegmentedFile(const std::string &folder, bool read_only, uint64_t segment_size)
+    : m_folder(folder), m_read_only(read_only), m_segment_size(segment_size) {
+	if (!read_only && !create_folder_if_necessary(folder))
+		throw common::StreamError("Failed to create folder " + folder);
+}
+
+std::string SegmentedFile::segment_path(uint32_t segment) const {
+	char buf[32] = {};
+	sprintf(buf, "/%06u.dat", segment);
+	return m_folder + buf;
+}
+
+std::shared_ptr<FileStream> SegmentedFile::get_file(uint32_t segment, bool create) const {
+	std::unique_lock<std::mutex> lock(m_mutex);
+	if (segment >= m_files.size())
+		m_files.resize(segment + 1);
+	auto &file = m_files.at(segment);
+	if (!file || create)
+		file.reset(new FileStream(segment_path(segment),
+		    create ? FileStream::TRUNCATE_READ_WRITE
+		           : m_read_only ? FileStream::READ_EXISTING : FileStream::READ_WRITE_EXISTING));
+	return file;
+}
+
+void SegmentedFile::open(const Position &committed_end) {
+	m_end = committed_end;
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_unsynced.clear();
+	}
+	if (m_read_only)
+		return;
+	// Appended after last commit by crashed or failed run
+	for (uint32_t segment = committed_end.segment + 1; remove_file(segment_path(segment)); ++segment) {
+	}
+	FileStream &file = *get_file(committed_end.segment, committed_end.offset == 0);
+	const uint64_t size = file.seek(0, SEEK_END);
+	if (size < committed_end.offset)
+		throw common::StreamError("Segment " + segment_path(committed_end.segment) + " is shorter than committed size " +
+		                          common::to_string(committed_end.offset) + ", data lost");
+	file.truncate(committed_end.offset);
+	file.fsync();
+}
+
+SegmentedFile::Position SegmentedFile::append(const void *data, size_t size) {
+	if (m_read_only)
+		throw common::StreamError("SegmentedFile::append on read only " + m_folder);
+	if (m_end.offset != 0 && m_end.offset + size > m_segment_size) {
+		m_end.segment += 1;
+		m_end.offset = 0;
+		get_file(m_end.segment, true);
+	}
+	const auto file = get_file(m_end.segment, false);
+	const Position result = m_end;
+	file->write_at(m_end.offset, data, size);
+	m_end.offset += size;
+	std::unique_lock<std::mutex> lock(m_mutex);
+	if (m_unsynced.empty() || m_unsynced.back() != result.segment)
+		m_unsynced.push_back(result.segment);
+	return result;
+}
+
+void SegmentedFile::read(const Position &pos, size_t size, common::BinaryArray *data) const {
+	if (pos.segment < m_first_segment)
+		throw common::StreamError("SegmentedFile::read from pruned segment " + segment_path(pos.segment));
+	data->resize(size);
+	get_file(pos.segment, false)->read_at(pos.offset, data->data(), size);
+}
+
+void SegmentedFile::sync() {
+	std::vector<uint32_t> unsynced;
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		unsynced.swap(m_unsynced);
+	}
+	for (auto segment : unsynced)
+		if (segment >= m_first_segment)
+			get_file(segment, false)->fsync();
+}
+
+void SegmentedFile::set_first_segment(uint32_t segment) {
+	if (segment > m_end.segment)
+		throw common::StreamError("SegmentedFile::set_first_segment cannot prune segment being appended to");
+	m_first_segment = segment;
+	if (m_read_only)
+		return;
+	std::unique_lock<std::mutex> lock(m_mutex);
+	for (uint32_t s = 0; s != segment && s < m_files.size(); ++s)
+		m_files.at(s).reset();
+	for (uint32_t s = segment; s-- > 0 && remove_file(segment_path(s));) {
+	}
+}
+
+void SegmentedFile::copy_folder(
+    const std::string &folder, const std::string &dst_folder, const Position &dst_committed_end) {
+	if (!create_folder_if_necessary(dst_folder))
+		throw common::StreamError("Failed to create folder " + dst_folder);
+	for (auto &&name : get_filenames_in_folder(folder)) {
+		std::unique_ptr<FileStream> from;
+		try {
+			from.reset(new FileStream(folder + "/" + name, FileStream::READ_EXISTING));
+		} catch (const common::StreamError &) {
+			continue;  // pruned by running node after listing
+		}
+		uint64_t size    = from->seek(0, SEEK_END);
+		unsigned segment = 0;
+		char buf[32]     = {};
+		if (sscanf(name.c_str(), "%u", &segment) == 1)
+			sprintf(buf, "%06u.dat", segment);
+		if (name == buf && segment < dst_committed_end.segment)
+			try {
+				FileStream to(dst_folder + "/" + name, FileStream::READ_EXISTING);
+				if (to.seek(0, SEEK_END) == size)
+					continue;  // committed segments never change
+			} catch (const common::StreamError &) {
+			}
+		FileStream to(dst_folder + "/" + name, FileStream::TRUNCATE_READ_WRITE);
+		from->seek(0, SEEK_SET);
+		const uint64_t CHUNK = 10 * 1024 * 1024;
+		common::BinaryArray data;
+		for (; size > 0; size -= data.size()) {
+			data.resize(static_cast<size_t>(std::min(size, CHUNK)));
+			from->read(data.data(), data.size());
+			to.write(data.data(), data.size());
+		}
+		to.fsync();
+	}
+}
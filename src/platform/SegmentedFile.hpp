@@ -0,0 +1,60 @@
+// Copyright (c) 2019, The Cryonero developers.
+// Licensed under the GNU Lesser General Public License. See LICENSE for details.
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "common/BinaryArray.hpp"
+#include "common/Nocopy.hpp"
+#include "platform/Files.hpp"
+
+namespace platform {
+
+// Append-only storage split into numbered segment files in folder. Owner keeps positions of records and
+// committed end in its DB, so after crash everything past committed end is garbage and is truncated by open().
+// Appends and reads are positional and never use file pointers, so reads can be done from any thread while
+// main thread appends (on Windows positional reads and writes move pointer, so nothing may rely on it).
+class SegmentedFile : private common::Nocopy {
+public:
+	struct Position {
+		uint32_t segment = 0;
+		uint64_t offset  = 0;
+	};
+	explicit SegmentedFile(const std::string &folder, bool read_only, uint64_t segment_size);
+	void open(const Position &committed_end);
+	Position append(const void *data, size_t size);  // record never spans segments
+	void read(const Position &pos, size_t size, common::BinaryArray *data) const;
+	// fsync segments appended to since last sync, call before committing DB referencing them. Can be called from
+	// other thread, while main thread appends
+	void sync();
+	// Segments before are pruned and cannot be read. Owner commits new value to its DB first, their files are
+	// removed here (read-write only), so calling again on startup removes files left by crash
+	void set_first_segment(uint32_t segment);
+	uint32_t get_first_segment() const { return m_first_segment; }
+	const Position &get_end() const { return m_end; }
+	const std::string &get_folder() const { return m_folder; }
+	std::string segment_path(uint32_t segment) const;
+
+	// Copies files to dst_folder, skips files removed while copying. Hot backup copies before and after DB, so
+	// segments of DB copy are there, even if pruned or appended to meanwhile. Only dst segments before
+	// dst_committed_end.segment (committed end in DB referencing them) are fully committed, so kept if of the
+	// same size, others can have bytes truncated by open() after crash and are copied again
+	static void copy_folder(
+	    const std::string &folder, const std::string &dst_folder, const Position &dst_committed_end);
+
+private:
+	const std::string m_folder;
+	const bool m_read_only;
+	const uint64_t m_segment_size;
+	Position m_end;
+	std::atomic<uint32_t> m_first_segment{0};
+	mutable std::mutex m_mutex;  // protects m_files, readers open segments lazily, and m_unsynced
+	std::vector<uint32_t> m_unsynced;
+	mutable std::vector<std::shared_ptr<FileStream>> m_files;  // shared, so pruning does not close file being read
+	std::shared_ptr<FileStream> get_file(uint32_t segment, bool create) const;
+};
+}
@@ -182,6 +182,8 @@ namespace cryonerocoin
 					Timestamp top_block_timestamp = 0;
 					Timestamp top_block_timestamp_median = 0;  
 					uint32_t next_block_effective_median_size =	0;  
+					uint32_t last_db_commit_ms = 0;  // main thread blocked in DB commit
+					Height pruned_height       = 0;  // node has no bodies of blocks below, 0 if it keeps all
 				};
 			};
 
@@ -505,6 +507,7 @@ namespace cryonerocoin {
 					std::string wallet_address;
 					Hash top_block_hash;                    // for longpoll in v3 - behaves like GetStatus
 					uint32_t transaction_pool_version = 0;  // for longpoll in v3 - behaves like GetStatus
+					Hash template_id;  // for longpoll - waits until tip or selected transactions change
 				};
 				struct Response {
 					Difficulty difficulty = 0;
@@ -515,6 +518,7 @@ namespace cryonerocoin {
 					Hash top_block_hash;                    // for longpoll in v3 - behaves like GetStatus
 					uint32_t transaction_pool_version = 0;  // for longpoll in v3 - behaves like GetStatus
 					Hash previous_block_hash;               // Deprecated, used by some legacy miners.
+					Hash template_id;                       // hash of tip and transactions in template
 				};
 			};
 
@@ -48,21 +48,20 @@ namespace seria {
 	};
 
 	template<typename T>
-	void from_binary(T &obj, const common::BinaryArray &blob) {
+	void from_binary(T &obj, const void *data, size_t size) {  // also deserializes from DB::Value views without copy
 		static_assert(!std::is_pointer<T>::value, "Cannot be called with pointer");
-		common::MemoryInputStream stream(blob.data(), blob.size());
+		common::MemoryInputStream stream(data, size);
 		BinaryInputStream ba(stream);
 		ba(obj);
 		if (!stream.empty())
 			throw std::runtime_error("Excess data in from_binary " + std::string(typeid(T).name()));
 	}
 	template<typename T>
+	void from_binary(T &obj, const common::BinaryArray &blob) {
+		from_binary(obj, blob.data(), blob.size());
+	}
+	template<typename T>
 	void from_binary(T &obj, const std::string &blob) {
-		static_assert(!std::is_pointer<T>::value, "Cannot be called with pointer");
-		common::MemoryInputStream stream(blob.data(), blob.size());
-		BinaryInputStream ba(stream);
-		ba(obj);
-		if (!stream.empty())
-			throw std::runtime_error("Excess data in from_binary " + std::string(typeid(T).name()));
+		from_binary(obj, blob.data(), blob.size());
 	}
 }